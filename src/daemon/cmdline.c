@@ -68,7 +68,9 @@ enum {
     ARG_DUMP_RESAMPLE_METHODS,
     ARG_SYSTEM,
     ARG_CLEANUP_SHM,
-    ARG_START
+    ARG_START,
+    ARG_PARALLEL_MODULE_INIT,
+    ARG_STARTUP_TRACE
 };
 
 /* Table for getopt_long() */
@@ -104,6 +106,8 @@ static const struct option long_options[] = {
     {"disable-shm",                 2, 0, ARG_DISABLE_SHM},
     {"dump-resample-methods",       2, 0, ARG_DUMP_RESAMPLE_METHODS},
     {"cleanup-shm",                 2, 0, ARG_CLEANUP_SHM},
+    {"parallel-module-init",        2, 0, ARG_PARALLEL_MODULE_INIT},
+    {"startup-trace",               2, 0, ARG_STARTUP_TRACE},
     {NULL, 0, 0, 0}
 };
 
@@ -154,7 +158,10 @@ void pa_cmdline_help(const char *argv0) {
            "      --use-pid-file[=BOOL]             Create a PID file\n"
            "      --no-cpu-limit[=BOOL]             Do not install CPU load limiter on\n"
            "                                        platforms that support it.\n"
-           "      --disable-shm[=BOOL]              Disable shared memory support.\n\n"
+           "      --disable-shm[=BOOL]              Disable shared memory support.\n"
+           "      --parallel-module-init[=BOOL]     Allow modules to finish slow initialization\n"
+           "                                        (e.g. device probing) in parallel\n"
+           "      --startup-trace[=BOOL]            Log the time it took to load each module\n\n"
 
            "STARTUP SCRIPT:\n"
            "  -L, --load=\"MODULE ARGUMENTS\"         Load the specified plugin module with\n"
@@ -374,6 +381,20 @@ int pa_cmdline_parse(pa_daemon_conf *conf, int argc, char *const argv [], int *d
                 }
                 break;
 
+            case ARG_PARALLEL_MODULE_INIT:
+                if ((conf->parallel_module_init = optarg ? pa_parse_boolean(optarg) : TRUE) < 0) {
+                    pa_log(_("--parallel-module-init expects boolean argument"));
+                    goto fail;
+                }
+                break;
+
+            case ARG_STARTUP_TRACE:
+                if ((conf->startup_trace = optarg ? pa_parse_boolean(optarg) : TRUE) < 0) {
+                    pa_log(_("--startup-trace expects boolean argument"));
+                    goto fail;
+                }
+                break;
+
             default:
                 goto fail;
         }
@@ -68,6 +68,7 @@ typedef struct pa_daemon_conf {
         system_instance,
         no_cpu_limit,
         disable_shm,
+        disable_memfd,
         disable_remixing,
         disable_lfe_remixing,
         load_default_script_file,
@@ -76,7 +77,11 @@ typedef struct pa_daemon_conf {
         log_time,
         flat_volumes,
         lock_memory,
-        deferred_volume;
+        shm_huge_pages,
+        deferred_volume,
+        parallel_module_init,
+        startup_trace,
+        scache_precompile;
     pa_server_type_t local_server_type;
     int exit_idle_time,
         scache_idle_time,
@@ -134,6 +139,7 @@ typedef struct pa_daemon_conf {
     uint32_t alternate_sample_rate;
     pa_channel_map default_channel_map;
     size_t shm_size;
+    unsigned shm_prefault_slots;
 } pa_daemon_conf;
 
 /* Allocate a new structure and fill it with sane defaults */
@@ -64,6 +64,7 @@
 #endif
 #include <pulse/mainloop.h>
 #include <pulse/mainloop-signal.h>
+#include <pulse/rtclock.h>
 #include <pulse/timeval.h>
 #include <pulse/xmalloc.h>
 
@@ -414,6 +415,7 @@ int main(int argc, char *argv[]) {
 #endif
     int autospawn_fd = -1;
     pa_bool_t autospawn_locked = FALSE;
+    pa_usec_t script_started;
 #ifdef HAVE_DBUS
     pa_dbusobj_server_lookup *server_lookup = NULL; /* /org/pulseaudio/server_lookup */
     pa_dbus_connection *lookup_service_bus = NULL; /* Always the user bus. */
@@ -1007,7 +1009,9 @@ int main(int argc, char *argv[]) {
 
     pa_assert_se(mainloop = pa_mainloop_new());
 
-    if (!(c = pa_core_new(pa_mainloop_get_api(mainloop), !conf->disable_shm, conf->shm_size))) {
+    if (!(c = pa_core_new(pa_mainloop_get_api(mainloop),
+                          conf->disable_shm ? PA_SHM_PRIVATE : conf->disable_memfd ? PA_SHM_POSIX : PA_SHM_MEMFD,
+                          conf->shm_size, conf->shm_huge_pages, conf->shm_prefault_slots))) {
         pa_log(_("pa_core_new() failed."));
         goto finish;
     }
@@ -1021,6 +1025,7 @@ int main(int argc, char *argv[]) {
     c->deferred_volume_extra_delay_usec = conf->deferred_volume_extra_delay_usec;
     c->exit_idle_time = conf->exit_idle_time;
     c->scache_idle_time = conf->scache_idle_time;
+    c->scache_precompile = !!conf->scache_precompile;
     c->resample_method = conf->resample_method;
     c->realtime_priority = conf->realtime_priority;
     c->realtime_scheduling = !!conf->realtime_scheduling;
@@ -1030,6 +1035,8 @@ int main(int argc, char *argv[]) {
     c->running_as_daemon = !!conf->daemonize;
     c->disallow_exit = conf->disallow_exit;
     c->flat_volumes = conf->flat_volumes;
+    c->parallel_module_init = !!conf->parallel_module_init;
+    c->startup_trace = !!conf->startup_trace;
 #ifdef HAVE_DBUS
     c->server_type = conf->local_server_type;
 #endif
@@ -1070,6 +1077,8 @@ int main(int argc, char *argv[]) {
 
     if (start_server) {
 #endif
+        script_started = pa_rtclock_now();
+
         if (conf->load_default_script_file) {
             FILE *f;
 
@@ -1085,6 +1094,11 @@ int main(int argc, char *argv[]) {
         pa_log_error("%s", s = pa_strbuf_tostring_free(buf));
         pa_xfree(s);
 
+        if (c->startup_trace)
+            pa_log_notice("Startup trace: startup script finished in %0.2f ms, %u modules loaded.",
+                          (double) (pa_rtclock_now() - script_started) / PA_USEC_PER_MSEC,
+                          c->modules ? pa_idxset_size(c->modules) : 0);
+
         if (r < 0 && conf->fail) {
             pa_log(_("Failed to initialize daemon."));
             goto finish;
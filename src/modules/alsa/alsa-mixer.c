@@ -24,7 +24,10 @@
 #include <config.h>
 #endif
 
+#include <errno.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
 #include <asoundlib.h>
 #include <math.h>
 
@@ -33,6 +36,7 @@
 #endif
 
 #include <pulse/mainloop-api.h>
+#include <pulse/rtclock.h>
 #include <pulse/sample.h>
 #include <pulse/timeval.h>
 #include <pulse/util.h>
@@ -45,6 +49,9 @@
 #include <pulsecore/macro.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/conf-parser.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/database.h>
+#include <pulsecore/mutex.h>
 #include <pulsecore/strbuf.h>
 
 #include "alsa-mixer.h"
@@ -3363,6 +3370,7 @@ void pa_alsa_profile_set_free(pa_alsa_profile_set *ps) {
         pa_hashmap_free(ps->decibel_fixes, NULL, NULL);
     }
 
+    pa_xfree(ps->fname);
     pa_xfree(ps);
 }
 
@@ -3821,8 +3829,11 @@ fail:
     return -1;
 }
 
+/* Finds the mixer through the PCM opened during probing, or through the
+ * card if the profile was taken from the probe cache and no PCM was
+ * opened for it */
 static void mapping_paths_probe(pa_alsa_mapping *m, pa_alsa_profile *profile,
-                                pa_alsa_direction_t direction) {
+                                pa_alsa_direction_t direction, int alsa_card_index) {
 
     pa_alsa_path *p;
     void *state;
@@ -3846,9 +3857,13 @@ static void mapping_paths_probe(pa_alsa_mapping *m, pa_alsa_profile *profile,
     if (!ps)
         return; /* No paths */
 
-    pa_assert(pcm_handle);
+    if (pcm_handle)
+        mixer_handle = pa_alsa_open_mixer_for_pcm(pcm_handle, NULL, &hctl_handle);
+    else {
+        pa_assert(alsa_card_index >= 0);
+        mixer_handle = pa_alsa_open_mixer(alsa_card_index, NULL, &hctl_handle);
+    }
 
-    mixer_handle = pa_alsa_open_mixer_for_pcm(pcm_handle, NULL, &hctl_handle);
     if (!mixer_handle || !hctl_handle) {
          /* Cannot open mixer, remove all entries */
         while (pa_hashmap_steal_first(ps->paths));
@@ -4251,7 +4266,7 @@ pa_alsa_profile_set* pa_alsa_profile_set_new(const char *fname, const pa_channel
                               PA_ALSA_PROFILE_SETS_DIR);
 
     r = pa_config_parse(fn, NULL, items, ps);
-    pa_xfree(fn);
+    ps->fname = fn;
 
     if (r < 0)
         goto fail;
@@ -4365,23 +4380,282 @@ static void paths_drop_unsupported(pa_hashmap* h) {
     }
 }
 
-void pa_alsa_profile_set_probe(
+/* The probe cache remembers which profiles of a card turned out to be
+ * supported or unsupported, so that we don't have to open their PCMs
+ * again on the next startup or hotplug. It is keyed by the card
+ * identity as reported by the driver, and each entry carries a stamp
+ * of the configuration that influences probing and of the PCM devices
+ * the card exposes. As long as the stamp matches, the profiles listed
+ * are taken as they are, without opening anything but the mixer for
+ * path probing. If a sink or source of such a profile fails to open
+ * later on, the entry is dropped and the card is probed properly the
+ * next time.
+ *
+ * A profile that was merely busy is listed neither way and gets probed
+ * again next time. Nor do we remember anything about a card that ended
+ * up with no profile at all. */
+
+static pa_static_mutex probe_cache_mutex = PA_STATIC_MUTEX_INIT;
+
+static void probe_cache_free_cb(void *p, void *userdata) {
+    pa_xfree(p);
+}
+
+/* Also returns the PCM devices of the card in *devices, so that they
+ * can be made part of the stamp */
+static char *probe_cache_key(const char *dev_id, char **devices) {
+    snd_ctl_t *ctl;
+    snd_ctl_card_info_t *info;
+    char *t, *k = NULL;
+    int err;
+
+    snd_ctl_card_info_alloca(&info);
+
+    t = pa_sprintf_malloc("hw:%s", dev_id);
+    err = pa_alsa_ctl_open(&ctl, t, 0);
+    pa_xfree(t);
+
+    if (err < 0) {
+        pa_log_debug("Failed to open control device for card %s, not using the probe cache: %s", dev_id, pa_alsa_strerror(err));
+        return NULL;
+    }
+
+    if ((err = snd_ctl_card_info(ctl, info)) < 0)
+        pa_log_debug("Failed to get card info for card %s, not using the probe cache: %s", dev_id, pa_alsa_strerror(err));
+    else {
+        pa_strbuf *buf;
+        int device = -1;
+
+        k = pa_sprintf_malloc("%s|%s|%s|%s|%s",
+                              dev_id,
+                              snd_ctl_card_info_get_driver(info),
+                              snd_ctl_card_info_get_components(info),
+                              snd_ctl_card_info_get_longname(info),
+                              snd_ctl_card_info_get_mixername(info));
+
+        buf = pa_strbuf_new();
+
+        while (snd_ctl_pcm_next_device(ctl, &device) >= 0 && device >= 0)
+            pa_strbuf_printf(buf, "%s%i", pa_strbuf_isempty(buf) ? "" : ",", device);
+
+        *devices = pa_strbuf_tostring_free(buf);
+    }
+
+    snd_ctl_close(ctl);
+
+    return k;
+}
+
+static char *probe_cache_stamp(pa_alsa_profile_set *ps, const char *devices, const pa_sample_spec *ss, unsigned default_n_fragments, unsigned default_fragment_size_msec) {
+    struct stat st;
+    unsigned long ps_mtime = 0, paths_mtime = 0;
+    unsigned n_paths = 0;
+    DIR *d;
+
+    if (ps->fname && stat(ps->fname, &st) >= 0)
+        ps_mtime = (unsigned long) st.st_mtime;
+
+    if ((d = opendir(get_default_paths_dir()))) {
+        struct dirent *de;
+
+        while ((de = readdir(d))) {
+            char *fn;
+
+            if (!pa_endswith(de->d_name, ".conf"))
+                continue;
+
+            fn = pa_maybe_prefix_path(de->d_name, get_default_paths_dir());
+
+            if (stat(fn, &st) >= 0) {
+                paths_mtime = PA_MAX(paths_mtime, (unsigned long) st.st_mtime);
+                n_paths++;
+            }
+
+            pa_xfree(fn);
+        }
+
+        closedir(d);
+    }
+
+    return pa_sprintf_malloc("%s:%lu paths:%lu:%u devices:%s %s:%u:%u fragments:%u:%u",
+                             pa_strnull(ps->fname), ps_mtime,
+                             paths_mtime, n_paths,
+                             devices,
+                             pa_sample_format_to_string(ss->format), ss->rate, ss->channels,
+                             default_n_fragments, default_fragment_size_msec);
+}
+
+static pa_database *probe_cache_open(pa_bool_t for_write) {
+    pa_database *db;
+    char *fn;
+
+    if (!(fn = pa_state_path("alsa-probe-cache", TRUE)))
+        return NULL;
+
+    if (!(db = pa_database_open(fn, for_write)) && for_write)
+        pa_log_warn("Failed to open probe cache '%s': %s", fn, pa_cstrerror(errno));
+
+    pa_xfree(fn);
+
+    return db;
+}
+
+/* Returns the profiles listed in the entry for the card, mapping each
+ * profile name to its line, which is "+name" for a supported and
+ * "-name" for an unsupported profile. Returns NULL if there is no
+ * valid entry for the card. */
+static pa_hashmap *probe_cache_load(const char *key, const char *stamp) {
+    pa_database *db;
+    pa_datum k, data;
+    pa_hashmap *profiles = NULL;
+    pa_mutex *mutex;
+
+    mutex = pa_static_mutex_get(&probe_cache_mutex, FALSE, FALSE);
+    pa_mutex_lock(mutex);
+
+    if (!(db = probe_cache_open(FALSE)))
+        goto finish;
+
+    k.data = (char*) key;
+    k.size = strlen(key);
+
+    if (pa_database_get(db, &k, &data)) {
+        char *v, *line;
+        const char *state = NULL;
+
+        v = pa_xstrndup(data.data, data.size);
+        pa_datum_free(&data);
+
+        if ((line = pa_split(v, "\n", &state))) {
+
+            if (pa_streq(line, stamp)) {
+                pa_xfree(line);
+                profiles = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+
+                while ((line = pa_split(v, "\n", &state)))
+                    if ((line[0] != '+' && line[0] != '-') || pa_hashmap_put(profiles, line + 1, line) < 0)
+                        pa_xfree(line);
+            } else {
+                pa_log_debug("Probe cache entry for '%s' is outdated.", key);
+                pa_xfree(line);
+            }
+        }
+
+        pa_xfree(v);
+    }
+
+    pa_database_close(db);
+
+finish:
+    pa_mutex_unlock(mutex);
+
+    return profiles;
+}
+
+static void probe_cache_save(const char *key, const char *stamp, const char *profiles) {
+    pa_database *db;
+    pa_datum k, data;
+    pa_mutex *mutex;
+    char *v;
+
+    mutex = pa_static_mutex_get(&probe_cache_mutex, FALSE, FALSE);
+    pa_mutex_lock(mutex);
+
+    if (!(db = probe_cache_open(TRUE)))
+        goto finish;
+
+    v = pa_sprintf_malloc("%s\n%s", stamp, profiles);
+
+    k.data = (char*) key;
+    k.size = strlen(key);
+    data.data = v;
+    data.size = strlen(v);
+
+    if (pa_database_set(db, &k, &data, TRUE) < 0)
+        pa_log_warn("Failed to update probe cache for '%s'.", key);
+
+    pa_database_sync(db);
+    pa_database_close(db);
+    pa_xfree(v);
+
+finish:
+    pa_mutex_unlock(mutex);
+}
+
+static void probe_cache_drop(const char *key) {
+    pa_database *db;
+    pa_datum k;
+    pa_mutex *mutex;
+
+    mutex = pa_static_mutex_get(&probe_cache_mutex, FALSE, FALSE);
+    pa_mutex_lock(mutex);
+
+    if ((db = probe_cache_open(TRUE))) {
+        k.data = (char*) key;
+        k.size = strlen(key);
+
+        pa_database_unset(db, &k);
+        pa_database_sync(db);
+        pa_database_close(db);
+    }
+
+    pa_mutex_unlock(mutex);
+}
+
+/* Takes a profile the way it is listed in the probe cache, without
+ * opening any PCM. Returns FALSE if it isn't listed. */
+static pa_bool_t profile_from_cache(pa_alsa_profile *p, pa_hashmap *cached, int alsa_card_index) {
+    const char *line;
+    pa_alsa_mapping *m;
+    uint32_t idx;
+
+    if (!cached || alsa_card_index < 0 || !(line = pa_hashmap_get(cached, p->name)))
+        return FALSE;
+
+    p->from_cache = TRUE;
+    p->failed_temporarily = FALSE;
+
+    if (line[0] == '-') {
+        pa_log_debug("Skipping profile %s, known to be unsupported", p->name);
+        p->supported = FALSE;
+        return TRUE;
+    }
+
+    pa_log_debug("Profile %s known to be supported.", p->name);
+    p->supported = TRUE;
+
+    if (p->output_mappings)
+        PA_IDXSET_FOREACH(m, p->output_mappings, idx) {
+            m->supported++;
+            mapping_paths_probe(m, p, PA_ALSA_DIRECTION_OUTPUT, alsa_card_index);
+        }
+
+    if (p->input_mappings)
+        PA_IDXSET_FOREACH(m, p->input_mappings, idx) {
+            m->supported++;
+            mapping_paths_probe(m, p, PA_ALSA_DIRECTION_INPUT, alsa_card_index);
+        }
+
+    return TRUE;
+}
+
+/* Probes all profiles that aren't taken from the cache and returns the
+ * number of profiles that had to be opened for that */
+static unsigned profile_set_probe_profiles(
         pa_alsa_profile_set *ps,
         const char *dev_id,
         const pa_sample_spec *ss,
         unsigned default_n_fragments,
-        unsigned default_fragment_size_msec) {
+        unsigned default_fragment_size_msec,
+        pa_hashmap *cached) {
 
     void *state;
     pa_alsa_profile *p, *last = NULL;
     pa_alsa_mapping *m;
+    unsigned n_probed = 0;
+    int alsa_card_index;
 
-    pa_assert(ps);
-    pa_assert(dev_id);
-    pa_assert(ss);
-
-    if (ps->probed)
-        return;
+    alsa_card_index = cached ? snd_card_get_index(dev_id) : -1;
 
     PA_HASHMAP_FOREACH(p, ps->profiles, state) {
         uint32_t idx;
@@ -4389,9 +4663,14 @@ void pa_alsa_profile_set_probe(
         /* Skip if this is already marked that it is supported (i.e. from the config file) */
         if (!p->supported) {
 
+            if (profile_from_cache(p, cached, alsa_card_index))
+                continue;
+
             pa_log_debug("Looking at profile %s", p->name);
             profile_finalize_probing(last, p);
             p->supported = TRUE;
+            p->failed_temporarily = FALSE;
+            n_probed++;
 
             /* Check if we can open all new ones */
             if (p->output_mappings)
@@ -4406,6 +4685,7 @@ void pa_alsa_profile_set_probe(
                                                            default_n_fragments,
                                                            default_fragment_size_msec))) {
                         p->supported = FALSE;
+                        p->failed_temporarily = !pa_alsa_error_is_permanent(errno);
                         break;
                     }
                 }
@@ -4422,6 +4702,7 @@ void pa_alsa_profile_set_probe(
                                                           default_n_fragments,
                                                           default_fragment_size_msec))) {
                         p->supported = FALSE;
+                        p->failed_temporarily = !pa_alsa_error_is_permanent(errno);
                         break;
                     }
                 }
@@ -4437,21 +4718,70 @@ void pa_alsa_profile_set_probe(
         if (p->output_mappings)
             PA_IDXSET_FOREACH(m, p->output_mappings, idx)
                 if (m->output_pcm)
-                    mapping_paths_probe(m, p, PA_ALSA_DIRECTION_OUTPUT);
+                    mapping_paths_probe(m, p, PA_ALSA_DIRECTION_OUTPUT, -1);
 
         if (p->input_mappings)
             PA_IDXSET_FOREACH(m, p->input_mappings, idx)
                 if (m->input_pcm)
-                    mapping_paths_probe(m, p, PA_ALSA_DIRECTION_INPUT);
+                    mapping_paths_probe(m, p, PA_ALSA_DIRECTION_INPUT, -1);
     }
 
-    /* Clean up */
     profile_finalize_probing(last, NULL);
 
+    return n_probed;
+}
+
+void pa_alsa_profile_set_probe(
+        pa_alsa_profile_set *ps,
+        const char *dev_id,
+        const pa_sample_spec *ss,
+        unsigned default_n_fragments,
+        unsigned default_fragment_size_msec) {
+
+    void *state;
+    pa_alsa_profile *p;
+    pa_alsa_mapping *m;
+    char *cache_key, *cache_stamp = NULL, *devices = NULL;
+    pa_hashmap *cached = NULL;
+    pa_strbuf *profiles;
+    unsigned n_supported = 0, n_probed;
+    pa_bool_t cache_hit = FALSE;
+    pa_usec_t started;
+
+    pa_assert(ps);
+    pa_assert(dev_id);
+    pa_assert(ss);
+
+    if (ps->probed)
+        return;
+
+    started = pa_rtclock_now();
+
+    if ((cache_key = probe_cache_key(dev_id, &devices))) {
+        cache_stamp = probe_cache_stamp(ps, devices, ss, default_n_fragments, default_fragment_size_msec);
+        cached = probe_cache_load(cache_key, cache_stamp);
+        cache_hit = !!cached;
+        pa_xfree(devices);
+    }
+
+    n_probed = profile_set_probe_profiles(ps, dev_id, ss, default_n_fragments, default_fragment_size_msec, cached);
+
+    if (cached)
+        pa_hashmap_free(cached, probe_cache_free_cb, NULL);
+
+    /* Clean up */
+    profiles = pa_strbuf_new();
+
     PA_HASHMAP_FOREACH(p, ps->profiles, state)
         if (!p->supported) {
+            if (!p->failed_temporarily)
+                pa_strbuf_printf(profiles, "-%s\n", p->name);
+
             pa_hashmap_remove(ps->profiles, p->name);
             profile_free(p);
+        } else {
+            pa_strbuf_printf(profiles, "+%s\n", p->name);
+            n_supported++;
         }
 
     PA_HASHMAP_FOREACH(m, ps->mappings, state)
@@ -4463,9 +4793,51 @@ void pa_alsa_profile_set_probe(
     paths_drop_unsupported(ps->input_paths);
     paths_drop_unsupported(ps->output_paths);
 
+    /* Only write if something had to be probed for real */
+    if (cache_key && (!cache_hit || n_probed > 0)) {
+        if (n_supported > 0) {
+            char *t = pa_strbuf_tostring(profiles);
+            probe_cache_save(cache_key, cache_stamp, t);
+            pa_xfree(t);
+        } else
+            pa_log_info("No profile of card %s works, not updating the probe cache.", dev_id);
+    }
+
+    pa_strbuf_free(profiles);
+    pa_xfree(cache_key);
+    pa_xfree(cache_stamp);
+
+    pa_log_info("Probing card %s took %0.2f ms (probe cache %s, %u profiles opened).", dev_id,
+                (double) (pa_rtclock_now() - started) / PA_USEC_PER_MSEC,
+                cache_hit ? "hit" : "miss", n_probed);
+
     ps->probed = TRUE;
 }
 
+void pa_alsa_profile_open_failed(pa_alsa_profile *p, const char *dev_id) {
+    pa_alsa_profile *i;
+    void *state;
+    char *key, *devices = NULL;
+
+    pa_assert(p);
+    pa_assert(dev_id);
+
+    if (!p->from_cache)
+        return;
+
+    pa_log_info("Profile %s of card %s was taken from the probe cache but fails to open, dropping the cache entry.", p->name, dev_id);
+
+    if ((key = probe_cache_key(dev_id, &devices))) {
+        probe_cache_drop(key);
+        pa_xfree(devices);
+        pa_xfree(key);
+    }
+
+    /* The entry is gone, no need to drop it again */
+    PA_HASHMAP_FOREACH(i, p->profile_set->profiles, state)
+        i->from_cache = FALSE;
+}
+
 void pa_alsa_profile_set_dump(pa_alsa_profile_set *ps) {
     pa_alsa_profile *p;
     pa_alsa_mapping *m;
@@ -274,6 +274,8 @@ struct pa_alsa_profile {
     unsigned priority;
 
     pa_bool_t supported:1;
+    pa_bool_t failed_temporarily:1; /* e.g. busy when probed */
+    pa_bool_t from_cache:1; /* taken from the probe cache without opening it */
 
     char **input_mapping_names;
     char **output_mapping_names;
@@ -305,6 +307,9 @@ struct pa_alsa_profile_set {
     pa_hashmap *input_paths;
     pa_hashmap *output_paths;
 
+    /* Profile set configuration file, used for validating the probe cache */
+    char *fname;
+
     pa_bool_t auto_profiles;
     pa_bool_t ignore_dB:1;
     pa_bool_t probed:1;
@@ -316,6 +321,7 @@ void pa_alsa_decibel_fix_dump(pa_alsa_decibel_fix *db_fix);
 
 pa_alsa_profile_set* pa_alsa_profile_set_new(const char *fname, const pa_channel_map *bonus);
 void pa_alsa_profile_set_probe(pa_alsa_profile_set *ps, const char *dev_id, const pa_sample_spec *ss, unsigned default_n_fragments, unsigned default_fragment_size_msec);
+void pa_alsa_profile_open_failed(pa_alsa_profile *p, const char *dev_id);
 void pa_alsa_profile_set_free(pa_alsa_profile_set *s);
 void pa_alsa_profile_set_dump(pa_alsa_profile_set *s);
 
@@ -54,6 +54,7 @@
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/time-smoother.h>
+#include <pulsecore/watermark-predictor.h>
 
 #include <modules/reserve-wrap.h>
 
@@ -66,15 +67,9 @@
 
 #define DEFAULT_TSCHED_BUFFER_USEC (2*PA_USEC_PER_SEC)             /* 2s    -- Overall buffer size */
 #define DEFAULT_TSCHED_WATERMARK_USEC (20*PA_USEC_PER_MSEC)        /* 20ms  -- Fill up when only this much is left in the buffer */
+#define NO_REWIND_TSCHED_BUFFER_USEC (50*PA_USEC_PER_MSEC)         /* 50ms  -- Overall buffer size when never rewinding */
 
-#define TSCHED_WATERMARK_INC_STEP_USEC (10*PA_USEC_PER_MSEC)       /* 10ms  -- On underrun, increase watermark by this */
-#define TSCHED_WATERMARK_DEC_STEP_USEC (5*PA_USEC_PER_MSEC)        /* 5ms   -- When everything's great, decrease watermark by this */
-#define TSCHED_WATERMARK_VERIFY_AFTER_USEC (20*PA_USEC_PER_SEC)    /* 20s   -- How long after a drop out recheck if things are good now */
-#define TSCHED_WATERMARK_INC_THRESHOLD_USEC (0*PA_USEC_PER_MSEC)   /* 0ms   -- If the buffer level ever below this threshold, increase the watermark */
-#define TSCHED_WATERMARK_DEC_THRESHOLD_USEC (100*PA_USEC_PER_MSEC) /* 100ms -- If the buffer level didn't drop below this threshold in the verification time, decrease the watermark */
-
-/* Note that TSCHED_WATERMARK_INC_THRESHOLD_USEC == 0 means that we
- * will increase the watermark only if we hit a real underrun. */
+/* How the watermark moves is up to PA_WATERMARK_* of watermark-predictor.h */
 
 #define TSCHED_MIN_SLEEP_USEC (10*PA_USEC_PER_MSEC)                /* 10ms  -- Sleep at least 10ms on each iteration */
 #define TSCHED_MIN_WAKEUP_USEC (4*PA_USEC_PER_MSEC)                /* 4ms   -- Wakeup at least this long before the buffer runs empty*/
@@ -130,6 +125,14 @@ struct userdata {
     pa_usec_t watermark_dec_not_before;
     pa_usec_t min_latency_ref;
 
+    pa_watermark_predictor *watermark_predictor;
+
+    /* What we expect to be left in the buffer when the timer fires,
+     * and how much of that the last timer wakeup used up */
+    pa_usec_t watermark_expected;
+    int64_t watermark_demand;
+    pa_usec_t watermark_demand_at;
+
     pa_memchunk memchunk;
 
     char *device_name;  /* name of the PCM device */
@@ -321,7 +324,7 @@ static void increase_watermark(struct userdata *u) {
 
     /* First, just try to increase the watermark */
     old_watermark = u->tsched_watermark;
-    u->tsched_watermark = PA_MIN(u->tsched_watermark * 2, u->tsched_watermark + u->watermark_inc_step);
+    u->tsched_watermark = pa_watermark_increase(u->tsched_watermark, u->watermark_inc_step);
     fix_tsched_watermark(u);
 
     if (old_watermark != u->tsched_watermark) {
@@ -337,7 +340,7 @@ static void increase_watermark(struct userdata *u) {
         return;
 
     old_min_latency = u->sink->thread_info.min_latency;
-    new_min_latency = PA_MIN(old_min_latency * 2, old_min_latency + TSCHED_WATERMARK_INC_STEP_USEC);
+    new_min_latency = PA_MIN(old_min_latency * 2, old_min_latency + PA_WATERMARK_INC_STEP_USEC);
     new_min_latency = PA_MIN(new_min_latency, u->sink->thread_info.max_latency);
 
     if (old_min_latency != new_min_latency) {
@@ -352,26 +355,12 @@ static void increase_watermark(struct userdata *u) {
 
 static void decrease_watermark(struct userdata *u) {
     size_t old_watermark;
-    pa_usec_t now;
 
     pa_assert(u);
     pa_assert(u->use_tsched);
 
-    now = pa_rtclock_now();
-
-    if (u->watermark_dec_not_before <= 0)
-        goto restart;
-
-    if (u->watermark_dec_not_before > now)
-        return;
-
     old_watermark = u->tsched_watermark;
-
-    if (u->tsched_watermark < u->watermark_dec_step)
-        u->tsched_watermark = u->tsched_watermark / 2;
-    else
-        u->tsched_watermark = PA_MAX(u->tsched_watermark / 2, u->tsched_watermark - u->watermark_dec_step);
-
+    u->tsched_watermark = pa_watermark_decrease(u->tsched_watermark, u->watermark_dec_step, &u->watermark_dec_not_before, pa_rtclock_now());
     fix_tsched_watermark(u);
 
     if (old_watermark != u->tsched_watermark)
@@ -379,9 +368,44 @@ static void decrease_watermark(struct userdata *u) {
                     (double) pa_bytes_to_usec(u->tsched_watermark, &u->sink->sample_spec) / PA_USEC_PER_MSEC);
 
     /* We don't change the latency range*/
+}
+
+/* Called from IO context, once the refill following a timer wakeup is done */
+static void predict_watermark(struct userdata *u) {
+    size_t old_watermark;
+    pa_usec_t now, old_usec, usec;
+    int64_t demand;
+
+    pa_assert(u);
+    pa_assert(u->use_tsched);
+    pa_assert(u->watermark_predictor);
+
+    now = pa_rtclock_now();
+
+    /* Lateness plus processing time */
+    demand = u->watermark_demand + (int64_t) (now - u->watermark_demand_at);
+    u->watermark_demand_at = 0;
 
-restart:
-    u->watermark_dec_not_before = now + TSCHED_WATERMARK_VERIFY_AFTER_USEC;
+#ifdef DEBUG_TIMING
+    pa_log_debug("Wakeup demand: %lli us", (long long) demand);
+#endif
+
+    pa_watermark_predictor_add(u->watermark_predictor, demand);
+
+    old_usec = pa_bytes_to_usec(u->tsched_watermark, &u->sink->sample_spec);
+    usec = pa_watermark_predictor_update(u->watermark_predictor, now, old_usec);
+
+    if (usec == old_usec)
+        return;
+
+    old_watermark = u->tsched_watermark;
+    u->tsched_watermark = pa_usec_to_bytes_round_up(usec, &u->sink->sample_spec);
+    fix_tsched_watermark(u);
+
+    if (old_watermark != u->tsched_watermark)
+        pa_log_debug("%s wakeup watermark to %0.2f ms (predicted)",
+                     u->tsched_watermark > old_watermark ? "Increasing" : "Decreasing",
+                     (double) pa_bytes_to_usec(u->tsched_watermark, &u->sink->sample_spec) / PA_USEC_PER_MSEC);
 }
 
 static void hw_sleep_time(struct userdata *u, pa_usec_t *sleep_usec, pa_usec_t*process_usec) {
@@ -465,6 +489,23 @@ static size_t check_left_to_play(struct userdata *u, size_t n_bytes, pa_bool_t o
                 pa_log_info("Underrun!");
     }
 
+    if ((on_timeout || underrun) && !u->first && !u->after_rewind) {
+        int64_t headroom;
+
+        /* How close we came to the deadline, negative if we missed it */
+        headroom = underrun ?
+            -(int64_t) pa_bytes_to_usec(n_bytes - u->hwbuf_size, &u->sink->sample_spec) :
+            (int64_t) pa_bytes_to_usec(left_to_play, &u->sink->sample_spec);
+
+        pa_time_histogram_add(&pa_rtpoll_get_stat(u->rtpoll)->headroom, headroom);
+
+        /* How much of what we expected to be left we didn't find */
+        if (on_timeout && u->watermark_predictor && u->watermark_expected > 0) {
+            u->watermark_demand = (int64_t) u->watermark_expected - headroom;
+            u->watermark_demand_at = pa_rtclock_now();
+        }
+    }
+
 #ifdef DEBUG_TIMING
     pa_log_debug("%0.2f ms left to play; inc threshold = %0.2f ms; dec threshold = %0.2f ms",
                  (double) pa_bytes_to_usec(left_to_play, &u->sink->sample_spec) / PA_USEC_PER_MSEC,
@@ -476,9 +517,13 @@ static size_t check_left_to_play(struct userdata *u, size_t n_bytes, pa_bool_t o
         pa_bool_t reset_not_before = TRUE;
 
         if (!u->first && !u->after_rewind) {
-            if (underrun || left_to_play < u->watermark_inc_threshold)
+            if (underrun || left_to_play < u->watermark_inc_threshold) {
                 increase_watermark(u);
-            else if (left_to_play > u->watermark_dec_threshold) {
+
+                if (u->watermark_predictor)
+                    pa_watermark_predictor_dropout(u->watermark_predictor, pa_rtclock_now());
+
+            } else if (left_to_play > u->watermark_dec_threshold && !u->watermark_predictor) {
                 reset_not_before = FALSE;
 
                 /* We decrease the watermark only if have actually
@@ -998,11 +1043,11 @@ static void reset_watermark(struct userdata *u, size_t tsched_watermark, pa_samp
     u->tsched_watermark = pa_usec_to_bytes_round_up(pa_bytes_to_usec_round_up(tsched_watermark, ss),
                                                     &u->sink->sample_spec);
 
-    u->watermark_inc_step = pa_usec_to_bytes(TSCHED_WATERMARK_INC_STEP_USEC, &u->sink->sample_spec);
-    u->watermark_dec_step = pa_usec_to_bytes(TSCHED_WATERMARK_DEC_STEP_USEC, &u->sink->sample_spec);
+    u->watermark_inc_step = pa_usec_to_bytes(PA_WATERMARK_INC_STEP_USEC, &u->sink->sample_spec);
+    u->watermark_dec_step = pa_usec_to_bytes(PA_WATERMARK_DEC_STEP_USEC, &u->sink->sample_spec);
 
-    u->watermark_inc_threshold = pa_usec_to_bytes_round_up(TSCHED_WATERMARK_INC_THRESHOLD_USEC, &u->sink->sample_spec);
-    u->watermark_dec_threshold = pa_usec_to_bytes_round_up(TSCHED_WATERMARK_DEC_THRESHOLD_USEC, &u->sink->sample_spec);
+    u->watermark_inc_threshold = pa_usec_to_bytes_round_up(PA_WATERMARK_INC_THRESHOLD_USEC, &u->sink->sample_spec);
+    u->watermark_dec_threshold = pa_usec_to_bytes_round_up(PA_WATERMARK_DEC_THRESHOLD_USEC, &u->sink->sample_spec);
 
     fix_min_sleep_wakeup(u);
     fix_tsched_watermark(u);
@@ -1047,11 +1092,11 @@ static int unsuspend(struct userdata *u) {
         pa_snprintf(device_name, len, "%s,AES0=6", u->device_name);
     }
 
-    if ((err = snd_pcm_open(&u->pcm_handle, device_name ? device_name : u->device_name, SND_PCM_STREAM_PLAYBACK,
-                            SND_PCM_NONBLOCK|
-                            SND_PCM_NO_AUTO_RESAMPLE|
-                            SND_PCM_NO_AUTO_CHANNELS|
-                            SND_PCM_NO_AUTO_FORMAT)) < 0) {
+    if ((err = pa_alsa_pcm_open(&u->pcm_handle, device_name ? device_name : u->device_name, SND_PCM_STREAM_PLAYBACK,
+                                SND_PCM_NONBLOCK|
+                                SND_PCM_NO_AUTO_RESAMPLE|
+                                SND_PCM_NO_AUTO_CHANNELS|
+                                SND_PCM_NO_AUTO_FORMAT)) < 0) {
         pa_log("Error opening PCM device %s: %s", u->device_name, pa_alsa_strerror(err));
         goto fail;
     }
@@ -1675,7 +1720,7 @@ static void thread_func(void *userdata) {
 
     for (;;) {
         int ret;
-        pa_usec_t rtpoll_sleep = 0;
+        pa_usec_t rtpoll_sleep = 0, tsched_left = 0;
 
 #ifdef DEBUG_TIMING
         pa_log_debug("Loop");
@@ -1718,6 +1763,9 @@ static void thread_func(void *userdata) {
             if (u->use_tsched) {
                 pa_usec_t cusec;
 
+                /* mmap_write()/unix_write() left us with this much in the buffer */
+                tsched_left = sleep_usec + pa_bytes_to_usec(u->tsched_watermark, &u->sink->sample_spec);
+
                 if (u->since_start <= u->hwbuf_size) {
 
                     /* USB devices on ALSA seem to hit a buffer
@@ -1749,6 +1797,9 @@ static void thread_func(void *userdata) {
 
                 /* We don't trust the conversion, so we wake up whatever comes first */
                 rtpoll_sleep = PA_MIN(sleep_usec, cusec);
+
+                if (u->watermark_demand_at > 0)
+                    predict_watermark(u);
             }
 
             u->after_rewind = FALSE;
@@ -1766,6 +1817,8 @@ static void thread_func(void *userdata) {
             }
         }
 
+        u->watermark_expected = tsched_left > rtpoll_sleep ? tsched_left - rtpoll_sleep : 0;
+
         if (rtpoll_sleep > 0)
             pa_rtpoll_set_timer_relative(u->rtpoll, rtpoll_sleep);
         else
@@ -1980,7 +2033,7 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
     uint32_t nfrags, frag_size, buffer_size, tsched_size, tsched_watermark, rewind_safeguard;
     snd_pcm_uframes_t period_frames, buffer_frames, tsched_frames;
     size_t frame_size;
-    pa_bool_t use_mmap = TRUE, b, use_tsched = TRUE, d, ignore_dB = FALSE, namereg_fail = FALSE, deferred_volume = FALSE, set_formats = FALSE, fixed_latency_range = FALSE;
+    pa_bool_t use_mmap = TRUE, b, use_tsched = TRUE, d, ignore_dB = FALSE, namereg_fail = FALSE, deferred_volume = FALSE, set_formats = FALSE, fixed_latency_range = FALSE, no_rewind = FALSE, predictive_watermark = FALSE;
     pa_sink_new_data data;
     pa_alsa_profile_set *profile_set = NULL;
 
@@ -2006,7 +2059,14 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
     frag_size = (uint32_t) pa_usec_to_bytes(m->core->default_fragment_size_msec*PA_USEC_PER_MSEC, &ss);
     if (frag_size <= 0)
         frag_size = (uint32_t) frame_size;
-    tsched_size = (uint32_t) pa_usec_to_bytes(DEFAULT_TSCHED_BUFFER_USEC, &ss);
+    if (pa_modargs_get_value_boolean(ma, "no_rewind", &no_rewind) < 0) {
+        pa_log("Failed to parse no_rewind argument.");
+        goto fail;
+    }
+
+    /* Without rewinds there is no point in buffering far ahead: whatever
+     * is written can't be taken back, so it only adds latency */
+    tsched_size = (uint32_t) pa_usec_to_bytes(no_rewind ? NO_REWIND_TSCHED_BUFFER_USEC : DEFAULT_TSCHED_BUFFER_USEC, &ss);
     tsched_watermark = (uint32_t) pa_usec_to_bytes(DEFAULT_TSCHED_WATERMARK_USEC, &ss);
 
     if (pa_modargs_get_value_u32(ma, "fragments", &nfrags) < 0 ||
@@ -2055,6 +2115,11 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "predictive_watermark", &predictive_watermark) < 0) {
+        pa_log("Failed to parse predictive_watermark argument.");
+        goto fail;
+    }
+
     use_tsched = pa_alsa_may_tsched(use_tsched);
 
     u = pa_xnew0(struct userdata, 1);
@@ -2165,6 +2230,13 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
 
         if (u->fixed_latency_range)
             pa_log_info("Disabling latency range changes on underrun");
+
+        if (predictive_watermark) {
+            pa_log_info("Predicting the wakeup watermark from past wakeups");
+            u->watermark_predictor = pa_watermark_predictor_new(PA_WATERMARK_PREDICT_WINDOW,
+                                                                PA_WATERMARK_PREDICT_FRACTION,
+                                                                PA_WATERMARK_PREDICT_MARGIN_USEC);
+        }
     }
 
     if (is_iec958(u) || is_hdmi(u))
@@ -2229,7 +2301,7 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
         pa_alsa_add_ports(&data.ports, u->mixer_path_set, card);
 
     u->sink = pa_sink_new(m->core, &data, PA_SINK_HARDWARE | PA_SINK_LATENCY | (u->use_tsched ? PA_SINK_DYNAMIC_LATENCY : 0) |
-                          (set_formats ? PA_SINK_SET_FORMATS : 0));
+                          (set_formats ? PA_SINK_SET_FORMATS : 0) | (no_rewind ? PA_SINK_NO_REWIND : 0));
     pa_sink_new_data_done(&data);
 
     if (!u->sink) {
@@ -2400,6 +2472,9 @@ static void userdata_free(struct userdata *u) {
     if (u->smoother)
         pa_smoother_free(u->smoother);
 
+    if (u->watermark_predictor)
+        pa_watermark_predictor_free(u->watermark_predictor);
+
     if (u->formats)
         pa_idxset_free(u->formats, (pa_free2_cb_t) pa_format_info_free2, NULL);
 
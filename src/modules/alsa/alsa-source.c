@@ -49,6 +49,7 @@
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/time-smoother.h>
+#include <pulsecore/watermark-predictor.h>
 
 #include <modules/reserve-wrap.h>
 
@@ -62,11 +63,8 @@
 #define DEFAULT_TSCHED_BUFFER_USEC (2*PA_USEC_PER_SEC)             /* 2s */
 #define DEFAULT_TSCHED_WATERMARK_USEC (20*PA_USEC_PER_MSEC)        /* 20ms */
 
-#define TSCHED_WATERMARK_INC_STEP_USEC (10*PA_USEC_PER_MSEC)       /* 10ms  */
-#define TSCHED_WATERMARK_DEC_STEP_USEC (5*PA_USEC_PER_MSEC)        /* 5ms */
-#define TSCHED_WATERMARK_VERIFY_AFTER_USEC (20*PA_USEC_PER_SEC)    /* 20s */
-#define TSCHED_WATERMARK_INC_THRESHOLD_USEC (0*PA_USEC_PER_MSEC)   /* 0ms */
-#define TSCHED_WATERMARK_DEC_THRESHOLD_USEC (100*PA_USEC_PER_MSEC) /* 100ms */
+/* How the watermark moves is up to PA_WATERMARK_* of watermark-predictor.h */
+
 #define TSCHED_WATERMARK_STEP_USEC (10*PA_USEC_PER_MSEC)           /* 10ms */
 
 #define TSCHED_MIN_SLEEP_USEC (10*PA_USEC_PER_MSEC)                /* 10ms */
@@ -119,6 +117,14 @@ struct userdata {
     pa_usec_t watermark_dec_not_before;
     pa_usec_t min_latency_ref;
 
+    pa_watermark_predictor *watermark_predictor;
+
+    /* What we expect to be left in the buffer when the timer fires,
+     * and how much of that the last timer wakeup used up */
+    pa_usec_t watermark_expected;
+    int64_t watermark_demand;
+    pa_usec_t watermark_demand_at;
+
     char *device_name;  /* name of the PCM device */
     char *control_device; /* name of the control device */
 
@@ -296,7 +302,7 @@ static void increase_watermark(struct userdata *u) {
 
     /* First, just try to increase the watermark */
     old_watermark = u->tsched_watermark;
-    u->tsched_watermark = PA_MIN(u->tsched_watermark * 2, u->tsched_watermark + u->watermark_inc_step);
+    u->tsched_watermark = pa_watermark_increase(u->tsched_watermark, u->watermark_inc_step);
     fix_tsched_watermark(u);
 
     if (old_watermark != u->tsched_watermark) {
@@ -312,7 +318,7 @@ static void increase_watermark(struct userdata *u) {
         return;
 
     old_min_latency = u->source->thread_info.min_latency;
-    new_min_latency = PA_MIN(old_min_latency * 2, old_min_latency + TSCHED_WATERMARK_INC_STEP_USEC);
+    new_min_latency = PA_MIN(old_min_latency * 2, old_min_latency + PA_WATERMARK_INC_STEP_USEC);
     new_min_latency = PA_MIN(new_min_latency, u->source->thread_info.max_latency);
 
     if (old_min_latency != new_min_latency) {
@@ -327,26 +333,12 @@ static void increase_watermark(struct userdata *u) {
 
 static void decrease_watermark(struct userdata *u) {
     size_t old_watermark;
-    pa_usec_t now;
 
     pa_assert(u);
     pa_assert(u->use_tsched);
 
-    now = pa_rtclock_now();
-
-    if (u->watermark_dec_not_before <= 0)
-        goto restart;
-
-    if (u->watermark_dec_not_before > now)
-        return;
-
     old_watermark = u->tsched_watermark;
-
-    if (u->tsched_watermark < u->watermark_dec_step)
-        u->tsched_watermark = u->tsched_watermark / 2;
-    else
-        u->tsched_watermark = PA_MAX(u->tsched_watermark / 2, u->tsched_watermark - u->watermark_dec_step);
-
+    u->tsched_watermark = pa_watermark_decrease(u->tsched_watermark, u->watermark_dec_step, &u->watermark_dec_not_before, pa_rtclock_now());
     fix_tsched_watermark(u);
 
     if (old_watermark != u->tsched_watermark)
@@ -354,9 +346,44 @@ static void decrease_watermark(struct userdata *u) {
                     (double) pa_bytes_to_usec(u->tsched_watermark, &u->source->sample_spec) / PA_USEC_PER_MSEC);
 
     /* We don't change the latency range*/
+}
+
+/* Called from IO context, once the read following a timer wakeup is done */
+static void predict_watermark(struct userdata *u) {
+    size_t old_watermark;
+    pa_usec_t now, old_usec, usec;
+    int64_t demand;
+
+    pa_assert(u);
+    pa_assert(u->use_tsched);
+    pa_assert(u->watermark_predictor);
+
+    now = pa_rtclock_now();
+
+    /* Lateness plus processing time */
+    demand = u->watermark_demand + (int64_t) (now - u->watermark_demand_at);
+    u->watermark_demand_at = 0;
+
+#ifdef DEBUG_TIMING
+    pa_log_debug("Wakeup demand: %lli us", (long long) demand);
+#endif
+
+    pa_watermark_predictor_add(u->watermark_predictor, demand);
 
-restart:
-    u->watermark_dec_not_before = now + TSCHED_WATERMARK_VERIFY_AFTER_USEC;
+    old_usec = pa_bytes_to_usec(u->tsched_watermark, &u->source->sample_spec);
+    usec = pa_watermark_predictor_update(u->watermark_predictor, now, old_usec);
+
+    if (usec == old_usec)
+        return;
+
+    old_watermark = u->tsched_watermark;
+    u->tsched_watermark = pa_usec_to_bytes_round_up(usec, &u->source->sample_spec);
+    fix_tsched_watermark(u);
+
+    if (old_watermark != u->tsched_watermark)
+        pa_log_debug("%s wakeup watermark to %0.2f ms (predicted)",
+                     u->tsched_watermark > old_watermark ? "Increasing" : "Decreasing",
+                     (double) pa_bytes_to_usec(u->tsched_watermark, &u->source->sample_spec) / PA_USEC_PER_MSEC);
 }
 
 static void hw_sleep_time(struct userdata *u, pa_usec_t *sleep_usec, pa_usec_t*process_usec) {
@@ -439,6 +466,23 @@ static size_t check_left_to_record(struct userdata *u, size_t n_bytes, pa_bool_t
             pa_log_info("Overrun!");
     }
 
+    if (on_timeout || overrun) {
+        int64_t headroom;
+
+        /* How close we came to the deadline, negative if we missed it */
+        headroom = overrun ?
+            -(int64_t) pa_bytes_to_usec(n_bytes - rec_space, &u->source->sample_spec) :
+            (int64_t) pa_bytes_to_usec(left_to_record, &u->source->sample_spec);
+
+        pa_time_histogram_add(&pa_rtpoll_get_stat(u->rtpoll)->headroom, headroom);
+
+        /* How much of what we expected to be left we didn't find */
+        if (on_timeout && u->watermark_predictor && u->watermark_expected > 0) {
+            u->watermark_demand = (int64_t) u->watermark_expected - headroom;
+            u->watermark_demand_at = pa_rtclock_now();
+        }
+    }
+
 #ifdef DEBUG_TIMING
     pa_log_debug("%0.2f ms left to record", (double) pa_bytes_to_usec(left_to_record, &u->source->sample_spec) / PA_USEC_PER_MSEC);
 #endif
@@ -446,9 +490,13 @@ static size_t check_left_to_record(struct userdata *u, size_t n_bytes, pa_bool_t
     if (u->use_tsched) {
         pa_bool_t reset_not_before = TRUE;
 
-        if (overrun || left_to_record < u->watermark_inc_threshold)
+        if (overrun || left_to_record < u->watermark_inc_threshold) {
             increase_watermark(u);
-        else if (left_to_record > u->watermark_dec_threshold) {
+
+            if (u->watermark_predictor)
+                pa_watermark_predictor_dropout(u->watermark_predictor, pa_rtclock_now());
+
+        } else if (left_to_record > u->watermark_dec_threshold && !u->watermark_predictor) {
             reset_not_before = FALSE;
 
             /* We decrease the watermark only if have actually
@@ -912,11 +960,11 @@ static void reset_watermark(struct userdata *u, size_t tsched_watermark, pa_samp
     u->tsched_watermark = pa_usec_to_bytes_round_up(pa_bytes_to_usec_round_up(tsched_watermark, ss),
                                                     &u->source->sample_spec);
 
-    u->watermark_inc_step = pa_usec_to_bytes(TSCHED_WATERMARK_INC_STEP_USEC, &u->source->sample_spec);
-    u->watermark_dec_step = pa_usec_to_bytes(TSCHED_WATERMARK_DEC_STEP_USEC, &u->source->sample_spec);
+    u->watermark_inc_step = pa_usec_to_bytes(PA_WATERMARK_INC_STEP_USEC, &u->source->sample_spec);
+    u->watermark_dec_step = pa_usec_to_bytes(PA_WATERMARK_DEC_STEP_USEC, &u->source->sample_spec);
 
-    u->watermark_inc_threshold = pa_usec_to_bytes_round_up(TSCHED_WATERMARK_INC_THRESHOLD_USEC, &u->source->sample_spec);
-    u->watermark_dec_threshold = pa_usec_to_bytes_round_up(TSCHED_WATERMARK_DEC_THRESHOLD_USEC, &u->source->sample_spec);
+    u->watermark_inc_threshold = pa_usec_to_bytes_round_up(PA_WATERMARK_INC_THRESHOLD_USEC, &u->source->sample_spec);
+    u->watermark_dec_threshold = pa_usec_to_bytes_round_up(PA_WATERMARK_DEC_THRESHOLD_USEC, &u->source->sample_spec);
 
     fix_min_sleep_wakeup(u);
     fix_tsched_watermark(u);
@@ -952,11 +1000,11 @@ static int unsuspend(struct userdata *u) {
 
     pa_log_info("Trying resume...");
 
-    if ((err = snd_pcm_open(&u->pcm_handle, u->device_name, SND_PCM_STREAM_CAPTURE,
-                            SND_PCM_NONBLOCK|
-                            SND_PCM_NO_AUTO_RESAMPLE|
-                            SND_PCM_NO_AUTO_CHANNELS|
-                            SND_PCM_NO_AUTO_FORMAT)) < 0) {
+    if ((err = pa_alsa_pcm_open(&u->pcm_handle, u->device_name, SND_PCM_STREAM_CAPTURE,
+                                SND_PCM_NONBLOCK|
+                                SND_PCM_NO_AUTO_RESAMPLE|
+                                SND_PCM_NO_AUTO_CHANNELS|
+                                SND_PCM_NO_AUTO_FORMAT)) < 0) {
         pa_log("Error opening PCM device %s: %s", u->device_name, pa_alsa_strerror(err));
         goto fail;
     }
@@ -1441,7 +1489,7 @@ static void thread_func(void *userdata) {
 
     for (;;) {
         int ret;
-        pa_usec_t rtpoll_sleep = 0;
+        pa_usec_t rtpoll_sleep = 0, tsched_left = 0;
 
 #ifdef DEBUG_TIMING
         pa_log_debug("Loop");
@@ -1481,6 +1529,9 @@ static void thread_func(void *userdata) {
                 /* OK, the capture buffer is now empty, let's
                  * calculate when to wake up next */
 
+                /* mmap_read()/unix_read() left us with this much space in the buffer */
+                tsched_left = sleep_usec + pa_bytes_to_usec(u->tsched_watermark, &u->source->sample_spec);
+
 /*                 pa_log_debug("Waking up in %0.2fms (sound card clock).", (double) sleep_usec / PA_USEC_PER_MSEC); */
 
                 /* Convert from the sound card time domain to the
@@ -1491,6 +1542,9 @@ static void thread_func(void *userdata) {
 
                 /* We don't trust the conversion, so we wake up whatever comes first */
                 rtpoll_sleep = PA_MIN(sleep_usec, cusec);
+
+                if (u->watermark_demand_at > 0)
+                    predict_watermark(u);
             }
         }
 
@@ -1505,6 +1559,8 @@ static void thread_func(void *userdata) {
             }
         }
 
+        u->watermark_expected = tsched_left > rtpoll_sleep ? tsched_left - rtpoll_sleep : 0;
+
         if (rtpoll_sleep > 0)
             pa_rtpoll_set_timer_relative(u->rtpoll, rtpoll_sleep);
         else
@@ -1717,7 +1773,7 @@ pa_source *pa_alsa_source_new(pa_module *m, pa_modargs *ma, const char*driver, p
     uint32_t nfrags, frag_size, buffer_size, tsched_size, tsched_watermark;
     snd_pcm_uframes_t period_frames, buffer_frames, tsched_frames;
     size_t frame_size;
-    pa_bool_t use_mmap = TRUE, b, use_tsched = TRUE, d, ignore_dB = FALSE, namereg_fail = FALSE, deferred_volume = FALSE, fixed_latency_range = FALSE;
+    pa_bool_t use_mmap = TRUE, b, use_tsched = TRUE, d, ignore_dB = FALSE, namereg_fail = FALSE, deferred_volume = FALSE, fixed_latency_range = FALSE, predictive_watermark = FALSE;
     pa_source_new_data data;
     pa_alsa_profile_set *profile_set = NULL;
 
@@ -1786,6 +1842,11 @@ pa_source *pa_alsa_source_new(pa_module *m, pa_modargs *ma, const char*driver, p
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "predictive_watermark", &predictive_watermark) < 0) {
+        pa_log("Failed to parse predictive_watermark argument.");
+        goto fail;
+    }
+
     use_tsched = pa_alsa_may_tsched(use_tsched);
 
     u = pa_xnew0(struct userdata, 1);
@@ -1894,6 +1955,13 @@ pa_source *pa_alsa_source_new(pa_module *m, pa_modargs *ma, const char*driver, p
         pa_log_info("Successfully enabled timer-based scheduling mode.");
         if (u->fixed_latency_range)
             pa_log_info("Disabling latency range changes on overrun");
+
+        if (predictive_watermark) {
+            pa_log_info("Predicting the wakeup watermark from past wakeups");
+            u->watermark_predictor = pa_watermark_predictor_new(PA_WATERMARK_PREDICT_WINDOW,
+                                                                PA_WATERMARK_PREDICT_FRACTION,
+                                                                PA_WATERMARK_PREDICT_MARGIN_USEC);
+        }
     }
 
     u->rates = pa_alsa_get_supported_rates(u->pcm_handle);
@@ -2100,6 +2168,9 @@ static void userdata_free(struct userdata *u) {
     if (u->smoother)
         pa_smoother_free(u->smoother);
 
+    if (u->watermark_predictor)
+        pa_watermark_predictor_free(u->watermark_predictor);
+
     if (u->rates)
         pa_xfree(u->rates);
 
@@ -25,6 +25,7 @@
 #endif
 
 #include <sys/types.h>
+#include <errno.h>
 #include <asoundlib.h>
 
 #include <pulse/sample.h>
@@ -40,6 +41,7 @@
 #include <pulsecore/atomic.h>
 #include <pulsecore/core-error.h>
 #include <pulsecore/thread.h>
+#include <pulsecore/mutex.h>
 #include <pulsecore/conf-parser.h>
 #include <pulsecore/core-rtclock.h>
 
@@ -670,11 +672,11 @@ snd_pcm_t *pa_alsa_open_by_device_string(
     for (;;) {
         pa_log_debug("Trying %s %s SND_PCM_NO_AUTO_FORMAT ...", d, reformat ? "without" : "with");
 
-        if ((err = snd_pcm_open(&pcm_handle, d, mode,
-                                SND_PCM_NONBLOCK|
-                                SND_PCM_NO_AUTO_RESAMPLE|
-                                SND_PCM_NO_AUTO_CHANNELS|
-                                (reformat ? 0 : SND_PCM_NO_AUTO_FORMAT))) < 0) {
+        if ((err = pa_alsa_pcm_open(&pcm_handle, d, mode,
+                                    SND_PCM_NONBLOCK|
+                                    SND_PCM_NO_AUTO_RESAMPLE|
+                                    SND_PCM_NO_AUTO_CHANNELS|
+                                    (reformat ? 0 : SND_PCM_NO_AUTO_FORMAT))) < 0) {
             pa_log_info("Error opening PCM device %s: %s", d, pa_alsa_strerror(err));
             goto fail;
         }
@@ -732,6 +734,7 @@ snd_pcm_t *pa_alsa_open_by_device_string(
 fail:
     pa_xfree(d);
 
+    errno = -err;
     return NULL;
 }
 
@@ -751,6 +754,7 @@ snd_pcm_t *pa_alsa_open_by_template(
 
     snd_pcm_t *pcm_handle;
     char **i;
+    int err = ENOENT;
 
     for (i = template; *i; i++) {
         char *d;
@@ -774,11 +778,20 @@ snd_pcm_t *pa_alsa_open_by_template(
 
         if (pcm_handle)
             return pcm_handle;
+
+        /* Report a failure that might go away, if there was one */
+        if (pa_alsa_error_is_permanent(err))
+            err = errno;
     }
 
+    errno = err;
     return NULL;
 }
 
+pa_bool_t pa_alsa_error_is_permanent(int err) {
+    return err == EINVAL || err == ENOENT || err == ENODEV;
+}
+
 void pa_alsa_dump(pa_log_level_t level, snd_pcm_t *pcm) {
     int err;
     snd_output_t *out;
@@ -862,10 +875,53 @@ void pa_alsa_refcnt_dec(void) {
 
     if (r == 1) {
         snd_lib_error_set_handler(NULL);
+
+        pa_alsa_config_lock();
         snd_config_update_free_global();
+        pa_alsa_config_unlock();
     }
 }
 
+/* Cards may be probed in the deferred init threads while the main
+ * thread opens devices of others, see module-alsa-card. Only the calls
+ * that load or read the configuration are serialized, setting up and
+ * closing the PCMs runs in parallel. */
+static pa_static_mutex config_mutex = PA_STATIC_MUTEX_INIT;
+
+void pa_alsa_config_lock(void) {
+    pa_mutex_lock(pa_static_mutex_get(&config_mutex, FALSE, FALSE));
+}
+
+void pa_alsa_config_unlock(void) {
+    pa_mutex_unlock(pa_static_mutex_get(&config_mutex, FALSE, FALSE));
+}
+
+int pa_alsa_pcm_open(snd_pcm_t **pcm, const char *name, snd_pcm_stream_t stream, int mode) {
+    int err;
+
+    pa_assert(pcm);
+    pa_assert(name);
+
+    pa_alsa_config_lock();
+    err = snd_pcm_open(pcm, name, stream, mode);
+    pa_alsa_config_unlock();
+
+    return err;
+}
+
+int pa_alsa_ctl_open(snd_ctl_t **ctl, const char *name, int mode) {
+    int err;
+
+    pa_assert(ctl);
+    pa_assert(name);
+
+    pa_alsa_config_lock();
+    err = snd_ctl_open(ctl, name, mode);
+    pa_alsa_config_unlock();
+
+    return err;
+}
+
 pa_bool_t pa_alsa_init_description(pa_proplist *p) {
     const char *d, *k;
     pa_assert(p);
@@ -1012,7 +1068,7 @@ void pa_alsa_init_proplist_ctl(pa_proplist *p, const char *name) {
 
     snd_ctl_card_info_alloca(&info);
 
-    if ((err = snd_ctl_open(&ctl, name, 0)) < 0) {
+    if ((err = pa_alsa_ctl_open(&ctl, name, 0)) < 0) {
         pa_log_warn("Error opening low-level control device '%s': %s", name, snd_strerror(err));
         return;
     }
@@ -1459,7 +1515,12 @@ static int prepare_mixer(snd_mixer_t *mixer, const char *dev, snd_hctl_t **hctl)
     pa_assert(mixer);
     pa_assert(dev);
 
-    if ((err = snd_mixer_attach(mixer, dev)) < 0) {
+    /* This opens the control device by name */
+    pa_alsa_config_lock();
+    err = snd_mixer_attach(mixer, dev);
+    pa_alsa_config_unlock();
+
+    if (err < 0) {
         pa_log_info("Unable to attach to mixer %s: %s", dev, pa_alsa_strerror(err));
         return -1;
     }
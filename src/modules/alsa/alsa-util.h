@@ -79,7 +79,7 @@ snd_pcm_t *pa_alsa_open_by_device_id_mapping(
         pa_bool_t *use_tsched,            /* modified at return */
         pa_alsa_mapping *mapping);
 
-/* Opens the explicit ALSA device */
+/* Opens the explicit ALSA device, sets errno on failure */
 snd_pcm_t *pa_alsa_open_by_device_string(
         const char *dir,
         char **dev,                       /* modified at return */
@@ -93,7 +93,9 @@ snd_pcm_t *pa_alsa_open_by_device_string(
         pa_bool_t *use_tsched,            /* modified at return */
         pa_bool_t require_exact_channel_number);
 
-/* Opens the explicit ALSA device with a fallback list */
+/* Opens the explicit ALSA device with a fallback list. On failure
+ * errno is set, to a temporary error like EBUSY if any of the devices
+ * failed with one. */
 snd_pcm_t *pa_alsa_open_by_template(
         char **template,
         const char *dev_id,
@@ -108,12 +110,26 @@ snd_pcm_t *pa_alsa_open_by_template(
         pa_bool_t *use_tsched,            /* modified at return */
         pa_bool_t require_exact_channel_number);
 
+/* Whether an error from opening or configuring a PCM means the
+ * device won't work, as opposed to being busy right now */
+pa_bool_t pa_alsa_error_is_permanent(int err);
+
 void pa_alsa_dump(pa_log_level_t level, snd_pcm_t *pcm);
 void pa_alsa_dump_status(snd_pcm_t *pcm);
 
 void pa_alsa_refcnt_inc(void);
 void pa_alsa_refcnt_dec(void);
 
+/* alsa-lib's global configuration is loaded, reloaded and looked up
+ * without any locking. Everything that touches it has to hold this
+ * lock, from whatever thread. The wrappers below take it only for the
+ * open call itself. */
+void pa_alsa_config_lock(void);
+void pa_alsa_config_unlock(void);
+
+int pa_alsa_pcm_open(snd_pcm_t **pcm, const char *name, snd_pcm_stream_t stream, int mode);
+int pa_alsa_ctl_open(snd_ctl_t **ctl, const char *name, int mode);
+
 void pa_alsa_init_proplist_pcm_info(pa_core *c, pa_proplist *p, snd_pcm_info_t *pcm_info);
 void pa_alsa_init_proplist_card(pa_core *c, pa_proplist *p, int card);
 void pa_alsa_init_proplist_pcm(pa_core *c, pa_proplist *p, snd_pcm_t *pcm);
@@ -65,6 +65,8 @@ PA_MODULE_USAGE(
         "tsched_buffer_watermark=<lower fill watermark> "
         "profile=<profile name> "
         "fixed_latency_range=<disable latency range changes on underrun?> "
+        "no_rewind=<never rewind sinks, keep buffers at the latency target?> "
+        "predictive_watermark=<size the wakeup watermark from past wakeups?> "
         "ignore_dB=<ignore dB information from the device?> "
         "deferred_volume=<Synchronize software and hardware volume changes to avoid momentary jumps?> "
         "profile_set=<profile set configuration file> "
@@ -90,6 +92,8 @@ static const char* const valid_modargs[] = {
     "tsched_buffer_size",
     "tsched_buffer_watermark",
     "fixed_latency_range",
+    "no_rewind",
+    "predictive_watermark",
     "profile",
     "ignore_dB",
     "deferred_volume",
@@ -117,6 +121,9 @@ struct userdata {
     pa_modargs *modargs;
 
     pa_alsa_profile_set *profile_set;
+
+    /* Only held until the card is created */
+    pa_reserve_wrapper *reserve;
 };
 
 struct profile_data {
@@ -225,8 +232,9 @@ static int card_set_profile(pa_card *c, pa_card_profile *new_profile) {
     if (nd->profile && nd->profile->output_mappings)
         PA_IDXSET_FOREACH(am, nd->profile->output_mappings, idx) {
 
-            if (!am->sink)
-                am->sink = pa_alsa_sink_new(c->module, u->modargs, __FILE__, c, am);
+            if (!am->sink &&
+                !(am->sink = pa_alsa_sink_new(c->module, u->modargs, __FILE__, c, am)))
+                pa_alsa_profile_open_failed(nd->profile, u->device_id);
 
             if (sink_inputs && am->sink) {
                 pa_sink_move_all_finish(am->sink, sink_inputs, FALSE);
@@ -237,8 +245,9 @@ static int card_set_profile(pa_card *c, pa_card_profile *new_profile) {
     if (nd->profile && nd->profile->input_mappings)
         PA_IDXSET_FOREACH(am, nd->profile->input_mappings, idx) {
 
-            if (!am->source)
-                am->source = pa_alsa_source_new(c->module, u->modargs, __FILE__, c, am);
+            if (!am->source &&
+                !(am->source = pa_alsa_source_new(c->module, u->modargs, __FILE__, c, am)))
+                pa_alsa_profile_open_failed(nd->profile, u->device_id);
 
             if (source_outputs && am->source) {
                 pa_source_move_all_finish(am->source, source_outputs, FALSE);
@@ -266,11 +275,13 @@ static void init_profile(struct userdata *u) {
 
     if (d->profile && d->profile->output_mappings)
         PA_IDXSET_FOREACH(am, d->profile->output_mappings, idx)
-            am->sink = pa_alsa_sink_new(u->module, u->modargs, __FILE__, u->card, am);
+            if (!(am->sink = pa_alsa_sink_new(u->module, u->modargs, __FILE__, u->card, am)))
+                pa_alsa_profile_open_failed(d->profile, u->device_id);
 
     if (d->profile && d->profile->input_mappings)
         PA_IDXSET_FOREACH(am, d->profile->input_mappings, idx)
-            am->source = pa_alsa_source_new(u->module, u->modargs, __FILE__, u->card, am);
+            if (!(am->source = pa_alsa_source_new(u->module, u->modargs, __FILE__, u->card, am)))
+                pa_alsa_profile_open_failed(d->profile, u->device_id);
 }
 
 static void report_port_state(pa_device_port *p, struct userdata *u)
@@ -408,72 +419,32 @@ static void set_card_name(pa_card_new_data *data, pa_modargs *ma, const char *de
     pa_xfree(t);
 }
 
-int pa__init(pa_module *m) {
+/* Called from the deferred init thread, if parallel module
+ * initialization is enabled */
+static void card_probe_cb(pa_module *m, void *userdata) {
+    struct userdata *u = userdata;
+
+    pa_assert(m);
+    pa_assert(u);
+
+    /* Cards are probed in parallel, alsa-util serializes the few calls
+     * that touch alsa-lib's global configuration */
+    pa_alsa_profile_set_probe(u->profile_set, u->device_id, &m->core->default_sample_spec, m->core->default_n_fragments, m->core->default_fragment_size_msec);
+}
+
+static int card_init_cb(pa_module *m, void *userdata) {
     pa_card_new_data data;
+    struct userdata *u = userdata;
     pa_modargs *ma;
-    pa_bool_t ignore_dB = FALSE;
-    struct userdata *u;
-    pa_reserve_wrapper *reserve = NULL;
     const char *description;
     const char *profile = NULL;
-    char *fn = NULL;
     pa_bool_t namereg_fail = FALSE;
 
-    pa_alsa_refcnt_inc();
-
     pa_assert(m);
+    pa_assert(u);
 
-    if (!(ma = pa_modargs_new(m->argument, valid_modargs))) {
-        pa_log("Failed to parse module arguments");
-        goto fail;
-    }
-
-    if (pa_modargs_get_value_boolean(ma, "ignore_dB", &ignore_dB) < 0) {
-        pa_log("Failed to parse ignore_dB argument.");
-        goto fail;
-    }
-
-    m->userdata = u = pa_xnew0(struct userdata, 1);
-    u->core = m->core;
-    u->module = m;
-    u->device_id = pa_xstrdup(pa_modargs_get_value(ma, "device_id", DEFAULT_DEVICE_ID));
-    u->modargs = ma;
-
-    if ((u->alsa_card_index = snd_card_get_index(u->device_id)) < 0) {
-        pa_log("Card '%s' doesn't exist: %s", u->device_id, pa_alsa_strerror(u->alsa_card_index));
-        goto fail;
-    }
-
-    if (!pa_in_system_mode()) {
-        char *rname;
-
-        if ((rname = pa_alsa_get_reserve_name(u->device_id))) {
-            reserve = pa_reserve_wrapper_get(m->core, rname);
-            pa_xfree(rname);
-
-            if (!reserve)
-                goto fail;
-        }
-    }
-
-#ifdef HAVE_UDEV
-    fn = pa_udev_get_property(u->alsa_card_index, "PULSE_PROFILE_SET");
-#endif
-
-    if (pa_modargs_get_value(ma, "profile_set", NULL)) {
-        pa_xfree(fn);
-        fn = pa_xstrdup(pa_modargs_get_value(ma, "profile_set", NULL));
-    }
-
-    u->profile_set = pa_alsa_profile_set_new(fn, &u->core->default_channel_map);
-    pa_xfree(fn);
-
-    u->profile_set->ignore_dB = ignore_dB;
-
-    if (!u->profile_set)
-        goto fail;
+    ma = u->modargs;
 
-    pa_alsa_profile_set_probe(u->profile_set, u->device_id, &m->core->default_sample_spec, m->core->default_n_fragments, m->core->default_fragment_size_msec);
     pa_alsa_profile_set_dump(u->profile_set);
 
     pa_card_new_data_init(&data);
@@ -494,13 +465,13 @@ int pa__init(pa_module *m) {
     if (pa_modargs_get_value_boolean(ma, "namereg_fail", &namereg_fail) < 0) {
         pa_log("Failed to parse namereg_fail argument.");
         pa_card_new_data_done(&data);
-        goto fail;
+        return -1;
     }
     data.namereg_fail = namereg_fail;
 
-    if (reserve)
+    if (u->reserve)
         if ((description = pa_proplist_gets(data.proplist, PA_PROP_DEVICE_DESCRIPTION)))
-            pa_reserve_wrapper_set_application_device_name(reserve, description);
+            pa_reserve_wrapper_set_application_device_name(u->reserve, description);
 
     data.profiles = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
     add_profiles(u, data.profiles, data.ports);
@@ -508,7 +479,7 @@ int pa__init(pa_module *m) {
     if (pa_hashmap_isempty(data.profiles)) {
         pa_log("Failed to find a working profile.");
         pa_card_new_data_done(&data);
-        goto fail;
+        return -1;
     }
 
     add_disabled_profile(data.profiles);
@@ -516,7 +487,7 @@ int pa__init(pa_module *m) {
     if (pa_modargs_get_proplist(ma, "card_properties", data.proplist, PA_UPDATE_REPLACE) < 0) {
         pa_log("Invalid properties");
         pa_card_new_data_done(&data);
-        goto fail;
+        return -1;
     }
 
     if ((profile = pa_modargs_get_value(ma, "profile", NULL)))
@@ -526,7 +497,7 @@ int pa__init(pa_module *m) {
     pa_card_new_data_done(&data);
 
     if (!u->card)
-        goto fail;
+        return -1;
 
     u->card->userdata = u;
     u->card->set_profile = card_set_profile;
@@ -534,8 +505,10 @@ int pa__init(pa_module *m) {
     init_profile(u);
     init_jacks(u);
 
-    if (reserve)
-        pa_reserve_wrapper_unref(reserve);
+    if (u->reserve) {
+        pa_reserve_wrapper_unref(u->reserve);
+        u->reserve = NULL;
+    }
 
     if (!pa_hashmap_isempty(u->profile_set->decibel_fixes))
         pa_log_warn("Card %s uses decibel fixes (i.e. overrides the decibel information for some alsa volume elements). "
@@ -546,11 +519,86 @@ int pa__init(pa_module *m) {
                     "PulseAudio version.", u->card->name);
 
     return 0;
+}
 
-fail:
-    if (reserve)
-        pa_reserve_wrapper_unref(reserve);
+int pa__init(pa_module *m) {
+    pa_modargs *ma;
+    pa_bool_t ignore_dB = FALSE;
+    struct userdata *u;
+    char *fn = NULL;
+
+    pa_alsa_refcnt_inc();
+
+    pa_assert(m);
+
+    if (!(ma = pa_modargs_new(m->argument, valid_modargs))) {
+        pa_log("Failed to parse module arguments");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_boolean(ma, "ignore_dB", &ignore_dB) < 0) {
+        pa_log("Failed to parse ignore_dB argument.");
+        goto fail;
+    }
+
+    m->userdata = u = pa_xnew0(struct userdata, 1);
+    u->core = m->core;
+    u->module = m;
+    u->device_id = pa_xstrdup(pa_modargs_get_value(ma, "device_id", DEFAULT_DEVICE_ID));
+    u->modargs = ma;
+
+    if ((u->alsa_card_index = snd_card_get_index(u->device_id)) < 0) {
+        pa_log("Card '%s' doesn't exist: %s", u->device_id, pa_alsa_strerror(u->alsa_card_index));
+        goto fail;
+    }
+
+    if (!pa_in_system_mode()) {
+        char *rname;
+
+        if ((rname = pa_alsa_get_reserve_name(u->device_id))) {
+            u->reserve = pa_reserve_wrapper_get(m->core, rname);
+            pa_xfree(rname);
 
+            if (!u->reserve)
+                goto fail;
+        }
+    }
+
+#ifdef HAVE_UDEV
+    fn = pa_udev_get_property(u->alsa_card_index, "PULSE_PROFILE_SET");
+#endif
+
+    if (pa_modargs_get_value(ma, "profile_set", NULL)) {
+        pa_xfree(fn);
+        fn = pa_xstrdup(pa_modargs_get_value(ma, "profile_set", NULL));
+    }
+
+    u->profile_set = pa_alsa_profile_set_new(fn, &u->core->default_channel_map);
+    pa_xfree(fn);
+
+    u->profile_set->ignore_dB = ignore_dB;
+
+    if (!u->profile_set)
+        goto fail;
+
+    /* Probing opens every PCM device of the card, which may take a
+     * while. If requested let it run in parallel to the loading of
+     * other modules. */
+    if (m->core->parallel_module_init) {
+        if (pa_module_defer_init(m, card_probe_cb, card_init_cb, u) < 0)
+            goto fail;
+
+        return 0;
+    }
+
+    card_probe_cb(m, u);
+
+    if (card_init_cb(m, u) < 0)
+        goto fail;
+
+    return 0;
+
+fail:
     pa__done(m);
 
     return -1;
@@ -565,7 +613,10 @@ int pa__get_n_used(pa_module *m) {
 
     pa_assert(m);
     pa_assert_se(u = m->userdata);
-    pa_assert(u->card);
+
+    /* Deferred initialization not finished yet */
+    if (!u->card)
+        return 0;
 
     PA_IDXSET_FOREACH(sink, u->card->sinks, idx)
         n += pa_sink_linked_by(sink);
@@ -614,6 +665,9 @@ void pa__done(pa_module*m) {
     if (u->profile_set)
         pa_alsa_profile_set_free(u->profile_set);
 
+    if (u->reserve)
+        pa_reserve_wrapper_unref(u->reserve);
+
     pa_xfree(u->device_id);
     pa_xfree(u);
 
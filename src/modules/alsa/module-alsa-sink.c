@@ -60,7 +60,9 @@ PA_MODULE_USAGE(
         "deferred_volume=<Synchronize software and hardware volume changes to avoid momentary jumps?> "
         "deferred_volume_safety_margin=<usec adjustment depending on volume direction> "
         "deferred_volume_extra_delay=<usec adjustment to HW volume changes> "
-        "fixed_latency_range=<disable latency range changes on underrun?>");
+        "fixed_latency_range=<disable latency range changes on underrun?> "
+        "no_rewind=<never rewind, keep buffers at the latency target?> "
+        "predictive_watermark=<size the wakeup watermark from past wakeups?>");
 
 static const char* const valid_modargs[] = {
     "name",
@@ -87,6 +89,8 @@ static const char* const valid_modargs[] = {
     "deferred_volume_safety_margin",
     "deferred_volume_extra_delay",
     "fixed_latency_range",
+    "no_rewind",
+    "predictive_watermark",
     NULL
 };
 
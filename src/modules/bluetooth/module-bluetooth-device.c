@@ -28,6 +28,8 @@
 #include <errno.h>
 #include <linux/sockios.h>
 #include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include <pulse/rtclock.h>
 #include <pulse/sample.h>
@@ -80,7 +82,8 @@ PA_MODULE_USAGE(
         "path=<device object path> "
         "auto_connect=<automatically connect?> "
         "sco_sink=<SCO over PCM sink name> "
-        "sco_source=<SCO over PCM source name>");
+        "sco_source=<SCO over PCM source name> "
+        "fake_transport=<SOCK_SEQPACKET socket to use instead of a BlueZ transport, for testing>");
 
 /* TODO: not close fd when entering suspend mode in a2dp */
 
@@ -100,6 +103,7 @@ static const char* const valid_modargs[] = {
     "auto_connect",
     "sco_sink",
     "sco_source",
+    "fake_transport",
     NULL
 };
 
@@ -187,6 +191,10 @@ struct userdata {
     int stream_write_type;
 
     pa_bool_t filter_added;
+
+    /* Set if we talk to a local socket instead of BlueZ */
+    char *fake_transport;
+    pa_bluetooth_device *fake_device;
 };
 
 enum {
@@ -203,6 +211,19 @@ enum {
 
 #define USE_SCO_OVER_PCM(u) (u->profile == PROFILE_HSP && (u->hsp.sco_sink && u->hsp.sco_source))
 
+/* What BlueZ usually negotiates for A2DP on an EDR link */
+#define FAKE_TRANSPORT_MTU 895
+
+static const a2dp_sbc_t fake_transport_config = {
+    .channel_mode = BT_A2DP_CHANNEL_MODE_JOINT_STEREO,
+    .frequency = BT_SBC_SAMPLING_FREQ_44100,
+    .allocation_method = BT_A2DP_ALLOCATION_LOUDNESS,
+    .subbands = BT_A2DP_SUBBANDS_8,
+    .block_length = BT_A2DP_BLOCK_LENGTH_16,
+    .min_bitpool = MIN_BITPOOL,
+    .max_bitpool = 53
+};
+
 static int init_profile(struct userdata *u);
 
 /* from IO thread */
@@ -315,6 +336,40 @@ static void setup_stream(struct userdata *u) {
                 TRUE);
 }
 
+/* Connects to the socket given as fake_transport. SOCK_SEQPACKET keeps
+ * the packet boundaries just like L2CAP does. */
+static int fake_transport_acquire(const char *path, size_t *imtu, size_t *omtu) {
+    struct sockaddr_un sa;
+    int fd;
+
+    if (strlen(path) >= sizeof(sa.sun_path)) {
+        pa_log("Fake transport path too long: %s", path);
+        return -1;
+    }
+
+    if ((fd = pa_socket_cloexec(AF_UNIX, SOCK_SEQPACKET, 0)) < 0) {
+        pa_log("socket(): %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    pa_strlcpy(sa.sun_path, path, sizeof(sa.sun_path));
+
+    if (connect(fd, (struct sockaddr*) &sa, sizeof(sa)) < 0) {
+        pa_log("Failed to connect to fake transport %s: %s", path, pa_cstrerror(errno));
+        pa_close(fd);
+        return -1;
+    }
+
+    /* Like an L2CAP socket, don't queue more than a few packets */
+    pa_socket_set_sndbuf(fd, 4 * FAKE_TRANSPORT_MTU);
+
+    *imtu = *omtu = FAKE_TRANSPORT_MTU;
+
+    return fd;
+}
+
 static bool bt_transport_is_acquired(struct userdata *u) {
     if (u->accesstype == NULL) {
         pa_assert(u->stream_fd < 0);
@@ -335,9 +390,11 @@ static void bt_transport_release(struct userdata *u) {
 
     pa_log_debug("Releasing transport %s", u->transport);
 
-    t = pa_bluetooth_discovery_get_transport(u->discovery, u->transport);
-    if (t)
-        pa_bluetooth_transport_release(t, accesstype);
+    if (!u->fake_transport) {
+        t = pa_bluetooth_discovery_get_transport(u->discovery, u->transport);
+        if (t)
+            pa_bluetooth_transport_release(t, accesstype);
+    }
 
     pa_xfree(u->accesstype);
     u->accesstype = NULL;
@@ -375,15 +432,20 @@ static int bt_transport_acquire(struct userdata *u, pa_bool_t start) {
 
     pa_log_debug("Acquiring transport %s", u->transport);
 
-    t = pa_bluetooth_discovery_get_transport(u->discovery, u->transport);
-    if (!t) {
-        pa_log("Transport %s no longer available", u->transport);
-        pa_xfree(u->transport);
-        u->transport = NULL;
-        return -1;
+    if (u->fake_transport)
+        u->stream_fd = fake_transport_acquire(u->transport, &u->read_link_mtu, &u->write_link_mtu);
+    else {
+        t = pa_bluetooth_discovery_get_transport(u->discovery, u->transport);
+        if (!t) {
+            pa_log("Transport %s no longer available", u->transport);
+            pa_xfree(u->transport);
+            u->transport = NULL;
+            return -1;
+        }
+
+        u->stream_fd = pa_bluetooth_transport_acquire(t, accesstype, &u->read_link_mtu, &u->write_link_mtu);
     }
 
-    u->stream_fd = pa_bluetooth_transport_acquire(t, accesstype, &u->read_link_mtu, &u->write_link_mtu);
     if (u->stream_fd < 0)
         return -1;
 
@@ -1770,12 +1832,16 @@ static int add_source(struct userdata *u) {
 static void bt_transport_config_a2dp(struct userdata *u) {
     const pa_bluetooth_transport *t;
     struct a2dp_info *a2dp = &u->a2dp;
-    a2dp_sbc_t *config;
+    const a2dp_sbc_t *config;
 
-    t = pa_bluetooth_discovery_get_transport(u->discovery, u->transport);
-    pa_assert(t);
+    if (u->fake_transport)
+        config = &fake_transport_config;
+    else {
+        t = pa_bluetooth_discovery_get_transport(u->discovery, u->transport);
+        pa_assert(t);
 
-    config = (a2dp_sbc_t *) t->config;
+        config = (const a2dp_sbc_t *) t->config;
+    }
 
     u->sample_spec.format = PA_SAMPLE_S16LE;
 
@@ -1887,6 +1953,14 @@ static void bt_transport_config(struct userdata *u) {
         bt_transport_config_a2dp(u);
 }
 
+/* Run from main thread */
+static const pa_bluetooth_device *get_device(struct userdata *u) {
+    if (u->fake_device)
+        return u->fake_device;
+
+    return pa_bluetooth_discovery_get_by_path(u->discovery, u->path);
+}
+
 /* Run from main thread */
 static int setup_bt(struct userdata *u) {
     const pa_bluetooth_device *d;
@@ -1894,7 +1968,7 @@ static int setup_bt(struct userdata *u) {
 
     pa_assert(u);
 
-    if (!(d = pa_bluetooth_discovery_get_by_path(u->discovery, u->path))) {
+    if (!(d = get_device(u))) {
         pa_log_error("Failed to get device object.");
         return -1;
     }
@@ -1907,13 +1981,22 @@ static int setup_bt(struct userdata *u) {
     }
 
     /* check if profile has a transport */
-    t = pa_bluetooth_device_get_transport(d, u->profile);
-    if (t == NULL) {
-        pa_log_warn("Profile has no transport");
-        return -1;
-    }
+    if (u->fake_transport) {
+        if (u->profile != PROFILE_A2DP && u->profile != PROFILE_A2DP_SOURCE) {
+            pa_log_warn("Profile has no transport");
+            return -1;
+        }
 
-    u->transport = pa_xstrdup(t->path);
+        u->transport = pa_xstrdup(u->fake_transport);
+    } else {
+        t = pa_bluetooth_device_get_transport(d, u->profile);
+        if (t == NULL) {
+            pa_log_warn("Profile has no transport");
+            return -1;
+        }
+
+        u->transport = pa_xstrdup(t->path);
+    }
 
     if (bt_transport_acquire(u, FALSE) < 0)
         return -1;
@@ -2105,7 +2188,7 @@ static int card_set_profile(pa_card *c, pa_card_profile *new_profile) {
 
     d = PA_CARD_PROFILE_DATA(new_profile);
 
-    if (!(device = pa_bluetooth_discovery_get_by_path(u->discovery, u->path))) {
+    if (!(device = get_device(u))) {
         pa_log_error("Failed to get device object.");
         return -PA_ERR_IO;
     }
@@ -2458,19 +2541,98 @@ static int setup_dbus(struct userdata *u) {
     return 0;
 }
 
+/* Run from main thread. Stands in for what BlueZ tells us about a
+ * device that does A2DP in both directions. */
+static pa_bluetooth_device *fake_device_new(void) {
+    static const char * const uuids[] = { A2DP_SINK_UUID, A2DP_SOURCE_UUID };
+    pa_bluetooth_device *d;
+    unsigned i;
+
+    d = pa_xnew0(pa_bluetooth_device, 1);
+    d->device_info_valid = 1;
+    d->name = pa_xstrdup("Fake A2DP Device");
+    d->alias = pa_xstrdup(d->name);
+    d->address = pa_xstrdup("00:00:00:00:00:00");
+    d->path = pa_xstrdup("/fake");
+    d->audio_sink_state = d->audio_source_state = PA_BT_AUDIO_STATE_CONNECTED;
+    d->headset_state = d->hfgw_state = PA_BT_AUDIO_STATE_DISCONNECTED;
+
+    PA_LLIST_HEAD_INIT(pa_bluetooth_uuid, d->uuids);
+
+    for (i = 0; i < PA_ELEMENTSOF(uuids); i++) {
+        pa_bluetooth_uuid *uuid;
+
+        uuid = pa_xnew(pa_bluetooth_uuid, 1);
+        uuid->uuid = pa_xstrdup(uuids[i]);
+        PA_LLIST_INIT(pa_bluetooth_uuid, uuid);
+        PA_LLIST_PREPEND(pa_bluetooth_uuid, d->uuids, uuid);
+    }
+
+    return d;
+}
+
+static void fake_device_free(pa_bluetooth_device *d) {
+    pa_bluetooth_uuid *uuid;
+
+    while ((uuid = d->uuids)) {
+        PA_LLIST_REMOVE(pa_bluetooth_uuid, d->uuids, uuid);
+        pa_xfree(uuid->uuid);
+        pa_xfree(uuid);
+    }
+
+    pa_xfree(d->name);
+    pa_xfree(d->alias);
+    pa_xfree(d->address);
+    pa_xfree(d->path);
+    pa_xfree(d);
+}
+
+/* Run from main thread */
+static int add_dbus_matches(struct userdata *u) {
+    DBusError err;
+    char *mike, *speaker;
+    int r;
+
+    dbus_error_init(&err);
+
+    if (!dbus_connection_add_filter(pa_dbus_connection_get(u->connection), filter_cb, u, NULL)) {
+        pa_log_error("Failed to add filter function");
+        return -1;
+    }
+    u->filter_added = TRUE;
+
+    speaker = pa_sprintf_malloc("type='signal',sender='org.bluez',interface='org.bluez.Headset',member='SpeakerGainChanged',path='%s'", u->path);
+    mike = pa_sprintf_malloc("type='signal',sender='org.bluez',interface='org.bluez.Headset',member='MicrophoneGainChanged',path='%s'", u->path);
+
+    if ((r = pa_dbus_add_matches(
+                pa_dbus_connection_get(u->connection), &err,
+                speaker,
+                mike,
+                "type='signal',sender='org.bluez',interface='org.bluez.MediaTransport',member='PropertyChanged'",
+                "type='signal',sender='org.bluez',interface='org.bluez.HandsfreeGateway',member='PropertyChanged'",
+                "type='signal',sender='org.bluez',interface='org.bluez.Headset',member='PropertyChanged'",
+                "type='signal',sender='org.bluez',interface='org.bluez.AudioSource',member='PropertyChanged'",
+                "type='signal',sender='org.bluez',interface='org.bluez.AudioSink',member='PropertyChanged'",
+                NULL)) < 0)
+        pa_log("Failed to add D-Bus matches: %s", err.message);
+
+    pa_xfree(speaker);
+    pa_xfree(mike);
+
+    dbus_error_free(&err);
+
+    return r;
+}
+
 int pa__init(pa_module* m) {
     pa_modargs *ma;
     uint32_t channels;
     struct userdata *u;
     const char *address, *path;
-    DBusError err;
-    char *mike, *speaker;
     const pa_bluetooth_device *device;
 
     pa_assert(m);
 
-    dbus_error_init(&err);
-
     if (!(ma = pa_modargs_new(m->argument, valid_modargs))) {
         pa_log_error("Failed to parse module arguments");
         goto fail;
@@ -2519,14 +2681,22 @@ int pa__init(pa_module* m) {
     address = pa_modargs_get_value(ma, "address", NULL);
     path = pa_modargs_get_value(ma, "path", NULL);
 
-    if (setup_dbus(u) < 0)
-        goto fail;
+    if ((u->fake_transport = pa_xstrdup(pa_modargs_get_value(ma, "fake_transport", NULL)))) {
+        pa_log_info("Using fake transport %s instead of BlueZ.", u->fake_transport);
 
-    if (!(u->discovery = pa_bluetooth_discovery_get(m->core)))
-        goto fail;
+        device = u->fake_device = fake_device_new();
+        u->address = pa_xstrdup(device->address);
+        u->path = pa_xstrdup(device->path);
+    } else {
+        if (setup_dbus(u) < 0)
+            goto fail;
 
-    if (!(device = find_device(u, address, path)))
-        goto fail;
+        if (!(u->discovery = pa_bluetooth_discovery_get(m->core)))
+            goto fail;
+
+        if (!(device = find_device(u, address, path)))
+            goto fail;
+    }
 
     /* Add the card structure. This will also initialize the default profile */
     if (add_card(u, device) < 0)
@@ -2538,35 +2708,8 @@ int pa__init(pa_module* m) {
     u->msg->parent.process_msg = device_process_msg;
     u->msg->card = u->card;
 
-    if (!dbus_connection_add_filter(pa_dbus_connection_get(u->connection), filter_cb, u, NULL)) {
-        pa_log_error("Failed to add filter function");
+    if (u->connection && add_dbus_matches(u) < 0)
         goto fail;
-    }
-    u->filter_added = TRUE;
-
-    speaker = pa_sprintf_malloc("type='signal',sender='org.bluez',interface='org.bluez.Headset',member='SpeakerGainChanged',path='%s'", u->path);
-    mike = pa_sprintf_malloc("type='signal',sender='org.bluez',interface='org.bluez.Headset',member='MicrophoneGainChanged',path='%s'", u->path);
-
-    if (pa_dbus_add_matches(
-                pa_dbus_connection_get(u->connection), &err,
-                speaker,
-                mike,
-                "type='signal',sender='org.bluez',interface='org.bluez.MediaTransport',member='PropertyChanged'",
-                "type='signal',sender='org.bluez',interface='org.bluez.HandsfreeGateway',member='PropertyChanged'",
-                "type='signal',sender='org.bluez',interface='org.bluez.Headset',member='PropertyChanged'",
-                "type='signal',sender='org.bluez',interface='org.bluez.AudioSource',member='PropertyChanged'",
-                "type='signal',sender='org.bluez',interface='org.bluez.AudioSink',member='PropertyChanged'",
-                NULL) < 0) {
-
-        pa_xfree(speaker);
-        pa_xfree(mike);
-
-        pa_log("Failed to add D-Bus matches: %s", err.message);
-        goto fail;
-    }
-
-    pa_xfree(speaker);
-    pa_xfree(mike);
 
     if (u->profile != PROFILE_OFF)
         if (init_profile(u) < 0)
@@ -2582,8 +2725,6 @@ fail:
 
     pa__done(m);
 
-    dbus_error_free(&err);
-
     return -1;
 }
 
@@ -2667,5 +2808,10 @@ void pa__done(pa_module *m) {
     if (u->discovery)
         pa_bluetooth_discovery_unref(u->discovery);
 
+    if (u->fake_device)
+        fake_device_free(u->fake_device);
+
+    pa_xfree(u->fake_transport);
+
     pa_xfree(u);
 }
@@ -33,6 +33,7 @@
 
 #include "sbc_primitives.h"
 #include "sbc_primitives_mmx.h"
+#include "sbc_primitives_sse.h"
 #include "sbc_primitives_iwmmxt.h"
 #include "sbc_primitives_neon.h"
 #include "sbc_primitives_armv6.h"
@@ -517,9 +518,9 @@ static int sbc_calc_scalefactors_j(
 }
 
 /*
- * Detect CPU features and setup function pointers
+ * Setup function pointers for the generic C implementation
  */
-void sbc_init_primitives(struct sbc_encoder_state *state)
+void sbc_init_primitives_generic(struct sbc_encoder_state *state)
 {
 	/* Default implementation for analyze functions */
 	state->sbc_analyze_4b_4s = sbc_analyze_4b_4s_simd;
@@ -535,11 +536,22 @@ void sbc_init_primitives(struct sbc_encoder_state *state)
 	state->sbc_calc_scalefactors = sbc_calc_scalefactors;
 	state->sbc_calc_scalefactors_j = sbc_calc_scalefactors_j;
 	state->implementation_info = "Generic C";
+}
+
+/*
+ * Detect CPU features and setup function pointers
+ */
+void sbc_init_primitives(struct sbc_encoder_state *state)
+{
+	sbc_init_primitives_generic(state);
 
 	/* X86/AMD64 optimizations */
 #ifdef SBC_BUILD_WITH_MMX_SUPPORT
 	sbc_init_primitives_mmx(state);
 #endif
+#ifdef SBC_BUILD_WITH_SSE_SUPPORT
+	sbc_init_primitives_sse(state);
+#endif
 
 	/* ARM optimizations */
 #ifdef SBC_BUILD_WITH_ARMV6_SUPPORT
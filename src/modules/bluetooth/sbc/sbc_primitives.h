@@ -77,4 +77,10 @@ struct sbc_encoder_state {
  */
 void sbc_init_primitives(struct sbc_encoder_state *encoder_state);
 
+/*
+ * Initialize the pointers with the generic C implementation only. This is
+ * the reference the optimized variants have to match bit for bit.
+ */
+void sbc_init_primitives_generic(struct sbc_encoder_state *encoder_state);
+
 #endif
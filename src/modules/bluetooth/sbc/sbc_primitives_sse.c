@@ -0,0 +1,341 @@
+/*
+ *
+ *  Bluetooth low-complexity, subband codec (SBC) library
+ *
+ *  Copyright (C) 2008-2010  Nokia Corporation
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *  Copyright (C) 2004-2005  Henryk Ploetz <henryk@ploetzli.ch>
+ *  Copyright (C) 2005-2006  Brad Midgley <bmidgley@xmission.com>
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdint.h>
+#include <limits.h>
+#include "sbc.h"
+#include "sbc_math.h"
+#include "sbc_tables.h"
+
+#include "sbc_primitives_sse.h"
+
+/*
+ * SSE2 and AVX2 optimizations
+ */
+
+#ifdef SBC_BUILD_WITH_SSE_SUPPORT
+
+#include <emmintrin.h>
+
+static inline void sbc_analyze_four_sse(const int16_t *in, int32_t *out,
+					const FIXED_T *consts)
+{
+	const __m128i *c = (const __m128i *) consts;
+	__m128i t1, t2;
+	int hop;
+
+	/* rounding coefficient */
+	t1 = _mm_set1_epi32(1 << (SBC_PROTO_FIXED4_SCALE - 1));
+
+	/* low pass polyphase filter */
+	for (hop = 0; hop < 5; hop++)
+		t1 = _mm_add_epi32(t1, _mm_madd_epi16(
+			_mm_loadu_si128((const __m128i *) (in + hop * 8)),
+			_mm_load_si128(c + hop)));
+
+	/* scaling */
+	t1 = _mm_srai_epi32(t1, SBC_PROTO_FIXED4_SCALE);
+	t2 = _mm_packs_epi32(t1, t1);
+
+	/* do the cos transform, one pair of inputs at a time */
+	t1 = _mm_add_epi32(
+		_mm_madd_epi16(_mm_shuffle_epi32(t2, 0x00),
+						_mm_load_si128(c + 5)),
+		_mm_madd_epi16(_mm_shuffle_epi32(t2, 0x55),
+						_mm_load_si128(c + 6)));
+
+	_mm_storeu_si128((__m128i *) out, t1);
+}
+
+static inline void sbc_analyze_eight_sse(const int16_t *in, int32_t *out,
+							const FIXED_T *consts)
+{
+	const __m128i *c = (const __m128i *) consts;
+	__m128i lo, hi, t2, p;
+	int hop;
+
+	/* rounding coefficient */
+	lo = hi = _mm_set1_epi32(1 << (SBC_PROTO_FIXED8_SCALE - 1));
+
+	/* low pass polyphase filter */
+	for (hop = 0; hop < 5; hop++) {
+		lo = _mm_add_epi32(lo, _mm_madd_epi16(
+			_mm_loadu_si128((const __m128i *) (in + hop * 16)),
+			_mm_load_si128(c + hop * 2)));
+		hi = _mm_add_epi32(hi, _mm_madd_epi16(
+			_mm_loadu_si128((const __m128i *) (in + hop * 16 + 8)),
+			_mm_load_si128(c + hop * 2 + 1)));
+	}
+
+	/* scaling */
+	lo = _mm_srai_epi32(lo, SBC_PROTO_FIXED8_SCALE);
+	hi = _mm_srai_epi32(hi, SBC_PROTO_FIXED8_SCALE);
+	t2 = _mm_packs_epi32(lo, hi);
+
+	/* do the cos transform, one pair of inputs at a time */
+	p = _mm_shuffle_epi32(t2, 0x00);
+	lo = _mm_madd_epi16(p, _mm_load_si128(c + 10));
+	hi = _mm_madd_epi16(p, _mm_load_si128(c + 11));
+
+	p = _mm_shuffle_epi32(t2, 0x55);
+	lo = _mm_add_epi32(lo, _mm_madd_epi16(p, _mm_load_si128(c + 12)));
+	hi = _mm_add_epi32(hi, _mm_madd_epi16(p, _mm_load_si128(c + 13)));
+
+	p = _mm_shuffle_epi32(t2, 0xaa);
+	lo = _mm_add_epi32(lo, _mm_madd_epi16(p, _mm_load_si128(c + 14)));
+	hi = _mm_add_epi32(hi, _mm_madd_epi16(p, _mm_load_si128(c + 15)));
+
+	p = _mm_shuffle_epi32(t2, 0xff);
+	lo = _mm_add_epi32(lo, _mm_madd_epi16(p, _mm_load_si128(c + 16)));
+	hi = _mm_add_epi32(hi, _mm_madd_epi16(p, _mm_load_si128(c + 17)));
+
+	_mm_storeu_si128((__m128i *) out, lo);
+	_mm_storeu_si128((__m128i *) (out + 4), hi);
+}
+
+static void sbc_analyze_4b_4s_sse(int16_t *x, int32_t *out, int out_stride)
+{
+	/* Analyze blocks */
+	sbc_analyze_four_sse(x + 12, out, analysis_consts_fixed4_simd_odd);
+	out += out_stride;
+	sbc_analyze_four_sse(x + 8, out, analysis_consts_fixed4_simd_even);
+	out += out_stride;
+	sbc_analyze_four_sse(x + 4, out, analysis_consts_fixed4_simd_odd);
+	out += out_stride;
+	sbc_analyze_four_sse(x + 0, out, analysis_consts_fixed4_simd_even);
+}
+
+static void sbc_analyze_4b_8s_sse(int16_t *x, int32_t *out, int out_stride)
+{
+	/* Analyze blocks */
+	sbc_analyze_eight_sse(x + 24, out, analysis_consts_fixed8_simd_odd);
+	out += out_stride;
+	sbc_analyze_eight_sse(x + 16, out, analysis_consts_fixed8_simd_even);
+	out += out_stride;
+	sbc_analyze_eight_sse(x + 8, out, analysis_consts_fixed8_simd_odd);
+	out += out_stride;
+	sbc_analyze_eight_sse(x + 0, out, analysis_consts_fixed8_simd_even);
+}
+
+/*
+ * Maps each sample to "abs(x) - 1", or 0 for a zero sample, which is
+ * what gets OR-ed together to find the scale factor. Same trick as in
+ * the MMX code: x - 1 for positive values, ~x for negative ones.
+ */
+static inline __m128i sbc_scalefactor_bits_sse(__m128i x)
+{
+	__m128i zero = _mm_setzero_si128();
+
+	x = _mm_add_epi32(x, _mm_cmpgt_epi32(x, zero));
+	return _mm_xor_si128(x, _mm_cmpgt_epi32(zero, x));
+}
+
+static inline void sbc_store_scalefactors_sse(__m128i x,
+						uint32_t *scale_factor)
+{
+	uint32_t SBC_ALIGNED t[4];
+	int i;
+
+	_mm_store_si128((__m128i *) t, x);
+	for (i = 0; i < 4; i++)
+		scale_factor[i] = (31 - SCALE_OUT_BITS) - __builtin_clz(t[i]);
+}
+
+static void sbc_calc_scalefactors_sse(
+	int32_t sb_sample_f[16][2][8],
+	uint32_t scale_factor[2][8],
+	int blocks, int channels, int subbands)
+{
+	int ch, sb, blk;
+
+	for (ch = 0; ch < channels; ch++) {
+		for (sb = 0; sb < subbands; sb += 4) {
+			__m128i x = _mm_set1_epi32(1 << SCALE_OUT_BITS);
+
+			for (blk = 0; blk < blocks; blk++)
+				x = _mm_or_si128(x, sbc_scalefactor_bits_sse(
+					_mm_loadu_si128((const __m128i *)
+						&sb_sample_f[blk][ch][sb])));
+
+			sbc_store_scalefactors_sse(x, &scale_factor[ch][sb]);
+		}
+	}
+}
+
+static int sbc_calc_scalefactors_j_sse(
+	int32_t sb_sample_f[16][2][8],
+	uint32_t scale_factor[2][8],
+	int blocks, int subbands)
+{
+	uint32_t scale_factor_j[2][8];
+	int blk, sb, joint = 0;
+
+	/* scale factors of both the separate and the joint stereo samples
+	 * of four subbands at a time */
+	for (sb = 0; sb < subbands; sb += 4) {
+		__m128i x0, x1, y0, y1;
+
+		x0 = x1 = y0 = y1 = _mm_set1_epi32(1 << SCALE_OUT_BITS);
+
+		for (blk = 0; blk < blocks; blk++) {
+			__m128i l = _mm_loadu_si128((const __m128i *)
+						&sb_sample_f[blk][0][sb]);
+			__m128i r = _mm_loadu_si128((const __m128i *)
+						&sb_sample_f[blk][1][sb]);
+
+			x0 = _mm_or_si128(x0, sbc_scalefactor_bits_sse(l));
+			x1 = _mm_or_si128(x1, sbc_scalefactor_bits_sse(r));
+
+			l = _mm_srai_epi32(l, 1);
+			r = _mm_srai_epi32(r, 1);
+
+			y0 = _mm_or_si128(y0, sbc_scalefactor_bits_sse(
+						_mm_add_epi32(l, r)));
+			y1 = _mm_or_si128(y1, sbc_scalefactor_bits_sse(
+						_mm_sub_epi32(l, r)));
+		}
+
+		sbc_store_scalefactors_sse(x0, &scale_factor[0][sb]);
+		sbc_store_scalefactors_sse(x1, &scale_factor[1][sb]);
+		sbc_store_scalefactors_sse(y0, &scale_factor_j[0][sb]);
+		sbc_store_scalefactors_sse(y1, &scale_factor_j[1][sb]);
+	}
+
+	/* last subband does not use joint stereo, decide for the rest */
+	for (sb = subbands - 2; sb >= 0; sb--) {
+		if ((scale_factor[0][sb] + scale_factor[1][sb]) <=
+				scale_factor_j[0][sb] + scale_factor_j[1][sb])
+			continue;
+
+		joint |= 1 << (subbands - 1 - sb);
+		scale_factor[0][sb] = scale_factor_j[0][sb];
+		scale_factor[1][sb] = scale_factor_j[1][sb];
+
+		for (blk = 0; blk < blocks; blk++) {
+			int32_t tmp0 = sb_sample_f[blk][0][sb];
+			int32_t tmp1 = sb_sample_f[blk][1][sb];
+
+			sb_sample_f[blk][0][sb] = ASR(tmp0, 1) + ASR(tmp1, 1);
+			sb_sample_f[blk][1][sb] = ASR(tmp0, 1) - ASR(tmp1, 1);
+		}
+	}
+
+	/* bitmask with the information about subbands using joint stereo */
+	return joint;
+}
+
+#ifdef SBC_BUILD_WITH_AVX2_SUPPORT
+
+#include <immintrin.h>
+
+#define SBC_AVX2 __attribute__((target("avx2")))
+
+/* Loads two sets of 8 values into the two 128-bit lanes */
+static SBC_AVX2 inline __m256i sbc_load_2x128_avx2(const FIXED_T *lo,
+							const FIXED_T *hi)
+{
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(
+			_mm_load_si128((const __m128i *) lo)),
+			_mm_load_si128((const __m128i *) hi), 1);
+}
+
+static SBC_AVX2 inline __m256i sbc_loadu_2x128_avx2(const int16_t *lo,
+							const int16_t *hi)
+{
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(
+			_mm_loadu_si128((const __m128i *) lo)),
+			_mm_loadu_si128((const __m128i *) hi), 1);
+}
+
+/* Two blocks of the 4 subbands filter at once, one per 128-bit lane */
+static SBC_AVX2 inline void sbc_analyze_four_2b_avx2(const int16_t *in0,
+			int32_t *out0, const FIXED_T *consts0,
+			const int16_t *in1, int32_t *out1,
+			const FIXED_T *consts1)
+{
+	__m256i t1, t2;
+	int hop;
+
+	/* rounding coefficient */
+	t1 = _mm256_set1_epi32(1 << (SBC_PROTO_FIXED4_SCALE - 1));
+
+	/* low pass polyphase filter */
+	for (hop = 0; hop < 40; hop += 8)
+		t1 = _mm256_add_epi32(t1, _mm256_madd_epi16(
+			sbc_loadu_2x128_avx2(in0 + hop, in1 + hop),
+			sbc_load_2x128_avx2(consts0 + hop, consts1 + hop)));
+
+	/* scaling */
+	t1 = _mm256_srai_epi32(t1, SBC_PROTO_FIXED4_SCALE);
+	t2 = _mm256_packs_epi32(t1, t1);
+
+	/* do the cos transform */
+	t1 = _mm256_add_epi32(
+		_mm256_madd_epi16(_mm256_shuffle_epi32(t2, 0x00),
+			sbc_load_2x128_avx2(consts0 + 40, consts1 + 40)),
+		_mm256_madd_epi16(_mm256_shuffle_epi32(t2, 0x55),
+			sbc_load_2x128_avx2(consts0 + 48, consts1 + 48)));
+
+	_mm_storeu_si128((__m128i *) out0, _mm256_castsi256_si128(t1));
+	_mm_storeu_si128((__m128i *) out1, _mm256_extracti128_si256(t1, 1));
+}
+
+static SBC_AVX2 void sbc_analyze_4b_4s_avx2(int16_t *x, int32_t *out,
+							int out_stride)
+{
+	/* Analyze blocks */
+	sbc_analyze_four_2b_avx2(x + 12, out, analysis_consts_fixed4_simd_odd,
+			x + 8, out + out_stride,
+			analysis_consts_fixed4_simd_even);
+	out += out_stride * 2;
+	sbc_analyze_four_2b_avx2(x + 4, out, analysis_consts_fixed4_simd_odd,
+			x + 0, out + out_stride,
+			analysis_consts_fixed4_simd_even);
+}
+
+#endif
+
+void sbc_init_primitives_sse(struct sbc_encoder_state *state)
+{
+	/* SSE2 is part of the x86-64 baseline, no need to check for it */
+	state->sbc_analyze_4b_4s = sbc_analyze_4b_4s_sse;
+	state->sbc_analyze_4b_8s = sbc_analyze_4b_8s_sse;
+	state->sbc_calc_scalefactors = sbc_calc_scalefactors_sse;
+	state->sbc_calc_scalefactors_j = sbc_calc_scalefactors_j_sse;
+	state->implementation_info = "SSE2";
+
+#ifdef SBC_BUILD_WITH_AVX2_SUPPORT
+	__builtin_cpu_init();
+	/* Only the 4 subbands filter gains from processing two blocks per
+	 * register, for 8 subbands the lane shuffling eats up the benefit */
+	if (__builtin_cpu_supports("avx2")) {
+		state->sbc_analyze_4b_4s = sbc_analyze_4b_4s_avx2;
+		state->implementation_info = "SSE2+AVX2";
+	}
+#endif
+}
+
+#endif
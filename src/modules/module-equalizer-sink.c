@@ -46,6 +46,7 @@
 #include <fftw3.h>
 
 #include <pulse/xmalloc.h>
+#include <pulse/rtclock.h>
 #include <pulse/timeval.h>
 
 #include <pulsecore/core-rtclock.h>
@@ -82,10 +83,12 @@ PA_MODULE_USAGE(
           "channel_map=<channel map> "
           "autoloaded=<set if this module is being loaded automatically> "
           "use_volume_sharing=<yes or no> "
+          "low_latency=<filter in 5ms blocks with a partitioned convolution? yes or no> "
          ));
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 #define DEFAULT_AUTOLOADED FALSE
+#define PARTITION_USEC (5*PA_USEC_PER_MSEC)
 
 struct userdata {
     pa_module *module;
@@ -124,6 +127,32 @@ struct userdata {
     pa_memblockq *output_q;
     pa_bool_t first_iteration;
 
+    //low_latency mode: uniformly partitioned overlap-save convolution
+    //with a minimum phase FIR designed from H, instead of the STFT above
+    size_t partition_size;//B, the block size, 0 if not used
+    size_t n_partitions;
+    size_t partition_stride;//B+1 bins, rounded up to keep every partition aligned
+    size_t filter_length;//n_partitions * B
+    float **partition_input;//last 2B input samples of each channel
+    fftwf_complex **fdl;//frequency domain delay line, n_partitions input spectra per channel
+    size_t fdl_pos;
+    float *partition_time, *partition_output;
+    fftwf_complex *partition_accum;
+    fftwf_plan partition_forward_plan, partition_inverse_plan;
+    fftwf_complex ***Ps;//thread updatable copies of the partitioned filters
+    unsigned **P_generation;
+    pa_aupdate **a_P;
+    fftwf_complex **P_current;//what the I/O thread filters with right now
+    unsigned *P_current_generation;
+    unsigned partition_generation;
+    float *design_time, *design_partition;//main thread scratch
+    fftwf_complex *design_spectrum;
+
+    //CPU time spent filtering per second of audio, for D-Bus
+    pa_usec_t processing_time;
+    size_t processing_samples;
+    pa_atomic_t processing_cost;
+
     pa_dbus_protocol *dbus_protocol;
     char *dbus_path;
 
@@ -141,6 +170,7 @@ static const char* const valid_modargs[] = {
     "channel_map",
     "autoloaded",
     "use_volume_sharing",
+    "low_latency",
     NULL
 };
 
@@ -589,6 +619,252 @@ static void input_buffer(struct userdata *u, pa_memchunk *in){
     pa_memblock_release(in->memblock);
 }
 
+/* Called from main context. Turns the magnitude response of a channel
+ * into a minimum phase FIR filter, via the folded real cepstrum, and
+ * splits that into the partitions the I/O thread convolves with. */
+static void design_partitions(struct userdata *u, size_t c){
+    const size_t N = u->fft_size, B = u->partition_size;
+    float *t = u->design_time;
+    fftwf_complex *s = u->design_spectrum;
+    unsigned a_i, b_i;
+    float X, fade;
+    size_t fade_length;
+    fftwf_complex *P;
+
+    a_i = pa_aupdate_read_begin(u->a_H[c]);
+    X = u->Xs[c][a_i];
+    for(size_t k = 0; k < FILTER_SIZE(u); ++k){
+        /* H has the fft gain divided out already, see fix_filter() */
+        s[k][0] = logf(PA_MAX(fabsf(X * u->Hs[c][a_i][k] * N), 1e-6f));
+        s[k][1] = 0;
+    }
+    pa_aupdate_read_end(u->a_H[c]);
+
+    /* log magnitude -> real cepstrum, folded onto the positive quefrencies */
+    fftwf_execute_dft_c2r(u->inverse_plan, s, t);
+    t[0] /= N;
+    for(size_t n = 1; n < N / 2; ++n)
+        t[n] *= 2.0f / N;
+    t[N / 2] /= N;
+    memset(t + N / 2 + 1, 0, (N / 2 - 1) * sizeof(float));
+
+    /* ... and back to the minimum phase spectrum */
+    fftwf_execute_dft_r2c(u->forward_plan, t, s);
+    for(size_t k = 0; k < FILTER_SIZE(u); ++k){
+        float m = expf(s[k][0]), phi = s[k][1];
+        s[k][0] = m * cosf(phi);
+        s[k][1] = m * sinf(phi);
+    }
+    fftwf_execute_dft_c2r(u->inverse_plan, s, t);
+
+    /* Fade out the tail we cut off. The scaling takes care of the gain
+     * of both this transform and the overlap-save one. */
+    fade_length = u->filter_length / 4;
+    for(size_t n = 0; n < u->filter_length; ++n){
+        fade = n < u->filter_length - fade_length ? 1.0f :
+            (float) (0.5 * (1 + cos(M_PI * (n - (u->filter_length - fade_length)) / fade_length)));
+        t[n] *= fade / (N * 2 * B);
+    }
+
+    b_i = pa_aupdate_write_begin(u->a_P[c]);
+    P = u->Ps[c][b_i];
+    for(size_t p = 0; p < u->n_partitions; ++p){
+        memcpy(u->design_partition, t + p * B, B * sizeof(float));
+        memset(u->design_partition + B, 0, B * sizeof(float));
+        fftwf_execute_dft_r2c(u->partition_forward_plan, u->design_partition, P + p * u->partition_stride);
+    }
+    u->P_generation[c][b_i] = ++u->partition_generation;
+    pa_aupdate_write_end(u->a_P[c]);
+}
+
+/* Called from main context after the filter of a channel, or of all of
+ * them if channel == u->channels, was changed */
+static void filter_changed(struct userdata *u, size_t channel){
+    if(!u->partition_size)
+        return;
+
+    if(channel == u->channels){
+        for(size_t c = 0; c < u->channels; ++c)
+            design_partitions(u, c);
+    }else
+        design_partitions(u, channel);
+}
+
+/* Called from I/O thread context */
+static void convolve(struct userdata *u, size_t c, const fftwf_complex *P, float *dst){
+    const size_t B = u->partition_size;
+    fftwf_complex * restrict acc = u->partition_accum;
+
+    memset(acc, 0, (B + 1) * sizeof(fftwf_complex));
+
+    /* the newest input spectrum meets the first partition of the
+     * filter, the oldest one the last */
+    for(size_t p = 0; p < u->n_partitions; ++p){
+        size_t slot = (u->fdl_pos + u->n_partitions - p) % u->n_partitions;
+        const fftwf_complex * restrict x = u->fdl[c] + slot * u->partition_stride;
+        const fftwf_complex * restrict h = P + p * u->partition_stride;
+
+        for(size_t k = 0; k < B + 1; ++k){
+            acc[k][0] += x[k][0] * h[k][0] - x[k][1] * h[k][1];
+            acc[k][1] += x[k][0] * h[k][1] + x[k][1] * h[k][0];
+        }
+    }
+
+    fftwf_execute_dft_c2r(u->partition_inverse_plan, acc, u->partition_time);
+
+    /* overlap-save: the first half is wrapped around, the second is ours */
+    memcpy(dst, u->partition_time + B, B * sizeof(float));
+}
+
+/* Called from I/O thread context. Filters the block of partition_size
+ * samples at the end of each partition_input and writes it to dst. */
+static void process_partition(struct userdata *u, float *dst){
+    const size_t B = u->partition_size;
+    size_t fs = pa_frame_size(&u->sink->sample_spec);
+
+    u->fdl_pos = (u->fdl_pos + 1) % u->n_partitions;
+
+    for(size_t c = 0; c < u->channels; ++c){
+        unsigned a_i;
+
+        fftwf_execute_dft_r2c(u->partition_forward_plan, u->partition_input[c], u->fdl[c] + u->fdl_pos * u->partition_stride);
+
+        convolve(u, c, u->P_current[c], u->partition_output);
+
+        a_i = pa_aupdate_read_begin(u->a_P[c]);
+        if(u->P_generation[c][a_i] != u->P_current_generation[c]){
+            float *y = u->partition_output, *y_new = u->partition_output + B;
+
+            /* the filter was changed, cross fade to the new one over
+             * this block instead of switching with a click */
+            convolve(u, c, u->Ps[c][a_i], y_new);
+            for(size_t j = 0; j < B; ++j){
+                float g = (float) (j + 1) / B;
+                y[j] = (1.0f - g) * y[j] + g * y_new[j];
+            }
+
+            memcpy(u->P_current[c], u->Ps[c][a_i], u->n_partitions * u->partition_stride * sizeof(fftwf_complex));
+            u->P_current_generation[c] = u->P_generation[c][a_i];
+        }
+        pa_aupdate_read_end(u->a_P[c]);
+
+        pa_sample_clamp(PA_SAMPLE_FLOAT32NE, dst + c, fs, u->partition_output, sizeof(float), B);
+
+        memmove(u->partition_input[c], u->partition_input[c] + B, B * sizeof(float));
+    }
+}
+
+/* Called from I/O thread context. Reads the next partition_size
+ * samples of input into the end of each partition_input. */
+static void gather_partition(struct userdata *u){
+    const size_t B = u->partition_size;
+    size_t fs = pa_frame_size(&u->sink->sample_spec);
+    size_t mbs = pa_mempool_block_size_max(u->sink->core->mempool);
+    size_t gathered = 0;
+
+    while(gathered < B){
+        pa_memchunk tchunk;
+        float *src;
+        size_t samples;
+
+        while(pa_memblockq_peek(u->input_q, &tchunk) < 0){
+            pa_sink_render_full(u->sink, PA_MIN((B - gathered) * fs, mbs), &tchunk);
+            pa_memblockq_push(u->input_q, &tchunk);
+            pa_memblock_unref(tchunk.memblock);
+        }
+
+        samples = PA_MIN(B - gathered, tchunk.length / fs);
+        pa_memblockq_drop(u->input_q, samples * fs);
+
+        src = (float*) ((uint8_t*) pa_memblock_acquire(tchunk.memblock) + tchunk.index);
+        for(size_t c = 0; c < u->channels; ++c)
+            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, u->partition_input[c] + B + gathered, sizeof(float), src + c, fs, samples);
+        pa_memblock_release(tchunk.memblock);
+        pa_memblock_unref(tchunk.memblock);
+
+        gathered += samples;
+    }
+}
+
+/* How much input before the read index the partitions are built from */
+static size_t partition_history(struct userdata *u){
+    return (u->n_partitions + 1) * u->partition_size * pa_frame_size(&u->sink->sample_spec);
+}
+
+/* Called from I/O thread context. After a rewind the partitions still
+ * hold input that is going to be filtered again. They are built anew
+ * from the input right before the new read index, which input_q keeps
+ * around for this, the way the sink warms its stages up again. The
+ * output of that is not needed, so nothing is convolved. */
+static void rebuild_partitions(struct userdata *u){
+    const size_t B = u->partition_size;
+
+    pa_memblockq_rewind(u->input_q, partition_history(u));
+
+    /* The first block only goes into the first half of the overlap */
+    for(size_t n = 0; n <= u->n_partitions; ++n){
+        gather_partition(u);
+
+        if(n > 0)
+            u->fdl_pos = (u->fdl_pos + 1) % u->n_partitions;
+
+        for(size_t c = 0; c < u->channels; ++c){
+            if(n > 0)
+                fftwf_execute_dft_r2c(u->partition_forward_plan, u->partition_input[c], u->fdl[c] + u->fdl_pos * u->partition_stride);
+
+            memmove(u->partition_input[c], u->partition_input[c] + B, B * sizeof(float));
+        }
+    }
+}
+
+/* Called from I/O thread context */
+static void account_processing_time(struct userdata *u, pa_usec_t elapsed, size_t samples){
+    u->processing_time += elapsed;
+    u->processing_samples += samples;
+
+    if(u->processing_samples >= u->sink->sample_spec.rate){
+        pa_atomic_store(&u->processing_cost, (int) (u->processing_time * u->sink->sample_spec.rate / u->processing_samples));
+        u->processing_time = 0;
+        u->processing_samples = 0;
+    }
+}
+
+/* Called from I/O thread context */
+static int partitioned_pop(struct userdata *u, size_t nbytes, pa_memchunk *chunk){
+    const size_t B = u->partition_size;
+    size_t fs, mbs, n_blocks;
+    pa_usec_t t;
+    float *dst;
+
+    fs = pa_frame_size(&u->sink->sample_spec);
+    mbs = pa_mempool_block_size_max(u->sink->core->mempool);
+
+    /* As many whole blocks as asked for, but at least one, and no more
+     * than fit into a memblock */
+    n_blocks = PA_MIN((nbytes / fs + B - 1) / B, mbs / (B * fs));
+    n_blocks = PA_MAX(n_blocks, 1u);
+
+    /* Hmm, process any rewind request that might be queued up */
+    pa_sink_process_rewind(u->sink, 0);
+
+    chunk->index = 0;
+    chunk->length = n_blocks * B * fs;
+    chunk->memblock = pa_memblock_new(u->sink->core->mempool, chunk->length);
+    dst = pa_memblock_acquire(chunk->memblock);
+
+    for(size_t n = 0; n < n_blocks; ++n){
+        gather_partition(u);
+
+        t = pa_rtclock_now();
+        process_partition(u, dst + n * B * u->channels);
+        account_processing_time(u, pa_rtclock_now() - t, B);
+    }
+
+    pa_memblock_release(chunk->memblock);
+
+    return 0;
+}
+
 /* Called from I/O thread context */
 static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
     struct userdata *u;
@@ -596,12 +872,16 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     size_t mbs;
     //struct timeval start, end;
     pa_memchunk tchunk;
+    pa_usec_t t;
 
     pa_sink_input_assert_ref(i);
     pa_assert_se(u = i->userdata);
     pa_assert(chunk);
     pa_assert(u->sink);
 
+    if(u->partition_size)
+        return partitioned_pop(u, nbytes, chunk);
+
     /* FIXME: Please clean this up. I see more commented code lines
      * than uncommented code lines. I am sorry, but I am too dumb to
      * understand this. */
@@ -667,7 +947,9 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     pa_assert(u->R < u->window_size);
     //pa_rtclock_get(&start);
     /* process a block */
+    t = pa_rtclock_now();
     process_samples(u);
+    account_processing_time(u, pa_rtclock_now() - t, u->output_buffer_length / fs);
     //pa_rtclock_get(&end);
     //pa_log_debug("Took %0.6f seconds to process", (double) pa_timeval_diff(&end, &start) / PA_USEC_PER_SEC);
 END:
@@ -748,6 +1030,11 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
 
     pa_sink_process_rewind(u->sink, amount);
     pa_memblockq_rewind(u->input_q, nbytes);
+
+    /* Whatever was rewound gets filtered again, so the partitions must
+     * not still remember it */
+    if(u->partition_size && nbytes > 0)
+        rebuild_partitions(u);
 }
 
 /* Called from I/O thread context */
@@ -757,7 +1044,8 @@ static void sink_input_update_max_rewind_cb(pa_sink_input *i, size_t nbytes) {
     pa_sink_input_assert_ref(i);
     pa_assert_se(u = i->userdata);
 
-    pa_memblockq_set_maxrewind(u->input_q, nbytes);
+    /* The partitions are rebuilt from the input before the rewind */
+    pa_memblockq_set_maxrewind(u->input_q, nbytes + (u->partition_size ? partition_history(u) : 0));
     pa_sink_set_max_rewind_within_thread(u->sink, nbytes);
 }
 
@@ -770,7 +1058,7 @@ static void sink_input_update_max_request_cb(pa_sink_input *i, size_t nbytes) {
     pa_assert_se(u = i->userdata);
 
     fs = pa_frame_size(&u->sink_input->sample_spec);
-    pa_sink_set_max_request_within_thread(u->sink, PA_ROUND_UP(nbytes / fs, u->R) * fs);
+    pa_sink_set_max_request_within_thread(u->sink, PA_ROUND_UP(nbytes / fs, u->partition_size ? u->partition_size : u->R) * fs);
 }
 
 /* Called from I/O thread context */
@@ -819,8 +1107,12 @@ static void sink_input_attach_cb(pa_sink_input *i) {
 
     fs = pa_frame_size(&u->sink_input->sample_spec);
     /* set buffer size to max request, no overlap copy */
-    max_request = PA_ROUND_UP(pa_sink_input_get_max_request(u->sink_input) / fs, u->R);
-    max_request = PA_MAX(max_request, u->window_size);
+    if(u->partition_size)
+        max_request = PA_ROUND_UP(pa_sink_input_get_max_request(u->sink_input) / fs, u->partition_size);
+    else{
+        max_request = PA_ROUND_UP(pa_sink_input_get_max_request(u->sink_input) / fs, u->R);
+        max_request = PA_MAX(max_request, u->window_size);
+    }
 
     pa_sink_set_max_request_within_thread(u->sink, max_request * fs);
     pa_sink_set_max_rewind_within_thread(u->sink, pa_sink_input_get_max_rewind(i));
@@ -992,6 +1284,7 @@ static const char* load_profile(struct userdata *u, size_t channel, char *name){
             memcpy(u->Hs[channel][a_i], profile + 1, FILTER_SIZE(u) * sizeof(float));
             fix_filter(u->Hs[channel][a_i], u->fft_size);
             pa_aupdate_write_end(u->a_H[channel]);
+            filter_changed(u, channel);
             pa_xfree(u->base_profiles[channel]);
             u->base_profiles[channel] = pa_xstrdup(name);
         }else{
@@ -1033,6 +1326,7 @@ static void load_state(struct userdata *u){
                 memcpy(u->Hs[c][a_i], H, FILTER_SIZE(u) * sizeof(float));
                 pa_aupdate_write_end(u->a_H[c]);
             }
+            filter_changed(u, u->channels);
             unpack(((char *)value.data) + FILTER_STATE_SIZE(u) * sizeof(float), value.size - FILTER_STATE_SIZE(u) * sizeof(float), &names, &n_profs);
             n_profs = PA_MIN(n_profs, u->channels);
             for(size_t c = 0; c < n_profs; ++c){
@@ -1089,6 +1383,7 @@ int pa__init(pa_module*m) {
     float *H;
     unsigned a_i;
     pa_bool_t use_volume_sharing = TRUE;
+    pa_bool_t low_latency = FALSE;
 
     pa_assert(m);
 
@@ -1117,6 +1412,11 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "low_latency", &low_latency) < 0) {
+        pa_log("low_latency= expects a boolean argument");
+        goto fail;
+    }
+
     u = pa_xnew0(struct userdata, 1);
     u->module = m;
     m->userdata = u;
@@ -1159,6 +1459,45 @@ int pa__init(pa_module*m) {
     hanning_window(u->W, u->window_size);
     u->first_iteration = TRUE;
 
+    if (low_latency) {
+        u->partition_size = pa_usec_to_bytes(PARTITION_USEC, &ss) / pa_frame_size(&ss);
+        /* An eighth of the resolution of H keeps the filter at about
+         * 170ms, enough for the lowest bands */
+        u->n_partitions = (u->fft_size / 8 + u->partition_size - 1) / u->partition_size;
+        u->filter_length = u->n_partitions * u->partition_size;
+        u->partition_stride = PA_ROUND_UP(u->partition_size + 1, v_size);
+        pa_log_debug("partitioned convolution: %zd partitions of %zd samples", u->n_partitions, u->partition_size);
+
+        u->partition_input = pa_xnew0(float *, u->channels);
+        u->fdl = pa_xnew0(fftwf_complex *, u->channels);
+        u->Ps = pa_xnew0(fftwf_complex **, u->channels);
+        u->P_generation = pa_xnew0(unsigned *, u->channels);
+        u->a_P = pa_xnew0(pa_aupdate *, u->channels);
+        u->P_current = pa_xnew0(fftwf_complex *, u->channels);
+        u->P_current_generation = pa_xnew0(unsigned, u->channels);
+
+        for (c = 0; c < u->channels; ++c) {
+            u->partition_input[c] = alloc(2 * u->partition_size, sizeof(float));
+            u->fdl[c] = alloc(u->n_partitions * u->partition_stride, sizeof(fftwf_complex));
+            u->Ps[c] = pa_xnew0(fftwf_complex *, 2);
+            for (i = 0; i < 2; ++i)
+                u->Ps[c][i] = alloc(u->n_partitions * u->partition_stride, sizeof(fftwf_complex));
+            u->P_generation[c] = pa_xnew0(unsigned, 2);
+            u->a_P[c] = pa_aupdate_new();
+            u->P_current[c] = alloc(u->n_partitions * u->partition_stride, sizeof(fftwf_complex));
+        }
+
+        u->partition_time = alloc(2 * u->partition_size, sizeof(float));
+        u->partition_output = alloc(2 * u->partition_size, sizeof(float));
+        u->partition_accum = alloc(u->partition_stride, sizeof(fftwf_complex));
+        u->partition_forward_plan = fftwf_plan_dft_r2c_1d(2 * u->partition_size, u->partition_time, u->partition_accum, FFTW_ESTIMATE);
+        u->partition_inverse_plan = fftwf_plan_dft_c2r_1d(2 * u->partition_size, u->partition_accum, u->partition_time, FFTW_ESTIMATE);
+
+        u->design_time = alloc(u->fft_size, sizeof(float));
+        u->design_spectrum = alloc(FILTER_SIZE(u), sizeof(fftwf_complex));
+        u->design_partition = alloc(2 * u->partition_size, sizeof(float));
+    }
+
     u->base_profiles = pa_xnew0(char *, u->channels);
     for (c = 0; c < u->channels; ++c)
         u->base_profiles[c] = pa_xstrdup("default");
@@ -1269,6 +1608,7 @@ int pa__init(pa_module*m) {
         fix_filter(H, u->fft_size);
         pa_aupdate_write_end(u->a_H[c]);
     }
+    filter_changed(u, u->channels);
 
     /* load old parameters */
     load_state(u);
@@ -1334,6 +1674,34 @@ void pa__done(pa_module*m) {
     pa_memblockq_free(u->output_q);
     pa_memblockq_free(u->input_q);
 
+    if (u->partition_size) {
+        fftwf_destroy_plan(u->partition_inverse_plan);
+        fftwf_destroy_plan(u->partition_forward_plan);
+        for (c = 0; c < u->channels; ++c) {
+            pa_xfree(u->partition_input[c]);
+            pa_xfree(u->fdl[c]);
+            for (size_t i = 0; i < 2; ++i)
+                pa_xfree(u->Ps[c][i]);
+            pa_xfree(u->Ps[c]);
+            pa_xfree(u->P_generation[c]);
+            pa_aupdate_free(u->a_P[c]);
+            pa_xfree(u->P_current[c]);
+        }
+        pa_xfree(u->partition_input);
+        pa_xfree(u->fdl);
+        pa_xfree(u->Ps);
+        pa_xfree(u->P_generation);
+        pa_xfree(u->a_P);
+        pa_xfree(u->P_current);
+        pa_xfree(u->P_current_generation);
+        pa_xfree(u->partition_time);
+        pa_xfree(u->partition_output);
+        pa_xfree(u->partition_accum);
+        pa_xfree(u->design_time);
+        pa_xfree(u->design_spectrum);
+        pa_xfree(u->design_partition);
+    }
+
     fftwf_destroy_plan(u->inverse_plan);
     fftwf_destroy_plan(u->forward_plan);
     pa_xfree(u->output_window);
@@ -1376,6 +1744,8 @@ static void equalizer_get_sample_rate(DBusConnection *conn, DBusMessage *msg, vo
 static void equalizer_get_filter_rate(DBusConnection *conn, DBusMessage *msg, void *_u);
 static void equalizer_get_n_coefs(DBusConnection *conn, DBusMessage *msg, void *_u);
 static void equalizer_get_n_channels(DBusConnection *conn, DBusMessage *msg, void *_u);
+static void equalizer_get_block_size(DBusConnection *conn, DBusMessage *msg, void *_u);
+static void equalizer_get_processing_cost(DBusConnection *conn, DBusMessage *msg, void *_u);
 static void equalizer_get_all(DBusConnection *conn, DBusMessage *msg, void *_u);
 static void equalizer_handle_seed_filter(DBusConnection *conn, DBusMessage *msg, void *_u);
 static void equalizer_handle_get_filter_points(DBusConnection *conn, DBusMessage *msg, void *_u);
@@ -1461,6 +1831,8 @@ enum equalizer_handler_index {
     EQUALIZER_HANDLER_FILTERSAMPLERATE,
     EQUALIZER_HANDLER_N_COEFS,
     EQUALIZER_HANDLER_N_CHANNELS,
+    EQUALIZER_HANDLER_BLOCK_SIZE,
+    EQUALIZER_HANDLER_PROCESSING_COST,
     EQUALIZER_HANDLER_MAX
 };
 
@@ -1550,6 +1922,8 @@ static pa_dbus_property_handler equalizer_handlers[EQUALIZER_HANDLER_MAX]={
     [EQUALIZER_HANDLER_FILTERSAMPLERATE]={.property_name="FilterSampleRate",.type="u",.get_cb=equalizer_get_filter_rate,.set_cb=NULL},
     [EQUALIZER_HANDLER_N_COEFS]={.property_name="NFilterCoefficients",.type="u",.get_cb=equalizer_get_n_coefs,.set_cb=NULL},
     [EQUALIZER_HANDLER_N_CHANNELS]={.property_name="NChannels",.type="u",.get_cb=equalizer_get_n_channels,.set_cb=NULL},
+    [EQUALIZER_HANDLER_BLOCK_SIZE]={.property_name="BlockSize",.type="u",.get_cb=equalizer_get_block_size,.set_cb=NULL},
+    [EQUALIZER_HANDLER_PROCESSING_COST]={.property_name="ProcessingCost",.type="u",.get_cb=equalizer_get_processing_cost,.set_cb=NULL},
 };
 
 enum equalizer_signal_index{
@@ -1849,6 +2223,7 @@ void equalizer_handle_seed_filter(DBusConnection *conn, DBusMessage *msg, void *
         }
     }
     pa_aupdate_write_end(u->a_H[r_channel]);
+    filter_changed(u, channel);
     pa_xfree(ys);
 
 
@@ -2000,6 +2375,7 @@ static void set_filter(struct userdata *u, size_t channel, double *H_, double pr
         }
     }
     pa_aupdate_write_end(u->a_H[r_channel]);
+    filter_changed(u, channel);
 }
 
 void equalizer_handle_set_filter(DBusConnection *conn, DBusMessage *msg, void *_u){
@@ -2173,6 +2549,30 @@ void equalizer_get_n_channels(DBusConnection *conn, DBusMessage *msg, void *_u){
     pa_dbus_send_basic_variant_reply(conn, msg, DBUS_TYPE_UINT32, &channels);
 }
 
+/* The number of samples the filter works on at a time */
+void equalizer_get_block_size(DBusConnection *conn, DBusMessage *msg, void *_u){
+    struct userdata *u;
+    uint32_t block_size;
+    pa_assert_se(u = (struct userdata *) _u);
+    pa_assert(conn);
+    pa_assert(msg);
+
+    block_size = (uint32_t) (u->partition_size ? u->partition_size : u->R);
+    pa_dbus_send_basic_variant_reply(conn, msg, DBUS_TYPE_UINT32, &block_size);
+}
+
+/* Microseconds of CPU time the filter took for the last second of audio */
+void equalizer_get_processing_cost(DBusConnection *conn, DBusMessage *msg, void *_u){
+    struct userdata *u;
+    uint32_t cost;
+    pa_assert_se(u = (struct userdata *) _u);
+    pa_assert(conn);
+    pa_assert(msg);
+
+    cost = (uint32_t) pa_atomic_load(&u->processing_cost);
+    pa_dbus_send_basic_variant_reply(conn, msg, DBUS_TYPE_UINT32, &cost);
+}
+
 void equalizer_get_n_coefs(DBusConnection *conn, DBusMessage *msg, void *_u){
     struct userdata *u;
     uint32_t n_coefs;
@@ -2210,7 +2610,7 @@ void equalizer_get_all(DBusConnection *conn, DBusMessage *msg, void *_u){
     struct userdata *u;
     DBusMessage *reply = NULL;
     DBusMessageIter msg_iter, dict_iter;
-    uint32_t rev, n_coefs, rate, fft_size, channels;
+    uint32_t rev, n_coefs, rate, fft_size, channels, block_size, cost;
 
     pa_assert_se(u = _u);
     pa_assert(msg);
@@ -2220,6 +2620,8 @@ void equalizer_get_all(DBusConnection *conn, DBusMessage *msg, void *_u){
     rate = (uint32_t) u->sink->sample_spec.rate;
     fft_size = (uint32_t) u->fft_size;
     channels = (uint32_t) u->channels;
+    block_size = (uint32_t) (u->partition_size ? u->partition_size : u->R);
+    cost = (uint32_t) pa_atomic_load(&u->processing_cost);
 
     pa_assert_se((reply = dbus_message_new_method_return(msg)));
     dbus_message_iter_init_append(reply, &msg_iter);
@@ -2230,6 +2632,8 @@ void equalizer_get_all(DBusConnection *conn, DBusMessage *msg, void *_u){
     pa_dbus_append_basic_variant_dict_entry(&dict_iter, equalizer_handlers[EQUALIZER_HANDLER_FILTERSAMPLERATE].property_name, DBUS_TYPE_UINT32, &fft_size);
     pa_dbus_append_basic_variant_dict_entry(&dict_iter, equalizer_handlers[EQUALIZER_HANDLER_N_COEFS].property_name, DBUS_TYPE_UINT32, &n_coefs);
     pa_dbus_append_basic_variant_dict_entry(&dict_iter, equalizer_handlers[EQUALIZER_HANDLER_N_CHANNELS].property_name, DBUS_TYPE_UINT32, &channels);
+    pa_dbus_append_basic_variant_dict_entry(&dict_iter, equalizer_handlers[EQUALIZER_HANDLER_BLOCK_SIZE].property_name, DBUS_TYPE_UINT32, &block_size);
+    pa_dbus_append_basic_variant_dict_entry(&dict_iter, equalizer_handlers[EQUALIZER_HANDLER_PROCESSING_COST].property_name, DBUS_TYPE_UINT32, &cost);
 
     pa_assert_se(dbus_message_iter_close_container(&msg_iter, &dict_iter));
     pa_assert_se(dbus_connection_send(conn, reply, NULL));
@@ -28,6 +28,8 @@
 
 #include <math.h>
 
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/i18n.h>
@@ -40,6 +42,7 @@
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/sample-util.h>
 #include <pulsecore/ltdl-helper.h>
+#include <pulsecore/worker-pool.h>
 
 #include "module-ladspa-sink-symdef.h"
 #include "ladspa.h"
@@ -60,9 +63,12 @@ PA_MODULE_USAGE(
       "label=<ladspa plugin label> "
       "control=<comma separated list of input control values> "
       "input_ladspaport_map=<comma separated list of input LADSPA port names> "
-      "output_ladspaport_map=<comma separated list of output LADSPA port names> "));
+      "output_ladspaport_map=<comma separated list of output LADSPA port names> "
+      "stage=<run inside the master sink instead of creating a sink? yes or no> "
+      "threads=<number of threads to run plugin instances on in addition to the sink thread> "));
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
+#define STATS_INTERVAL_USEC (10*PA_USEC_PER_SEC)
 
 /* PLEASE NOTICE: The PortAudio ports and the LADSPA ports are two different concepts.
 They are not related and where possible the names of the LADSPA port variables contains "ladspa" to avoid confusion */
@@ -73,13 +79,34 @@ struct userdata {
     pa_sink *sink;
     pa_sink_input *sink_input;
 
+    /* Used instead of the two above with stage=yes */
+    pa_sink_filter *filter;
+
     const LADSPA_Descriptor *descriptor;
     LADSPA_Handle handle[PA_CHANNELS_MAX];
     unsigned long max_ladspaport_count, input_count, output_count, channels;
-    LADSPA_Data **input, **output;
+    uint32_t rate;
     size_t block_size;
     LADSPA_Data *control;
 
+    /* The port buffers of each plugin instance. With worker threads every
+     * instance has its own, otherwise they all share the first ones. */
+    LADSPA_Data **input[PA_CHANNELS_MAX], **output[PA_CHANNELS_MAX];
+    unsigned n_buffer_sets;
+
+    pa_worker_pool *pool;
+
+    /* The block the plugin instances are run on */
+    const float *run_src;
+    float *run_dst;
+    unsigned run_n;
+
+    /* Per instance run time and how often a block took longer to
+     * process than it lasts, over the last STATS_INTERVAL_USEC of audio */
+    pa_usec_t run_time[PA_CHANNELS_MAX], max_run_time[PA_CHANNELS_MAX];
+    pa_usec_t stats_audio;
+    unsigned stats_blocks, stats_late, stats_late_runs;
+
     /* This is a dummy buffer. Every port must be connected, but we don't care
     about control out ports. We connect them all to this single buffer. */
     LADSPA_Data control_out;
@@ -102,6 +129,8 @@ static const char* const valid_modargs[] = {
     "control",
     "input_ladspaport_map",
     "output_ladspaport_map",
+    "stage",
+    "threads",
     NULL
 };
 
@@ -213,12 +242,108 @@ static void sink_set_mute_cb(pa_sink *s) {
     pa_sink_input_set_mute(u->sink_input, s->muted, s->save_muted);
 }
 
+/* Called from I/O thread context or a worker thread */
+static void run_instance(unsigned h, void *userdata) {
+    struct userdata *u = userdata;
+    pa_usec_t t;
+    unsigned c;
+
+    t = pa_rtclock_now();
+
+    for (c = 0; c < u->input_count; c++)
+        pa_sample_clamp(PA_SAMPLE_FLOAT32NE, u->input[h][c], sizeof(float), u->run_src + h*u->max_ladspaport_count + c, u->channels*sizeof(float), u->run_n);
+    u->descriptor->run(u->handle[h], u->run_n);
+    for (c = 0; c < u->output_count; c++)
+        pa_sample_clamp(PA_SAMPLE_FLOAT32NE, u->run_dst + h*u->max_ladspaport_count + c, u->channels*sizeof(float), u->output[h][c], sizeof(float), u->run_n);
+
+    t = pa_rtclock_now() - t;
+    u->run_time[h] += t;
+    if (t > u->max_run_time[h])
+        u->max_run_time[h] = t;
+}
+
+/* Called from I/O thread context */
+static void update_stats(struct userdata *u, unsigned n, pa_usec_t elapsed, unsigned late_runs) {
+    pa_usec_t duration;
+    unsigned h;
+
+    duration = (pa_usec_t) n * PA_USEC_PER_SEC / u->rate;
+
+    u->stats_blocks++;
+    u->stats_late_runs += late_runs;
+    u->stats_audio += duration;
+
+    if (elapsed > duration)
+        u->stats_late++;
+
+    if (u->stats_audio < STATS_INTERVAL_USEC)
+        return;
+
+    for (h = 0; h < (u->channels / u->max_ladspaport_count); h++) {
+        pa_log_debug("Plugin instance %u: %llu us per second of audio, at most %llu us per block",
+                     h, (unsigned long long) (u->run_time[h] * PA_USEC_PER_SEC / u->stats_audio),
+                     (unsigned long long) u->max_run_time[h]);
+
+        u->run_time[h] = u->max_run_time[h] = 0;
+    }
+
+    if (u->stats_late > 0)
+        pa_log_debug("%u of %u blocks took longer to process than they last.", u->stats_late, u->stats_blocks);
+
+    if (u->stats_late_runs > 0)
+        pa_log_info("Plugin instances finished after the end of their block %u times, the worker threads can't keep up.", u->stats_late_runs);
+
+    u->stats_audio = 0;
+    u->stats_blocks = u->stats_late = u->stats_late_runs = 0;
+}
+
+/* Called from I/O thread context. src and dst may be the same. */
+static void process_block(struct userdata *u, const float *src, float *dst, unsigned n) {
+    unsigned h, n_instances, late_runs = 0;
+    pa_usec_t t;
+
+    pa_assert(n * sizeof(float) <= u->block_size);
+
+    u->run_src = src;
+    u->run_dst = dst;
+    u->run_n = n;
+
+    n_instances = (unsigned) (u->channels / u->max_ladspaport_count);
+
+    t = pa_rtclock_now();
+
+    /* Every instance reads and writes its own channels only, so they
+     * can run at the same time. They should be done before the block
+     * would have been played. */
+    if (u->pool)
+        late_runs = pa_worker_pool_run(u->pool, n_instances, run_instance, u, t + (pa_usec_t) n * PA_USEC_PER_SEC / u->rate);
+    else
+        for (h = 0; h < n_instances; h++)
+            run_instance(h, u);
+
+    update_stats(u, n, pa_rtclock_now() - t, late_runs);
+}
+
+/* Called from I/O thread context */
+static void reset_plugin(struct userdata *u) {
+    unsigned c;
+
+    pa_log_debug("Resetting plugin");
+
+    if (u->descriptor->deactivate)
+        for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
+            u->descriptor->deactivate(u->handle[c]);
+    if (u->descriptor->activate)
+        for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
+            u->descriptor->activate(u->handle[c]);
+}
+
 /* Called from I/O thread context */
 static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
     struct userdata *u;
     float *src, *dst;
     size_t fs;
-    unsigned n, h, c;
+    unsigned n;
     pa_memchunk tchunk;
 
     pa_sink_input_assert_ref(i);
@@ -253,13 +378,7 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     src = (float*) ((uint8_t*) pa_memblock_acquire(tchunk.memblock) + tchunk.index);
     dst = (float*) pa_memblock_acquire(chunk->memblock);
 
-    for (h = 0; h < (u->channels / u->max_ladspaport_count); h++) {
-        for (c = 0; c < u->input_count; c++)
-            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, u->input[c], sizeof(float), src+ h*u->max_ladspaport_count + c, u->channels*sizeof(float), n);
-        u->descriptor->run(u->handle[h], n);
-        for (c = 0; c < u->output_count; c++)
-            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, dst + h*u->max_ladspaport_count + c, u->channels*sizeof(float), u->output[c], sizeof(float), n);
-    }
+    process_block(u, src, dst, n);
 
     pa_memblock_release(tchunk.memblock);
     pa_memblock_release(chunk->memblock);
@@ -285,19 +404,8 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
         u->sink->thread_info.rewind_nbytes = 0;
 
         if (amount > 0) {
-            unsigned c;
-
             pa_memblockq_seek(u->memblockq, - (int64_t) amount, PA_SEEK_RELATIVE, TRUE);
-
-            pa_log_debug("Resetting plugin");
-
-            /* Reset the plugin */
-            if (u->descriptor->deactivate)
-                for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                    u->descriptor->deactivate(u->handle[c]);
-            if (u->descriptor->activate)
-                for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                    u->descriptor->activate(u->handle[c]);
+            reset_plugin(u);
         }
     }
 
@@ -469,6 +577,46 @@ static void sink_input_mute_changed_cb(pa_sink_input *i) {
     pa_sink_mute_changed(u->sink, i->muted);
 }
 
+/* Called from I/O thread context */
+static void filter_process_cb(pa_sink_filter *f, float *data, unsigned n) {
+    struct userdata *u;
+    unsigned max_n;
+
+    pa_assert_se(u = f->userdata);
+
+    max_n = (unsigned) (u->block_size / sizeof(float));
+
+    while (n > 0) {
+        unsigned k = PA_MIN(n, max_n);
+
+        process_block(u, data, data, k);
+
+        data += k * u->channels;
+        n -= k;
+    }
+}
+
+/* Called from I/O thread context */
+static void filter_reset_cb(pa_sink_filter *f) {
+    struct userdata *u;
+
+    pa_assert_se(u = f->userdata);
+
+    reset_plugin(u);
+}
+
+/* Called from main context */
+static void filter_kill_cb(pa_sink_filter *f) {
+    struct userdata *u;
+
+    pa_assert_se(u = f->userdata);
+
+    pa_sink_filter_free(u->filter);
+    u->filter = NULL;
+
+    pa_module_unload_request(u->module, TRUE);
+}
+
 int pa__init(pa_module*m) {
     struct userdata *u;
     pa_sample_spec ss;
@@ -485,6 +633,8 @@ int pa__init(pa_module*m) {
     const LADSPA_Descriptor *d;
     unsigned long p, h, j, n_control, c;
     pa_bool_t *use_default = NULL;
+    pa_bool_t stage = FALSE;
+    uint32_t n_threads = 0;
 
     pa_assert(m);
 
@@ -508,6 +658,21 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "stage", &stage) < 0) {
+        pa_log("stage= expects a boolean argument");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_u32(ma, "threads", &n_threads) < 0 || n_threads >= PA_CHANNELS_MAX) {
+        pa_log("Invalid number of threads");
+        goto fail;
+    }
+
+    if (stage && (ss.rate != master->sample_spec.rate || !pa_channel_map_equal(&map, &master->channel_map))) {
+        pa_log("A processing stage has to use the sample rate and channel map of the master sink.");
+        goto fail;
+    }
+
     if (!(plugin = pa_modargs_get_value(ma, "plugin", NULL))) {
         pa_log("Missing LADSPA plugin name");
         goto fail;
@@ -529,11 +694,9 @@ int pa__init(pa_module*m) {
     u = pa_xnew0(struct userdata, 1);
     u->module = m;
     m->userdata = u;
-    u->memblockq = pa_memblockq_new("module-ladspa-sink memblockq", 0, MEMBLOCKQ_MAXLENGTH, 0, &ss, 1, 1, 0, NULL);
     u->max_ladspaport_count = 1; /*to avoid division by zero etc. in pa__done when failing before this value has been set*/
     u->channels = 0;
-    u->input = NULL;
-    u->output = NULL;
+    u->rate = ss.rate;
 
     if (!(e = getenv("LADSPA_PATH")))
         e = LADSPA_PATH;
@@ -614,6 +777,19 @@ int pa__init(pa_module*m) {
 
     pa_log_debug("Will run %lu plugin instances", u->channels / u->max_ladspaport_count);
 
+    /* The sink thread runs instances too, more threads than one less
+     * than there are instances would have nothing to do */
+    n_threads = PA_MIN(n_threads, (uint32_t) (u->channels / u->max_ladspaport_count) - 1);
+
+    if (n_threads > 0) {
+        if (!(u->pool = pa_worker_pool_new("ladspa-worker", n_threads, m->core->realtime_scheduling ? m->core->realtime_priority : 0))) {
+            pa_log("Failed to create worker threads.");
+            goto fail;
+        }
+
+        pa_log_debug("Running plugin instances on %u additional threads", n_threads);
+    }
+
     /* Parse data for input ladspa port map */
     if (input_ladspaport_map) {
         const char *state = NULL;
@@ -672,19 +848,27 @@ int pa__init(pa_module*m) {
     u->block_size = pa_frame_align(pa_mempool_block_size_max(m->core->mempool), &ss);
 
     /* Create buffers */
-    if (LADSPA_IS_INPLACE_BROKEN(d->Properties)) {
-        u->input = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->input_count);
-        for (c = 0; c < u->input_count; c++)
-            u->input[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-        u->output = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->output_count);
-        for (c = 0; c < u->output_count; c++)
-            u->output[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-    } else {
-        u->input = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->max_ladspaport_count);
-        for (c = 0; c < u->max_ladspaport_count; c++)
-            u->input[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-        u->output = u->input;
+    u->n_buffer_sets = u->pool ? (unsigned) (u->channels / u->max_ladspaport_count) : 1;
+
+    for (h = 0; h < (u->channels / u->max_ladspaport_count); h++) {
+        if (h >= u->n_buffer_sets) {
+            u->input[h] = u->input[0];
+            u->output[h] = u->output[0];
+        } else if (LADSPA_IS_INPLACE_BROKEN(d->Properties)) {
+            u->input[h] = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->input_count);
+            for (c = 0; c < u->input_count; c++)
+                u->input[h][c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
+            u->output[h] = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->output_count);
+            for (c = 0; c < u->output_count; c++)
+                u->output[h][c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
+        } else {
+            u->input[h] = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->max_ladspaport_count);
+            for (c = 0; c < u->max_ladspaport_count; c++)
+                u->input[h][c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
+            u->output[h] = u->input[h];
+        }
     }
+
     /* Initialize plugin instances */
     for (h = 0; h < (u->channels / u->max_ladspaport_count); h++) {
         if (!(u->handle[h] = d->instantiate(d, ss.rate))) {
@@ -693,9 +877,9 @@ int pa__init(pa_module*m) {
         }
 
         for (c = 0; c < u->input_count; c++)
-            d->connect_port(u->handle[h], input_ladspaport[c], u->input[c]);
+            d->connect_port(u->handle[h], input_ladspaport[c], u->input[h][c]);
         for (c = 0; c < u->output_count; c++)
-            d->connect_port(u->handle[h], output_ladspaport[c], u->output[c]);
+            d->connect_port(u->handle[h], output_ladspaport[c], u->output[h][c]);
     }
 
     if (!cdata && n_control > 0) {
@@ -852,6 +1036,30 @@ int pa__init(pa_module*m) {
         for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
             d->activate(u->handle[c]);
 
+    if (stage) {
+        char *name;
+
+        if (!(name = pa_xstrdup(pa_modargs_get_value(ma, "sink_name", NULL))))
+            name = pa_sprintf_malloc("%s.ladspa", master->name);
+
+        u->filter = pa_sink_filter_new(master, m, name);
+        pa_xfree(name);
+
+        u->filter->process = filter_process_cb;
+        u->filter->reset = filter_reset_cb;
+        u->filter->kill = filter_kill_cb;
+        u->filter->userdata = u;
+
+        pa_sink_filter_put(u->filter);
+
+        pa_modargs_free(ma);
+        pa_xfree(use_default);
+
+        return 0;
+    }
+
+    u->memblockq = pa_memblockq_new("module-ladspa-sink memblockq", 0, MEMBLOCKQ_MAXLENGTH, 0, &ss, 1, 1, 0, NULL);
+
     /* Create sink */
     pa_sink_new_data_init(&sink_data);
     sink_data.driver = __FILE__;
@@ -962,12 +1170,12 @@ int pa__get_n_used(pa_module *m) {
     pa_assert(m);
     pa_assert_se(u = m->userdata);
 
-    return pa_sink_linked_by(u->sink);
+    return u->sink ? pa_sink_linked_by(u->sink) : 0;
 }
 
 void pa__done(pa_module*m) {
     struct userdata *u;
-    unsigned c;
+    unsigned c, h;
 
     pa_assert(m);
 
@@ -989,6 +1197,9 @@ void pa__done(pa_module*m) {
     if (u->sink)
         pa_sink_unref(u->sink);
 
+    if (u->filter)
+        pa_sink_filter_free(u->filter);
+
     for (c = 0; c < (u->channels / u->max_ladspaport_count); c++) {
         if (u->handle[c]) {
             if (u->descriptor->deactivate)
@@ -997,25 +1208,30 @@ void pa__done(pa_module*m) {
         }
     }
 
-    if (u->output == u->input) {
-        if (u->input != NULL) {
-            for (c = 0; c < u->max_ladspaport_count; c++)
-                pa_xfree(u->input[c]);
-            pa_xfree(u->input);
-        }
-    } else {
-        if (u->input != NULL) {
-            for (c = 0; c < u->input_count; c++)
-                pa_xfree(u->input[c]);
-            pa_xfree(u->input);
-        }
-        if (u->output != NULL) {
-            for (c = 0; c < u->output_count; c++)
-                pa_xfree(u->output[c]);
-            pa_xfree(u->output);
+    for (h = 0; h < u->n_buffer_sets; h++) {
+        if (u->output[h] == u->input[h]) {
+            if (u->input[h] != NULL) {
+                for (c = 0; c < u->max_ladspaport_count; c++)
+                    pa_xfree(u->input[h][c]);
+                pa_xfree(u->input[h]);
+            }
+        } else {
+            if (u->input[h] != NULL) {
+                for (c = 0; c < u->input_count; c++)
+                    pa_xfree(u->input[h][c]);
+                pa_xfree(u->input[h]);
+            }
+            if (u->output[h] != NULL) {
+                for (c = 0; c < u->output_count; c++)
+                    pa_xfree(u->output[h][c]);
+                pa_xfree(u->output[h]);
+            }
         }
     }
 
+    if (u->pool)
+        pa_worker_pool_free(u->pool);
+
     if (u->memblockq)
         pa_memblockq_free(u->memblockq);
 
@@ -46,6 +46,7 @@ PA_MODULE_LOAD_ONCE(TRUE);
 PA_MODULE_USAGE(
         "tsched=<enable system timer based scheduling mode?> "
         "fixed_latency_range=<disable latency range changes on underrun?> "
+        "predictive_watermark=<size the wakeup watermark from past wakeups?> "
         "ignore_dB=<ignore dB information from the device?> "
         "deferred_volume=<syncronize sw and hw volume changes in IO-thread?>");
 
@@ -64,6 +65,7 @@ struct userdata {
 
     pa_bool_t use_tsched:1;
     pa_bool_t fixed_latency_range:1;
+    pa_bool_t predictive_watermark:1;
     pa_bool_t ignore_dB:1;
     pa_bool_t deferred_volume:1;
 
@@ -78,6 +80,7 @@ struct userdata {
 static const char* const valid_modargs[] = {
     "tsched",
     "fixed_latency_range",
+    "predictive_watermark",
     "ignore_dB",
     "deferred_volume",
     NULL
@@ -392,6 +395,7 @@ static void card_changed(struct userdata *u, struct udev_device *dev) {
                                 "namereg_fail=false "
                                 "tsched=%s "
                                 "fixed_latency_range=%s "
+                                "predictive_watermark=%s "
                                 "ignore_dB=%s "
                                 "deferred_volume=%s "
                                 "card_properties=\"module-udev-detect.discovered=1\"",
@@ -400,6 +404,7 @@ static void card_changed(struct userdata *u, struct udev_device *dev) {
                                 d->card_name,
                                 pa_yes_no(u->use_tsched),
                                 pa_yes_no(u->fixed_latency_range),
+                                pa_yes_no(u->predictive_watermark),
                                 pa_yes_no(u->ignore_dB),
                                 pa_yes_no(u->deferred_volume));
     pa_xfree(n);
@@ -667,7 +672,7 @@ int pa__init(pa_module *m) {
     struct udev_enumerate *enumerate = NULL;
     struct udev_list_entry *item = NULL, *first = NULL;
     int fd;
-    pa_bool_t use_tsched = TRUE, fixed_latency_range = FALSE, ignore_dB = FALSE, deferred_volume = m->core->deferred_volume;
+    pa_bool_t use_tsched = TRUE, fixed_latency_range = FALSE, predictive_watermark = FALSE, ignore_dB = FALSE, deferred_volume = m->core->deferred_volume;
 
 
     pa_assert(m);
@@ -694,6 +699,12 @@ int pa__init(pa_module *m) {
     }
     u->fixed_latency_range = fixed_latency_range;
 
+    if (pa_modargs_get_value_boolean(ma, "predictive_watermark", &predictive_watermark) < 0) {
+        pa_log("Failed to parse predictive_watermark= argument.");
+        goto fail;
+    }
+    u->predictive_watermark = predictive_watermark;
+
     if (pa_modargs_get_value_boolean(ma, "ignore_dB", &ignore_dB) < 0) {
         pa_log("Failed to parse ignore_dB= argument.");
         goto fail;
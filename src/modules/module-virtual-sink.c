@@ -54,6 +54,7 @@ PA_MODULE_USAGE(
           "channel_map=<channel map> "
           "use_volume_sharing=<yes or no> "
           "force_flat_volume=<yes or no> "
+          "stage=<run inside the master sink instead of creating a sink? yes or no> "
         ));
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
@@ -67,6 +68,9 @@ struct userdata {
     pa_sink *sink;
     pa_sink_input *sink_input;
 
+    /* Used instead of the two above with stage=yes */
+    pa_sink_filter *filter;
+
     pa_memblockq *memblockq;
 
     pa_bool_t auto_desc;
@@ -83,6 +87,7 @@ static const char* const valid_modargs[] = {
     "channel_map",
     "use_volume_sharing",
     "force_flat_volume",
+    "stage",
     NULL
 };
 
@@ -471,6 +476,40 @@ static void sink_input_mute_changed_cb(pa_sink_input *i) {
     pa_sink_mute_changed(u->sink, i->muted);
 }
 
+/* Called from I/O thread context */
+static void filter_process_cb(pa_sink_filter *f, float *data, unsigned n) {
+    struct userdata *u;
+
+    pa_assert_se(u = f->userdata);
+
+    /* (10) WITH stage=yes PUT YOUR CODE HERE TO DO SOMETHING WITH THE
+     * DATA. IT IS PROCESSED IN PLACE, IN THE RATE AND CHANNEL MAP OF
+     * THE MASTER SINK, WITH WHATEVER BLOCK SIZE THE MASTER RENDERS. */
+}
+
+/* Called from I/O thread context */
+static void filter_reset_cb(pa_sink_filter *f) {
+    struct userdata *u;
+
+    pa_assert_se(u = f->userdata);
+
+    /* (11) PUT YOUR CODE HERE TO RESET YOUR FILTER. UNLIKE (5) THE
+     * MASTER THEN FEEDS THE STAGE WHAT CAME BEFORE THE REWIND POINT
+     * AGAIN, SO IT ENDS UP WHERE IT WAS THERE */
+}
+
+/* Called from main context */
+static void filter_kill_cb(pa_sink_filter *f) {
+    struct userdata *u;
+
+    pa_assert_se(u = f->userdata);
+
+    pa_sink_filter_free(u->filter);
+    u->filter = NULL;
+
+    pa_module_unload_request(u->module, TRUE);
+}
+
 int pa__init(pa_module*m) {
     struct userdata *u;
     pa_sample_spec ss;
@@ -481,6 +520,7 @@ int pa__init(pa_module*m) {
     pa_sink_new_data sink_data;
     pa_bool_t use_volume_sharing = TRUE;
     pa_bool_t force_flat_volume = FALSE;
+    pa_bool_t stage = FALSE;
     pa_memchunk silence;
 
     pa_assert(m);
@@ -520,11 +560,44 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "stage", &stage) < 0) {
+        pa_log("stage= expects a boolean argument");
+        goto fail;
+    }
+
+    if (stage && (ss.rate != master->sample_spec.rate || !pa_channel_map_equal(&map, &master->channel_map))) {
+        pa_log("A processing stage has to use the sample rate and channel map of the master sink.");
+        goto fail;
+    }
+
     u = pa_xnew0(struct userdata, 1);
     u->module = m;
     m->userdata = u;
     u->channels = ss.channels;
 
+    if (stage) {
+        char *name;
+
+        if (!(name = pa_xstrdup(pa_modargs_get_value(ma, "sink_name", NULL))))
+            name = pa_sprintf_malloc("%s.vsink", master->name);
+
+        u->filter = pa_sink_filter_new(master, m, name);
+        pa_xfree(name);
+
+        u->filter->process = filter_process_cb;
+        u->filter->reset = filter_reset_cb;
+        u->filter->kill = filter_kill_cb;
+        u->filter->userdata = u;
+
+        /* (12) INITIALIZE ANYTHING ELSE YOU NEED FOR THE STAGE HERE */
+
+        pa_sink_filter_put(u->filter);
+
+        pa_modargs_free(ma);
+
+        return 0;
+    }
+
     /* Create sink */
     pa_sink_new_data_init(&sink_data);
     sink_data.driver = __FILE__;
@@ -638,7 +711,7 @@ int pa__get_n_used(pa_module *m) {
     pa_assert(m);
     pa_assert_se(u = m->userdata);
 
-    return pa_sink_linked_by(u->sink);
+    return u->sink ? pa_sink_linked_by(u->sink) : 0;
 }
 
 void pa__done(pa_module*m) {
@@ -664,6 +737,9 @@ void pa__done(pa_module*m) {
     if (u->sink)
         pa_sink_unref(u->sink);
 
+    if (u->filter)
+        pa_sink_filter_free(u->filter);
+
     if (u->memblockq)
         pa_memblockq_free(u->memblockq);
 
@@ -350,7 +350,10 @@ static void thread_func(void *userdata) {
                     p = pa_memblock_acquire(silence_tmp.memblock);
                       memset(p, 0, 4096);
                     pa_memblock_release(silence_tmp.memblock);
-                    pa_raop_client_encode_sample(u->raop, &silence_tmp, &silence);
+                    if (pa_raop_client_encode_sample(u->raop, &silence_tmp, &silence) < 0) {
+                        pa_memblock_unref(silence_tmp.memblock);
+                        goto fail;
+                    }
                     pa_assert(0 == silence_tmp.length);
                     silence_overhead = silence_tmp.length - 4096;
                     silence_ratio = silence_tmp.length / 4096;
@@ -380,7 +383,8 @@ static void thread_func(void *userdata) {
                             /* Encode it */
                             rl = u->raw_memchunk.length;
                             u->encoding_overhead += u->next_encoding_overhead;
-                            pa_raop_client_encode_sample(u->raop, &u->raw_memchunk, &u->encoded_memchunk);
+                            if (pa_raop_client_encode_sample(u->raop, &u->raw_memchunk, &u->encoded_memchunk) < 0)
+                                goto fail;
                             u->next_encoding_overhead = (u->encoded_memchunk.length - (rl - u->raw_memchunk.length));
                             u->encoding_ratio = u->encoded_memchunk.length / (rl - u->raw_memchunk.length);
                         } else {
@@ -36,7 +36,7 @@
 /* TODO: Replace OpenSSL with NSS */
 #include <openssl/err.h>
 #include <openssl/rand.h>
-#include <openssl/aes.h>
+#include <openssl/evp.h>
 #include <openssl/rsa.h>
 #include <openssl/engine.h>
 
@@ -44,6 +44,7 @@
 
 #include <pulsecore/core-error.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/endianmacros.h>
 #include <pulsecore/iochannel.h>
 #include <pulsecore/socket-util.h>
 #include <pulsecore/log.h>
@@ -82,9 +83,8 @@ struct pa_raop_client {
     uint8_t jack_status;
 
     /* Encryption Related bits */
-    AES_KEY aes;
+    EVP_CIPHER_CTX *aes;
     uint8_t aes_iv[AES_CHUNKSIZE]; /* initialization vector for aes-cbc */
-    uint8_t aes_nv[AES_CHUNKSIZE]; /* next vector for aes-cbc */
     uint8_t aes_key[AES_CHUNKSIZE]; /* key for aes-cbc */
 
     pa_socket_client *sc;
@@ -99,56 +99,51 @@ struct pa_raop_client {
     void* closed_userdata;
 };
 
-/**
- * Function to write bits into a buffer.
- * @param buffer Handle to the buffer. It will be incremented if new data requires it.
- * @param bit_pos A pointer to a position buffer to keep track the current write location (0 for MSB, 7 for LSB)
- * @param size A pointer to the byte size currently written. This allows the calling function to do simple buffer overflow checks
- * @param data The data to write
- * @param data_bit_len The number of bits from data to write
- */
-static inline void bit_writer(uint8_t **buffer, uint8_t *bit_pos, int *size, uint8_t data, uint8_t data_bit_len) {
-    int bits_left, bit_overflow;
-    uint8_t bit_data;
-
-    if (!data_bit_len)
-        return;
+/* Writes the header of an uncompressed ALAC frame for n_frames stereo
+ * frames followed by the samples in big endian. The header is 55 bits
+ * long, so the samples are shifted by one bit against the output bytes:
+ * each output word is a frame swapped to big endian, shifted left by one
+ * and topped up with the first bit of the next frame. Returns the number
+ * of bytes written, which is 7 + n_frames * 4. */
+static size_t alac_pack(uint8_t *dst, const uint8_t *src, uint32_t n_frames) {
+    uint64_t h;
+    uint32_t i;
+    int k;
 
-    /* If bit pos is zero, we will definately use at least one bit from the current byte so size increments. */
-    if (!*bit_pos)
-        *size += 1;
-
-    /* Calc the number of bits left in the current byte of buffer */
-    bits_left = 7 - *bit_pos  + 1;
-    /* Calc the overflow of bits in relation to how much space we have left... */
-    bit_overflow = bits_left - data_bit_len;
-    if (bit_overflow >= 0) {
-        /* We can fit the new data in our current byte */
-        /* As we write from MSB->LSB we need to left shift by the overflow amount */
-        bit_data = data << bit_overflow;
-        if (*bit_pos)
-            **buffer |= bit_data;
-        else
-            **buffer = bit_data;
-        /* If our data fits exactly into the current byte, we need to increment our pointer */
-        if (0 == bit_overflow) {
-            /* Do not increment size as it will be incremented on next call as bit_pos is zero */
-            *buffer += 1;
-            *bit_pos = 0;
-        } else {
-            *bit_pos += data_bit_len;
-        }
-    } else {
-        /* bit_overflow is negative, there for we will need a new byte from our buffer */
-        /* Firstly fill up what's left in the current byte */
-        bit_data = data >> -bit_overflow;
-        **buffer |= bit_data;
-        /* Increment our buffer pointer and size counter*/
-        *buffer += 1;
-        *size += 1;
-        **buffer = data << (8 + bit_overflow);
-        *bit_pos = -bit_overflow;
+    h = ((uint64_t) 1 << 61) |          /* channel=1, stereo */
+        ((uint64_t) 1 << 44) |          /* hassize */
+        ((uint64_t) 1 << 41) |          /* is-not-compressed */
+        ((uint64_t) n_frames << 9);     /* size of data, big endian */
+
+    if (n_frames > 0)
+        h |= (uint64_t) (src[1] >> 7) << 8;
+
+    for (k = 0; k < 7; k++)
+        dst[k] = (uint8_t) (h >> (56 - 8 * k));
+
+    dst += 7;
+
+    for (i = 0; i < n_frames; i++) {
+        uint32_t w;
+
+        memcpy(&w, src, 4);
+        w = PA_UINT32_FROM_LE(w);
+
+        /* Left sample in the upper half, right one in the lower */
+        w = (w << 16) | (w >> 16);
+        w <<= 1;
+
+        if (i + 1 < n_frames)
+            w |= src[5] >> 7;
+
+        w = PA_UINT32_TO_BE(w);
+        memcpy(dst, &w, 4);
+
+        src += 4;
+        dst += 4;
     }
+
+    return 7 + (size_t) n_frames * 4;
 }
 
 static int rsa_encrypt(uint8_t *text, int len, uint8_t *res) {
@@ -165,34 +160,46 @@ static int rsa_encrypt(uint8_t *text, int len, uint8_t *res) {
     int size;
     RSA *rsa;
 
+    BIGNUM *bn_n, *bn_e;
+
     rsa = RSA_new();
     size = pa_base64_decode(n, modules);
-    rsa->n = BN_bin2bn(modules, size, NULL);
+    bn_n = BN_bin2bn(modules, size, NULL);
     size = pa_base64_decode(e, exponent);
-    rsa->e = BN_bin2bn(exponent, size, NULL);
+    bn_e = BN_bin2bn(exponent, size, NULL);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    RSA_set0_key(rsa, bn_n, bn_e, NULL);
+#else
+    rsa->n = bn_n;
+    rsa->e = bn_e;
+#endif
 
     size = RSA_public_encrypt(len, text, res, rsa, RSA_PKCS1_OAEP_PADDING);
     RSA_free(rsa);
     return size;
 }
 
+/* Encrypts the whole AES blocks of data in place, the rest is sent as
+ * is. Every packet is chained from the same IV. Going through EVP lets
+ * OpenSSL use AES-NI and friends where the CPU has them. */
 static int aes_encrypt(pa_raop_client* c, uint8_t *data, int size) {
-    uint8_t *buf;
-    int i=0, j;
+    int l = 0;
 
     pa_assert(c);
+    pa_assert(c->aes);
+
+    size &= ~(AES_CHUNKSIZE - 1);
 
-    memcpy(c->aes_nv, c->aes_iv, AES_CHUNKSIZE);
-    while (i+AES_CHUNKSIZE <= size) {
-        buf = data + i;
-        for (j=0; j<AES_CHUNKSIZE; ++j)
-            buf[j] ^= c->aes_nv[j];
+    if (size <= 0)
+        return 0;
 
-        AES_encrypt(buf, buf, &c->aes);
-        memcpy(c->aes_nv, buf, AES_CHUNKSIZE);
-        i += AES_CHUNKSIZE;
+    if (!EVP_EncryptInit_ex(c->aes, NULL, NULL, NULL, c->aes_iv) ||
+        !EVP_EncryptUpdate(c->aes, data, &l, data, size)) {
+        pa_log("AES encryption failed.");
+        return -1;
     }
-    return i;
+
+    return l;
 }
 
 static inline void rtrimchar(char *str, char rc) {
@@ -400,6 +407,8 @@ void pa_raop_client_free(pa_raop_client* c) {
         pa_rtsp_client_free(c->rtsp);
     if (c->sid)
         pa_xfree(c->sid);
+    if (c->aes)
+        EVP_CIPHER_CTX_free(c->aes);
     pa_xfree(c->host);
     pa_xfree(c);
 }
@@ -420,13 +429,20 @@ int pa_raop_connect(pa_raop_client* c) {
         return 0;
     }
 
-    c->rtsp = pa_rtsp_client_new(c->core->mainloop, c->host, c->port, "iTunes/4.6 (Macintosh; U; PPC Mac OS X 10.3)");
-
     /* Initialise the AES encryption system */
     pa_random(c->aes_iv, sizeof(c->aes_iv));
     pa_random(c->aes_key, sizeof(c->aes_key));
-    memcpy(c->aes_nv, c->aes_iv, sizeof(c->aes_nv));
-    AES_set_encrypt_key(c->aes_key, 128, &c->aes);
+    if (!c->aes)
+        c->aes = EVP_CIPHER_CTX_new();
+    if (!c->aes ||
+        !EVP_EncryptInit_ex(c->aes, EVP_aes_128_cbc(), NULL, c->aes_key, c->aes_iv)) {
+        pa_log("Failed to set up AES encryption.");
+        return -1;
+    }
+    /* We only ever encrypt whole blocks */
+    EVP_CIPHER_CTX_set_padding(c->aes, 0);
+
+    c->rtsp = pa_rtsp_client_new(c->core->mainloop, c->host, c->port, "iTunes/4.6 (Macintosh; U; PPC Mac OS X 10.3)");
 
     /* Generate random instance id */
     pa_random(&rand_data, sizeof(rand_data));
@@ -472,8 +488,6 @@ int pa_raop_client_set_volume(pa_raop_client* c, pa_volume_t volume) {
 int pa_raop_client_encode_sample(pa_raop_client* c, pa_memchunk* raw, pa_memchunk* encoded) {
     uint16_t len;
     size_t bufmax;
-    uint8_t *bp, bpos;
-    uint8_t *ibp, *maxibp;
     int size;
     uint8_t *b, *p;
     uint32_t bsize;
@@ -504,36 +518,13 @@ int pa_raop_client_encode_sample(pa_raop_client* c, pa_memchunk* raw, pa_memchun
     b = pa_memblock_acquire(encoded->memblock);
     memcpy(b, header, header_size);
 
-    /* Now write the actual samples */
-    bp = b + header_size;
-    size = bpos = 0;
-    bit_writer(&bp,&bpos,&size,1,3); /* channel=1, stereo */
-    bit_writer(&bp,&bpos,&size,0,4); /* unknown */
-    bit_writer(&bp,&bpos,&size,0,8); /* unknown */
-    bit_writer(&bp,&bpos,&size,0,4); /* unknown */
-    bit_writer(&bp,&bpos,&size,1,1); /* hassize */
-    bit_writer(&bp,&bpos,&size,0,2); /* unused */
-    bit_writer(&bp,&bpos,&size,1,1); /* is-not-compressed */
-
-    /* size of data, integer, big endian */
-    bit_writer(&bp,&bpos,&size,(bsize>>24)&0xff,8);
-    bit_writer(&bp,&bpos,&size,(bsize>>16)&0xff,8);
-    bit_writer(&bp,&bpos,&size,(bsize>>8)&0xff,8);
-    bit_writer(&bp,&bpos,&size,(bsize)&0xff,8);
-
-    ibp = p = pa_memblock_acquire(raw->memblock);
-    maxibp = p + raw->length - 4;
-    while (ibp <= maxibp) {
-        /* Byte swap stereo data */
-        bit_writer(&bp,&bpos,&size,*(ibp+1),8);
-        bit_writer(&bp,&bpos,&size,*(ibp+0),8);
-        bit_writer(&bp,&bpos,&size,*(ibp+3),8);
-        bit_writer(&bp,&bpos,&size,*(ibp+2),8);
-        ibp += 4;
-        raw->index += 4;
-        raw->length -= 4;
-    }
+    /* Now write the ALAC header and the byte swapped stereo data */
+    p = pa_memblock_acquire(raw->memblock);
+    size = (int) alac_pack(b + header_size, p + raw->index, bsize);
     pa_memblock_release(raw->memblock);
+
+    raw->index += length;
+    raw->length -= length;
     encoded->length = header_size + size;
 
     /* store the length (endian swapped: make this better) */
@@ -542,7 +533,12 @@ int pa_raop_client_encode_sample(pa_raop_client* c, pa_memchunk* raw, pa_memchun
     *(b + 3) = len & 0xff;
 
     /* encrypt our data */
-    aes_encrypt(c, (b + header_size), size);
+    if (aes_encrypt(c, (b + header_size), size) < 0) {
+        pa_memblock_release(encoded->memblock);
+        pa_memblock_unref(encoded->memblock);
+        pa_memchunk_reset(encoded);
+        return -1;
+    }
 
     /* We're done with the chunk */
     pa_memblock_release(encoded->memblock);
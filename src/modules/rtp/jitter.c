@@ -0,0 +1,513 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "jitter.h"
+
+/* How many sequence numbers back we remember having seen, and how
+ * many encoded packets we hold at most */
+#define SEQUENCE_WINDOW 64
+
+struct packet {
+    pa_memchunk chunk;
+    uint32_t timestamp;
+};
+
+struct pa_rtp_jitter {
+    pa_memblockq *memblockq;
+    pa_sample_spec sample_spec;
+    size_t frame_size;
+    pa_memchunk silence;
+    pa_rtp_conceal_mode_t mode;
+
+    pa_usec_t min_target, max_target, target;
+
+    /* The highest sequence number so far, and which of the ones before
+     * it we have seen: bit n stands for max_sequence - n */
+    pa_bool_t synced;
+    uint16_t max_sequence;
+    uint64_t seen;
+
+    /* The timestamp right after the end of the latest packet, and the
+     * index in the memblockq that corresponds to */
+    uint32_t next_timestamp;
+    int64_t next_index;
+
+    pa_bool_t have_arrival;
+    pa_usec_t last_arrival;
+    uint32_t last_timestamp;
+    double jitter;
+
+    /* What was played last, for repeating it into a hole */
+    pa_memchunk last;
+    size_t repeated;
+    pa_bool_t playing;
+
+    /* With a decoder, packets wait in their slot by sequence number
+     * until everything before them has been decoded. next_timestamp is
+     * then the timestamp of the newest packet, and decode_timestamp the
+     * one at the write index of the memblockq. */
+    pa_rtp_jitter_decode_cb_t decode;
+    void *decode_userdata;
+    struct packet packets[SEQUENCE_WINDOW];
+    uint16_t decode_sequence;
+    uint32_t decode_timestamp;
+    size_t packet_length;
+
+    pa_rtp_jitter_stats stats;
+};
+
+pa_rtp_jitter* pa_rtp_jitter_new(
+        pa_memblockq *q,
+        const pa_sample_spec *ss,
+        const pa_memchunk *silence,
+        pa_rtp_conceal_mode_t mode,
+        pa_usec_t min_target,
+        pa_usec_t max_target) {
+
+    pa_rtp_jitter *j;
+
+    pa_assert(q);
+    pa_assert(ss);
+    pa_assert(silence);
+    pa_assert(silence->memblock);
+    pa_assert(min_target > 0);
+
+    j = pa_xnew0(pa_rtp_jitter, 1);
+    j->memblockq = q;
+    j->sample_spec = *ss;
+    j->frame_size = pa_frame_size(ss);
+    j->mode = mode;
+    j->min_target = PA_MIN(min_target, max_target);
+    j->max_target = max_target;
+
+    j->silence = *silence;
+    pa_memblock_ref(j->silence.memblock);
+
+    j->target = j->min_target;
+    pa_memblockq_set_prebuf(q, pa_usec_to_bytes(j->target, ss));
+
+    return j;
+}
+
+static void flush_packets(pa_rtp_jitter *j) {
+    unsigned i;
+
+    for (i = 0; i < SEQUENCE_WINDOW; i++)
+        if (j->packets[i].chunk.memblock) {
+            pa_memblock_unref(j->packets[i].chunk.memblock);
+            pa_memchunk_reset(&j->packets[i].chunk);
+        }
+}
+
+void pa_rtp_jitter_free(pa_rtp_jitter *j) {
+    pa_assert(j);
+
+    flush_packets(j);
+
+    if (j->last.memblock)
+        pa_memblock_unref(j->last.memblock);
+
+    pa_memblock_unref(j->silence.memblock);
+    pa_xfree(j);
+}
+
+void pa_rtp_jitter_set_decoder(pa_rtp_jitter *j, pa_rtp_jitter_decode_cb_t cb, void *userdata) {
+    pa_assert(j);
+    pa_assert(cb);
+    pa_assert(!j->synced);
+
+    j->decode = cb;
+    j->decode_userdata = userdata;
+}
+
+void pa_rtp_jitter_reset(pa_rtp_jitter *j) {
+    pa_assert(j);
+
+    flush_packets(j);
+
+    j->synced = FALSE;
+    j->have_arrival = FALSE;
+    j->playing = FALSE;
+
+    if (j->last.memblock) {
+        pa_memblock_unref(j->last.memblock);
+        pa_memchunk_reset(&j->last);
+    }
+}
+
+static void resync(pa_rtp_jitter *j, uint16_t sequence, uint32_t timestamp) {
+    j->synced = TRUE;
+    j->max_sequence = (uint16_t) (sequence - 1);
+    j->seen = 0;
+    j->next_timestamp = timestamp;
+    j->next_index = pa_memblockq_get_write_index(j->memblockq);
+    j->have_arrival = FALSE;
+
+    /* Whatever was waiting belongs to the stream before the jump */
+    flush_packets(j);
+    j->decode_sequence = sequence;
+    j->decode_timestamp = timestamp;
+}
+
+/* Interarrival jitter as in RFC 3550 section 6.4.1, and the depth we
+ * want from it: what the sink takes in one go, one packet, and four
+ * times the jitter to ride out most of the spread */
+static void update_target(pa_rtp_jitter *j, uint32_t timestamp, pa_usec_t arrival, size_t length) {
+    pa_usec_t target;
+
+    if (j->have_arrival) {
+        double d;
+
+        d = (double) ((int64_t) arrival - (int64_t) j->last_arrival) -
+            (double) (int32_t) (timestamp - j->last_timestamp) * PA_USEC_PER_SEC / j->sample_spec.rate;
+
+        j->jitter += (fabs(d) - j->jitter) / 16;
+    }
+
+    j->have_arrival = TRUE;
+    j->last_arrival = arrival;
+    j->last_timestamp = timestamp;
+
+    target = j->min_target + pa_bytes_to_usec(length, &j->sample_spec) + (pa_usec_t) (4 * j->jitter);
+    target = PA_MIN(target, j->max_target);
+
+    if (target == j->target)
+        return;
+
+    /* This only takes effect when the queue prebuffers again. While
+     * playing, the caller has to steer the fill level towards it */
+    j->target = target;
+    pa_memblockq_set_prebuf(j->memblockq, pa_usec_to_bytes(target, &j->sample_spec));
+}
+
+static void push_pcm(pa_rtp_jitter *j, pa_memchunk *pcm) {
+    pa_assert(pcm->length % j->frame_size == 0);
+
+    if (pa_memblockq_push(j->memblockq, pcm) < 0)
+        pa_log_warn("Queue overrun");
+
+    pa_memblock_unref(pcm->memblock);
+}
+
+/* Makes up the n packets missing before the next one that is queued,
+ * spread evenly over the timestamps in between. The last one right
+ * before it can be recovered from its FEC data. */
+static void conceal_packets(pa_rtp_jitter *j, unsigned n) {
+    const struct packet *next;
+
+    next = &j->packets[(uint16_t) (j->decode_sequence + n) % SEQUENCE_WINDOW];
+
+    for (; n > 0; n--) {
+        pa_memchunk pcm;
+        int32_t span;
+        unsigned n_samples;
+
+        span = (int32_t) (next->timestamp - j->decode_timestamp);
+        n_samples = span > 0 ? (unsigned) span / n : 0;
+
+        if (n_samples > 0 &&
+            j->decode(j->decode_userdata, NULL, n == 1 ? &next->chunk : NULL, n_samples, &pcm) >= 0) {
+            push_pcm(j, &pcm);
+            j->stats.recovered++;
+        }
+
+        j->decode_timestamp += n_samples;
+        j->decode_sequence++;
+    }
+}
+
+/* Decodes the packets that are next in line. A missing one is only made
+ * up when a later packet has arrived, and either playback is about to
+ * run into it or the packets after it cover the whole target depth.
+ * Without a length nothing is made up at all. */
+static void decode_packets(pa_rtp_jitter *j, size_t length) {
+
+    for (;;) {
+        struct packet *p;
+        pa_memchunk pcm;
+        int64_t ahead;
+        unsigned n;
+
+        p = &j->packets[j->decode_sequence % SEQUENCE_WINDOW];
+
+        if (p->chunk.memblock) {
+            int r;
+
+            r = j->decode(j->decode_userdata, &p->chunk, NULL, 0, &pcm);
+            pa_memblock_unref(p->chunk.memblock);
+            pa_memchunk_reset(&p->chunk);
+
+            /* Then it is as good as lost */
+            if (r < 0) {
+                pa_log_debug("Failed to decode packet %u.", (unsigned) j->decode_sequence);
+                continue;
+            }
+
+            j->decode_timestamp = p->timestamp + (uint32_t) (pcm.length / j->frame_size);
+            j->decode_sequence++;
+            j->packet_length = pcm.length;
+
+            push_pcm(j, &pcm);
+            continue;
+        }
+
+        if (length <= 0)
+            break;
+
+        for (n = 1; n < SEQUENCE_WINDOW; n++)
+            if (j->packets[(uint16_t) (j->decode_sequence + n) % SEQUENCE_WINDOW].chunk.memblock)
+                break;
+
+        if (n >= SEQUENCE_WINDOW)
+            break;
+
+        ahead = (int64_t) (int32_t) (j->next_timestamp - j->decode_timestamp) * (int64_t) j->frame_size;
+
+        if (!((j->playing || !pa_memblockq_prebuf_active(j->memblockq)) && pa_memblockq_get_length(j->memblockq) <= length) &&
+            ahead < (int64_t) pa_usec_to_bytes(j->target, &j->sample_spec))
+            break;
+
+        conceal_packets(j, n);
+    }
+}
+
+static int queue_packet(pa_rtp_jitter *j, uint16_t sequence, uint32_t timestamp, const pa_memchunk *chunk) {
+    struct packet *p;
+    int16_t d;
+
+    d = (int16_t) (sequence - j->decode_sequence);
+
+    if (d < 0) {
+        /* Its place has been made up already */
+        j->stats.late++;
+        return -1;
+    }
+
+    if (d >= SEQUENCE_WINDOW) {
+        pa_log_warn("Queue overrun");
+        return -1;
+    }
+
+    p = &j->packets[sequence % SEQUENCE_WINDOW];
+
+    if (p->chunk.memblock) {
+        j->stats.duplicates++;
+        return -1;
+    }
+
+    p->chunk = *chunk;
+    pa_memblock_ref(p->chunk.memblock);
+    p->timestamp = timestamp;
+
+    j->stats.received++;
+
+    if ((int32_t) (timestamp - j->next_timestamp) > 0)
+        j->next_timestamp = timestamp;
+
+    decode_packets(j, 0);
+
+    return 0;
+}
+
+int pa_rtp_jitter_push(pa_rtp_jitter *j, uint16_t sequence, uint32_t timestamp, pa_usec_t arrival, const pa_memchunk *uchunk) {
+    pa_memchunk chunk;
+    int64_t index, end, read_index;
+    int16_t d;
+    int r = 0;
+
+    pa_assert(j);
+    pa_assert(uchunk);
+    pa_assert(uchunk->memblock);
+    pa_assert(j->decode || uchunk->length % j->frame_size == 0);
+
+    if (!j->synced)
+        resync(j, sequence, timestamp);
+
+    d = (int16_t) (sequence - j->max_sequence);
+    index = j->next_index + (int64_t) (int32_t) (timestamp - j->next_timestamp) * (int64_t) j->frame_size;
+
+    /* A newer packet this far off is no jitter, the sender restarted or
+     * skipped ahead. Queue it right behind what we have. */
+    if ((d > 0 || d <= -SEQUENCE_WINDOW) &&
+        (uint64_t) (index > j->next_index ? index - j->next_index : j->next_index - index) > pa_usec_to_bytes(j->max_target, &j->sample_spec)) {
+
+        pa_log_debug("RTP timestamp jumped by %lli bytes, resyncing.", (long long) (index - j->next_index));
+
+        if (d > 0)
+            j->stats.lost += (uint64_t) (d - 1);
+
+        j->stats.resyncs++;
+        resync(j, sequence, timestamp);
+
+        d = 1;
+        index = j->next_index;
+    }
+
+    if (d > 0) {
+        j->stats.lost += (uint64_t) (d - 1);
+        j->seen = d < SEQUENCE_WINDOW ? (j->seen << d) | 1 : 1;
+        j->max_sequence = sequence;
+
+    } else if (-d >= SEQUENCE_WINDOW) {
+        /* Too old to tell, but most likely we counted it as lost */
+        j->stats.late++;
+
+        if (j->stats.lost > 0)
+            j->stats.lost--;
+
+        return -1;
+
+    } else if (j->seen & (UINT64_C(1) << -d)) {
+        j->stats.duplicates++;
+        return -1;
+
+    } else {
+        /* We counted this one as lost when we saw the gap */
+        j->seen |= UINT64_C(1) << -d;
+        j->stats.reordered++;
+
+        if (j->stats.lost > 0)
+            j->stats.lost--;
+    }
+
+    /* The size of a packet is only known once it is decoded, the one
+     * before it has to do */
+    update_target(j, timestamp, arrival, j->decode ? j->packet_length : uchunk->length);
+
+    if (j->decode)
+        return queue_packet(j, sequence, timestamp, uchunk);
+
+    chunk = *uchunk;
+    end = index + (int64_t) chunk.length;
+    read_index = pa_memblockq_get_read_index(j->memblockq);
+
+    if (end <= read_index) {
+        /* Its place has been concealed already */
+        j->stats.late++;
+        return -1;
+    }
+
+    if (index < read_index) {
+        chunk.index += (size_t) (read_index - index);
+        chunk.length -= (size_t) (read_index - index);
+        index = read_index;
+    }
+
+    pa_memblockq_seek(j->memblockq, index, PA_SEEK_ABSOLUTE, TRUE);
+
+    if (pa_memblockq_push(j->memblockq, &chunk) < 0) {
+        pa_log_warn("Queue overrun");
+        r = -1;
+    } else
+        j->stats.received++;
+
+    if (end > j->next_index) {
+        j->next_index = end;
+        j->next_timestamp = timestamp + (uint32_t) (uchunk->length / j->frame_size);
+    }
+
+    /* Filling a hole leaves the write index in the middle, put it back
+     * at the end */
+    pa_memblockq_seek(j->memblockq, j->next_index, PA_SEEK_ABSOLUTE, TRUE);
+
+    return r;
+}
+
+int pa_rtp_jitter_peek(pa_rtp_jitter *j, size_t length, pa_memchunk *chunk) {
+    size_t hole;
+    pa_bool_t repeat;
+
+    pa_assert(j);
+    pa_assert(chunk);
+
+    if (j->decode)
+        decode_packets(j, length);
+
+    if (pa_memblockq_peek(j->memblockq, chunk) < 0) {
+        if (j->playing) {
+            j->playing = FALSE;
+            j->stats.underruns++;
+        }
+
+        return -1;
+    }
+
+    j->playing = TRUE;
+
+    if (chunk->memblock) {
+        if (j->last.memblock)
+            pa_memblock_unref(j->last.memblock);
+
+        j->last = *chunk;
+        pa_memblock_ref(j->last.memblock);
+        j->repeated = 0;
+
+        return 0;
+    }
+
+    /* A hole, the packets for it haven't arrived in time */
+    hole = chunk->length;
+    repeat = j->mode == PA_RTP_CONCEAL_REPEAT && j->last.memblock && j->repeated < j->last.length;
+
+    if (repeat) {
+        *chunk = j->last;
+        chunk->index += j->repeated;
+        chunk->length -= j->repeated;
+    } else
+        *chunk = j->silence;
+
+    pa_memblock_ref(chunk->memblock);
+
+    if (chunk->length > hole)
+        chunk->length = hole;
+
+    if (repeat)
+        j->repeated += chunk->length;
+
+    j->stats.concealed += chunk->length;
+
+    return 0;
+}
+
+pa_usec_t pa_rtp_jitter_get_target(pa_rtp_jitter *j) {
+    pa_assert(j);
+
+    return j->target;
+}
+
+void pa_rtp_jitter_get_stats(pa_rtp_jitter *j, pa_rtp_jitter_stats *stats) {
+    pa_assert(j);
+    pa_assert(stats);
+
+    *stats = j->stats;
+    stats->jitter = (pa_usec_t) j->jitter;
+    stats->target = j->target;
+}
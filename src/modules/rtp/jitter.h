@@ -0,0 +1,106 @@
+#ifndef foortpjitterhfoo
+#define foortpjitterhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+
+#include <pulse/sample.h>
+#include <pulsecore/memblockq.h>
+#include <pulsecore/memchunk.h>
+
+/* A jitter buffer on top of a memblockq. Packets are placed by their
+ * RTP timestamp, so reordered packets land where they belong, and the
+ * sequence numbers tell lost, reordered, duplicated and late packets
+ * apart. Whatever is still missing when it is due to be played is
+ * concealed. The depth the queue prebuffers to follows the jitter of
+ * the packet arrival times.
+ *
+ * With a decoder set, the payloads are kept as they are, by sequence
+ * number, and decoded strictly in that order as far as they are
+ * complete. A packet that is still missing when its place is due is
+ * made up by the decoder, and the original is dropped should it still
+ * arrive. */
+
+typedef struct pa_rtp_jitter pa_rtp_jitter;
+
+typedef enum pa_rtp_conceal_mode {
+    PA_RTP_CONCEAL_SILENCE,  /* Play silence for missing data */
+    PA_RTP_CONCEAL_REPEAT    /* Play the last packet once more, then silence */
+} pa_rtp_conceal_mode_t;
+
+typedef struct pa_rtp_jitter_stats {
+    uint64_t received;       /* Packets that made it into the queue */
+    uint64_t lost;           /* Packets never seen, going by the sequence numbers */
+    uint64_t reordered;      /* Packets that arrived after a later one */
+    uint64_t late;           /* Packets that arrived after they were due */
+    uint64_t duplicates;
+    uint64_t resyncs;        /* Timestamp jumps that restarted the stream */
+    uint64_t recovered;      /* Holes the decoder filled in */
+    uint64_t concealed;      /* Bytes of concealment played */
+    uint64_t underruns;      /* Times the queue ran dry and had to prebuffer again */
+    pa_usec_t jitter;        /* Interarrival jitter as in RFC 3550 */
+    pa_usec_t target;        /* Depth the queue prebuffers to */
+} pa_rtp_jitter_stats;
+
+/* Decodes packet into pcm if it is set. Otherwise makes up n_samples
+ * for a packet that is missing, from the FEC data in next if that is
+ * set, which is the packet right after the missing one. Returns 0 with
+ * a new reference in pcm, or -1 if nothing could be produced. */
+typedef int (*pa_rtp_jitter_decode_cb_t)(void *userdata, const pa_memchunk *packet, const pa_memchunk *next, unsigned n_samples, pa_memchunk *pcm);
+
+/* The memblockq must not have a silence memchunk set, since holes in
+ * it are what is concealed. Its prebuf is controlled from here. The
+ * depth stays between min_target and max_target, a min_target above
+ * max_target is lowered to it. */
+pa_rtp_jitter* pa_rtp_jitter_new(
+        pa_memblockq *q,
+        const pa_sample_spec *ss,
+        const pa_memchunk *silence,
+        pa_rtp_conceal_mode_t mode,
+        pa_usec_t min_target,
+        pa_usec_t max_target);
+
+void pa_rtp_jitter_free(pa_rtp_jitter *j);
+
+/* Switch to queueing encoded packets. Call this before the first
+ * packet is pushed. */
+void pa_rtp_jitter_set_decoder(pa_rtp_jitter *j, pa_rtp_jitter_decode_cb_t cb, void *userdata);
+
+/* Forget the sequence and timestamp of the stream, the next packet is
+ * queued at the write index. Call this after flushing the queue. */
+void pa_rtp_jitter_reset(pa_rtp_jitter *j);
+
+/* Queue the payload of one packet. arrival is the receive time of the
+ * packet. Returns 0 if the payload was queued, -1 if it was dropped as
+ * duplicate or late. */
+int pa_rtp_jitter_push(pa_rtp_jitter *j, uint16_t sequence, uint32_t timestamp, pa_usec_t arrival, const pa_memchunk *chunk);
+
+/* Like pa_memblockq_peek(), but holes are concealed instead of being
+ * returned. length is how much the caller is about to play, missing
+ * packets that this would run into are made up by the decoder. The
+ * caller is expected to drop all of the returned chunk from the
+ * memblockq. */
+int pa_rtp_jitter_peek(pa_rtp_jitter *j, size_t length, pa_memchunk *chunk);
+
+pa_usec_t pa_rtp_jitter_get_target(pa_rtp_jitter *j);
+void pa_rtp_jitter_get_stats(pa_rtp_jitter *j, pa_rtp_jitter_stats *stats);
+
+#endif
@@ -58,9 +58,14 @@
 #include "module-rtp-recv-symdef.h"
 
 #include "rtp.h"
+#include "jitter.h"
 #include "sdp.h"
 #include "sap.h"
 
+#ifdef HAVE_OPUS
+#include "opus-codec.h"
+#endif
+
 PA_MODULE_AUTHOR("Lennart Poettering");
 PA_MODULE_DESCRIPTION("Receive data from a network via RTP/SAP/SDP");
 PA_MODULE_VERSION(PACKAGE_VERSION);
@@ -77,6 +82,9 @@ PA_MODULE_USAGE(
 #define DEATH_TIMEOUT 20
 #define RATE_UPDATE_INTERVAL (5*PA_USEC_PER_SEC)
 #define LATENCY_USEC (500*PA_USEC_PER_MSEC)
+#define MIN_JITTER_USEC (20*PA_USEC_PER_MSEC) /* A few packets at the default MTU of module-rtp-send */
+#define STATS_UPDATE_INTERVAL (2*PA_USEC_PER_SEC)
+#define MAX_OPUS_RECOVER_SAMPLES (PA_RTP_OPUS_RATE/10)
 
 static const char* const valid_modargs[] = {
     "sink",
@@ -90,15 +98,19 @@ struct session {
 
     pa_sink_input *sink_input;
     pa_memblockq *memblockq;
+    pa_rtp_jitter *jitter;
 
     pa_bool_t first_packet;
     uint32_t ssrc;
-    uint32_t offset;
 
     struct pa_sdp_info sdp_info;
 
     pa_rtp_context rtp_context;
 
+#ifdef HAVE_OPUS
+    pa_rtp_opus_decoder *decoder;
+#endif
+
     pa_rtpoll_item *rtpoll_item;
 
     pa_atomic_t timestamp;
@@ -120,6 +132,7 @@ struct userdata {
     pa_io_event* sap_event;
 
     pa_time_event *check_death_event;
+    pa_time_event *stats_event;
 
     char *sink_name;
 
@@ -128,6 +141,10 @@ struct userdata {
     int n_sessions;
 };
 
+enum {
+    SINK_INPUT_MESSAGE_GET_JITTER_STATS = PA_SINK_INPUT_MESSAGE_MAX
+};
+
 static void session_free(struct session *s);
 
 /* Called from I/O thread context */
@@ -141,6 +158,10 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *data, int64_t
             /* Fall through, the default handler will add in the extra
              * latency added by the resampler */
             break;
+
+        case SINK_INPUT_MESSAGE_GET_JITTER_STATS:
+            pa_rtp_jitter_get_stats(s->jitter, data);
+            return 0;
     }
 
     return pa_sink_input_process_msg(o, code, data, offset, chunk);
@@ -152,7 +173,7 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *chunk
     pa_sink_input_assert_ref(i);
     pa_assert_se(s = i->userdata);
 
-    if (pa_memblockq_peek(s->memblockq, chunk) < 0)
+    if (pa_rtp_jitter_peek(s->jitter, length, chunk) < 0)
         return -1;
 
     pa_memblockq_drop(s->memblockq, chunk->length);
@@ -195,92 +216,109 @@ static void sink_input_suspend_within_thread(pa_sink_input* i, pa_bool_t b) {
     pa_sink_input_assert_ref(i);
     pa_assert_se(s = i->userdata);
 
-    if (b)
+    if (b) {
         pa_memblockq_flush_read(s->memblockq);
-    else
+        pa_rtp_jitter_reset(s->jitter);
+    } else
         s->first_packet = FALSE;
 }
 
+#ifdef HAVE_OPUS
 /* Called from I/O thread context */
-static int rtpoll_work_cb(pa_rtpoll_item *i) {
-    pa_memchunk chunk;
-    int64_t k, j, delta;
-    struct timeval now = { 0, 0 };
-    struct session *s;
-    struct pollfd *p;
+static int decode_opus_cb(void *userdata, const pa_memchunk *packet, const pa_memchunk *next, unsigned n_samples, pa_memchunk *pcm) {
+    struct session *s = userdata;
+    size_t frame_size = pa_frame_size(&s->sink_input->sample_spec);
+    const pa_memchunk *source;
+    const uint8_t *data = NULL;
+    int n;
+
+    /* The packets come in playout order, a missing one gets made up
+     * from the FEC data of the one after it or by extrapolation */
+    source = packet ? packet : next;
+
+    if (source)
+        data = (const uint8_t*) pa_memblock_acquire(source->memblock) + source->index;
+
+    if (packet)
+        n = pa_rtp_opus_get_samples(data, packet->length);
+    else
+        n = n_samples <= MAX_OPUS_RECOVER_SAMPLES ? (int) n_samples : -1;
 
-    pa_assert_se(s = pa_rtpoll_item_get_userdata(i));
+    if (n <= 0) {
+        if (source)
+            pa_memblock_release(source->memblock);
 
-    p = pa_rtpoll_item_get_pollfd(i, NULL);
+        if (packet)
+            pa_log_debug("Dropping broken Opus packet.");
 
-    if (p->revents & (POLLERR|POLLNVAL|POLLHUP|POLLOUT)) {
-        pa_log("poll() signalled bad revents.");
         return -1;
     }
 
-    if ((p->revents & POLLIN) == 0)
-        return 0;
+    pcm->memblock = pa_memblock_new(s->userdata->module->core->mempool, (size_t) n * frame_size);
+    pcm->index = 0;
 
-    p->revents = 0;
+    if (packet)
+        n = pa_rtp_opus_decode(s->decoder, data, packet->length, pa_memblock_acquire(pcm->memblock), (unsigned) n);
+    else
+        n = pa_rtp_opus_recover(s->decoder, data, next ? next->length : 0, pa_memblock_acquire(pcm->memblock), (unsigned) n);
 
-    if (pa_rtp_recv(&s->rtp_context, &chunk, s->userdata->module->core->mempool, &now) < 0)
-        return 0;
+    pa_memblock_release(pcm->memblock);
+
+    if (source)
+        pa_memblock_release(source->memblock);
+
+    if (n <= 0) {
+        pa_memblock_unref(pcm->memblock);
+        return -1;
+    }
+
+    pcm->length = (size_t) n * frame_size;
 
+    return 0;
+}
+#endif
+
+/* Called from I/O thread context */
+static void process_packet(struct session *s, pa_memchunk *chunk, struct timeval *now) {
     if (s->sdp_info.payload != s->rtp_context.payload ||
         !PA_SINK_IS_OPENED(s->sink_input->sink->thread_info.state)) {
-        pa_memblock_unref(chunk.memblock);
-        return 0;
+        pa_memblock_unref(chunk->memblock);
+        return;
     }
 
     if (!s->first_packet) {
         s->first_packet = TRUE;
 
         s->ssrc = s->rtp_context.ssrc;
-        s->offset = s->rtp_context.timestamp;
 
         if (s->ssrc == s->userdata->module->core->cookie)
             pa_log_warn("Detected RTP packet loop!");
     } else {
         if (s->ssrc != s->rtp_context.ssrc) {
-            pa_memblock_unref(chunk.memblock);
-            return 0;
+            pa_memblock_unref(chunk->memblock);
+            return;
         }
     }
 
-    /* Check whether there was a timestamp overflow */
-    k = (int64_t) s->rtp_context.timestamp - (int64_t) s->offset;
-    j = (int64_t) 0x100000000LL - (int64_t) s->offset + (int64_t) s->rtp_context.timestamp;
-
-    if ((k < 0 ? -k : k) < (j < 0 ? -j : j))
-        delta = k;
-    else
-        delta = j;
-
-    pa_memblockq_seek(s->memblockq, delta * (int64_t) s->rtp_context.frame_size, PA_SEEK_RELATIVE, TRUE);
-
-    if (now.tv_sec == 0) {
+    if (now->tv_sec == 0) {
         PA_ONCE_BEGIN {
             pa_log_warn("Using artificial time instead of timestamp");
         } PA_ONCE_END;
-        pa_rtclock_get(&now);
+        pa_rtclock_get(now);
     } else
-        pa_rtclock_from_wallclock(&now);
+        pa_rtclock_from_wallclock(now);
 
-    if (pa_memblockq_push(s->memblockq, &chunk) < 0) {
-        pa_log_warn("Queue overrun");
-        pa_memblockq_seek(s->memblockq, (int64_t) chunk.length, PA_SEEK_RELATIVE, TRUE);
-    }
+    /* The jitter buffer places the packet by its timestamp and keeps
+     * track of what is missing, Opus packets it decodes in order */
+    pa_rtp_jitter_push(s->jitter, s->rtp_context.sequence, s->rtp_context.timestamp, pa_timeval_load(now), chunk);
 
 /*     pa_log("blocks in q: %u", pa_memblockq_get_nblocks(s->memblockq)); */
 
-    pa_memblock_unref(chunk.memblock);
-
-    /* The next timestamp we expect */
-    s->offset = s->rtp_context.timestamp + (uint32_t) (chunk.length / s->rtp_context.frame_size);
+    pa_memblock_unref(chunk->memblock);
 
-    pa_atomic_store(&s->timestamp, (int) now.tv_sec);
+    pa_atomic_store(&s->timestamp, (int) now->tv_sec);
 
-    if (s->last_rate_update + RATE_UPDATE_INTERVAL < pa_timeval_load(&now)) {
+    if (s->last_rate_update + RATE_UPDATE_INTERVAL < pa_timeval_load(now)) {
         pa_usec_t wi, ri, render_delay, sink_delay = 0, latency;
         uint32_t base_rate = s->sink_input->sink->sample_spec.rate;
         uint32_t current_rate = s->sink_input->sample_spec.rate;
@@ -289,6 +327,10 @@ static int rtpoll_work_cb(pa_rtpoll_item *i) {
 
         pa_log_debug("Updating sample rate");
 
+        /* Steer towards the depth the jitter buffer wants right now, on
+         * top of what the sink holds */
+        s->intended_latency = s->sink_latency + pa_rtp_jitter_get_target(s->jitter);
+
         wi = pa_bytes_to_usec((uint64_t) pa_memblockq_get_write_index(s->memblockq), &s->sink_input->sample_spec);
         ri = pa_bytes_to_usec((uint64_t) pa_memblockq_get_read_index(s->memblockq), &s->sink_input->sample_spec);
 
@@ -369,7 +411,7 @@ static int rtpoll_work_cb(pa_rtpoll_item *i) {
 
         pa_log_debug("Updated sampling rate to %lu Hz.", (unsigned long) s->sink_input->sample_spec.rate);
 
-        s->last_rate_update = pa_timeval_load(&now);
+        s->last_rate_update = pa_timeval_load(now);
     }
 
     if (pa_memblockq_is_readable(s->memblockq) &&
@@ -379,8 +421,41 @@ static int rtpoll_work_cb(pa_rtpoll_item *i) {
                                      (size_t) (s->sink_input->thread_info.underrun_for == (uint64_t) -1 ? 0 : s->sink_input->thread_info.underrun_for),
                                      FALSE, TRUE, FALSE);
     }
+}
+
+/* Called from I/O thread context */
+static int rtpoll_work_cb(pa_rtpoll_item *i) {
+    pa_memchunk chunk;
+    struct timeval now = { 0, 0 };
+    pa_bool_t received = FALSE;
+    int r;
+    struct session *s;
+    struct pollfd *p;
+
+    pa_assert_se(s = pa_rtpoll_item_get_userdata(i));
+
+    p = pa_rtpoll_item_get_pollfd(i, NULL);
+
+    if (p->revents & (POLLERR|POLLNVAL|POLLHUP|POLLOUT)) {
+        pa_log("poll() signalled bad revents.");
+        return -1;
+    }
+
+    if ((p->revents & POLLIN) == 0)
+        return 0;
 
-    return 1;
+    p->revents = 0;
+
+    /* The RTP context reads up to PA_RTP_BATCH_MAX packets at once, we
+     * take all of them before going back to sleep */
+    do {
+        if ((r = pa_rtp_recv(&s->rtp_context, &chunk, s->userdata->module->core->mempool, &now)) > 0) {
+            process_packet(s, &chunk, &now);
+            received = TRUE;
+        }
+    } while (r != 0 && s->rtp_context.packet_idx < s->rtp_context.n_packets);
+
+    return received ? 1 : 0;
 }
 
 /* Called from I/O thread context */
@@ -513,6 +588,16 @@ static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_in
     s->avg_estimated_rate = (double) sink->sample_spec.rate;
     pa_atomic_store(&s->timestamp, (int) now.tv_sec);
 
+    if (sdp_info->encoding == PA_RTP_ENCODING_OPUS) {
+#ifdef HAVE_OPUS
+        if (!(s->decoder = pa_rtp_opus_decoder_new(sdp_info->sample_spec.channels)))
+            goto fail;
+#else
+        pa_log("Session uses Opus, which is not supported.");
+        goto fail;
+#endif
+    }
+
     if ((fd = mcast_socket((const struct sockaddr*) &sdp_info->sa, sdp_info->salen)) < 0)
         goto fail;
 
@@ -530,6 +615,7 @@ static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_in
         pa_proplist_sets(data.proplist, "rtp.session", sdp_info->session_name);
     pa_proplist_sets(data.proplist, "rtp.origin", sdp_info->origin);
     pa_proplist_setf(data.proplist, "rtp.payload", "%u", (unsigned) sdp_info->payload);
+    pa_proplist_sets(data.proplist, "rtp.codec", sdp_info->encoding == PA_RTP_ENCODING_OPUS ? "opus" : "pcm");
     data.module = u->module;
     pa_sink_input_new_data_set_sample_spec(&data, &sdp_info->sample_spec);
     data.flags = PA_SINK_INPUT_VARIABLE_RATE;
@@ -566,14 +652,33 @@ static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_in
             MEMBLOCKQ_MAXLENGTH,
             MEMBLOCKQ_MAXLENGTH,
             &s->sink_input->sample_spec,
-            pa_usec_to_bytes(s->intended_latency - s->sink_latency, &s->sink_input->sample_spec),
             0,
             0,
-            &silence);
+            0,
+            NULL);
+
+    /* The sink holds its own latency on top of the queue, so the queue
+     * only needs to ride out what the network does. The jitter buffer
+     * starts out small and grows from there. */
+    s->jitter = pa_rtp_jitter_new(
+            s->memblockq,
+            &s->sink_input->sample_spec,
+            &silence,
+            PA_RTP_CONCEAL_REPEAT,
+            MIN_JITTER_USEC,
+            LATENCY_USEC);
+
+#ifdef HAVE_OPUS
+    if (s->decoder)
+        pa_rtp_jitter_set_decoder(s->jitter, decode_opus_cb, s);
+#endif
+
+    s->intended_latency = s->sink_latency + pa_rtp_jitter_get_target(s->jitter);
 
     pa_memblock_unref(silence.memblock);
 
-    pa_rtp_context_init_recv(&s->rtp_context, fd, pa_frame_size(&s->sdp_info.sample_spec));
+    /* Opus packets are any number of bytes */
+    pa_rtp_context_init_recv(&s->rtp_context, fd, s->sdp_info.encoding == PA_RTP_ENCODING_OPUS ? 1 : pa_frame_size(&s->sdp_info.sample_spec));
 
     pa_hashmap_put(s->userdata->by_origin, s->sdp_info.origin, s);
     u->n_sessions++;
@@ -586,6 +691,11 @@ static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_in
     return s;
 
 fail:
+#ifdef HAVE_OPUS
+    if (s && s->decoder)
+        pa_rtp_opus_decoder_free(s->decoder);
+#endif
+
     pa_xfree(s);
 
     if (fd >= 0)
@@ -607,6 +717,12 @@ static void session_free(struct session *s) {
     s->userdata->n_sessions--;
     pa_hashmap_remove(s->userdata->by_origin, s->sdp_info.origin);
 
+    pa_rtp_jitter_free(s->jitter);
+
+#ifdef HAVE_OPUS
+    if (s->decoder)
+        pa_rtp_opus_decoder_free(s->decoder);
+#endif
     pa_memblockq_free(s->memblockq);
     pa_sdp_info_destroy(&s->sdp_info);
     pa_rtp_context_destroy(&s->rtp_context);
@@ -681,6 +797,44 @@ static void check_death_event_cb(pa_mainloop_api *m, pa_time_event *t, const str
     pa_core_rttime_restart(u->module->core, t, pa_rtclock_now() + DEATH_TIMEOUT * PA_USEC_PER_SEC);
 }
 
+static void stats_event_cb(pa_mainloop_api *m, pa_time_event *t, const struct timeval *tv, void *userdata) {
+    struct session *s;
+    struct userdata *u = userdata;
+
+    pa_assert(m);
+    pa_assert(t);
+    pa_assert(u);
+
+    for (s = u->sessions; s; s = s->next) {
+        pa_rtp_jitter_stats stats;
+        pa_proplist *p;
+
+        /* Being moved to another sink, try again next time */
+        if (!s->sink_input->sink)
+            continue;
+
+        pa_assert_se(pa_asyncmsgq_send(s->sink_input->sink->asyncmsgq, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_GET_JITTER_STATS, &stats, 0, NULL) == 0);
+
+        p = pa_proplist_new();
+        pa_proplist_setf(p, "rtp.jitter.received", "%llu", (unsigned long long) stats.received);
+        pa_proplist_setf(p, "rtp.jitter.lost", "%llu", (unsigned long long) stats.lost);
+        pa_proplist_setf(p, "rtp.jitter.reordered", "%llu", (unsigned long long) stats.reordered);
+        pa_proplist_setf(p, "rtp.jitter.late", "%llu", (unsigned long long) stats.late);
+        pa_proplist_setf(p, "rtp.jitter.duplicates", "%llu", (unsigned long long) stats.duplicates);
+        pa_proplist_setf(p, "rtp.jitter.resyncs", "%llu", (unsigned long long) stats.resyncs);
+        pa_proplist_setf(p, "rtp.jitter.recovered", "%llu", (unsigned long long) stats.recovered);
+        pa_proplist_setf(p, "rtp.jitter.concealed_usec", "%llu", (unsigned long long) pa_bytes_to_usec(stats.concealed, &s->sink_input->sample_spec));
+        pa_proplist_setf(p, "rtp.jitter.underruns", "%llu", (unsigned long long) stats.underruns);
+        pa_proplist_setf(p, "rtp.jitter.jitter_usec", "%llu", (unsigned long long) stats.jitter);
+        pa_proplist_setf(p, "rtp.jitter.target_usec", "%llu", (unsigned long long) stats.target);
+
+        pa_sink_input_update_proplist(s->sink_input, PA_UPDATE_REPLACE, p);
+        pa_proplist_free(p);
+    }
+
+    pa_core_rttime_restart(u->module->core, t, pa_rtclock_now() + STATS_UPDATE_INTERVAL);
+}
+
 int pa__init(pa_module*m) {
     struct userdata *u;
     pa_modargs *ma = NULL;
@@ -735,6 +889,7 @@ int pa__init(pa_module*m) {
     u->by_origin = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
 
     u->check_death_event = pa_core_rttime_new(m->core, pa_rtclock_now() + DEATH_TIMEOUT * PA_USEC_PER_SEC, check_death_event_cb, u);
+    u->stats_event = pa_core_rttime_new(m->core, pa_rtclock_now() + STATS_UPDATE_INTERVAL, stats_event_cb, u);
 
     pa_modargs_free(ma);
 
@@ -765,6 +920,9 @@ void pa__done(pa_module*m) {
     if (u->check_death_event)
         m->core->mainloop->time_free(u->check_death_event);
 
+    if (u->stats_event)
+        m->core->mainloop->time_free(u->stats_event);
+
     pa_sap_context_destroy(&u->sap_context);
 
     if (u->by_origin) {
@@ -54,6 +54,10 @@
 #include "sdp.h"
 #include "sap.h"
 
+#ifdef HAVE_OPUS
+#include "opus-codec.h"
+#endif
+
 PA_MODULE_AUTHOR("Lennart Poettering");
 PA_MODULE_DESCRIPTION("Read data from source and send it to the network via RTP/SAP/SDP");
 PA_MODULE_VERSION(PACKAGE_VERSION);
@@ -67,7 +71,11 @@ PA_MODULE_USAGE(
         "port=<port number> "
         "mtu=<maximum transfer unit> "
         "loop=<loopback to local host?> "
-        "ttl=<ttl value>"
+        "ttl=<ttl value> "
+        "codec=<pcm or opus> "
+        "bitrate=<Opus bit rate in bit/s> "
+        "frame_msec=<Opus frame length: 5, 10, 20, 40 or 60> "
+        "fec_loss=<packet loss in percent the Opus FEC is sized for, 0 to disable>"
 );
 
 #define DEFAULT_PORT 46000
@@ -77,6 +85,9 @@ PA_MODULE_USAGE(
 #define MEMBLOCKQ_MAXLENGTH (1024*170)
 #define DEFAULT_MTU 1280
 #define SAP_INTERVAL (5*PA_USEC_PER_SEC)
+#define DEFAULT_OPUS_BITRATE 96000
+#define DEFAULT_OPUS_FRAME_MSEC 20
+#define DEFAULT_OPUS_FEC_LOSS 5
 
 static const char* const valid_modargs[] = {
     "source",
@@ -88,6 +99,10 @@ static const char* const valid_modargs[] = {
     "mtu" ,
     "loop",
     "ttl",
+    "codec",
+    "bitrate",
+    "frame_msec",
+    "fec_loss",
     NULL
 };
 
@@ -102,6 +117,11 @@ struct userdata {
     size_t mtu;
 
     pa_time_event *sap_event;
+
+#ifdef HAVE_OPUS
+    pa_rtp_opus_encoder *encoder;
+    uint8_t *packet;
+#endif
 };
 
 /* Called from I/O thread context */
@@ -121,6 +141,33 @@ static int source_output_process_msg(pa_msgobject *o, int code, void *data, int6
     return pa_source_output_process_msg(o, code, data, offset, chunk);
 }
 
+#ifdef HAVE_OPUS
+/* Called from I/O thread context */
+static void send_opus(struct userdata *u) {
+    unsigned n_samples = pa_rtp_opus_encoder_get_frame_samples(u->encoder);
+    size_t length = n_samples * pa_frame_size(&u->source_output->sample_spec);
+
+    /* Every packet is one frame, the MTU only limits how big it may get */
+    while (pa_memblockq_get_length(u->memblockq) >= length) {
+        pa_memchunk chunk;
+        int r;
+
+        pa_assert_se(pa_memblockq_peek_fixed_size(u->memblockq, length, &chunk) >= 0);
+
+        r = pa_rtp_opus_encode(u->encoder, (const int16_t*) ((uint8_t*) pa_memblock_acquire(chunk.memblock) + chunk.index), u->packet, u->mtu);
+        pa_memblock_release(chunk.memblock);
+        pa_memblock_unref(chunk.memblock);
+
+        pa_memblockq_drop(u->memblockq, length);
+
+        if (r > 0)
+            pa_rtp_send_encoded(&u->rtp_context, u->packet, (size_t) r, n_samples);
+        else
+            u->rtp_context.timestamp += n_samples;
+    }
+}
+#endif
+
 /* Called from I/O thread context */
 static void source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
     struct userdata *u;
@@ -132,6 +179,13 @@ static void source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
         return;
     }
 
+#ifdef HAVE_OPUS
+    if (u->encoder) {
+        send_opus(u);
+        return;
+    }
+#endif
+
     pa_rtp_send(&u->rtp_context, u->mtu, u->memblockq);
 }
 
@@ -166,6 +220,9 @@ int pa__init(pa_module*m) {
     const char *dest;
     uint32_t port = DEFAULT_PORT, mtu;
     uint32_t ttl = DEFAULT_TTL;
+    uint32_t bitrate = DEFAULT_OPUS_BITRATE, frame_msec = DEFAULT_OPUS_FRAME_MSEC, fec_loss = DEFAULT_OPUS_FEC_LOSS;
+    pa_rtp_encoding_t encoding = PA_RTP_ENCODING_PCM;
+    const char *codec;
     sa_family_t af;
     int fd = -1, sap_fd = -1;
     pa_source *s;
@@ -184,6 +241,9 @@ int pa__init(pa_module*m) {
     char hn[128], *n;
     pa_bool_t loop = FALSE;
     pa_source_output_new_data data;
+#ifdef HAVE_OPUS
+    pa_rtp_opus_encoder *encoder = NULL;
+#endif
 
     pa_assert(m);
 
@@ -202,6 +262,20 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    codec = pa_modargs_get_value(ma, "codec", "pcm");
+
+    if (pa_streq(codec, "opus")) {
+#ifdef HAVE_OPUS
+        encoding = PA_RTP_ENCODING_OPUS;
+#else
+        pa_log("Opus support is not available.");
+        goto fail;
+#endif
+    } else if (!pa_streq(codec, "pcm")) {
+        pa_log("codec= expects pcm or opus.");
+        goto fail;
+    }
+
     ss = s->sample_spec;
     pa_rtp_sample_spec_fixup(&ss);
     cm = s->channel_map;
@@ -210,7 +284,29 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
-    if (!pa_rtp_sample_spec_valid(&ss)) {
+    if (encoding == PA_RTP_ENCODING_OPUS) {
+        /* The encoder takes this, and we let the resampler get us there */
+        ss.format = PA_SAMPLE_S16NE;
+        ss.rate = PA_RTP_OPUS_RATE;
+        ss.channels = PA_MIN(ss.channels, 2);
+
+        if (pa_modargs_get_value_u32(ma, "bitrate", &bitrate) < 0 || bitrate < 6000 || bitrate > 510000) {
+            pa_log("bitrate= expects a numerical argument between 6000 and 510000.");
+            goto fail;
+        }
+
+        if (pa_modargs_get_value_u32(ma, "frame_msec", &frame_msec) < 0 ||
+            (frame_msec != 5 && frame_msec != 10 && frame_msec != 20 && frame_msec != 40 && frame_msec != 60)) {
+            pa_log("frame_msec= expects 5, 10, 20, 40 or 60.");
+            goto fail;
+        }
+
+        if (pa_modargs_get_value_u32(ma, "fec_loss", &fec_loss) < 0 || fec_loss > 100) {
+            pa_log("fec_loss= expects a numerical argument between 0 and 100.");
+            goto fail;
+        }
+
+    } else if (!pa_rtp_sample_spec_valid(&ss)) {
         pa_log("Specified sample type not compatible with RTP");
         goto fail;
     }
@@ -218,7 +314,8 @@ int pa__init(pa_module*m) {
     if (ss.channels != cm.channels)
         pa_channel_map_init_auto(&cm, ss.channels, PA_CHANNEL_MAP_AIFF);
 
-    payload = pa_rtp_payload_from_sample_spec(&ss);
+    /* Opus has no static payload type */
+    payload = encoding == PA_RTP_ENCODING_OPUS ? 127 : pa_rtp_payload_from_sample_spec(&ss);
 
     mtu = (uint32_t) pa_frame_align(DEFAULT_MTU, &ss);
 
@@ -315,12 +412,19 @@ int pa__init(pa_module*m) {
     pa_make_fd_nonblock(fd);
     pa_make_udp_socket_low_delay(fd);
 
+#ifdef HAVE_OPUS
+    if (encoding == PA_RTP_ENCODING_OPUS)
+        if (!(encoder = pa_rtp_opus_encoder_new(ss.channels, bitrate, frame_msec, fec_loss)))
+            goto fail;
+#endif
+
     pa_source_output_new_data_init(&data);
     pa_proplist_sets(data.proplist, PA_PROP_MEDIA_NAME, "RTP Monitor Stream");
     pa_proplist_sets(data.proplist, "rtp.destination", dest);
     pa_proplist_setf(data.proplist, "rtp.mtu", "%lu", (unsigned long) mtu);
     pa_proplist_setf(data.proplist, "rtp.port", "%lu", (unsigned long) port);
     pa_proplist_setf(data.proplist, "rtp.ttl", "%lu", (unsigned long) ttl);
+    pa_proplist_sets(data.proplist, "rtp.codec", codec);
     data.driver = __FILE__;
     data.module = m;
     pa_source_output_new_data_set_source(&data, s, FALSE);
@@ -341,12 +445,18 @@ int pa__init(pa_module*m) {
     o->kill = source_output_kill;
 
     pa_log_info("Configured source latency of %llu ms.",
-                (unsigned long long) pa_source_output_set_requested_latency(o, pa_bytes_to_usec(mtu, &o->sample_spec)) / PA_USEC_PER_MSEC);
+                (unsigned long long) pa_source_output_set_requested_latency(o,
+                        encoding == PA_RTP_ENCODING_OPUS ? frame_msec * PA_USEC_PER_MSEC : pa_bytes_to_usec(mtu, &o->sample_spec)) / PA_USEC_PER_MSEC);
 
     m->userdata = o->userdata = u = pa_xnew(struct userdata, 1);
     u->module = m;
     u->source_output = o;
 
+#ifdef HAVE_OPUS
+    u->encoder = encoder;
+    u->packet = encoding == PA_RTP_ENCODING_OPUS ? pa_xmalloc(mtu) : NULL;
+#endif
+
     u->memblockq = pa_memblockq_new(
             "module-rtp-send memblockq",
             0,
@@ -369,13 +479,13 @@ int pa__init(pa_module*m) {
         p = pa_sdp_build(af,
                      (void*) &((struct sockaddr_in*) &sa_dst)->sin_addr,
                      (void*) &sa4.sin_addr,
-                     n, (uint16_t) port, payload, &ss);
+                     n, (uint16_t) port, payload, &ss, encoding);
 #ifdef HAVE_IPV6
     } else {
         p = pa_sdp_build(af,
                      (void*) &((struct sockaddr_in6*) &sa_dst)->sin6_addr,
                      (void*) &sa6.sin6_addr,
-                     n, (uint16_t) port, payload, &ss);
+                     n, (uint16_t) port, payload, &ss, encoding);
 #endif
     }
 
@@ -412,6 +522,11 @@ fail:
         pa_source_output_unref(o);
     }
 
+#ifdef HAVE_OPUS
+    if (encoder)
+        pa_rtp_opus_encoder_free(encoder);
+#endif
+
     return -1;
 }
 
@@ -438,5 +553,12 @@ void pa__done(pa_module*m) {
     if (u->memblockq)
         pa_memblockq_free(u->memblockq);
 
+#ifdef HAVE_OPUS
+    if (u->encoder)
+        pa_rtp_opus_encoder_free(u->encoder);
+
+    pa_xfree(u->packet);
+#endif
+
     pa_xfree(u);
 }
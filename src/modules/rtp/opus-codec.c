@@ -0,0 +1,164 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <opus.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "opus-codec.h"
+
+struct pa_rtp_opus_encoder {
+    OpusEncoder *encoder;
+    unsigned frame_samples;
+};
+
+struct pa_rtp_opus_decoder {
+    OpusDecoder *decoder;
+};
+
+pa_rtp_opus_encoder* pa_rtp_opus_encoder_new(uint8_t channels, uint32_t bitrate, unsigned frame_msec, unsigned expected_loss) {
+    pa_rtp_opus_encoder *e;
+    int error;
+
+    pa_assert(channels == 1 || channels == 2);
+    pa_assert(frame_msec == 5 || frame_msec == 10 || frame_msec == 20 || frame_msec == 40 || frame_msec == 60);
+    pa_assert(expected_loss <= 100);
+
+    e = pa_xnew(pa_rtp_opus_encoder, 1);
+    e->frame_samples = PA_RTP_OPUS_RATE / 1000 * frame_msec;
+
+    if (!(e->encoder = opus_encoder_create(PA_RTP_OPUS_RATE, channels, OPUS_APPLICATION_AUDIO, &error))) {
+        pa_log("Failed to create Opus encoder: %s", opus_strerror(error));
+        pa_xfree(e);
+        return NULL;
+    }
+
+    if ((error = opus_encoder_ctl(e->encoder, OPUS_SET_BITRATE((opus_int32) bitrate))) != OPUS_OK ||
+        (error = opus_encoder_ctl(e->encoder, OPUS_SET_INBAND_FEC(expected_loss > 0))) != OPUS_OK ||
+        (error = opus_encoder_ctl(e->encoder, OPUS_SET_PACKET_LOSS_PERC((int) expected_loss))) != OPUS_OK) {
+        pa_log("Failed to configure Opus encoder: %s", opus_strerror(error));
+        pa_rtp_opus_encoder_free(e);
+        return NULL;
+    }
+
+    return e;
+}
+
+void pa_rtp_opus_encoder_free(pa_rtp_opus_encoder *e) {
+    pa_assert(e);
+
+    opus_encoder_destroy(e->encoder);
+    pa_xfree(e);
+}
+
+unsigned pa_rtp_opus_encoder_get_frame_samples(pa_rtp_opus_encoder *e) {
+    pa_assert(e);
+
+    return e->frame_samples;
+}
+
+int pa_rtp_opus_encode(pa_rtp_opus_encoder *e, const int16_t *pcm, uint8_t *packet, size_t max_size) {
+    opus_int32 r;
+
+    pa_assert(e);
+    pa_assert(pcm);
+    pa_assert(packet);
+
+    if ((r = opus_encode(e->encoder, pcm, (int) e->frame_samples, packet, (opus_int32) max_size)) < 0) {
+        pa_log("Opus encoding failed: %s", opus_strerror(r));
+        return -1;
+    }
+
+    return (int) r;
+}
+
+pa_rtp_opus_decoder* pa_rtp_opus_decoder_new(uint8_t channels) {
+    pa_rtp_opus_decoder *d;
+    int error;
+
+    pa_assert(channels == 1 || channels == 2);
+
+    d = pa_xnew(pa_rtp_opus_decoder, 1);
+
+    if (!(d->decoder = opus_decoder_create(PA_RTP_OPUS_RATE, channels, &error))) {
+        pa_log("Failed to create Opus decoder: %s", opus_strerror(error));
+        pa_xfree(d);
+        return NULL;
+    }
+
+    return d;
+}
+
+void pa_rtp_opus_decoder_free(pa_rtp_opus_decoder *d) {
+    pa_assert(d);
+
+    opus_decoder_destroy(d->decoder);
+    pa_xfree(d);
+}
+
+int pa_rtp_opus_get_samples(const uint8_t *packet, size_t length) {
+    int r;
+
+    pa_assert(packet);
+
+    if (length <= 0)
+        return -1;
+
+    if ((r = opus_packet_get_nb_samples(packet, (opus_int32) length, PA_RTP_OPUS_RATE)) <= 0 || r > PA_RTP_OPUS_MAX_SAMPLES)
+        return -1;
+
+    return r;
+}
+
+int pa_rtp_opus_decode(pa_rtp_opus_decoder *d, const uint8_t *packet, size_t length, int16_t *pcm, unsigned max_samples) {
+    int r;
+
+    pa_assert(d);
+    pa_assert(packet);
+    pa_assert(pcm);
+
+    if ((r = opus_decode(d->decoder, packet, (opus_int32) length, pcm, (int) max_samples, 0)) < 0) {
+        pa_log_debug("Opus decoding failed: %s", opus_strerror(r));
+        return -1;
+    }
+
+    return r;
+}
+
+int pa_rtp_opus_recover(pa_rtp_opus_decoder *d, const uint8_t *next_packet, size_t length, int16_t *pcm, unsigned n_samples) {
+    int r;
+
+    pa_assert(d);
+    pa_assert(pcm);
+
+    /* Without FEC data in it this is the same as passing no packet */
+    if ((r = opus_decode(d->decoder, next_packet, next_packet ? (opus_int32) length : 0, pcm, (int) n_samples, next_packet != NULL)) < 0) {
+        pa_log_debug("Opus loss concealment failed: %s", opus_strerror(r));
+        return -1;
+    }
+
+    return r;
+}
@@ -0,0 +1,66 @@
+#ifndef foortpopuscodechfoo
+#define foortpopuscodechfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+#include <sys/types.h>
+
+#include <pulsecore/macro.h>
+
+#include "rtp.h"
+
+/* Opus as carried in RTP (RFC 7587). Audio is S16NE at
+ * PA_RTP_OPUS_RATE, which is also the RTP clock rate, with one or two
+ * channels. */
+
+/* The longest frame a packet may carry, in samples per channel */
+#define PA_RTP_OPUS_MAX_SAMPLES 5760
+
+typedef struct pa_rtp_opus_encoder pa_rtp_opus_encoder;
+typedef struct pa_rtp_opus_decoder pa_rtp_opus_decoder;
+
+/* frame_msec is one of 5, 10, 20, 40 or 60. If expected_loss is not 0
+ * the encoder adds in-band FEC sized for that loss in percent. */
+pa_rtp_opus_encoder* pa_rtp_opus_encoder_new(uint8_t channels, uint32_t bitrate, unsigned frame_msec, unsigned expected_loss);
+void pa_rtp_opus_encoder_free(pa_rtp_opus_encoder *e);
+
+/* The samples per channel that go into one packet */
+unsigned pa_rtp_opus_encoder_get_frame_samples(pa_rtp_opus_encoder *e);
+
+/* Encodes one frame. Returns the size of the packet or -1 on error. */
+int pa_rtp_opus_encode(pa_rtp_opus_encoder *e, const int16_t *pcm, uint8_t *packet, size_t max_size);
+
+pa_rtp_opus_decoder* pa_rtp_opus_decoder_new(uint8_t channels);
+void pa_rtp_opus_decoder_free(pa_rtp_opus_decoder *d);
+
+/* The samples per channel a packet decodes to, or -1 if it is broken */
+int pa_rtp_opus_get_samples(const uint8_t *packet, size_t length);
+
+/* Decodes a packet into up to max_samples samples per channel. Returns
+ * the samples per channel or -1 on error. */
+int pa_rtp_opus_decode(pa_rtp_opus_decoder *d, const uint8_t *packet, size_t length, int16_t *pcm, unsigned max_samples);
+
+/* Makes up n_samples samples per channel for a packet that never
+ * arrived. If the packet after it is given, the copy of the lost one
+ * it carries as FEC is decoded, otherwise the decoder extrapolates. */
+int pa_rtp_opus_recover(pa_rtp_opus_decoder *d, const uint8_t *next_packet, size_t length, int16_t *pcm, unsigned n_samples);
+
+#endif
@@ -37,6 +37,8 @@
 #include <sys/uio.h>
 #endif
 
+#include <pulse/xmalloc.h>
+
 #include <pulsecore/core-error.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
@@ -56,6 +58,9 @@ pa_rtp_context* pa_rtp_context_init_send(pa_rtp_context *c, int fd, uint32_t ssr
     c->payload = (uint8_t) (payload & 127U);
     c->frame_size = frame_size;
 
+    c->n_packets = c->packet_idx = 0;
+    c->spill = NULL;
+
     pa_memchunk_reset(&c->memchunk);
 
     return c;
@@ -63,9 +68,72 @@ pa_rtp_context* pa_rtp_context_init_send(pa_rtp_context *c, int fd, uint32_t ssr
 
 #define MAX_IOVECS 16
 
+/* The packets of one pa_rtp_send() call that are ready to go out */
+struct send_batch {
+    struct iovec iov[PA_RTP_BATCH_MAX][MAX_IOVECS];
+    pa_memblock *mb[PA_RTP_BATCH_MAX][MAX_IOVECS];
+    uint32_t header[PA_RTP_BATCH_MAX][3];
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr msg[PA_RTP_BATCH_MAX];
+#else
+    struct msghdr msg[PA_RTP_BATCH_MAX];
+#endif
+    unsigned n;
+};
+
+static struct msghdr *batch_msghdr(struct send_batch *b, unsigned i) {
+#ifdef HAVE_SENDMMSG
+    return &b->msg[i].msg_hdr;
+#else
+    return &b->msg[i];
+#endif
+}
+
+static int batch_flush(pa_rtp_context *c, struct send_batch *b) {
+    unsigned i;
+    int sent;
+
+    if (b->n <= 0)
+        return 0;
+
+#ifdef HAVE_SENDMMSG
+    sent = sendmmsg(c->fd, b->msg, b->n, MSG_DONTWAIT);
+#else
+    for (sent = 0; sent < (int) b->n; sent++)
+        if (sendmsg(c->fd, &b->msg[sent], MSG_DONTWAIT) < 0)
+            break;
+
+    if (sent == 0)
+        sent = -1;
+#endif
+
+    for (i = 0; i < b->n; i++) {
+        struct msghdr *m = batch_msghdr(b, i);
+        size_t j;
+
+        for (j = 1; j < m->msg_iovlen; j++) {
+            pa_memblock_release(b->mb[i][j]);
+            pa_memblock_unref(b->mb[i][j]);
+        }
+    }
+
+    /* Whatever didn't fit into the socket buffer is dropped */
+    if (sent < (int) b->n) {
+        if (sent < 0 && errno != EAGAIN && errno != EINTR) /* If the queue is full, just ignore it */
+            pa_log("sendmsg() failed: %s", pa_cstrerror(errno));
+
+        b->n = 0;
+        return -1;
+    }
+
+    b->n = 0;
+    return 0;
+}
+
 int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
-    struct iovec iov[MAX_IOVECS];
-    pa_memblock* mb[MAX_IOVECS];
+    struct send_batch b;
+    struct iovec *iov;
+    pa_memblock **mb;
     int iov_idx = 1;
     size_t n = 0;
 
@@ -76,6 +144,10 @@ int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
     if (pa_memblockq_get_length(q) < size)
         return 0;
 
+    b.n = 0;
+    iov = b.iov[0];
+    mb = b.mb[0];
+
     for (;;) {
         int r;
         pa_memchunk chunk;
@@ -100,138 +172,322 @@ int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
         pa_assert(n % c->frame_size == 0);
 
         if (r < 0 || n >= size || iov_idx >= MAX_IOVECS) {
-            uint32_t header[3];
-            struct msghdr m;
-            ssize_t k;
-            int i;
+            pa_bool_t last = r < 0 || pa_memblockq_get_length(q) < size;
 
             if (n > 0) {
+                uint32_t *header = b.header[b.n];
+                struct msghdr *m = batch_msghdr(&b, b.n);
+
                 header[0] = htonl(((uint32_t) 2 << 30) | ((uint32_t) c->payload << 16) | ((uint32_t) c->sequence));
                 header[1] = htonl(c->timestamp);
                 header[2] = htonl(c->ssrc);
 
                 iov[0].iov_base = (void*)header;
-                iov[0].iov_len = sizeof(header);
-
-                m.msg_name = NULL;
-                m.msg_namelen = 0;
-                m.msg_iov = iov;
-                m.msg_iovlen = (size_t) iov_idx;
-                m.msg_control = NULL;
-                m.msg_controllen = 0;
-                m.msg_flags = 0;
+                iov[0].iov_len = 3 * sizeof(uint32_t);
 
-                k = sendmsg(c->fd, &m, MSG_DONTWAIT);
-
-                for (i = 1; i < iov_idx; i++) {
-                    pa_memblock_release(mb[i]);
-                    pa_memblock_unref(mb[i]);
-                }
+                m->msg_name = NULL;
+                m->msg_namelen = 0;
+                m->msg_iov = iov;
+                m->msg_iovlen = (size_t) iov_idx;
+                m->msg_control = NULL;
+                m->msg_controllen = 0;
+                m->msg_flags = 0;
 
+                b.n++;
                 c->sequence++;
-            } else
-                k = 0;
+            }
 
             c->timestamp += (unsigned) (n/c->frame_size);
 
-            if (k < 0) {
-                if (errno != EAGAIN && errno != EINTR) /* If the queue is full, just ignore it */
-                    pa_log("sendmsg() failed: %s", pa_cstrerror(errno));
-                return -1;
-            }
+            /* Send the packets we have so far in one go */
+            if (last || b.n >= PA_RTP_BATCH_MAX)
+                if (batch_flush(c, &b) < 0)
+                    return -1;
 
-            if (r < 0 || pa_memblockq_get_length(q) < size)
+            if (last)
                 break;
 
             n = 0;
             iov_idx = 1;
+            iov = b.iov[b.n];
+            mb = b.mb[b.n];
         }
     }
 
     return 0;
 }
 
+int pa_rtp_send_encoded(pa_rtp_context *c, const void *data, size_t length, uint32_t n_samples) {
+    uint32_t header[3];
+    struct iovec iov[2];
+    struct msghdr m;
+    ssize_t k;
+
+    pa_assert(c);
+    pa_assert(data);
+    pa_assert(length > 0);
+
+    header[0] = htonl(((uint32_t) 2 << 30) | ((uint32_t) c->payload << 16) | ((uint32_t) c->sequence));
+    header[1] = htonl(c->timestamp);
+    header[2] = htonl(c->ssrc);
+
+    iov[0].iov_base = (void*) header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = (void*) data;
+    iov[1].iov_len = length;
+
+    m.msg_name = NULL;
+    m.msg_namelen = 0;
+    m.msg_iov = iov;
+    m.msg_iovlen = 2;
+    m.msg_control = NULL;
+    m.msg_controllen = 0;
+    m.msg_flags = 0;
+
+    k = sendmsg(c->fd, &m, MSG_DONTWAIT);
+
+    c->sequence++;
+    c->timestamp += n_samples;
+
+    if (k < 0) {
+        if (errno != EAGAIN && errno != EINTR) /* If the queue is full, just ignore it */
+            pa_log("sendmsg() failed: %s", pa_cstrerror(errno));
+
+        return -1;
+    }
+
+    return 0;
+}
+
 pa_rtp_context* pa_rtp_context_init_recv(pa_rtp_context *c, int fd, size_t frame_size) {
     pa_assert(c);
 
     c->fd = fd;
     c->frame_size = frame_size;
 
+    c->n_packets = c->packet_idx = 0;
+    c->slot_size = 0;
+    c->spill = NULL;
+
     pa_memchunk_reset(&c->memchunk);
     return c;
 }
 
-int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct timeval *tstamp) {
-    int size;
-    struct msghdr m;
-    struct cmsghdr *cm;
-    struct iovec iov;
-    uint32_t header;
-    unsigned cc;
-    ssize_t r;
-    uint8_t aux[1024];
-    pa_bool_t found_tstamp = FALSE;
+/* Enough for the SCM_TIMESTAMP we ask for */
+#define AUX_SIZE 128
+
+/* No UDP datagram is larger than this */
+#define MAX_DATAGRAM_SIZE 65536
+
+/* Reads all packets that are waiting, up to PA_RTP_BATCH_MAX, straight
+ * into one memblock. Each packet gets a slot of slot_size bytes in it,
+ * the next read continues after the last packet. A packet that is
+ * larger than its slot continues in a spill buffer and is copied into
+ * a memblock of its own, so nothing is ever truncated. Returns the
+ * number of packets, 0 if there was nothing to read, -1 on error. */
+static int recv_batch(pa_rtp_context *c, pa_mempool *pool) {
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr msg[PA_RTP_BATCH_MAX];
+#else
+    struct msghdr msg[1];
+#endif
+    struct iovec iov[PA_RTP_BATCH_MAX][2];
+    uint8_t aux[PA_RTP_BATCH_MAX][AUX_SIZE];
+    unsigned i, n_slots;
+    uint8_t *d;
+    size_t largest = 0;
+    int size, r;
 
-    pa_assert(c);
-    pa_assert(chunk);
+    pa_assert(c->packet_idx == c->n_packets);
 
-    pa_memchunk_reset(chunk);
+    c->n_packets = c->packet_idx = 0;
 
     if (ioctl(c->fd, FIONREAD, &size) < 0) {
         pa_log_warn("FIONREAD failed: %s", pa_cstrerror(errno));
-        goto fail;
+        return -1;
     }
 
     if (size <= 0)
         return 0;
 
-    if (c->memchunk.length < (unsigned) size) {
+    /* Slots are as large as the largest packet we have seen so far,
+     * which usually is what the sender's MTU allows */
+    c->slot_size = PA_MIN(PA_MAX(c->slot_size, PA_ALIGN((size_t) size)), (size_t) MAX_DATAGRAM_SIZE);
+
+    if (!c->spill)
+        c->spill = pa_xmalloc(PA_RTP_BATCH_MAX * MAX_DATAGRAM_SIZE);
+
+#ifdef HAVE_RECVMMSG
+    n_slots = PA_RTP_BATCH_MAX;
+#else
+    n_slots = 1;
+#endif
+
+    if (c->memchunk.length < n_slots * c->slot_size) {
         size_t l;
 
         if (c->memchunk.memblock)
             pa_memblock_unref(c->memchunk.memblock);
 
-        l = PA_MAX((size_t) size, pa_mempool_block_size_max(pool));
+        l = PA_MAX(n_slots * c->slot_size, pa_mempool_block_size_max(pool));
 
         c->memchunk.memblock = pa_memblock_new(pool, l);
         c->memchunk.index = 0;
         c->memchunk.length = pa_memblock_get_length(c->memchunk.memblock);
     }
 
-    pa_assert(c->memchunk.length >= (size_t) size);
+    d = (uint8_t*) pa_memblock_acquire(c->memchunk.memblock) + c->memchunk.index;
 
-    chunk->memblock = pa_memblock_ref(c->memchunk.memblock);
-    chunk->index = c->memchunk.index;
+    for (i = 0; i < n_slots; i++) {
+        struct msghdr *m;
 
-    iov.iov_base = (uint8_t*) pa_memblock_acquire(chunk->memblock) + chunk->index;
-    iov.iov_len = (size_t) size;
+        iov[i][0].iov_base = d + i * c->slot_size;
+        iov[i][0].iov_len = c->slot_size;
+        iov[i][1].iov_base = c->spill + i * MAX_DATAGRAM_SIZE;
+        iov[i][1].iov_len = MAX_DATAGRAM_SIZE;
 
-    m.msg_name = NULL;
-    m.msg_namelen = 0;
-    m.msg_iov = &iov;
-    m.msg_iovlen = 1;
-    m.msg_control = aux;
-    m.msg_controllen = sizeof(aux);
-    m.msg_flags = 0;
+#ifdef HAVE_RECVMMSG
+        m = &msg[i].msg_hdr;
+#else
+        m = &msg[i];
+#endif
+        m->msg_name = NULL;
+        m->msg_namelen = 0;
+        m->msg_iov = iov[i];
+        m->msg_iovlen = 2;
+        m->msg_control = aux[i];
+        m->msg_controllen = AUX_SIZE;
+        m->msg_flags = 0;
+    }
 
-    r = recvmsg(c->fd, &m, 0);
-    pa_memblock_release(chunk->memblock);
+#ifdef HAVE_RECVMMSG
+    r = recvmmsg(c->fd, msg, n_slots, MSG_DONTWAIT|MSG_TRUNC, NULL);
+#else
+    size = (int) recvmsg(c->fd, &msg[0], MSG_DONTWAIT|MSG_TRUNC);
+    r = size < 0 ? -1 : 1;
+#endif
 
-    if (r != size) {
-        if (r < 0 && errno != EAGAIN && errno != EINTR)
-            pa_log_warn("recvmsg() failed: %s", r < 0 ? pa_cstrerror(errno) : "size mismatch");
+    if (r < 0) {
+        pa_memblock_release(c->memchunk.memblock);
 
-        goto fail;
+        if (errno == EAGAIN || errno == EINTR)
+            return 0;
+
+        pa_log_warn("recvmsg() failed: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    for (i = 0; i < (unsigned) r; i++) {
+        pa_rtp_packet *p = &c->packets[c->n_packets];
+        struct cmsghdr *cm;
+        struct msghdr *m;
+        size_t length;
+
+#ifdef HAVE_RECVMMSG
+        m = &msg[i].msg_hdr;
+        length = msg[i].msg_len;
+#else
+        m = &msg[i];
+        length = (size_t) size;
+#endif
+
+        if (m->msg_flags & MSG_TRUNC) {
+            pa_log_warn("RTP packet too large, dropped.");
+            continue;
+        }
+
+        if (length > c->slot_size) {
+            uint8_t *t;
+
+            /* Didn't fit, put it together in a block of its own */
+            p->chunk.memblock = pa_memblock_new(pool, length);
+            p->chunk.index = 0;
+            p->chunk.length = length;
+
+            t = pa_memblock_acquire(p->chunk.memblock);
+            memcpy(t, d + i * c->slot_size, c->slot_size);
+            memcpy(t + c->slot_size, c->spill + i * MAX_DATAGRAM_SIZE, length - c->slot_size);
+            pa_memblock_release(p->chunk.memblock);
+
+            largest = PA_MAX(largest, length);
+        } else {
+            p->chunk.memblock = pa_memblock_ref(c->memchunk.memblock);
+            p->chunk.index = c->memchunk.index + i * c->slot_size;
+            p->chunk.length = length;
+        }
+
+        memset(&p->tstamp, 0, sizeof(p->tstamp));
+
+        for (cm = CMSG_FIRSTHDR(m); cm; cm = CMSG_NXTHDR(m, cm))
+            if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMP) {
+                memcpy(&p->tstamp, CMSG_DATA(cm), sizeof(struct timeval));
+                break;
+            }
+
+        c->n_packets++;
+    }
+
+    pa_memblock_release(c->memchunk.memblock);
+
+    /* The next batch goes right behind the last packet of this one */
+    if (r > 0) {
+        size_t used = (r - 1) * c->slot_size;
+
+#ifdef HAVE_RECVMMSG
+        used += PA_ALIGN(PA_MIN((size_t) msg[r - 1].msg_len, c->slot_size));
+#else
+        used += PA_ALIGN(PA_MIN((size_t) size, c->slot_size));
+#endif
+
+        c->memchunk.index += used;
+        c->memchunk.length -= PA_MIN(used, c->memchunk.length);
+
+        if (c->memchunk.length <= 0) {
+            pa_memblock_unref(c->memchunk.memblock);
+            pa_memchunk_reset(&c->memchunk);
+        }
     }
 
-    if (size < 12) {
+    /* Make room for packets this large from now on */
+    if (largest > 0) {
+        pa_log_debug("RTP packet of %lu bytes larger than its slot.", (unsigned long) largest);
+        c->slot_size = PA_MIN(PA_ALIGN(largest), (size_t) MAX_DATAGRAM_SIZE);
+    }
+
+    return (int) c->n_packets;
+}
+
+int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct timeval *tstamp) {
+    pa_rtp_packet *p;
+    uint8_t *d;
+    uint32_t header;
+    unsigned cc;
+
+    pa_assert(c);
+    pa_assert(chunk);
+
+    pa_memchunk_reset(chunk);
+
+    if (c->packet_idx >= c->n_packets) {
+        int r;
+
+        if ((r = recv_batch(c, pool)) <= 0)
+            return r;
+    }
+
+    p = &c->packets[c->packet_idx++];
+    *chunk = p->chunk;
+
+    if (chunk->length < 12) {
         pa_log_warn("RTP packet too short.");
         goto fail;
     }
 
-    memcpy(&header, iov.iov_base, sizeof(uint32_t));
-    memcpy(&c->timestamp, (uint8_t*) iov.iov_base + 4, sizeof(uint32_t));
-    memcpy(&c->ssrc, (uint8_t*) iov.iov_base + 8, sizeof(uint32_t));
+    d = (uint8_t*) pa_memblock_acquire(chunk->memblock) + chunk->index;
+    memcpy(&header, d, sizeof(uint32_t));
+    memcpy(&c->timestamp, d + 4, sizeof(uint32_t));
+    memcpy(&c->ssrc, d + 8, sizeof(uint32_t));
+    pa_memblock_release(chunk->memblock);
 
     header = ntohl(header);
     c->timestamp = ntohl(c->timestamp);
@@ -256,44 +512,29 @@ int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct
     c->payload = (uint8_t) ((header >> 16) & 127U);
     c->sequence = (uint16_t) (header & 0xFFFFU);
 
-    if (12 + cc*4 > (unsigned) size) {
+    if (12 + cc*4 > chunk->length) {
         pa_log_warn("RTP packet too short. (CSRC)");
         goto fail;
     }
 
     chunk->index += 12 + cc*4;
-    chunk->length = (size_t) size - 12 + cc*4;
+    chunk->length -= 12 + cc*4;
 
     if (chunk->length % c->frame_size != 0) {
         pa_log_warn("Bad RTP packet size.");
         goto fail;
     }
 
-    c->memchunk.index = chunk->index + chunk->length;
-    c->memchunk.length = pa_memblock_get_length(c->memchunk.memblock) - c->memchunk.index;
-
-    if (c->memchunk.length <= 0) {
-        pa_memblock_unref(c->memchunk.memblock);
-        pa_memchunk_reset(&c->memchunk);
-    }
-
-    for (cm = CMSG_FIRSTHDR(&m); cm; cm = CMSG_NXTHDR(&m, cm))
-        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMP) {
-            memcpy(tstamp, CMSG_DATA(cm), sizeof(struct timeval));
-            found_tstamp = TRUE;
-            break;
-        }
-
-    if (!found_tstamp) {
+    if (p->tstamp.tv_sec == 0 && p->tstamp.tv_usec == 0)
         pa_log_warn("Couldn't find SCM_TIMESTAMP data in auxiliary recvmsg() data!");
-        memset(tstamp, 0, sizeof(tstamp));
-    }
 
-    return 0;
+    *tstamp = p->tstamp;
+
+    return 1;
 
 fail:
-    if (chunk->memblock)
-        pa_memblock_unref(chunk->memblock);
+    pa_memblock_unref(chunk->memblock);
+    pa_memchunk_reset(chunk);
 
     return -1;
 }
@@ -378,6 +619,11 @@ void pa_rtp_context_destroy(pa_rtp_context *c) {
 
     if (c->memchunk.memblock)
         pa_memblock_unref(c->memchunk.memblock);
+
+    for (; c->packet_idx < c->n_packets; c->packet_idx++)
+        pa_memblock_unref(c->packets[c->packet_idx].chunk.memblock);
+
+    pa_xfree(c->spill);
 }
 
 const char* pa_rtp_format_to_string(pa_sample_format_t f) {
@@ -24,10 +24,28 @@
 
 #include <inttypes.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <pulsecore/memblockq.h>
 #include <pulsecore/memchunk.h>
 
+/* How many packets are sent or received with one system call */
+#define PA_RTP_BATCH_MAX 16
+
+/* What the payload of a stream is */
+typedef enum pa_rtp_encoding {
+    PA_RTP_ENCODING_PCM,    /* L16, L8, PCMA or PCMU */
+    PA_RTP_ENCODING_OPUS
+} pa_rtp_encoding_t;
+
+/* Opus always uses a 48 kHz RTP clock (RFC 7587) */
+#define PA_RTP_OPUS_RATE 48000
+
+typedef struct pa_rtp_packet {
+    pa_memchunk chunk;
+    struct timeval tstamp;
+} pa_rtp_packet;
+
 typedef struct pa_rtp_context {
     int fd;
     uint16_t sequence;
@@ -36,7 +54,18 @@ typedef struct pa_rtp_context {
     uint8_t payload;
     size_t frame_size;
 
+    /* When receiving, the part of the current memblock that has not
+     * been received into yet */
     pa_memchunk memchunk;
+
+    /* Packets received in one go that haven't been returned by
+     * pa_rtp_recv() yet */
+    pa_rtp_packet packets[PA_RTP_BATCH_MAX];
+    unsigned n_packets, packet_idx;
+    size_t slot_size;
+
+    /* Where the part of a packet that doesn't fit into its slot goes */
+    uint8_t *spill;
 } pa_rtp_context;
 
 pa_rtp_context* pa_rtp_context_init_send(pa_rtp_context *c, int fd, uint32_t ssrc, uint8_t payload, size_t frame_size);
@@ -45,7 +74,17 @@ pa_rtp_context* pa_rtp_context_init_send(pa_rtp_context *c, int fd, uint32_t ssr
  * guarantee that the current read index doesn't point to a hole. */
 int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q);
 
+/* Sends one packet with a payload that is encoded already and covers
+ * n_samples samples of the RTP clock */
+int pa_rtp_send_encoded(pa_rtp_context *c, const void *data, size_t length, uint32_t n_samples);
+
 pa_rtp_context* pa_rtp_context_init_recv(pa_rtp_context *c, int fd, size_t frame_size);
+
+/* Returns 1 and the payload of the next packet in chunk, 0 if there is
+ * nothing to read right now and -1 if a bad packet was dropped or
+ * reading failed. Reads
+ * as many packets as are waiting, up to PA_RTP_BATCH_MAX, at once, so
+ * call this until it returns 0. */
 int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct timeval *tstamp);
 
 void pa_rtp_context_destroy(pa_rtp_context *c);
@@ -41,9 +41,9 @@
 #include "sdp.h"
 #include "rtp.h"
 
-char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, uint16_t port, uint8_t payload, const pa_sample_spec *ss) {
+char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, uint16_t port, uint8_t payload, const pa_sample_spec *ss, pa_rtp_encoding_t encoding) {
     uint32_t ntp;
-    char buf_src[64], buf_dst[64], un[64];
+    char buf_src[64], buf_dst[64], un[64], map[128];
     const char *u, *f;
 
     pa_assert(src);
@@ -55,7 +55,18 @@ char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, u
     pa_assert(af == AF_INET);
 #endif
 
-    pa_assert_se(f = pa_rtp_format_to_string(ss->format));
+    if (encoding == PA_RTP_ENCODING_OPUS)
+        /* RFC 7587 always announces two channels and tells mono from
+         * stereo in the format parameters */
+        pa_snprintf(map, sizeof(map),
+                    "a=rtpmap:%i opus/%u/2\n"
+                    "a=fmtp:%i stereo=%i; sprop-stereo=%i; useinbandfec=1",
+                    payload, PA_RTP_OPUS_RATE,
+                    payload, ss->channels > 1, ss->channels > 1);
+    else {
+        pa_assert_se(f = pa_rtp_format_to_string(ss->format));
+        pa_snprintf(map, sizeof(map), "a=rtpmap:%i %s/%u/%u", payload, f, ss->rate, ss->channels);
+    }
 
     if (!(u = pa_get_user_name(un, sizeof(un))))
         u = "-";
@@ -73,22 +84,30 @@ char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, u
             "t=%lu 0\n"
             "a=recvonly\n"
             "m=audio %u RTP/AVP %i\n"
-            "a=rtpmap:%i %s/%u/%u\n"
+            "%s\n"
             "a=type:broadcast\n",
             u, (unsigned long) ntp, af == AF_INET ? "IP4" : "IP6", buf_src,
             name,
             af == AF_INET ? "IP4" : "IP6", buf_dst,
             (unsigned long) ntp,
             port, payload,
-            payload, f, ss->rate, ss->channels);
+            map);
 }
 
-static pa_sample_spec *parse_sdp_sample_spec(pa_sample_spec *ss, char *c) {
+static pa_sample_spec *parse_sdp_sample_spec(pa_sample_spec *ss, pa_rtp_encoding_t *encoding, char *c) {
     unsigned rate, channels;
     pa_assert(ss);
+    pa_assert(encoding);
     pa_assert(c);
 
-    if (pa_startswith(c, "L16/")) {
+    *encoding = PA_RTP_ENCODING_PCM;
+
+    if (pa_startswith(c, "opus/")) {
+        /* Decoded Opus is what we play */
+        ss->format = PA_SAMPLE_S16NE;
+        *encoding = PA_RTP_ENCODING_OPUS;
+        c += 5;
+    } else if (pa_startswith(c, "L16/")) {
         ss->format = PA_SAMPLE_S16BE;
         c += 4;
     } else if (pa_startswith(c, "L8/")) {
@@ -120,7 +139,7 @@ static pa_sample_spec *parse_sdp_sample_spec(pa_sample_spec *ss, char *c) {
 
 pa_sdp_info *pa_sdp_parse(const char *t, pa_sdp_info *i, int is_goodbye) {
     uint16_t port = 0;
-    pa_bool_t ss_valid = FALSE;
+    pa_bool_t ss_valid = FALSE, mono = FALSE;
 
     pa_assert(t);
     pa_assert(i);
@@ -128,6 +147,7 @@ pa_sdp_info *pa_sdp_parse(const char *t, pa_sdp_info *i, int is_goodbye) {
     i->origin = i->session_name = NULL;
     i->salen = 0;
     i->payload = 255;
+    i->encoding = PA_RTP_ENCODING_PCM;
 
     if (!pa_startswith(t, PA_SDP_HEADER)) {
         pa_log("Failed to parse SDP data: invalid header.");
@@ -226,11 +246,27 @@ pa_sdp_info *pa_sdp_parse(const char *t, pa_sdp_info *i, int is_goodbye) {
 
                         c[strcspn(c, "\n")] = 0;
 
-                        if (parse_sdp_sample_spec(&i->sample_spec, c))
+                        if (parse_sdp_sample_spec(&i->sample_spec, &i->encoding, c))
                             ss_valid = TRUE;
                     }
                 }
             }
+        } else if (pa_startswith(t, "a=fmtp:")) {
+
+            if (i->payload <= 127) {
+                int _payload;
+
+                /* The only parameter we care for is whether an Opus
+                 * sender sends mono */
+                if (sscanf(t+7, "%i", &_payload) == 1 && _payload == i->payload) {
+                    char *f = pa_xstrndup(t+7, l-7);
+
+                    if (strstr(f, "sprop-stereo=0"))
+                        mono = TRUE;
+
+                    pa_xfree(f);
+                }
+            }
         }
 
         t += l;
@@ -244,6 +280,15 @@ pa_sdp_info *pa_sdp_parse(const char *t, pa_sdp_info *i, int is_goodbye) {
         goto fail;
     }
 
+    if (ss_valid && i->encoding == PA_RTP_ENCODING_OPUS) {
+        if (i->sample_spec.rate != PA_RTP_OPUS_RATE) {
+            pa_log("Failed to parse SDP data: Opus at %u Hz.", i->sample_spec.rate);
+            goto fail;
+        }
+
+        i->sample_spec.channels = mono ? 1 : 2;
+    }
+
     if (((struct sockaddr*) &i->sa)->sa_family == AF_INET)
         ((struct sockaddr_in*) &i->sa)->sin_port = htons(port);
     else
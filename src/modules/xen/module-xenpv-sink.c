@@ -108,7 +108,8 @@ struct userdata {
     pa_thread_mq thread_mq;
     pa_rtpoll *rtpoll;
 
-    pa_memchunk memchunk;
+    /* The buffer of the ring, which we render into directly */
+    pa_memblock *ring_block;
 
     pa_rtpoll_item *rtpoll_item;
 
@@ -148,7 +149,7 @@ struct ioctl_gntalloc_alloc_gref gref;
 static int register_backend_state_watch(void);
 static int wait_for_backend_state_change(void);
 static int alloc_gref(struct ioctl_gntalloc_alloc_gref *gref, void **addr);
-static int ring_write(struct ring *r, void *src, int length);
+static size_t ring_fill(struct ring *r);
 static int publish_spec(pa_sample_spec *ss);
 static int read_backend_default_spec(pa_sample_spec *ss);
 static int publish_param(const char *paramname, const char *value);
@@ -265,7 +266,8 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
         case PA_SINK_MESSAGE_GET_LATENCY: {
             size_t n = 0;
 
-            n += u->memchunk.length;
+            /* Everything the backend hasn't picked up yet */
+            n += ring_fill(ioring);
 
             *((pa_usec_t*) data) = pa_bytes_to_usec(n, &u->sink->sample_spec);
             return 0;
@@ -275,52 +277,53 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
     return pa_sink_process_msg(o, code, data, offset, chunk);
 }
 
-static int process_render(struct userdata *u) {
-    pa_assert(u);
-
+static void render_into_ring(struct userdata *u, uint32_t index, size_t length) {
+    pa_memchunk chunk;
 
-    if (u->memchunk.length <= 0)
-        pa_sink_render(u->sink, ioring->usable_buffer_space, &u->memchunk);
+    chunk.memblock = u->ring_block;
+    chunk.index = index;
+    chunk.length = length;
 
+    pa_sink_render_into_full(u->sink, &chunk);
+}
 
-    pa_assert(u->memchunk.length > 0);
-
-    xc_evtchn_notify(xce, xen_evtchn_port);
-    for (;;) {
-        ssize_t l;
-        void *p;
+static int process_render(struct userdata *u) {
+    uint32_t cons, prod;
+    size_t free_bytes, n;
 
-        p = pa_memblock_acquire(u->memchunk.memblock);
-	    /* xen: write data to ring buffer & notify backend */
-        l = ring_write(ioring, (uint8_t*)p + u->memchunk.index, u->memchunk.length);
+    pa_assert(u);
 
-        pa_memblock_release(u->memchunk.memblock);
+    cons = ioring->cons_indx;
+    prod = ioring->prod_indx;
+    xen_rmb();
 
-        pa_assert(l != 0);
+    /* Fill up whatever the backend has consumed so far. One byte stays
+     * free so that a full ring can be told from an empty one. */
+    free_bytes = (cons + ioring->usable_buffer_space - prod - 1) % ioring->usable_buffer_space;
+    free_bytes -= free_bytes % pa_frame_size(&u->sink->sample_spec);
 
-        if (l < 0) {
-            if (errno == EINTR)
-                continue;
-            else if (errno == EAGAIN)
-                return 0;
-            else {
-                pa_log("Failed to write data to FIFO: %s", pa_cstrerror(errno));
-                return -1;
-            }
+    if (free_bytes <= 0)
+        return 0;
 
-        } else {
+    /* xen: render straight into the ring, in two steps if the free
+     * space wraps around its end */
+    n = PA_MIN(free_bytes, (size_t) (ioring->usable_buffer_space - prod));
+    render_into_ring(u, prod, n);
 
-            u->memchunk.index += (size_t) l;
-            u->memchunk.length -= (size_t) l;
+    if (free_bytes > n)
+        render_into_ring(u, 0, free_bytes - n);
 
-            if (u->memchunk.length <= 0) {
-                pa_memblock_unref(u->memchunk.memblock);
-                pa_memchunk_reset(&u->memchunk);
-            }
-        }
+    /* The audio has to be in the ring before the backend sees the new
+     * index */
+    xen_wmb();
+    ioring->prod_indx = (uint32_t) ((prod + free_bytes) % ioring->usable_buffer_space);
 
-        return 0;
+    if (xc_evtchn_notify(xce, xen_evtchn_port) < 0) {
+        pa_log("Failed to notify backend: %s", pa_cstrerror(errno));
+        return -1;
     }
+
+    return 0;
 }
 
 static void thread_func(void *userdata) {
@@ -336,26 +339,31 @@ static void thread_func(void *userdata) {
         struct pollfd *pollfd;
         int ret;
 
-        pollfd = pa_rtpoll_item_get_pollfd(u->rtpoll_item, NULL);
-
-        /* Render some data and write it to the fifo */
+        /* Render some data into the ring */
         if (PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
 
             if (u->sink->thread_info.rewind_requested)
                 pa_sink_process_rewind(u->sink, 0);
 
-            if (pollfd->revents) {
+            if (u->sink->thread_info.state == PA_SINK_RUNNING)
                 if (process_render(u) < 0)
                     goto fail;
-
-                pollfd->revents = 0;
-            }
         }
 
-        /* Hmm, nothing to do. Let's sleep */
+        /* The backend kicks the event channel when it has consumed
+         * something. In case it doesn't we come back anyway when half of
+         * what is in the ring has been played. */
+        pollfd = pa_rtpoll_item_get_pollfd(u->rtpoll_item, NULL);
 
-        pollfd->events = (short) (u->sink->thread_info.state == PA_SINK_RUNNING ? POLLOUT : 0);
+        if (u->sink->thread_info.state == PA_SINK_RUNNING) {
+            pollfd->events = POLLIN;
+            pa_rtpoll_set_timer_relative(u->rtpoll, pa_bytes_to_usec(ring_fill(ioring), &u->sink->sample_spec) / 2);
+        } else {
+            pollfd->events = 0;
+            pa_rtpoll_set_timer_disabled(u->rtpoll);
+        }
 
+        /* Hmm, nothing to do. Let's sleep */
         if ((ret = pa_rtpoll_run(u->rtpoll, TRUE)) < 0)
             goto fail;
 
@@ -364,10 +372,21 @@ static void thread_func(void *userdata) {
 
         pollfd = pa_rtpoll_item_get_pollfd(u->rtpoll_item, NULL);
 
-        if (pollfd->revents & ~POLLOUT) {
-            pa_log("FIFO shutdown.");
+        if (pollfd->revents & ~POLLIN) {
+            pa_log("Event channel shutdown.");
             goto fail;
         }
+
+        if (pollfd->revents & POLLIN) {
+            evtchn_port_or_error_t port;
+
+            /* Acknowledge the event so that the next one wakes us up
+             * again */
+            if ((port = xc_evtchn_pending(xce)) >= 0)
+                xc_evtchn_unmask(xce, (evtchn_port_t) port);
+
+            pollfd->revents = 0;
+        }
     }
 
 fail:
@@ -389,6 +408,7 @@ int pa__init(pa_module*m) {
     int backend_state;
     int ret;
     char strbuf[100];
+    struct pollfd *pollfd;
 
     pa_assert(m);
 
@@ -477,7 +497,6 @@ int pa__init(pa_module*m) {
     u->core = m->core;
     u->module = m;
     m->userdata = u;
-    pa_memchunk_reset(&u->memchunk);
     u->rtpoll = pa_rtpoll_new();
     pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
     u->write_type = 0;
@@ -485,6 +504,7 @@ int pa__init(pa_module*m) {
     /* init ring buffer */
     ioring->prod_indx = ioring->cons_indx = 0;
     ioring->usable_buffer_space = BUFSIZE - BUFSIZE % pa_frame_size(&ss);
+    u->ring_block = pa_memblock_new_fixed(u->core->mempool, ioring->buffer, ioring->usable_buffer_space, FALSE);
 
     pa_sink_new_data_init(&data);
     data.driver = __FILE__;
@@ -518,6 +538,9 @@ int pa__init(pa_module*m) {
     pa_sink_set_fixed_latency(u->sink, pa_bytes_to_usec(ioring->usable_buffer_space, &u->sink->sample_spec));
 
     u->rtpoll_item = pa_rtpoll_item_new(u->rtpoll, PA_RTPOLL_NEVER, 1);
+    pollfd = pa_rtpoll_item_get_pollfd(u->rtpoll_item, NULL);
+    pollfd->fd = xc_evtchn_fd(xce);
+    pollfd->events = 0;
 
     if (!(u->thread = pa_thread_new("xenpv-sink", thread_func, u))) {
         pa_log("Failed to create thread.");
@@ -569,8 +592,8 @@ void pa__done(pa_module*m) {
     if (u->sink)
         pa_sink_unref(u->sink);
 
-    if (u->memchunk.memblock)
-       pa_memblock_unref(u->memchunk.memblock);
+    if (u->ring_block)
+        pa_memblock_unref_fixed(u->ring_block);
 
     if (u->rtpoll_item)
         pa_rtpoll_item_free(u->rtpoll_item);
@@ -639,41 +662,9 @@ static int alloc_gref(struct ioctl_gntalloc_alloc_gref *gref_, void **addr) {
     return rv;
 }
 
-#define RING_FREE_BYTES ((r->usable_buffer_space - (r->prod_indx-r->cons_indx) -1) % r->usable_buffer_space)
-static int ring_write(struct ring *r, void *src, int length) {
-    int full = 0;
-    for (;;) {
-        /* free space may be split over the end of the buffer */
-        int first_chunk_size = (r->usable_buffer_space-r->prod_indx);
-        int second_chunk_size = (r->cons_indx>=r->prod_indx)? (r->cons_indx) : 0;
-        int l, fl, sl;
-
-        /* full? */
-        if (RING_FREE_BYTES==0) {
-            /*XXX hardcoded*/
-            if (full>=100) {
-                errno = EINTR;
-                return -1;
-            }
-            /*XXX hardcoded */
-            usleep(1000);
-            /* should return in 100ms max; definitely not midstream */
-            full++;
-            continue;
-        }
-
-        /* calculate lengths in case of a split buffer */
-        l = PA_MIN((int)RING_FREE_BYTES, length);
-        fl = PA_MIN(l, first_chunk_size);
-        sl = PA_MIN(l-fl, second_chunk_size);
-
-        memcpy(r->buffer+r->prod_indx, src, fl);
-        if (sl)
-            memcpy(r->buffer, ((char*)src)+fl, sl);
-        r->prod_indx = (r->prod_indx+fl+sl) % r->usable_buffer_space;
-
-        return sl+fl;
-    }
+/* Bytes the backend hasn't consumed yet */
+static size_t ring_fill(struct ring *r) {
+    return (r->prod_indx + r->usable_buffer_space - r->cons_indx) % r->usable_buffer_space;
 }
 
 static int publish_param(const char *paramname, const char *value) {
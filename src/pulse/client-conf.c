@@ -59,9 +59,12 @@ static const pa_client_conf default_conf = {
     .default_dbus_server = NULL,
     .autospawn = TRUE,
     .disable_shm = FALSE,
+    .disable_memfd = FALSE,
     .cookie_file = NULL,
     .cookie_valid = FALSE,
     .shm_size = 0,
+    .shm_huge_pages = FALSE,
+    .shm_prefault_slots = 0,
     .auto_connect_localhost = FALSE,
     .auto_connect_display = FALSE
 };
@@ -105,7 +108,10 @@ int pa_client_conf_load(pa_client_conf *c, const char *filename) {
         { "cookie-file",            pa_config_parse_string,   &c->cookie_file, NULL },
         { "disable-shm",            pa_config_parse_bool,     &c->disable_shm, NULL },
         { "enable-shm",             pa_config_parse_not_bool, &c->disable_shm, NULL },
+        { "enable-memfd",           pa_config_parse_not_bool, &c->disable_memfd, NULL },
         { "shm-size-bytes",         pa_config_parse_size,     &c->shm_size, NULL },
+        { "shm-huge-pages",         pa_config_parse_bool,     &c->shm_huge_pages, NULL },
+        { "shm-prefault-slots",     pa_config_parse_unsigned, &c->shm_prefault_slots, NULL },
         { "auto-connect-localhost", pa_config_parse_bool,     &c->auto_connect_localhost, NULL },
         { "auto-connect-display",   pa_config_parse_bool,     &c->auto_connect_display, NULL },
         { NULL,                     NULL,                     NULL, NULL },
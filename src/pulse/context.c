@@ -175,10 +175,11 @@ pa_context *pa_context_new_with_proplist(pa_mainloop_api *mainloop, const char *
 #endif
     pa_client_conf_env(c->conf);
 
-    if (!(c->mempool = pa_mempool_new(!c->conf->disable_shm, c->conf->shm_size))) {
+    if (!(c->mempool = pa_mempool_new_full(c->conf->disable_shm ? PA_SHM_PRIVATE : c->conf->disable_memfd ? PA_SHM_POSIX : PA_SHM_MEMFD,
+                                           c->conf->shm_size, c->conf->shm_huge_pages, c->conf->shm_prefault_slots))) {
 
         if (!c->conf->disable_shm)
-            c->mempool = pa_mempool_new(FALSE, c->conf->shm_size);
+            c->mempool = pa_mempool_new_full(PA_SHM_PRIVATE, c->conf->shm_size, c->conf->shm_huge_pages, c->conf->shm_prefault_slots);
 
         if (!c->mempool) {
             context_free(c);
@@ -361,6 +362,8 @@ static void pstream_memblock_callback(pa_pstream *p, uint32_t channel, int64_t o
         } else
             pa_memblockq_seek(s->record_memblockq, offset+chunk->length, seek, TRUE);
 
+        pa_stream_update_snapshot(s);
+
         if (s->read_callback) {
             size_t l;
 
@@ -428,7 +431,7 @@ static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t
     switch(c->state) {
         case PA_CONTEXT_AUTHORIZING: {
             pa_tagstruct *reply;
-            pa_bool_t shm_on_remote = FALSE;
+            pa_bool_t shm_on_remote = FALSE, memfd_on_remote = FALSE;
 
             if (pa_tagstruct_getu32(t, &c->version) < 0 ||
                 !pa_tagstruct_eof(t)) {
@@ -450,6 +453,13 @@ static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t
                 c->version &= 0x7FFFFFFFU;
             }
 
+            /* Starting with protocol version 27 the second MSB tells
+               whether memfd segments may be passed over the socket */
+            if (c->version >= 27) {
+                memfd_on_remote = !!(c->version & 0x40000000U);
+                c->version &= 0x3FFFFFFFU;
+            }
+
             pa_log_debug("Protocol version: remote %u, local %u", c->version, PA_PROTOCOL_VERSION);
 
             /* Enable shared memory support if possible */
@@ -473,6 +483,11 @@ static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t
             pa_log_debug("Negotiated SHM: %s", pa_yes_no(c->do_shm));
             pa_pstream_enable_shm(c->pstream, c->do_shm);
 
+            if (c->do_shm && memfd_on_remote && pa_mempool_is_memfd_backed(c->mempool)) {
+                pa_log_debug("Negotiated memfd: yes");
+                pa_pstream_enable_memfd(c->pstream);
+            }
+
             reply = pa_tagstruct_command(c, PA_COMMAND_SET_CLIENT_NAME, &tag);
 
             if (c->version >= 13) {
@@ -539,8 +554,11 @@ static void setup_context(pa_context *c, pa_iochannel *io) {
     pa_log_debug("SHM possible: %s", pa_yes_no(c->do_shm));
 
     /* Starting with protocol version 13 we use the MSB of the version
-     * tag for informing the other side if we could do SHM or not */
-    pa_tagstruct_putu32(t, PA_PROTOCOL_VERSION | (c->do_shm ? 0x80000000U : 0));
+     * tag for informing the other side if we could do SHM or not,
+     * starting with 27 the second MSB whether we can do memfd */
+    pa_tagstruct_putu32(t, PA_PROTOCOL_VERSION |
+                        (c->do_shm ? 0x80000000U : 0) |
+                        (c->do_shm && pa_mempool_is_memfd_backed(c->mempool) ? 0x40000000U : 0));
     pa_tagstruct_put_arbitrary(t, c->conf->cookie, sizeof(c->conf->cookie));
 
 #ifdef HAVE_CREDS
@@ -789,6 +789,11 @@ typedef enum pa_sink_flags {
 
     PA_SINK_DEFERRED_VOLUME = 0x2000000U,
     /**< The HW volume changes are syncronized with SW volume. */
+
+    PA_SINK_NO_REWIND = 0x4000000U,
+    /**< This sink never rewinds. Buffers carry no rewind history and
+     * volume changes are faded in instead of re-rendered (used for low
+     * latency sinks). */
 /** \endcond */
 #endif
 
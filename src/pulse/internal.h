@@ -44,6 +44,7 @@
 #include <pulsecore/hashmap.h>
 #include <pulsecore/refcnt.h>
 #include <pulsecore/time-smoother.h>
+#include <pulsecore/atomic.h>
 #ifdef HAVE_DBUS
 #include <pulsecore/dbus-util.h>
 #endif
@@ -174,6 +175,7 @@ struct pa_stream {
     /* playback */
     pa_memblock *write_memblock;
     void *write_data;
+    pa_memregion *shared_buffer;
     int64_t latest_underrun_at_index;
 
     /* recording */
@@ -201,6 +203,13 @@ struct pa_stream {
 
     pa_smoother *smoother;
 
+    /* Published by pa_stream_update_snapshot() for
+     * pa_stream_get_snapshot(), which may be called from other
+     * threads. The sequence counter is odd while an update is in
+     * progress. */
+    pa_atomic_t snapshot_seq;
+    pa_stream_snapshot snapshot;
+
     /* Callbacks */
     pa_stream_notify_cb_t state_callback;
     void *state_userdata;
@@ -269,6 +278,7 @@ int pa_context_handle_error(pa_context *c, uint32_t command, pa_tagstruct *t, pa
 pa_operation* pa_context_send_simple_command(pa_context *c, uint32_t command, void (*internal_callback)(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata), void (*cb)(void), void *userdata);
 
 void pa_stream_set_state(pa_stream *s, pa_stream_state_t st);
+void pa_stream_update_snapshot(pa_stream *s);
 
 pa_tagstruct *pa_tagstruct_command(pa_context *c, uint32_t command, uint32_t *tag);
 
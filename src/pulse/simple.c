@@ -29,6 +29,7 @@
 #include <stdlib.h>
 
 #include <pulse/pulseaudio.h>
+#include <pulse/rtclock.h>
 #include <pulse/thread-mainloop.h>
 #include <pulse/xmalloc.h>
 
@@ -49,6 +50,12 @@ struct pa_simple {
     size_t read_index, read_length;
 
     int operation_success;
+
+    /* Only touched with the mainloop locked */
+    pa_simple_fill_cb_t fill_cb;
+    void *fill_userdata;
+    pa_bool_t fill_stopped;
+    pa_time_event *fill_retry_event;
 };
 
 #define CHECK_VALIDITY_RETURN_ANY(rerror, expression, error, ret)       \
@@ -139,6 +146,75 @@ static void stream_request_cb(pa_stream *s, size_t length, void *userdata) {
     pa_threaded_mainloop_signal(p->mainloop, 0);
 }
 
+static void fill_retry_cb(pa_mainloop_api *m, pa_time_event *e, const struct timeval *t, void *userdata);
+
+/* Called from the mainloop thread. Lets the fill callback write
+ * straight into the stream's buffers, as long as the server wants
+ * data and the callback has some. */
+static void fill(pa_simple *p) {
+    size_t l;
+
+    while (p->fill_cb && !p->fill_stopped &&
+           (l = pa_stream_writable_size(p->stream)) > 0 && l != (size_t) -1) {
+        void *data;
+        ssize_t r;
+
+        if (pa_stream_begin_write(p->stream, &data, &l) < 0)
+            return;
+
+        if ((r = p->fill_cb(p, data, l, p->fill_userdata)) <= 0) {
+            pa_stream_cancel_write(p->stream);
+
+            if (r < 0)
+                p->fill_stopped = TRUE;
+            break;
+        }
+
+        pa_assert((size_t) r <= l);
+
+        if (pa_stream_write(p->stream, data, (size_t) r, NULL, 0LL, PA_SEEK_RELATIVE) < 0 || (size_t) r < l)
+            break;
+    }
+
+    if (!p->fill_cb || p->fill_stopped || p->fill_retry_event ||
+        pa_stream_get_state(p->stream) != PA_STREAM_READY)
+        return;
+
+    if ((l = pa_stream_writable_size(p->stream)) > 0 && l != (size_t) -1) {
+        const pa_buffer_attr *a;
+        pa_usec_t usec;
+
+        /* The callback didn't have enough yet. The server won't ask
+         * again for what it asked for already, so try again by
+         * ourselves after a minimal request's worth of time. */
+        a = pa_stream_get_buffer_attr(p->stream);
+        usec = pa_bytes_to_usec(a ? a->minreq : 0, pa_stream_get_sample_spec(p->stream));
+        p->fill_retry_event = pa_context_rttime_new(p->context, pa_rtclock_now() + PA_MAX(usec, PA_USEC_PER_MSEC), fill_retry_cb, p);
+    }
+}
+
+static void fill_retry_cb(pa_mainloop_api *m, pa_time_event *e, const struct timeval *t, void *userdata) {
+    pa_simple *p = userdata;
+
+    pa_assert(p);
+    pa_assert(p->fill_retry_event == e);
+
+    m->time_free(e);
+    p->fill_retry_event = NULL;
+
+    fill(p);
+}
+
+static void stream_write_cb(pa_stream *s, size_t length, void *userdata) {
+    pa_simple *p = userdata;
+    pa_assert(p);
+
+    if (p->fill_cb)
+        fill(p);
+
+    pa_threaded_mainloop_signal(p->mainloop, 0);
+}
+
 static void stream_latency_update_cb(pa_stream *s, void *userdata) {
     pa_simple *p = userdata;
 
@@ -212,7 +288,7 @@ pa_simple* pa_simple_new(
 
     pa_stream_set_state_callback(p->stream, stream_state_cb, p);
     pa_stream_set_read_callback(p->stream, stream_request_cb, p);
-    pa_stream_set_write_callback(p->stream, stream_request_cb, p);
+    pa_stream_set_write_callback(p->stream, stream_write_cb, p);
     pa_stream_set_latency_update_callback(p->stream, stream_latency_update_cb, p);
 
     if (dir == PA_STREAM_PLAYBACK)
@@ -268,6 +344,9 @@ void pa_simple_free(pa_simple *s) {
     if (s->mainloop)
         pa_threaded_mainloop_stop(s->mainloop);
 
+    if (s->fill_retry_event)
+        pa_threaded_mainloop_get_api(s->mainloop)->time_free(s->fill_retry_event);
+
     if (s->stream)
         pa_stream_unref(s->stream);
 
@@ -293,6 +372,12 @@ int pa_simple_write(pa_simple *p, const void*data, size_t length, int *rerror) {
 
     CHECK_DEAD_GOTO(p, rerror, unlock_and_fail);
 
+    if (p->fill_cb) {
+        if (rerror)
+            *rerror = PA_ERR_BADSTATE;
+        goto unlock_and_fail;
+    }
+
     while (length > 0) {
         size_t l;
         int r;
@@ -322,6 +407,36 @@ unlock_and_fail:
     return -1;
 }
 
+int pa_simple_set_fill_callback(pa_simple *p, pa_simple_fill_cb_t cb, void *userdata, int *rerror) {
+    pa_assert(p);
+
+    CHECK_VALIDITY_RETURN_ANY(rerror, p->direction == PA_STREAM_PLAYBACK, PA_ERR_BADSTATE, -1);
+
+    pa_threaded_mainloop_lock(p->mainloop);
+
+    CHECK_DEAD_GOTO(p, rerror, unlock_and_fail);
+
+    p->fill_cb = cb;
+    p->fill_userdata = userdata;
+    p->fill_stopped = FALSE;
+
+    if (p->fill_retry_event) {
+        pa_threaded_mainloop_get_api(p->mainloop)->time_free(p->fill_retry_event);
+        p->fill_retry_event = NULL;
+    }
+
+    /* Whatever the server asked for so far is ours to deliver now */
+    if (cb)
+        fill(p);
+
+    pa_threaded_mainloop_unlock(p->mainloop);
+    return 0;
+
+unlock_and_fail:
+    pa_threaded_mainloop_unlock(p->mainloop);
+    return -1;
+}
+
 int pa_simple_read(pa_simple *p, void*data, size_t length, int *rerror) {
     pa_assert(p);
 
@@ -556,7 +671,7 @@ pa_simple* pa_simple_new_proplist(
 
     pa_stream_set_state_callback(p->stream, stream_state_cb, p);
     pa_stream_set_read_callback(p->stream, stream_request_cb, p);
-    pa_stream_set_write_callback(p->stream, stream_request_cb, p);
+    pa_stream_set_write_callback(p->stream, stream_write_cb, p);
     pa_stream_set_latency_update_callback(p->stream, stream_latency_update_cb, p);
 
     if (dir == PA_STREAM_PLAYBACK)
@@ -77,6 +77,12 @@
  * system calls. The main difference is that they're called pa_simple_read()
  * and pa_simple_write(). Note that these operations always block.
  *
+ * Alternatively a playback connection can have the server pull the data
+ * with pa_simple_set_fill_callback(). The callback is called from the
+ * thread of the connection whenever the server wants more data, and
+ * writes it straight into the buffers that are sent to the server.
+ * This saves the thread switches and the copy of pa_simple_write().
+ *
  * \section ctrl_sec Buffer control
  *
  * If a playback stream is used then a few other operations are available:
@@ -116,6 +122,14 @@ PA_C_DECL_BEGIN
  * An opaque simple connection object */
 typedef struct pa_simple pa_simple;
 
+/** A callback that places up to \a nbytes of audio at \a data. It
+ * returns how many bytes it placed there, a multiple of the frame
+ * size. If it returns less than \a nbytes it is called again a little
+ * later, if it returns a negative value it isn't called anymore. It
+ * is called from the thread of the connection, so it must not call
+ * any pa_simple functions and should not block. \since 3.0 */
+typedef ssize_t (*pa_simple_fill_cb_t)(pa_simple *s, void *data, size_t nbytes, void *userdata);
+
 /** Create a new connection to the server. */
 pa_simple* pa_simple_new(
     const char *server,                 /**< Server name, or NULL for default */
@@ -149,6 +163,12 @@ void pa_simple_free(pa_simple *s);
 /** Write some data to the server. */
 int pa_simple_write(pa_simple *s, const void *data, size_t bytes, int *error);
 
+/** Have the server pull the data of a playback stream through \a cb
+ * instead of writing it with pa_simple_write(), which fails while a
+ * callback is set. Pass NULL to go back to pa_simple_write(). \since
+ * 3.0 */
+int pa_simple_set_fill_callback(pa_simple *s, pa_simple_fill_cb_t cb, void *userdata, int *error);
+
 /** Wait until all data already written is played by the daemon. */
 int pa_simple_drain(pa_simple *s, int *error);
 
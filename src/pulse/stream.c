@@ -40,6 +40,7 @@
 #include <pulsecore/macro.h>
 #include <pulsecore/core-rtclock.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/thread.h>
 
 #include "internal.h"
 #include "stream.h"
@@ -171,6 +172,7 @@ static pa_stream *pa_stream_new_with_proplist_internal(
 
     s->write_memblock = NULL;
     s->write_data = NULL;
+    s->shared_buffer = NULL;
 
     pa_memchunk_reset(&s->peek_memchunk);
     s->peek_data = NULL;
@@ -196,6 +198,10 @@ static pa_stream *pa_stream_new_with_proplist_internal(
 
     s->smoother = NULL;
 
+    pa_atomic_store(&s->snapshot_seq, 0);
+    memset(&s->snapshot, 0, sizeof(s->snapshot));
+    s->snapshot.state = PA_STREAM_UNCONNECTED;
+
     /* Refcounting is strictly one-way: from the "bigger" to the "smaller" object. */
     PA_LLIST_PREPEND(pa_stream, c->streams, s);
     pa_stream_ref(s);
@@ -289,6 +295,9 @@ static void stream_free(pa_stream *s) {
         pa_memblock_unref(s->write_memblock);
     }
 
+    if (s->shared_buffer)
+        pa_memregion_unref(s->shared_buffer);
+
     if (s->peek_memchunk.memblock) {
         if (s->peek_data)
             pa_memblock_release(s->peek_memchunk.memblock);
@@ -365,6 +374,8 @@ void pa_stream_set_state(pa_stream *s, pa_stream_state_t st) {
 
     s->state = st;
 
+    pa_stream_update_snapshot(s);
+
     if (s->state_callback)
         s->state_callback(s, s->state_userdata);
 
@@ -836,6 +847,8 @@ void pa_command_request(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tag
 
     s->requested_bytes += bytes;
 
+    pa_stream_update_snapshot(s);
+
     /* pa_log("got request for %lli, now at %lli", (long long) bytes, (long long) s->requested_bytes); */
 
     if (s->requested_bytes > 0 && s->write_callback)
@@ -1456,6 +1469,61 @@ int pa_stream_cancel_write(
     return 0;
 }
 
+int pa_stream_alloc_shared_buffer(
+        pa_stream *s,
+        void **data,
+        size_t *nbytes) {
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+
+    PA_CHECK_VALIDITY(s->context, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY(s->context, s->state == PA_STREAM_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, s->direction == PA_STREAM_PLAYBACK || s->direction == PA_STREAM_UPLOAD, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, !s->shared_buffer, PA_ERR_EXIST);
+    PA_CHECK_VALIDITY(s->context, data, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(s->context, nbytes && *nbytes != 0, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(s->context, *nbytes <= PA_MEMREGION_SIZE_MAX, PA_ERR_TOOLARGE);
+
+    if (!(s->shared_buffer = pa_memregion_new(s->context->mempool, *nbytes)))
+        PA_FAIL(s->context, PA_ERR_INTERNAL);
+
+    *data = pa_memregion_get_data(s->shared_buffer);
+    *nbytes = pa_memregion_get_length(s->shared_buffer);
+
+    return 0;
+}
+
+int pa_stream_free_shared_buffer(
+        pa_stream *s) {
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+
+    PA_CHECK_VALIDITY(s->context, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY(s->context, s->shared_buffer, PA_ERR_BADSTATE);
+
+    /* Blocks still on their way to the server keep it alive */
+    pa_memregion_unref(s->shared_buffer);
+    s->shared_buffer = NULL;
+
+    return 0;
+}
+
+/* Returns TRUE if the data lies within the stream's shared buffer */
+static pa_bool_t in_shared_buffer(pa_stream *s, const void *data, size_t length) {
+    const uint8_t *start;
+
+    if (!s->shared_buffer)
+        return FALSE;
+
+    start = pa_memregion_get_data(s->shared_buffer);
+
+    return
+        (const uint8_t*) data >= start &&
+        (const uint8_t*) data + length <= start + pa_memregion_get_length(s->shared_buffer);
+}
+
 int pa_stream_write(
         pa_stream *s,
         const void *data,
@@ -1497,6 +1565,18 @@ int pa_stream_write(
         pa_pstream_send_memblock(s->context->pstream, s->channel, offset, seek, &chunk);
         pa_memblock_unref(chunk.memblock);
 
+    } else if (pa_pstream_get_shm(s->context->pstream) && in_shared_buffer(s, data, length)) {
+        pa_memchunk chunk;
+
+        /* The server can read this where it is, in one piece */
+
+        chunk.memblock = pa_memblock_new_region(s->shared_buffer, (void*) data, length, free_cb);
+        chunk.index = 0;
+        chunk.length = length;
+
+        pa_pstream_send_memblock(s->context->pstream, s->channel, offset, seek, &chunk);
+        pa_memblock_unref(chunk.memblock);
+
     } else {
         pa_seek_mode_t t_seek = seek;
         int64_t t_offset = offset;
@@ -1578,6 +1658,8 @@ int pa_stream_write(
             request_auto_timing_update(s, TRUE);
     }
 
+    pa_stream_update_snapshot(s);
+
     return 0;
 }
 
@@ -1628,6 +1710,8 @@ int pa_stream_drop(pa_stream *s) {
     pa_memblock_unref(s->peek_memchunk.memblock);
     pa_memchunk_reset(&s->peek_memchunk);
 
+    pa_stream_update_snapshot(s);
+
     return 0;
 }
 
@@ -1918,6 +2002,8 @@ static void stream_get_timing_info_callback(pa_pdispatch *pd, uint32_t command,
 
     o->stream->auto_timing_update_requested = FALSE;
 
+    pa_stream_update_snapshot(o->stream);
+
     if (o->stream->latency_update_callback)
         o->stream->latency_update_callback(o->stream, o->stream->latency_update_userdata);
 
@@ -2506,6 +2592,101 @@ const pa_timing_info* pa_stream_get_timing_info(pa_stream *s) {
     return &s->timing_info;
 }
 
+/* Called from the main loop whenever something changed that
+ * pa_stream_get_snapshot() returns. There is only a single writer, so
+ * bumping the sequence counter around the update is enough for the
+ * readers to notice that they raced with it. */
+void pa_stream_update_snapshot(pa_stream *s) {
+    pa_stream_snapshot *n;
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+
+    pa_atomic_inc(&s->snapshot_seq);
+
+    n = &s->snapshot;
+    n->state = s->state;
+    n->writable_size = 0;
+    n->readable_size = 0;
+    n->latency_valid = FALSE;
+    n->latency = 0;
+    n->negative = 0;
+    n->timestamp = pa_rtclock_now();
+
+    if (s->state == PA_STREAM_READY && s->direction != PA_STREAM_UPLOAD) {
+
+        if (s->direction == PA_STREAM_PLAYBACK)
+            n->writable_size = s->requested_bytes > 0 ? (size_t) s->requested_bytes : 0;
+        else
+            n->readable_size = pa_memblockq_get_length(s->record_memblockq);
+
+        /* Check the preconditions first, pa_stream_get_latency() would
+         * set the error of the context otherwise */
+        if (s->timing_info_valid &&
+            !s->timing_info.write_index_corrupt &&
+            !s->timing_info.read_index_corrupt &&
+            pa_stream_get_latency(s, &n->latency, &n->negative) >= 0) {
+
+            n->latency_valid = TRUE;
+            n->timing_info = s->timing_info;
+        }
+    }
+
+    pa_atomic_inc(&s->snapshot_seq);
+}
+
+int pa_stream_get_snapshot(pa_stream *s, pa_stream_snapshot *snapshot) {
+    pa_usec_t age;
+    int seq;
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+    pa_assert(snapshot);
+
+    /* No PA_CHECK_VALIDITY() here, we may not touch the context */
+
+    for (;;) {
+        seq = pa_atomic_load(&s->snapshot_seq);
+
+        /* pa_atomic_load() only has its barrier before the load, the
+         * copy must not be read ahead of the sequence number */
+        pa_memory_barrier();
+
+        if (seq & 1) {
+            /* The main loop is in the middle of an update */
+            pa_thread_yield();
+            continue;
+        }
+
+        *snapshot = s->snapshot;
+
+        if (pa_atomic_load(&s->snapshot_seq) == seq)
+            break;
+    }
+
+    if (snapshot->state != PA_STREAM_READY)
+        return -PA_ERR_BADSTATE;
+
+    if (!snapshot->latency_valid || !snapshot->timing_info.playing)
+        return 0;
+
+    /* Account for what was played or recorded since */
+    age = pa_rtclock_now() - snapshot->timestamp;
+
+    if (s->direction == PA_STREAM_PLAYBACK)
+        snapshot->latency = snapshot->latency > age ? snapshot->latency - age : 0;
+    else if (!snapshot->negative)
+        snapshot->latency += age;
+    else if (snapshot->latency > age)
+        snapshot->latency -= age;
+    else {
+        snapshot->latency = age - snapshot->latency;
+        snapshot->negative = 0;
+    }
+
+    return 0;
+}
+
 const pa_sample_spec* pa_stream_get_sample_spec(pa_stream *s) {
     pa_assert(s);
     pa_assert(PA_REFCNT_VALUE(s) >= 1);
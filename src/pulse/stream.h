@@ -338,6 +338,19 @@ typedef void (*pa_stream_notify_cb_t)(pa_stream *p, void *userdata);
  * it doesn't know. \since 0.9.15 */
 typedef void (*pa_stream_event_cb_t)(pa_stream *p, const char *name, pa_proplist *pl, void *userdata);
 
+/** A copy of the stream state that is polled most often, as returned
+ * by pa_stream_get_snapshot(). \since 3.0 */
+typedef struct pa_stream_snapshot {
+    pa_stream_state_t state;      /**< The stream state */
+    size_t writable_size;         /**< As returned by pa_stream_writable_size(), 0 for record streams */
+    size_t readable_size;         /**< As returned by pa_stream_readable_size(), 0 for playback streams */
+    int latency_valid;            /**< Non-zero if latency, negative and timing_info are filled in */
+    pa_usec_t latency;            /**< As returned by pa_stream_get_latency() */
+    int negative;                 /**< As returned by pa_stream_get_latency() */
+    pa_timing_info timing_info;   /**< As returned by pa_stream_get_timing_info() */
+    pa_usec_t timestamp;          /**< The time the state was taken, as returned by pa_rtclock_now() */
+} pa_stream_snapshot;
+
 /** Create a new, unconnected stream with the specified name and
  * sample type. It is recommended to use pa_stream_new_with_proplist()
  * instead and specify some initial properties. */
@@ -503,6 +516,37 @@ int pa_stream_begin_write(
 int pa_stream_cancel_write(
         pa_stream *p);
 
+/** Allocate a buffer for the stream that the server can read from
+ * directly (for playback and upload streams). Data written with
+ * pa_stream_write() from anywhere within this buffer is passed to the
+ * server as a reference instead of being copied, however large it
+ * is. This pays off for clients that produce audio in large buffers
+ * of a second or more.
+ *
+ * Pass in the address of a pointer and the number of bytes you want.
+ * On return they contain the address of the buffer and its actual
+ * size, which may be larger. Only one shared buffer may exist per
+ * stream at a time.
+ *
+ * Since the server reads the data in place, a part of the buffer may
+ * only be overwritten once the server is done with it. Pass a 
+ * free_cb to pa_stream_write() to be told: it is called with the 
+ * data pointer that was written once that is the case. If the
+ * connection to the server does not use shared memory the data is
+ * copied to the server as usual. \since 3.0 */
+int pa_stream_alloc_shared_buffer(
+        pa_stream *p,
+        void **data,
+        size_t *nbytes);
+
+/** Give up the buffer allocated with
+ * pa_stream_alloc_shared_buffer(). The memory stays valid until the
+ * server is done with everything written from it, but must not be
+ * accessed anymore by the client. It is freed automatically with the
+ * stream. \since 3.0 */
+int pa_stream_free_shared_buffer(
+        pa_stream *p);
+
 /** Write some data to the server (for playback streams).
  * If \a free_cb is non-NULL this routine is called when all data has
  * been written out. An internal reference to the specified data is
@@ -524,7 +568,10 @@ int pa_stream_cancel_write(
  * necessary. It is OK to write the memory area returned by
  * pa_stream_begin_write() only partially with this call, skipping
  * bytes both at the end and at the beginning of the reserved memory
- * area.*/
+ * area.
+ *
+ * Data placed in the buffer returned by pa_stream_alloc_shared_buffer()
+ * isn't copied either, see there. */
 int pa_stream_write(
         pa_stream *p             /**< The stream to use */,
         const void *data         /**< The data to write */,
@@ -721,6 +768,25 @@ int pa_stream_get_latency(pa_stream *s, pa_usec_t *r_usec, int *negative);
  * update has been received. */
 const pa_timing_info* pa_stream_get_timing_info(pa_stream *s);
 
+/** Fill in \a *snapshot with the stream state as of the last event
+ * that was dispatched for the stream. Unlike every other function in
+ * this API this one may be called from any thread without holding the
+ * lock of a pa_threaded_mainloop, and never blocks: the state is
+ * published by the main loop whenever it changes and is copied out
+ * without synchronizing with it. The caller still needs to hold a
+ * reference to the stream.
+ *
+ * While the stream is playing the latency is advanced by the time
+ * that passed since the state was taken, the same way
+ * pa_stream_get_latency() interpolates between timing updates. Use
+ * PA_STREAM_AUTO_TIMING_UPDATE to keep it accurate.
+ *
+ * Returns 0 on success, or -PA_ERR_BADSTATE if the stream is not
+ * ready, in which case only the state field is meaningful. Unlike
+ * other functions this does not change the error of the context.
+ * \since 3.0 */
+int pa_stream_get_snapshot(pa_stream *s, pa_stream_snapshot *snapshot);
+
 /** Return a pointer to the stream's sample specification. */
 const pa_sample_spec* pa_stream_get_sample_spec(pa_stream *s);
 
@@ -91,6 +91,11 @@ PA_C_DECL_BEGIN
  * }
  * \endcode
  *
+ * The one exception is pa_stream_get_snapshot(), which returns the
+ * writable size, latency and timing info of a stream without taking
+ * the lock. Audio threads that poll these every period should use it
+ * instead of contending with the event loop for the lock.
+ *
  * \section cb_sec Callbacks
  *
  * Callbacks in PulseAudio are asynchronous, so they require extra care when
@@ -36,6 +36,7 @@
 
 #include <pulse/xmalloc.h>
 #include <pulse/error.h>
+#include <pulse/timeval.h>
 
 #include <pulsecore/module.h>
 #include <pulsecore/sink.h>
@@ -90,6 +91,7 @@ static int pa_cli_command_sources(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, p
 static int pa_cli_command_sink_inputs(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_source_outputs(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_stat(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
+static int pa_cli_command_reset_io_stat(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_info(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_load(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_unload(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
@@ -145,7 +147,8 @@ static const struct command commands[] = {
     { "list-clients",            pa_cli_command_clients,            "List loaded clients",          1 },
     { "list-sink-inputs",        pa_cli_command_sink_inputs,        "List sink inputs",             1 },
     { "list-source-outputs",     pa_cli_command_source_outputs,     "List source outputs",          1 },
-    { "stat",                    pa_cli_command_stat,               "Show memory block statistics", 1 },
+    { "stat",                    pa_cli_command_stat,               "Show memory block and IO thread statistics", 1 },
+    { "reset-io-stat",           pa_cli_command_reset_io_stat,      "Reset the IO thread statistics", 1 },
     { "info",                    pa_cli_command_info,               "Show comprehensive status",    1 },
     { "ls",                      pa_cli_command_info,               NULL,                           1 },
     { "list",                    pa_cli_command_info,               NULL,                           1 },
@@ -334,6 +337,76 @@ static int pa_cli_command_source_outputs(pa_core *c, pa_tokenizer *t, pa_strbuf
     return 0;
 }
 
+/* Calls cb once for each IO thread, as found via the sinks and sources
+ * running in them */
+static void foreach_rtpoll(pa_core *c, void (*cb)(pa_rtpoll *rtpoll, const char *type, uint32_t idx, const char *name, void *userdata), void *userdata) {
+    pa_idxset *seen;
+    pa_sink *sink;
+    pa_source *source;
+    uint32_t idx;
+
+    seen = pa_idxset_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+
+    PA_IDXSET_FOREACH(sink, c->sinks, idx) {
+        /* Filter sinks run in the thread of their master */
+        if (sink->input_to_master || !sink->thread_info.rtpoll)
+            continue;
+
+        if (pa_idxset_put(seen, sink->thread_info.rtpoll, NULL) < 0)
+            continue;
+
+        cb(sink->thread_info.rtpoll, "sink", sink->index, sink->name, userdata);
+    }
+
+    PA_IDXSET_FOREACH(source, c->sources, idx) {
+        if (source->monitor_of || source->output_from_master || !source->thread_info.rtpoll)
+            continue;
+
+        if (pa_idxset_put(seen, source->thread_info.rtpoll, NULL) < 0)
+            continue;
+
+        cb(source->thread_info.rtpoll, "source", source->index, source->name, userdata);
+    }
+
+    pa_idxset_free(seen, NULL, NULL);
+}
+
+static void time_histogram_to_strbuf(pa_strbuf *buf, const char *what, const char *negative, const pa_time_histogram *h) {
+    unsigned n;
+
+    if ((n = pa_time_histogram_count(h)) <= 0)
+        return;
+
+    pa_strbuf_printf(buf, "    %s: %u samples, 0.1%%/1%%/50%%/99%%/99.9%% below %0.2f/%0.2f/%0.2f/%0.2f/%0.2f ms, max %0.2f ms",
+                     what, n,
+                     (double) pa_time_histogram_percentile(h, 0.001) / PA_USEC_PER_MSEC,
+                     (double) pa_time_histogram_percentile(h, 0.01) / PA_USEC_PER_MSEC,
+                     (double) pa_time_histogram_percentile(h, 0.5) / PA_USEC_PER_MSEC,
+                     (double) pa_time_histogram_percentile(h, 0.99) / PA_USEC_PER_MSEC,
+                     (double) pa_time_histogram_percentile(h, 0.999) / PA_USEC_PER_MSEC,
+                     (double) pa_time_histogram_max(h) / PA_USEC_PER_MSEC);
+
+    if (negative)
+        pa_strbuf_printf(buf, ", %u %s", pa_time_histogram_negative(h), negative);
+
+    pa_strbuf_puts(buf, ".\n");
+}
+
+static void rtpoll_stat_to_strbuf(pa_rtpoll *rtpoll, const char *type, uint32_t idx, const char *name, void *userdata) {
+    pa_strbuf *buf = userdata;
+    pa_rtpoll_stat *stat = pa_rtpoll_get_stat(rtpoll);
+
+    pa_strbuf_printf(buf, "IO thread of %s #%u (%s):\n", type, idx, name);
+
+    time_histogram_to_strbuf(buf, "Wakeup lateness", "early", &stat->lateness);
+    time_histogram_to_strbuf(buf, "Processing time", NULL, &stat->processing);
+    time_histogram_to_strbuf(buf, "Headroom to device deadline", "missed", &stat->headroom);
+}
+
+static void rtpoll_stat_reset(pa_rtpoll *rtpoll, const char *type, uint32_t idx, const char *name, void *userdata) {
+    pa_rtpoll_reset_stat(rtpoll);
+}
+
 static int pa_cli_command_stat(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail) {
     char ss[PA_SAMPLE_SPEC_SNPRINT_MAX];
     char cm[PA_CHANNEL_MAP_SNPRINT_MAX];
@@ -350,6 +423,7 @@ static int pa_cli_command_stat(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_b
         [PA_MEMBLOCK_USER] = "USER",
         [PA_MEMBLOCK_FIXED] = "FIXED",
         [PA_MEMBLOCK_IMPORTED] = "IMPORTED",
+        [PA_MEMBLOCK_REGION] = "REGION",
     };
 
     pa_core_assert_ref(c);
@@ -375,6 +449,10 @@ static int pa_cli_command_stat(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_b
                      (unsigned) pa_atomic_load(&mstat->n_exported),
                      pa_bytes_snprint(bytes, sizeof(bytes), (unsigned) pa_atomic_load(&mstat->exported_size)));
 
+    pa_strbuf_printf(buf, "Memory pool slots prefaulted: %u, first touched while in use: %u.\n",
+                     (unsigned) pa_atomic_load(&mstat->n_prefaulted),
+                     (unsigned) pa_atomic_load(&mstat->n_cold_slots));
+
     pa_strbuf_printf(buf, "Total sample cache size: %s.\n",
                      pa_bytes_snprint(bytes, sizeof(bytes), (unsigned) pa_scache_total_size(c)));
 
@@ -398,6 +476,19 @@ static int pa_cli_command_stat(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_b
                          (unsigned) pa_atomic_load(&mstat->n_allocated_by_type[k]),
                          (unsigned) pa_atomic_load(&mstat->n_accumulated_by_type[k]));
 
+    foreach_rtpoll(c, rtpoll_stat_to_strbuf, buf);
+
+    return 0;
+}
+
+static int pa_cli_command_reset_io_stat(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail) {
+    pa_core_assert_ref(c);
+    pa_assert(t);
+    pa_assert(buf);
+    pa_assert(fail);
+
+    foreach_rtpoll(c, rtpoll_stat_reset, NULL);
+
     return 0;
 }
 
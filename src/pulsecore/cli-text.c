@@ -443,6 +443,13 @@ char *pa_source_list_to_string(pa_core *c) {
                     "\tfixed latency: %0.2f ms\n",
                     (double) pa_source_get_fixed_latency(source) / PA_USEC_PER_MSEC);
 
+        if (PA_SOURCE_IS_LINKED(source->state)) {
+            uint64_t conversions, shared;
+
+            pa_source_get_conversion_stats(source, &conversions, &shared);
+            pa_strbuf_printf(s, "\tshared conversions: %llu of %llu\n", (unsigned long long) shared, (unsigned long long) conversions);
+        }
+
         if (source->monitor_of)
             pa_strbuf_printf(s, "\tmonitor_of: %u\n", source->monitor_of->index);
         if (source->card)
@@ -32,6 +32,12 @@
 #include <errno.h>
 #include <limits.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 #ifdef HAVE_GLOB_H
 #include <glob.h>
@@ -51,6 +57,9 @@
 
 #include <pulsecore/sink-input.h>
 #include <pulsecore/play-memchunk.h>
+#include <pulsecore/resampler.h>
+#include <pulsecore/sample-util.h>
+#include <pulsecore/asyncmsgq.h>
 #include <pulsecore/core-subscribe.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/sound-file.h>
@@ -59,11 +68,59 @@
 #include <pulsecore/log.h>
 #include <pulsecore/core-error.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/mutex.h>
+#include <pulsecore/atomic.h>
+#include <pulsecore/idxset.h>
+#include <pulsecore/queue.h>
+#include <pulsecore/tagstruct.h>
 
 #include "core-scache.h"
 
 #define UNLOAD_POLL_TIME (60 * PA_USEC_PER_SEC)
 
+/* Precompiled sample cache files hold the decoded PCM data of a sound
+ * file, so that it can be mapped into memory instead of being decoded
+ * with libsndfile on each load. The data starts at a page boundary
+ * after the header and is followed by the properties libsndfile found
+ * in the file, in tagstruct format. */
+#define COMPILED_MAGIC "PASCACH2"
+#define COMPILED_DATA_OFFSET PA_PAGE_ALIGN(sizeof(struct compiled_header))
+#define COMPILED_PROPLIST_SIZE_MAX (64*1024)
+
+struct compiled_header {
+    char magic[8];
+    uint64_t source_size;
+    int64_t source_mtime;
+    uint64_t length;
+    uint64_t proplist_length;
+    pa_sample_spec sample_spec;
+    pa_channel_map channel_map;
+    char source[PATH_MAX];
+};
+
+/* How much silence to feed into the resampler after an entry, to get
+ * the tail of the entry out of its filter */
+#define CONVERT_DRAIN_USEC (100*PA_USEC_PER_MSEC)
+
+/* Decodes autoloaded samples into precompiled files and converts
+ * entries for sinks in the background. The main thread only ever
+ * queues more work for it, the thread exits when the queue runs
+ * empty. Converted entries are passed back through an asyncmsgq. */
+struct pa_scache_compiler {
+    pa_core *core;
+    pa_thread *thread;
+    pa_atomic_t cancel;
+
+    pa_mutex *mutex;
+    pa_queue *jobs;
+    pa_bool_t running;
+    unsigned n_compiled, n_up_to_date;
+
+    pa_asyncmsgq *results;
+    pa_io_event *results_event;
+};
+
 static void timeout_callback(pa_mainloop_api *m, pa_time_event *e, const struct timeval *t, void *userdata) {
     pa_core *c = userdata;
 
@@ -76,9 +133,695 @@ static void timeout_callback(pa_mainloop_api *m, pa_time_event *e, const struct
     pa_core_rttime_restart(c, e, pa_rtclock_now() + UNLOAD_POLL_TIME);
 }
 
+#ifdef HAVE_SYS_MMAN_H
+
+static char *compiled_path(const char *filename) {
+    char *dir, *fn;
+
+    if (!(dir = pa_state_path("sample-cache", TRUE)))
+        return NULL;
+
+    if (pa_make_secure_dir(dir, 0700, (uid_t) -1, (gid_t) -1) < 0) {
+        pa_log_warn("Failed to create sample cache directory '%s': %s", dir, pa_cstrerror(errno));
+        pa_xfree(dir);
+        return NULL;
+    }
+
+    fn = pa_sprintf_malloc("%s" PA_PATH_SEP "%08x-%s.pcm", dir,
+                           pa_idxset_string_hash_func(filename),
+                           pa_path_get_filename(filename));
+    pa_xfree(dir);
+
+    return fn;
+}
+
+static void compiled_unmap_cb(void *p) {
+    struct compiled_header *h = (struct compiled_header*) ((uint8_t*) p - COMPILED_DATA_OFFSET);
+
+    pa_assert_se(munmap(h, COMPILED_DATA_OFFSET + (size_t) h->length + (size_t) h->proplist_length) == 0);
+}
+
+static pa_bool_t compiled_header_valid(const struct compiled_header *h, const char *filename, const struct stat *source, size_t file_size) {
+
+    return
+        memcmp(h->magic, COMPILED_MAGIC, sizeof(h->magic)) == 0 &&
+        h->source_size == (uint64_t) source->st_size &&
+        h->source_mtime == (int64_t) source->st_mtime &&
+        h->length > 0 &&
+        h->length <= file_size - COMPILED_DATA_OFFSET &&
+        h->proplist_length == file_size - COMPILED_DATA_OFFSET - h->length &&
+        strncmp(h->source, filename, sizeof(h->source)) == 0 &&
+        pa_sample_spec_valid(&h->sample_spec) &&
+        pa_channel_map_valid(&h->channel_map) &&
+        pa_channel_map_compatible(&h->channel_map, &h->sample_spec) &&
+        pa_frame_aligned((size_t) h->length, &h->sample_spec);
+}
+
+/* Maps the precompiled version of filename into a read-only memblock,
+ * if there is an up-to-date one. The properties stored with it are
+ * merged into p. */
+static int compiled_load(pa_mempool *pool, const char *filename, pa_sample_spec *ss, pa_channel_map *map, pa_memchunk *chunk, pa_proplist *p) {
+    struct stat source, st;
+    struct compiled_header *h;
+    char *fn;
+    void *d;
+    int fd;
+
+    if (stat(filename, &source) < 0)
+        return -1;
+
+    if (!(fn = compiled_path(filename)))
+        return -1;
+
+    fd = pa_open_cloexec(fn, O_RDONLY, 0);
+    pa_xfree(fn);
+
+    if (fd < 0)
+        return -1;
+
+    if (fstat(fd, &st) < 0 ||
+        (size_t) st.st_size <= COMPILED_DATA_OFFSET ||
+        st.st_size > PA_SCACHE_ENTRY_SIZE_MAX + (off_t) (COMPILED_DATA_OFFSET + COMPILED_PROPLIST_SIZE_MAX)) {
+        pa_close(fd);
+        return -1;
+    }
+
+    d = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    pa_close(fd);
+
+    if (d == MAP_FAILED)
+        return -1;
+
+    h = d;
+
+    if (!compiled_header_valid(h, filename, &source, (size_t) st.st_size)) {
+        pa_log_debug("Precompiled version of '%s' is outdated.", filename);
+        munmap(d, (size_t) st.st_size);
+        return -1;
+    }
+
+    if (p && h->proplist_length > 0) {
+        pa_tagstruct *t;
+        pa_proplist *q;
+        int r;
+
+        t = pa_tagstruct_new((uint8_t*) d + COMPILED_DATA_OFFSET + h->length, (size_t) h->proplist_length);
+        q = pa_proplist_new();
+
+        if ((r = pa_tagstruct_get_proplist(t, q)) >= 0)
+            pa_proplist_update(p, PA_UPDATE_REPLACE, q);
+
+        pa_proplist_free(q);
+        pa_tagstruct_free(t);
+
+        if (r < 0) {
+            pa_log_debug("Precompiled version of '%s' has broken properties.", filename);
+            munmap(d, (size_t) st.st_size);
+            return -1;
+        }
+    }
+
+    *ss = h->sample_spec;
+    *map = h->channel_map;
+
+    chunk->memblock = pa_memblock_new_user(pool, (uint8_t*) d + COMPILED_DATA_OFFSET, (size_t) h->length, compiled_unmap_cb, TRUE);
+    chunk->index = 0;
+    chunk->length = (size_t) h->length;
+
+    return 0;
+}
+
+/* May be called from the compiler thread */
+static int compiled_save(const char *filename, const pa_sample_spec *ss, const pa_channel_map *map, const pa_memchunk *chunk, pa_proplist *p) {
+    struct stat source;
+    struct compiled_header *h;
+    pa_tagstruct *ts;
+    const uint8_t *props;
+    size_t props_length;
+    char *fn, *t = NULL;
+    void *d;
+    int fd, r = -1;
+
+    pa_assert(chunk->length > 0);
+    pa_assert(p);
+
+    if (strlen(filename) >= sizeof(h->source))
+        return -1;
+
+    if (stat(filename, &source) < 0)
+        return -1;
+
+    ts = pa_tagstruct_new(NULL, 0);
+    pa_tagstruct_put_proplist(ts, p);
+    props = pa_tagstruct_data(ts, &props_length);
+
+    if (props_length > COMPILED_PROPLIST_SIZE_MAX) {
+        pa_tagstruct_free(ts);
+        return -1;
+    }
+
+    if (!(fn = compiled_path(filename))) {
+        pa_tagstruct_free(ts);
+        return -1;
+    }
+
+    /* Write to a temporary file and rename it, so that readers never
+     * see a half-written file. Another daemon or the compiler thread
+     * may be writing the same file at the same time, hence a unique
+     * name. */
+    t = pa_sprintf_malloc("%s.tmp-XXXXXX", fn);
+
+    if ((fd = mkstemp(t)) < 0) {
+        pa_log_warn("Failed to create '%s': %s", t, pa_cstrerror(errno));
+        goto finish;
+    }
+
+    pa_make_fd_cloexec(fd);
+
+    h = pa_xnew0(struct compiled_header, 1);
+    memcpy(h->magic, COMPILED_MAGIC, sizeof(h->magic));
+    h->source_size = (uint64_t) source.st_size;
+    h->source_mtime = (int64_t) source.st_mtime;
+    h->length = (uint64_t) chunk->length;
+    h->proplist_length = (uint64_t) props_length;
+    h->sample_spec = *ss;
+    h->channel_map = *map;
+    pa_strlcpy(h->source, filename, sizeof(h->source));
+
+    d = pa_memblock_acquire(chunk->memblock);
+
+    if (pa_loop_write(fd, h, sizeof(*h), NULL) != (ssize_t) sizeof(*h) ||
+        lseek(fd, (off_t) COMPILED_DATA_OFFSET, SEEK_SET) == (off_t) -1 ||
+        pa_loop_write(fd, (uint8_t*) d + chunk->index, chunk->length, NULL) != (ssize_t) chunk->length ||
+        pa_loop_write(fd, props, props_length, NULL) != (ssize_t) props_length)
+        pa_log_warn("Failed to write '%s': %s", t, pa_cstrerror(errno));
+    else
+        r = 0;
+
+    pa_memblock_release(chunk->memblock);
+    pa_xfree(h);
+
+    if (pa_close(fd) < 0)
+        r = -1;
+
+    if (r >= 0 && rename(t, fn) < 0) {
+        pa_log_warn("Failed to rename '%s': %s", t, pa_cstrerror(errno));
+        r = -1;
+    }
+
+    if (r < 0)
+        unlink(t);
+
+finish:
+    pa_xfree(t);
+    pa_xfree(fn);
+    pa_tagstruct_free(ts);
+
+    return r;
+}
+
+#else
+
+static int compiled_load(pa_mempool *pool, const char *filename, pa_sample_spec *ss, pa_channel_map *map, pa_memchunk *chunk, pa_proplist *p) {
+    return -1;
+}
+
+static int compiled_save(const char *filename, const pa_sample_spec *ss, const pa_channel_map *map, const pa_memchunk *chunk, pa_proplist *p) {
+    return -1;
+}
+
+#endif
+
+/* Loads a sound file, preferably from its precompiled version. Only
+ * what libsndfile found in the file is stored with the precompiled
+ * version, not what the caller already put into p. */
+static int sound_file_load(pa_core *c, const char *filename, pa_sample_spec *ss, pa_channel_map *map, pa_memchunk *chunk, pa_proplist *p) {
+    pa_proplist *file_props;
+
+    file_props = pa_proplist_new();
+
+    if (c->scache_precompile && compiled_load(c->mempool, filename, ss, map, chunk, file_props) >= 0)
+        pa_log_debug("Mapped precompiled version of '%s'.", filename);
+
+    else if (pa_sound_file_load(c->mempool, filename, ss, map, chunk, file_props) < 0) {
+        pa_proplist_free(file_props);
+        return -1;
+
+    } else if (c->scache_precompile)
+        compiled_save(filename, ss, map, chunk, file_props);
+
+    if (p)
+        pa_proplist_update(p, PA_UPDATE_REPLACE, file_props);
+
+    pa_proplist_free(file_props);
+
+    return 0;
+}
+
+static void variant_free(pa_scache_entry *e, pa_scache_variant *v) {
+    pa_assert(e);
+    pa_assert(v);
+
+    PA_LLIST_REMOVE(pa_scache_variant, e->variants, v);
+
+    if (v->memchunk.memblock)
+        pa_memblock_unref(v->memchunk.memblock);
+
+    pa_xfree(v);
+}
+
+static void free_variants(pa_scache_entry *e) {
+    pa_assert(e);
+
+    while (e->variants)
+        variant_free(e, e->variants);
+}
+
+static size_t variants_total_size(pa_core *c) {
+    pa_scache_entry *e;
+    pa_scache_variant *v;
+    uint32_t idx;
+    size_t sum = 0;
+
+    PA_IDXSET_FOREACH(e, c->scache, idx)
+        PA_LLIST_FOREACH(v, e->variants)
+            sum += v->memchunk.length;
+
+    return sum;
+}
+
+/* Drops the least recently used variants until another 'length'
+ * bytes fit into PA_SCACHE_VARIANTS_SIZE_MAX. Variants that are still
+ * being converted take no space yet and are left alone. */
+static void variants_make_room(pa_core *c, size_t length) {
+    size_t sum;
+
+    sum = variants_total_size(c);
+
+    while (sum > 0 && sum + length > PA_SCACHE_VARIANTS_SIZE_MAX) {
+        pa_scache_entry *e, *lru_e = NULL;
+        pa_scache_variant *v, *lru_v = NULL;
+        uint32_t idx;
+
+        PA_IDXSET_FOREACH(e, c->scache, idx)
+            PA_LLIST_FOREACH(v, e->variants)
+                if (v->memchunk.memblock && (!lru_v || v->last_used < lru_v->last_used)) {
+                    lru_e = e;
+                    lru_v = v;
+                }
+
+        pa_assert(lru_v);
+
+        pa_log_debug("Dropping converted variant of sample \"%s\" (%lu bytes)", lru_e->name, (unsigned long) lru_v->memchunk.length);
+
+        sum -= lru_v->memchunk.length;
+        variant_free(lru_e, lru_v);
+    }
+}
+
+/* Work for the compiler thread: either a sound file to precompile, or
+ * an entry to convert for a sink. Conversion jobs carry everything
+ * they need, the thread never looks at the entry itself. */
+struct compiler_job {
+    char *filename;
+
+    uint32_t entry_index;
+    pa_memchunk source;
+    pa_sample_spec source_ss, ss;
+    pa_channel_map source_map, map;
+    pa_resample_method_t method;
+    pa_resample_flags_t flags;
+};
+
+static void job_free(struct compiler_job *j) {
+    pa_assert(j);
+
+    if (j->source.memblock)
+        pa_memblock_unref(j->source.memblock);
+
+    pa_xfree(j->filename);
+    pa_xfree(j);
+}
+
+/* Converts a whole entry in one go. The resampler's filter delays the
+ * data, so silence is fed after it until the tail has come out as
+ * well. The result is as long as what came out, minus the silence
+ * beyond the converted length of the input. */
+static int convert(pa_mempool *pool, const struct compiler_job *j, pa_memchunk *result) {
+    pa_resampler *r;
+    pa_memblock *silence;
+    size_t max_block_size, drain, index = 0, length = 0, allocated = 0, expected, fs;
+    uint8_t *data = NULL;
+    void *silent_frame;
+
+    if (!(r = pa_resampler_new(pool, &j->source_ss, &j->source_map, &j->ss, &j->map, j->method, j->flags)))
+        return -1;
+
+    max_block_size = pa_frame_align(pa_resampler_max_block_size(r), &j->source_ss);
+    drain = pa_usec_to_bytes(CONVERT_DRAIN_USEC, &j->source_ss);
+    expected = pa_resampler_result(r, j->source.length);
+
+    silence = pa_silence_memblock(pa_memblock_new(pool, PA_MIN(drain, max_block_size)), &j->source_ss);
+
+    while (index < j->source.length + drain) {
+        pa_memchunk in, out;
+
+        if (index < j->source.length) {
+            in = j->source;
+            in.index += index;
+            in.length = PA_MIN(j->source.length - index, max_block_size);
+        } else {
+            in.memblock = silence;
+            in.index = 0;
+            in.length = PA_MIN(j->source.length + drain - index, pa_memblock_get_length(silence));
+        }
+
+        index += in.length;
+
+        pa_resampler_run(r, &in, &out);
+
+        if (!out.memblock)
+            continue;
+
+        if (length + out.length > PA_SCACHE_VARIANTS_SIZE_MAX) {
+            pa_memblock_unref(out.memblock);
+            length = 0;
+            break;
+        }
+
+        if (length + out.length > allocated) {
+            allocated = PA_MAX(allocated * 2, length + out.length);
+            data = pa_xrealloc(data, allocated);
+        }
+
+        memcpy(data + length, (uint8_t*) pa_memblock_acquire(out.memblock) + out.index, out.length);
+        pa_memblock_release(out.memblock);
+        pa_memblock_unref(out.memblock);
+
+        length += out.length;
+    }
+
+    pa_memblock_unref(silence);
+    pa_resampler_free(r);
+
+    fs = pa_frame_size(&j->ss);
+    silent_frame = pa_silence_memory(pa_xmalloc(fs), fs, &j->ss);
+
+    while (length > expected && memcmp(data + length - fs, silent_frame, fs) == 0)
+        length -= fs;
+
+    pa_xfree(silent_frame);
+
+    if (length <= 0) {
+        pa_xfree(data);
+        return -1;
+    }
+
+    result->memblock = pa_memblock_new_malloced(pool, pa_xrealloc(data, length), length);
+    result->index = 0;
+    result->length = length;
+
+    return 0;
+}
+
+static void compile_file(pa_scache_compiler *sc, const char *fn) {
+    pa_sample_spec ss;
+    pa_channel_map map;
+    pa_memchunk chunk;
+    pa_proplist *p;
+
+    if (compiled_load(sc->core->mempool, fn, &ss, &map, &chunk, NULL) >= 0) {
+        pa_memblock_unref(chunk.memblock);
+        sc->n_up_to_date++;
+        return;
+    }
+
+    p = pa_proplist_new();
+
+    if (!pa_sound_file_too_big_to_cache(fn) &&
+        pa_sound_file_load(sc->core->mempool, fn, &ss, &map, &chunk, p) >= 0) {
+
+        if (compiled_save(fn, &ss, &map, &chunk, p) >= 0)
+            sc->n_compiled++;
+
+        pa_memblock_unref(chunk.memblock);
+    }
+
+    pa_proplist_free(p);
+}
+
+static void compiler_thread_func(void *userdata) {
+    pa_scache_compiler *sc = userdata;
+
+    for (;;) {
+        struct compiler_job *j;
+
+        pa_mutex_lock(sc->mutex);
+
+        if (pa_atomic_load(&sc->cancel) || !(j = pa_queue_pop(sc->jobs))) {
+            pa_log_debug("Precompiled %u samples, %u were up to date.", sc->n_compiled, sc->n_up_to_date);
+            sc->running = FALSE;
+            pa_mutex_unlock(sc->mutex);
+            break;
+        }
+
+        pa_mutex_unlock(sc->mutex);
+
+        if (j->source.memblock) {
+            pa_memchunk result;
+
+            /* Hand the result over to the main thread, which owns the
+             * entries */
+            if (convert(sc->core->mempool, j, &result) >= 0) {
+                pa_asyncmsgq_post(sc->results, NULL, 0, j, 0, &result, (pa_free_cb_t) job_free);
+                pa_memblock_unref(result.memblock);
+            } else
+                pa_asyncmsgq_post(sc->results, NULL, 0, j, 0, NULL, (pa_free_cb_t) job_free);
+
+        } else {
+            compile_file(sc, j->filename);
+            job_free(j);
+        }
+    }
+}
+
+/* Called from the main thread when a conversion is done */
+static void variant_done(pa_core *c, const struct compiler_job *j, const pa_memchunk *chunk) {
+    pa_scache_entry *e;
+    pa_scache_variant *v = NULL;
+
+    /* The entry might have been replaced or removed in the meantime,
+     * or the variant dropped again. The job holds a reference to the
+     * data it converted, so it can't have been reused for another
+     * entry. */
+    if ((e = pa_idxset_get_by_index(c->scache, j->entry_index)) && e->memchunk.memblock == j->source.memblock)
+        PA_LLIST_FOREACH(v, e->variants)
+            if (!v->memchunk.memblock &&
+                pa_sample_spec_equal(&v->sample_spec, &j->ss) &&
+                pa_channel_map_equal(&v->channel_map, &j->map))
+                break;
+
+    if (!v)
+        return;
+
+    if (!chunk->memblock) {
+        pa_log_debug("Failed to convert sample \"%s\".", e->name);
+        variant_free(e, v);
+        return;
+    }
+
+    variants_make_room(c, chunk->length);
+
+    v->memchunk = *chunk;
+    pa_memblock_ref(v->memchunk.memblock);
+
+    pa_log_debug("Converted sample \"%s\", %lu bytes", e->name, (unsigned long) chunk->length);
+}
+
+static void compiler_results_cb(pa_mainloop_api *m, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    pa_scache_compiler *sc = userdata;
+
+    pa_assert(sc);
+    pa_assert(pa_asyncmsgq_read_fd(sc->results) == fd);
+
+    pa_asyncmsgq_read_after_poll(sc->results);
+
+    for (;;) {
+        struct compiler_job *j;
+        pa_memchunk chunk;
+
+        while (pa_asyncmsgq_get(sc->results, NULL, NULL, (void**) &j, NULL, &chunk, FALSE) >= 0) {
+            variant_done(sc->core, j, &chunk);
+            pa_asyncmsgq_done(sc->results, 0);
+        }
+
+        if (pa_asyncmsgq_read_before_poll(sc->results) == 0)
+            break;
+    }
+}
+
+/* Queues a job for the compiler thread, and starts the thread unless
+ * it is running already. Never waits for the thread: if it is still
+ * busy it picks up the job when it is done with the current one. If
+ * the thread can't be started, all queued jobs are dropped together
+ * with the variants waiting for them, and -1 is returned. */
+static int compiler_push(pa_core *c, struct compiler_job *j) {
+    pa_scache_compiler *sc;
+    struct compiler_job *k;
+    pa_bool_t start;
+
+    pa_assert(c);
+
+    if (!(sc = c->scache_compiler)) {
+        sc = c->scache_compiler = pa_xnew0(pa_scache_compiler, 1);
+        sc->core = c;
+        sc->mutex = pa_mutex_new(FALSE, FALSE);
+        sc->jobs = pa_queue_new();
+
+        pa_assert_se(sc->results = pa_asyncmsgq_new(0));
+        pa_assert_se(pa_asyncmsgq_read_before_poll(sc->results) == 0);
+        pa_assert_se(sc->results_event = c->mainloop->io_new(c->mainloop, pa_asyncmsgq_read_fd(sc->results), PA_IO_EVENT_INPUT, compiler_results_cb, sc));
+    }
+
+    pa_mutex_lock(sc->mutex);
+
+    pa_queue_push(sc->jobs, j);
+
+    if ((start = !sc->running))
+        sc->running = TRUE;
+
+    pa_mutex_unlock(sc->mutex);
+
+    if (!start)
+        return 0;
+
+    /* The previous thread has run out of work already, so this
+     * doesn't block */
+    if (sc->thread)
+        pa_thread_free(sc->thread);
+
+    if ((sc->thread = pa_thread_new("scache-compiler", compiler_thread_func, sc)))
+        return 0;
+
+    pa_log_warn("Failed to start sample compiler thread, dropping queued work.");
+
+    /* Nobody is going to fill in the variants, so drop them again */
+    pa_mutex_lock(sc->mutex);
+
+    while ((k = pa_queue_pop(sc->jobs))) {
+        if (k->source.memblock) {
+            pa_memchunk chunk;
+
+            pa_memchunk_reset(&chunk);
+            variant_done(c, k, &chunk);
+        }
+
+        job_free(k);
+    }
+
+    sc->running = FALSE;
+    pa_mutex_unlock(sc->mutex);
+
+    return -1;
+}
+
+/* Queues all lazy entries that are not loaded yet for precompiling */
+static void compiler_start(pa_core *c) {
+#ifdef HAVE_SYS_MMAN_H
+    pa_scache_entry *e;
+    uint32_t idx;
+
+    pa_assert(c);
+
+    PA_IDXSET_FOREACH(e, c->scache, idx)
+        if (e->lazy && !e->memchunk.memblock) {
+            struct compiler_job *j;
+
+            j = pa_xnew0(struct compiler_job, 1);
+            j->filename = pa_xstrdup(e->filename);
+            compiler_push(c, j);
+        }
+#endif
+}
+
+static void compiler_free(pa_scache_compiler *sc) {
+    pa_assert(sc);
+
+    pa_atomic_store(&sc->cancel, 1);
+
+    if (sc->thread)
+        pa_thread_free(sc->thread);
+
+    /* Conversions that are done but not picked up yet are dropped */
+    pa_asyncmsgq_flush(sc->results, FALSE);
+    sc->core->mainloop->io_free(sc->results_event);
+    pa_asyncmsgq_unref(sc->results);
+
+    pa_queue_free(sc->jobs, (pa_free_cb_t) job_free);
+    pa_mutex_free(sc->mutex);
+    pa_xfree(sc);
+}
+
+/* Returns the variant of the entry matching the sink, or NULL if the
+ * entry is to be played as it is. A missing variant is converted by
+ * the compiler thread, until it is done the entry is resampled on the
+ * fly like any other stream. */
+static pa_scache_variant *variant_get(pa_scache_entry *e, pa_sink *sink) {
+    pa_scache_variant *v;
+
+    pa_assert(e);
+    pa_assert(sink);
+
+    if (pa_sample_spec_equal(&e->sample_spec, &sink->sample_spec) &&
+        pa_channel_map_equal(&e->channel_map, &sink->channel_map))
+        return NULL;
+
+    PA_LLIST_FOREACH(v, e->variants)
+        if (pa_sample_spec_equal(&v->sample_spec, &sink->sample_spec) &&
+            pa_channel_map_equal(&v->channel_map, &sink->channel_map))
+            break;
+
+    if (!v) {
+        struct compiler_job *j;
+
+        if (pa_usec_to_bytes(pa_bytes_to_usec(e->memchunk.length, &e->sample_spec), &sink->sample_spec) > PA_SCACHE_VARIANTS_SIZE_MAX)
+            return NULL;
+
+        /* A variant without data is one that is being converted */
+        v = pa_xnew0(pa_scache_variant, 1);
+        v->sample_spec = sink->sample_spec;
+        v->channel_map = sink->channel_map;
+        pa_memchunk_reset(&v->memchunk);
+        PA_LLIST_PREPEND(pa_scache_variant, e->variants, v);
+
+        j = pa_xnew0(struct compiler_job, 1);
+        j->entry_index = e->index;
+        j->source = e->memchunk;
+        pa_memblock_ref(j->source.memblock);
+        j->source_ss = e->sample_spec;
+        j->source_map = e->channel_map;
+        j->ss = sink->sample_spec;
+        j->map = sink->channel_map;
+        j->method = e->core->resample_method;
+        j->flags =
+            (e->core->disable_remixing ? PA_RESAMPLER_NO_REMIX : 0) |
+            (e->core->disable_lfe_remixing ? PA_RESAMPLER_NO_LFE : 0);
+
+        /* On failure the placeholder is gone already */
+        if (compiler_push(e->core, j) < 0)
+            return NULL;
+    }
+
+    v->last_used = pa_rtclock_now();
+
+    return v->memchunk.memblock ? v : NULL;
+}
+
 static void free_entry(pa_scache_entry *e) {
     pa_assert(e);
 
+    free_variants(e);
+
     pa_namereg_unregister(e->core, e->name);
     pa_subscription_post(e->core, PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE|PA_SUBSCRIPTION_EVENT_REMOVE, e->index);
     pa_xfree(e->name);
@@ -100,6 +843,8 @@ static pa_scache_entry* scache_add_item(pa_core *c, const char *name) {
         if (e->memchunk.memblock)
             pa_memblock_unref(e->memchunk.memblock);
 
+        free_variants(e);
+
         pa_xfree(e->filename);
         pa_proplist_clear(e->proplist);
 
@@ -117,6 +862,7 @@ static pa_scache_entry* scache_add_item(pa_core *c, const char *name) {
         e->name = pa_xstrdup(name);
         e->core = c;
         e->proplist = pa_proplist_new();
+        PA_LLIST_HEAD_INIT(pa_scache_variant, e->variants);
 
         pa_idxset_put(c->scache, e, &e->index);
 
@@ -220,7 +966,7 @@ int pa_scache_add_file(pa_core *c, const char *name, const char *filename, uint3
     p = pa_proplist_new();
     pa_proplist_sets(p, PA_PROP_MEDIA_FILENAME, filename);
 
-    if (pa_sound_file_load(c->mempool, filename, &ss, &map, &chunk, p) < 0) {
+    if (sound_file_load(c, filename, &ss, &map, &chunk, p) < 0) {
         pa_proplist_free(p);
         return -1;
     }
@@ -286,6 +1032,11 @@ void pa_scache_free_all(pa_core *c) {
 
     pa_assert(c);
 
+    if (c->scache_compiler) {
+        compiler_free(c->scache_compiler);
+        c->scache_compiler = NULL;
+    }
+
     while ((e = pa_idxset_steal_first(c->scache, NULL)))
         free_entry(e);
 
@@ -300,6 +1051,7 @@ int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t
     pa_cvolume r;
     pa_proplist *merged;
     pa_bool_t pass_volume;
+    pa_scache_variant *v;
 
     pa_assert(c);
     pa_assert(name);
@@ -315,7 +1067,7 @@ int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t
     if (e->lazy && !e->memchunk.memblock) {
         pa_channel_map old_channel_map = e->channel_map;
 
-        if (pa_sound_file_load(c->mempool, e->filename, &e->sample_spec, &e->channel_map, &e->memchunk, merged) < 0)
+        if (sound_file_load(c, e->filename, &e->sample_spec, &e->channel_map, &e->memchunk, merged) < 0)
             goto fail;
 
         pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE|PA_SUBSCRIPTION_EVENT_CHANGE, e->index);
@@ -350,12 +1102,27 @@ int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t
     if (p)
         pa_proplist_update(merged, PA_UPDATE_REPLACE, p);
 
-    if (pa_play_memchunk(sink,
-                         &e->sample_spec, &e->channel_map,
-                         &e->memchunk,
-                         pass_volume ? &r : NULL,
-                         merged,
-                         PA_SINK_INPUT_NO_CREATE_ON_SUSPEND|PA_SINK_INPUT_KILL_ON_SUSPEND, sink_input_idx) < 0)
+    /* If the sink doesn't match the entry, play a copy that has been
+     * converted once instead of resampling on every play */
+    if ((v = variant_get(e, sink))) {
+
+        if (pass_volume)
+            pa_cvolume_remap(&r, &e->channel_map, &v->channel_map);
+
+        if (pa_play_memchunk(sink,
+                             &v->sample_spec, &v->channel_map,
+                             &v->memchunk,
+                             pass_volume ? &r : NULL,
+                             merged,
+                             PA_SINK_INPUT_NO_CREATE_ON_SUSPEND|PA_SINK_INPUT_KILL_ON_SUSPEND, sink_input_idx) < 0)
+            goto fail;
+
+    } else if (pa_play_memchunk(sink,
+                                &e->sample_spec, &e->channel_map,
+                                &e->memchunk,
+                                pass_volume ? &r : NULL,
+                                merged,
+                                PA_SINK_INPUT_NO_CREATE_ON_SUSPEND|PA_SINK_INPUT_KILL_ON_SUSPEND, sink_input_idx) < 0)
         goto fail;
 
     pa_proplist_free(merged);
@@ -420,7 +1187,7 @@ size_t pa_scache_total_size(pa_core *c) {
         if (e->memchunk.memblock)
             sum += e->memchunk.length;
 
-    return sum;
+    return sum + variants_total_size(c);
 }
 
 void pa_scache_unload_unused(pa_core *c) {
@@ -445,6 +1212,7 @@ void pa_scache_unload_unused(pa_core *c) {
 
         pa_memblock_unref(e->memchunk.memblock);
         pa_memchunk_reset(&e->memchunk);
+        free_variants(e);
 
         pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE|PA_SUBSCRIPTION_EVENT_CHANGE, e->index);
     }
@@ -512,5 +1280,8 @@ int pa_scache_add_directory_lazy(pa_core *c, const char *pathname) {
         closedir(dir);
     }
 
+    if (c->scache_precompile)
+        compiler_start(c);
+
     return 0;
 }
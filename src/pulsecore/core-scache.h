@@ -26,9 +26,28 @@
 #include <pulsecore/core.h>
 #include <pulsecore/memchunk.h>
 #include <pulsecore/sink.h>
+#include <pulsecore/llist.h>
 
 #define PA_SCACHE_ENTRY_SIZE_MAX (1024*1024*16)
 
+/* Upper bound for the memory used by all converted variants together */
+#define PA_SCACHE_VARIANTS_SIZE_MAX (1024*1024*4)
+
+typedef struct pa_scache_compiler pa_scache_compiler;
+
+/* A copy of an entry converted to the sample spec and channel map of
+ * a sink, so that playing it there needs no resampler. The memchunk
+ * stays empty while the compiler thread is converting it. */
+typedef struct pa_scache_variant {
+    pa_sample_spec sample_spec;
+    pa_channel_map channel_map;
+    pa_memchunk memchunk;
+
+    pa_usec_t last_used;
+
+    PA_LLIST_FIELDS(struct pa_scache_variant);
+} pa_scache_variant;
+
 typedef struct pa_scache_entry {
     uint32_t index;
     pa_core *core;
@@ -47,6 +66,8 @@ typedef struct pa_scache_entry {
     time_t last_used_time;
 
     pa_proplist *proplist;
+
+    PA_LLIST_HEAD(pa_scache_variant, variants);
 } pa_scache_entry;
 
 int pa_scache_add_item(pa_core *c, const char *name, const pa_sample_spec *ss, const pa_channel_map *map, const pa_memchunk *chunk, pa_proplist *p, uint32_t *idx);
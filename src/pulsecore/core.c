@@ -63,22 +63,22 @@ static int core_process_msg(pa_msgobject *o, int code, void *userdata, int64_t o
 
 static void core_free(pa_object *o);
 
-pa_core* pa_core_new(pa_mainloop_api *m, pa_bool_t shared, size_t shm_size) {
+pa_core* pa_core_new(pa_mainloop_api *m, pa_shm_type_t shm_type, size_t shm_size, pa_bool_t shm_huge_pages, unsigned shm_prefault_slots) {
     pa_core* c;
     pa_mempool *pool;
     int j;
 
     pa_assert(m);
 
-    if (shared) {
-        if (!(pool = pa_mempool_new(shared, shm_size))) {
+    if (shm_type != PA_SHM_PRIVATE) {
+        if (!(pool = pa_mempool_new_full(shm_type, shm_size, shm_huge_pages, shm_prefault_slots))) {
             pa_log_warn("failed to allocate shared memory pool. Falling back to a normal memory pool.");
-            shared = FALSE;
+            shm_type = PA_SHM_PRIVATE;
         }
     }
 
-    if (!shared) {
-        if (!(pool = pa_mempool_new(shared, shm_size))) {
+    if (shm_type == PA_SHM_PRIVATE) {
+        if (!(pool = pa_mempool_new_full(shm_type, shm_size, shm_huge_pages, shm_prefault_slots))) {
             pa_log("pa_mempool_new() failed.");
             return NULL;
         }
@@ -98,6 +98,7 @@ pa_core* pa_core_new(pa_mainloop_api *m, pa_bool_t shared, size_t shm_size) {
     c->sink_inputs = pa_idxset_new(NULL, NULL);
     c->source_outputs = pa_idxset_new(NULL, NULL);
     c->modules = pa_idxset_new(NULL, NULL);
+    c->modules_aborted = pa_idxset_new(NULL, NULL);
     c->scache = pa_idxset_new(NULL, NULL);
 
     c->namereg = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
@@ -118,6 +119,7 @@ pa_core* pa_core_new(pa_mainloop_api *m, pa_bool_t shared, size_t shm_size) {
 
     c->module_defer_unload_event = NULL;
     c->scache_auto_unload_event = NULL;
+    c->scache_compiler = NULL;
 
     c->subscription_defer_event = NULL;
     PA_LLIST_HEAD_INIT(pa_subscription, c->subscriptions);
@@ -141,6 +143,9 @@ pa_core* pa_core_new(pa_mainloop_api *m, pa_bool_t shared, size_t shm_size) {
     c->disable_remixing = FALSE;
     c->disable_lfe_remixing = FALSE;
     c->deferred_volume = TRUE;
+    c->parallel_module_init = FALSE;
+    c->startup_trace = FALSE;
+    c->scache_precompile = FALSE;
     c->resample_method = PA_RESAMPLER_SPEEX_FLOAT_BASE + 3;
 
     for (j = 0; j < PA_CORE_HOOK_MAX; j++)
@@ -175,6 +180,9 @@ static void core_free(pa_object *o) {
     pa_assert(pa_idxset_isempty(c->modules));
     pa_idxset_free(c->modules, NULL, NULL);
 
+    pa_assert(pa_idxset_isempty(c->modules_aborted));
+    pa_idxset_free(c->modules_aborted, NULL, NULL);
+
     pa_assert(pa_idxset_isempty(c->clients));
     pa_idxset_free(c->clients, NULL, NULL);
 
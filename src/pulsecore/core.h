@@ -151,6 +151,9 @@ struct pa_core {
 
     pa_defer_event *module_defer_unload_event;
 
+    /* Unloaded modules whose deferred initialization is still running */
+    pa_idxset *modules_aborted;
+
     pa_defer_event *subscription_defer_event;
     PA_LLIST_HEAD(pa_subscription, subscriptions);
     PA_LLIST_HEAD(pa_subscription_event, subscription_event_queue);
@@ -161,6 +164,7 @@ struct pa_core {
 
     pa_time_event *exit_event;
     pa_time_event *scache_auto_unload_event;
+    struct pa_scache_compiler *scache_compiler;
 
     int exit_idle_time, scache_idle_time;
 
@@ -172,6 +176,9 @@ struct pa_core {
     pa_bool_t disable_remixing:1;
     pa_bool_t disable_lfe_remixing:1;
     pa_bool_t deferred_volume:1;
+    pa_bool_t parallel_module_init:1;
+    pa_bool_t startup_trace:1;
+    pa_bool_t scache_precompile:1;
 
     pa_resample_method_t resample_method;
     int realtime_priority;
@@ -191,7 +198,7 @@ enum {
     PA_CORE_MESSAGE_MAX
 };
 
-pa_core* pa_core_new(pa_mainloop_api *m, pa_bool_t shared, size_t shm_size);
+pa_core* pa_core_new(pa_mainloop_api *m, pa_shm_type_t shm_type, size_t shm_size, pa_bool_t shm_huge_pages, unsigned shm_prefault_slots);
 
 /* Check whether no one is connected to this core */
 void pa_core_check_idle(pa_core *c);
@@ -56,7 +56,11 @@ pa_bool_t pa_iochannel_creds_supported(pa_iochannel *io);
 int pa_iochannel_creds_enable(pa_iochannel *io);
 
 ssize_t pa_iochannel_write_with_creds(pa_iochannel*io, const void*data, size_t l, const pa_creds *ucred);
-ssize_t pa_iochannel_read_with_creds(pa_iochannel*io, void*data, size_t l, pa_creds *ucred, pa_bool_t *creds_valid);
+ssize_t pa_iochannel_read_with_creds(pa_iochannel*io, void*data, size_t l, pa_creds *ucred, pa_bool_t *creds_valid, int *fd);
+
+/* Like pa_iochannel_write(), but passes a duplicate of fd to the peer
+ * alongside the data */
+ssize_t pa_iochannel_write_with_fd(pa_iochannel*io, const void*data, size_t l, int fd);
 #endif
 
 pa_bool_t pa_iochannel_is_readable(pa_iochannel*io);
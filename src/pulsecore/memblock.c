@@ -89,9 +89,20 @@ struct pa_memblock {
             uint32_t id;
             pa_memimport_segment *segment;
         } imported;
+
+        struct {
+            pa_memregion *region;
+            pa_free_cb_t free_cb;
+        } region;
     } per_type;
 };
 
+struct pa_memregion {
+    PA_REFCNT_DECLARE;
+    pa_mempool *pool;
+    pa_shm memory;
+};
+
 struct pa_memimport_segment {
     pa_memimport *import;
     pa_shm memory;
@@ -147,6 +158,9 @@ struct pa_mempool {
     size_t block_size;
     unsigned n_blocks;
 
+    /* The first slots were faulted in when the pool was created */
+    unsigned n_prefaulted;
+
     pa_atomic_t n_init;
 
     PA_LLIST_HEAD(pa_memimport, imports);
@@ -257,9 +271,14 @@ static struct mempool_slot* mempool_allocate_slot(pa_mempool *p) {
 
         if ((unsigned) (idx = pa_atomic_inc(&p->n_init)) >= p->n_blocks)
             pa_atomic_dec(&p->n_init);
-        else
+        else {
             slot = (struct mempool_slot*) ((uint8_t*) p->memory.ptr + (p->block_size * (size_t) idx));
 
+            /* Whoever writes to it first will take the page faults */
+            if ((unsigned) idx >= p->n_prefaulted)
+                pa_atomic_inc(&p->stat.n_cold_slots);
+        }
+
         if (!slot) {
             if (pa_log_ratelimit(PA_LOG_DEBUG))
                 pa_log_debug("Pool full");
@@ -415,6 +434,37 @@ pa_memblock *pa_memblock_new_user(pa_mempool *p, void *d, size_t length, pa_free
     return b;
 }
 
+/* No lock necessary */
+pa_memblock *pa_memblock_new_region(pa_memregion *r, void *d, size_t length, pa_free_cb_t free_cb) {
+    pa_memblock *b;
+
+    pa_assert(r);
+    pa_assert(PA_REFCNT_VALUE(r) > 0);
+    pa_assert(d);
+    pa_assert(length);
+    pa_assert((uint8_t*) d >= (uint8_t*) r->memory.ptr);
+    pa_assert((uint8_t*) d + length <= (uint8_t*) r->memory.ptr + r->memory.size);
+
+    if (!(b = pa_flist_pop(PA_STATIC_FLIST_GET(unused_memblocks))))
+        b = pa_xnew(pa_memblock, 1);
+
+    PA_REFCNT_INIT(b);
+    b->pool = r->pool;
+    b->type = PA_MEMBLOCK_REGION;
+    b->read_only = TRUE;
+    b->is_silence = FALSE;
+    pa_atomic_ptr_store(&b->data, d);
+    b->length = length;
+    pa_atomic_store(&b->n_acquired, 0);
+    pa_atomic_store(&b->please_signal, 0);
+
+    b->per_type.region.region = pa_memregion_ref(r);
+    b->per_type.region.free_cb = free_cb;
+
+    stat_add(b);
+    return b;
+}
+
 /* No lock necessary */
 pa_bool_t pa_memblock_is_read_only(pa_memblock *b) {
     pa_assert(b);
@@ -516,6 +566,17 @@ static void memblock_free(pa_memblock *b) {
 
             break;
 
+        case PA_MEMBLOCK_REGION:
+            if (b->per_type.region.free_cb)
+                b->per_type.region.free_cb(pa_atomic_ptr_load(&b->data));
+
+            pa_memregion_unref(b->per_type.region.region);
+
+            if (pa_flist_push(PA_STATIC_FLIST_GET(unused_memblocks), b) < 0)
+                pa_xfree(b);
+
+            break;
+
         case PA_MEMBLOCK_APPENDED:
 
             /* We could attach it to unused_memblocks, but that would
@@ -537,7 +598,7 @@ static void memblock_free(pa_memblock *b) {
             pa_assert_se(pa_hashmap_remove(import->blocks, PA_UINT32_TO_PTR(b->per_type.imported.id)));
 
             pa_assert(segment->n_blocks >= 1);
-            if (-- segment->n_blocks <= 0)
+            if (-- segment->n_blocks <= 0 && !segment->memory.memfd)
                 segment_detach(segment);
 
             pa_mutex_unlock(import->mutex);
@@ -699,13 +760,17 @@ static void memblock_replace_import(pa_memblock *b) {
     memblock_make_local(b);
 
     pa_assert(segment->n_blocks >= 1);
-    if (-- segment->n_blocks <= 0)
+    if (-- segment->n_blocks <= 0 && !segment->memory.memfd)
         segment_detach(segment);
 
     pa_mutex_unlock(import->mutex);
 }
 
 pa_mempool* pa_mempool_new(pa_bool_t shared, size_t size) {
+    return pa_mempool_new_full(shared ? PA_SHM_POSIX : PA_SHM_PRIVATE, size, FALSE, 0);
+}
+
+pa_mempool* pa_mempool_new_full(pa_shm_type_t type, size_t size, pa_bool_t huge_pages, unsigned prefault_slots) {
     pa_mempool *p;
     char t1[PA_BYTES_SNPRINT_MAX], t2[PA_BYTES_SNPRINT_MAX];
 
@@ -724,19 +789,24 @@ pa_mempool* pa_mempool_new(pa_bool_t shared, size_t size) {
             p->n_blocks = 2;
     }
 
-    if (pa_shm_create_rw(&p->memory, p->n_blocks * p->block_size, shared, 0700) < 0) {
+    p->n_prefaulted = PA_MIN(prefault_slots, p->n_blocks);
+
+    if (pa_shm_create_rw_full(&p->memory, p->n_blocks * p->block_size, type, huge_pages, p->n_prefaulted * p->block_size, 0700) < 0) {
         pa_xfree(p);
         return NULL;
     }
 
-    pa_log_debug("Using %s memory pool with %u slots of size %s each, total size is %s, maximum usable slot size is %lu",
-                 p->memory.shared ? "shared" : "private",
+    pa_log_debug("Using %s memory pool with %u slots of size %s each, total size is %s, maximum usable slot size is %lu, %u slots prefaulted%s",
+                 p->memory.memfd ? "memfd shared" : p->memory.shared ? "shared" : "private",
                  p->n_blocks,
                  pa_bytes_snprint(t1, sizeof(t1), (unsigned) p->block_size),
                  pa_bytes_snprint(t2, sizeof(t2), (unsigned) (p->n_blocks * p->block_size)),
-                 (unsigned long) pa_mempool_block_size_max(p));
+                 (unsigned long) pa_mempool_block_size_max(p),
+                 p->n_prefaulted,
+                 p->memory.huge_pages ? ", using huge pages" : "");
 
     memset(&p->stat, 0, sizeof(p->stat));
+    pa_atomic_store(&p->stat.n_prefaulted, (int) p->n_prefaulted);
     pa_atomic_store(&p->n_init, 0);
 
     PA_LLIST_HEAD_INIT(pa_memimport, p->imports);
@@ -845,7 +915,10 @@ void pa_mempool_vacuum(pa_mempool *p) {
             ;
 
     while ((slot = pa_flist_pop(list))) {
-        pa_shm_punch(&p->memory, (size_t) ((uint8_t*) slot - (uint8_t*) p->memory.ptr), p->block_size);
+
+        /* Keep what we faulted in on purpose */
+        if (mempool_slot_idx(p, slot) >= p->n_prefaulted)
+            pa_shm_punch(&p->memory, (size_t) ((uint8_t*) slot - (uint8_t*) p->memory.ptr), p->block_size);
 
         while (pa_flist_push(p->free_slots, slot))
             ;
@@ -873,6 +946,75 @@ pa_bool_t pa_mempool_is_shared(pa_mempool *p) {
     return !!p->memory.shared;
 }
 
+pa_bool_t pa_mempool_is_memfd_backed(pa_mempool *p) {
+    pa_assert(p);
+
+    return !!p->memory.memfd;
+}
+
+pa_memregion* pa_memregion_new(pa_mempool *p, size_t size) {
+    pa_memregion *r;
+
+    pa_assert(p);
+    pa_assert(size > 0);
+
+    if (size > PA_MEMREGION_SIZE_MAX)
+        return NULL;
+
+    r = pa_xnew(pa_memregion, 1);
+
+    /* Not a memfd, even if the pool is one: a peer keeps memfd segments
+     * attached until the connection is closed, and regions come and go
+     * with the shared buffers of the streams. POSIX segments are
+     * detached as soon as the last block is released. */
+    if (pa_shm_create_rw(&r->memory, PA_PAGE_ALIGN(size), p->memory.shared, 0700) < 0) {
+        pa_xfree(r);
+        return NULL;
+    }
+
+    PA_REFCNT_INIT(r);
+    r->pool = p;
+
+    pa_log_debug("Using %s memory region of %lu bytes", r->memory.shared ? "shared" : "private", (unsigned long) r->memory.size);
+
+    return r;
+}
+
+/* No lock necessary */
+pa_memregion* pa_memregion_ref(pa_memregion *r) {
+    pa_assert(r);
+    pa_assert(PA_REFCNT_VALUE(r) > 0);
+
+    PA_REFCNT_INC(r);
+    return r;
+}
+
+/* No lock necessary */
+void pa_memregion_unref(pa_memregion *r) {
+    pa_assert(r);
+    pa_assert(PA_REFCNT_VALUE(r) > 0);
+
+    if (PA_REFCNT_DEC(r) > 0)
+        return;
+
+    pa_shm_free(&r->memory);
+    pa_xfree(r);
+}
+
+void* pa_memregion_get_data(pa_memregion *r) {
+    pa_assert(r);
+    pa_assert(PA_REFCNT_VALUE(r) > 0);
+
+    return r->memory.ptr;
+}
+
+size_t pa_memregion_get_length(pa_memregion *r) {
+    pa_assert(r);
+    pa_assert(PA_REFCNT_VALUE(r) > 0);
+
+    return r->memory.size;
+}
+
 /* For receiving blocks from other nodes */
 pa_memimport* pa_memimport_new(pa_mempool *p, pa_memimport_release_cb_t cb, void *userdata) {
     pa_memimport *i;
@@ -897,16 +1039,22 @@ pa_memimport* pa_memimport_new(pa_mempool *p, pa_memimport_release_cb_t cb, void
 
 static void memexport_revoke_blocks(pa_memexport *e, pa_memimport *i);
 
-/* Should be called locked */
-static pa_memimport_segment* segment_attach(pa_memimport *i, uint32_t shm_id) {
+/* Should be called locked. Attaches the segment by its ID, or through
+ * memfd if that is not -1. Segments passed to us as memfd stay
+ * attached until the import is freed, since the other side sends us
+ * their fd only once. */
+static pa_memimport_segment* segment_attach(pa_memimport *i, uint32_t shm_id, int memfd) {
     pa_memimport_segment* seg;
 
-    if (pa_hashmap_size(i->segments) >= PA_MEMIMPORT_SEGMENTS_MAX)
+    if (pa_hashmap_size(i->segments) >= PA_MEMIMPORT_SEGMENTS_MAX) {
+        if (memfd >= 0)
+            pa_close(memfd);
         return NULL;
+    }
 
     seg = pa_xnew0(pa_memimport_segment, 1);
 
-    if (pa_shm_attach_ro(&seg->memory, shm_id) < 0) {
+    if ((memfd >= 0 ? pa_shm_attach_memfd(&seg->memory, shm_id, memfd) : pa_shm_attach_ro(&seg->memory, shm_id)) < 0) {
         pa_xfree(seg);
         return NULL;
     }
@@ -935,6 +1083,7 @@ static void segment_detach(pa_memimport_segment *seg) {
 void pa_memimport_free(pa_memimport *i) {
     pa_memexport *e;
     pa_memblock *b;
+    pa_memimport_segment *seg;
 
     pa_assert(i);
 
@@ -943,7 +1092,12 @@ void pa_memimport_free(pa_memimport *i) {
     while ((b = pa_hashmap_first(i->blocks)))
         memblock_replace_import(b);
 
-    pa_assert(pa_hashmap_size(i->segments) == 0);
+    /* Only the memfd segments are left, which are kept attached */
+    while ((seg = pa_hashmap_first(i->segments))) {
+        pa_assert(seg->memory.memfd);
+        pa_assert(seg->n_blocks == 0);
+        segment_detach(seg);
+    }
 
     pa_mutex_unlock(i->mutex);
 
@@ -966,7 +1120,28 @@ void pa_memimport_free(pa_memimport *i) {
 }
 
 /* Self-locked */
-pa_memblock* pa_memimport_get(pa_memimport *i, uint32_t block_id, uint32_t shm_id, size_t offset, size_t size) {
+int pa_memimport_attach_memfd(pa_memimport *i, uint32_t shm_id, int memfd) {
+    int r = 0;
+
+    pa_assert(i);
+    pa_assert(memfd >= 0);
+
+    pa_mutex_lock(i->mutex);
+
+    if (pa_hashmap_get(i->segments, PA_UINT32_TO_PTR(shm_id))) {
+        pa_log_warn("Received memfd for a segment that is already attached.");
+        pa_close(memfd);
+        r = -1;
+    } else if (!segment_attach(i, shm_id, memfd))
+        r = -1;
+
+    pa_mutex_unlock(i->mutex);
+
+    return r;
+}
+
+/* Self-locked */
+pa_memblock* pa_memimport_get(pa_memimport *i, uint32_t block_id, uint32_t shm_id, size_t offset, size_t size, pa_bool_t memfd) {
     pa_memblock *b = NULL;
     pa_memimport_segment *seg;
 
@@ -982,9 +1157,21 @@ pa_memblock* pa_memimport_get(pa_memimport *i, uint32_t block_id, uint32_t shm_i
     if (pa_hashmap_size(i->blocks) >= PA_MEMIMPORT_SLOTS_MAX)
         goto finish;
 
-    if (!(seg = pa_hashmap_get(i->segments, PA_UINT32_TO_PTR(shm_id))))
-        if (!(seg = segment_attach(i, shm_id)))
+    if (!(seg = pa_hashmap_get(i->segments, PA_UINT32_TO_PTR(shm_id)))) {
+
+        /* memfd segments cannot be looked up by their ID, they need to
+         * have been passed to pa_memimport_attach_memfd() first */
+        if (memfd) {
+            pa_log_warn("Received block of memfd segment %u that was never attached.", shm_id);
+            goto finish;
+        }
+
+        if (!(seg = segment_attach(i, shm_id, -1)))
             goto finish;
+    }
+
+    if (seg->memory.memfd != memfd)
+        goto finish;
 
     if (offset+size > seg->memory.size)
         goto finish;
@@ -1148,7 +1335,11 @@ static pa_memblock *memblock_shared_copy(pa_mempool *p, pa_memblock *b) {
     pa_assert(p);
     pa_assert(b);
 
-    if (b->type == PA_MEMBLOCK_IMPORTED ||
+    /* Blocks from a memfd segment of some other peer are copied: passing
+     * that segment on would keep it mapped in whoever we forward it to
+     * for as long as they stay connected. */
+    if ((b->type == PA_MEMBLOCK_IMPORTED && !b->per_type.imported.segment->memory.memfd) ||
+        b->type == PA_MEMBLOCK_REGION ||
         b->type == PA_MEMBLOCK_POOL ||
         b->type == PA_MEMBLOCK_POOL_EXTERNAL) {
         pa_assert(b->pool == p);
@@ -1163,7 +1354,7 @@ static pa_memblock *memblock_shared_copy(pa_mempool *p, pa_memblock *b) {
 }
 
 /* Self-locked */
-int pa_memexport_put(pa_memexport *e, pa_memblock *b, uint32_t *block_id, uint32_t *shm_id, size_t *offset, size_t * size) {
+int pa_memexport_put(pa_memexport *e, pa_memblock *b, uint32_t *block_id, uint32_t *shm_id, size_t *offset, size_t * size, int *memfd) {
     pa_shm *memory;
     struct memexport_slot *slot;
     void *data;
@@ -1204,6 +1395,9 @@ int pa_memexport_put(pa_memexport *e, pa_memblock *b, uint32_t *block_id, uint32
     if (b->type == PA_MEMBLOCK_IMPORTED) {
         pa_assert(b->per_type.imported.segment);
         memory = &b->per_type.imported.segment->memory;
+    } else if (b->type == PA_MEMBLOCK_REGION) {
+        pa_assert(b->per_type.region.region);
+        memory = &b->per_type.region.region->memory;
     } else {
         pa_assert(b->type == PA_MEMBLOCK_POOL || b->type == PA_MEMBLOCK_POOL_EXTERNAL);
         pa_assert(b->pool);
@@ -1217,6 +1411,9 @@ int pa_memexport_put(pa_memexport *e, pa_memblock *b, uint32_t *block_id, uint32
     *offset = (size_t) ((uint8_t*) data - (uint8_t*) memory->ptr);
     *size = b->length;
 
+    if (memfd)
+        *memfd = memory->memfd ? memory->fd : -1;
+
     pa_memblock_release(b);
 
     pa_atomic_inc(&e->pool->stat.n_exported);
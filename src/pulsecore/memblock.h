@@ -28,6 +28,7 @@
 
 #include <pulse/def.h>
 #include <pulsecore/atomic.h>
+#include <pulsecore/shm.h>
 
 /* A pa_memblock is a reference counted memory block. PulseAudio
  * passed references to pa_memblocks around instead of copying
@@ -42,6 +43,7 @@ typedef enum pa_memblock_type {
     PA_MEMBLOCK_USER,             /* User supplied memory, to be freed with free_cb */
     PA_MEMBLOCK_FIXED,            /* data is a pointer to fixed memory that needs not to be freed */
     PA_MEMBLOCK_IMPORTED,         /* Memory is imported from another process via shm */
+    PA_MEMBLOCK_REGION,           /* Memory is part of a pa_memregion */
     PA_MEMBLOCK_TYPE_MAX
 } pa_memblock_type_t;
 
@@ -51,6 +53,7 @@ typedef struct pa_mempool_stat pa_mempool_stat;
 typedef struct pa_memimport_segment pa_memimport_segment;
 typedef struct pa_memimport pa_memimport;
 typedef struct pa_memexport pa_memexport;
+typedef struct pa_memregion pa_memregion;
 
 typedef void (*pa_memimport_release_cb_t)(pa_memimport *i, uint32_t block_id, void *userdata);
 typedef void (*pa_memexport_revoke_cb_t)(pa_memexport *e, uint32_t block_id, void *userdata);
@@ -72,6 +75,12 @@ struct pa_mempool_stat {
     pa_atomic_t n_too_large_for_pool;
     pa_atomic_t n_pool_full;
 
+    /* Slots faulted in when the pool was created, and slots that were
+     * handed out untouched, so that their first user took the page
+     * faults */
+    pa_atomic_t n_prefaulted;
+    pa_atomic_t n_cold_slots;
+
     pa_atomic_t n_allocated_by_type[PA_MEMBLOCK_TYPE_MAX];
     pa_atomic_t n_accumulated_by_type[PA_MEMBLOCK_TYPE_MAX];
 };
@@ -88,6 +97,11 @@ pa_memblock *pa_memblock_new_user(pa_mempool *, void *data, size_t length, pa_fr
 /* A special case of pa_memblock_new_user: take a memory buffer previously allocated with pa_xmalloc()  */
 #define pa_memblock_new_malloced(p,data,length) pa_memblock_new_user(p, data, length, pa_xfree, 0)
 
+/* Allocate a new memory block of type PA_MEMBLOCK_REGION, for length
+ * bytes at data, which have to lie within the region. free_cb, if not
+ * NULL, is called with data once the block is gone. */
+pa_memblock *pa_memblock_new_region(pa_memregion *r, void *data, size_t length, pa_free_cb_t free_cb);
+
 /* Allocate a new memory block of type PA_MEMBLOCK_FIXED */
 pa_memblock *pa_memblock_new_fixed(pa_mempool *, void *data, size_t length, pa_bool_t read_only);
 
@@ -116,23 +130,45 @@ pa_memblock *pa_memblock_will_need(pa_memblock *b);
 
 /* The memory block manager */
 pa_mempool* pa_mempool_new(pa_bool_t shared, size_t size);
+
+/* Like pa_mempool_new(), but allows choosing how the pool is shared,
+ * backs it with huge pages if huge_pages is TRUE and the system has
+ * them available, and faults in the first prefault_slots slots right
+ * away, so that the IO threads don't take the page faults when they
+ * first use them. */
+pa_mempool* pa_mempool_new_full(pa_shm_type_t type, size_t size, pa_bool_t huge_pages, unsigned prefault_slots);
 void pa_mempool_free(pa_mempool *p);
 const pa_mempool_stat* pa_mempool_get_stat(pa_mempool *p);
 void pa_mempool_vacuum(pa_mempool *p);
 int pa_mempool_get_shm_id(pa_mempool *p, uint32_t *id);
 pa_bool_t pa_mempool_is_shared(pa_mempool *p);
+pa_bool_t pa_mempool_is_memfd_backed(pa_mempool *p);
 size_t pa_mempool_block_size_max(pa_mempool *p);
 
+/* A region is a piece of memory of its own, a POSIX SHM segment if the
+ * pool it belongs to is shared, and private memory otherwise. Blocks
+ * of any size may be carved out of it and exported from it without
+ * copying. It lives on until the last block referring to it is
+ * gone. */
+#define PA_MEMREGION_SIZE_MAX (64*1024*1024)
+
+pa_memregion* pa_memregion_new(pa_mempool *p, size_t size);
+pa_memregion* pa_memregion_ref(pa_memregion *r);
+void pa_memregion_unref(pa_memregion *r);
+void* pa_memregion_get_data(pa_memregion *r);
+size_t pa_memregion_get_length(pa_memregion *r);
+
 /* For receiving blocks from other nodes */
 pa_memimport* pa_memimport_new(pa_mempool *p, pa_memimport_release_cb_t cb, void *userdata);
 void pa_memimport_free(pa_memimport *i);
-pa_memblock* pa_memimport_get(pa_memimport *i, uint32_t block_id, uint32_t shm_id, size_t offset, size_t size);
+pa_memblock* pa_memimport_get(pa_memimport *i, uint32_t block_id, uint32_t shm_id, size_t offset, size_t size, pa_bool_t memfd);
+int pa_memimport_attach_memfd(pa_memimport *i, uint32_t shm_id, int memfd);
 int pa_memimport_process_revoke(pa_memimport *i, uint32_t block_id);
 
 /* For sending blocks to other nodes */
 pa_memexport* pa_memexport_new(pa_mempool *p, pa_memexport_revoke_cb_t cb, void *userdata);
 void pa_memexport_free(pa_memexport *e);
-int pa_memexport_put(pa_memexport *e, pa_memblock *b, uint32_t *block_id, uint32_t *shm_id, size_t *offset, size_t *size);
+int pa_memexport_put(pa_memexport *e, pa_memblock *b, uint32_t *block_id, uint32_t *shm_id, size_t *offset, size_t *size, int *memfd);
 int pa_memexport_process_release(pa_memexport *e, uint32_t id);
 
 #endif
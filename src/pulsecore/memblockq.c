@@ -38,6 +38,17 @@
 
 /* #define MEMBLOCKQ_DEBUG */
 
+/* Chunks up to this size are small enough to be worth copying
+ * together instead of keeping a list item and a memblock reference
+ * for each of them */
+#define COALESCE_MAX_LENGTH 1024
+
+/* Don't bother compacting shorter lists */
+#define COMPACT_MIN_BLOCKS 32
+
+/* How many retired rings are kept around for reuse */
+#define RING_SPARES_MAX 16
+
 struct list_item {
     struct list_item *next, *prev;
     int64_t index;
@@ -58,6 +69,35 @@ struct pa_memblockq {
     int64_t missing, requested;
     char *name;
     pa_sample_spec sample_spec;
+
+    /* In ring mode pushed data is copied into the ring, one piece after
+     * the other, so that consecutive writes merge into one list item
+     * and the reader gets contiguous memory. The items pointing into
+     * the current ring don't hold references of their own, only the
+     * queue does. */
+    pa_mempool *ring_pool;
+    pa_memblock *ring;
+    size_t ring_size, ring_write, ring_used;
+
+    /* Readers usually keep what they got from us for a while, for
+     * rewinding, so the current ring often can't be wrapped around.
+     * Rings we moved on from are kept here, oldest first, and are
+     * taken up again once nobody references them anymore. */
+    pa_memblock *ring_spares[RING_SPARES_MAX];
+    unsigned n_ring_spares;
+
+    /* The block small chunks were last copied together into. Nothing
+     * after coalesce_used has been handed out, so small chunks pushed
+     * right after the tail item can be appended there in place. */
+    pa_memblock *coalesce;
+    size_t coalesce_used;
+    unsigned compact_at;
+
+    /* Compaction is spread over several pushes, one run of small items
+     * each. Everything before compact_index has been looked at. */
+    pa_bool_t compacting;
+    int64_t compact_index;
+    pa_memblockq_coalesce_stats coalesce_stats;
 };
 
 pa_memblockq* pa_memblockq_new(
@@ -82,6 +122,18 @@ pa_memblockq* pa_memblockq_new(
     bq->current_read = bq->current_write = NULL;
     bq->n_blocks = 0;
 
+    bq->ring_pool = NULL;
+    bq->ring = NULL;
+    bq->ring_size = bq->ring_write = bq->ring_used = 0;
+    bq->n_ring_spares = 0;
+
+    bq->coalesce = NULL;
+    bq->coalesce_used = 0;
+    bq->compact_at = COMPACT_MIN_BLOCKS;
+    bq->compacting = FALSE;
+    bq->compact_index = 0;
+    memset(&bq->coalesce_stats, 0, sizeof(bq->coalesce_stats));
+
     bq->sample_spec = *sample_spec;
     bq->base = pa_frame_size(sample_spec);
     bq->read_index = bq->write_index = idx;
@@ -124,6 +176,15 @@ void pa_memblockq_free(pa_memblockq* bq) {
     if (bq->mcalign)
         pa_mcalign_free(bq->mcalign);
 
+    if (bq->ring)
+        pa_memblock_unref(bq->ring);
+
+    while (bq->n_ring_spares > 0)
+        pa_memblock_unref(bq->ring_spares[--bq->n_ring_spares]);
+
+    if (bq->coalesce)
+        pa_memblock_unref(bq->coalesce);
+
     pa_xfree(bq->name);
     pa_xfree(bq);
 }
@@ -210,7 +271,8 @@ static void drop_block(pa_memblockq *bq, struct list_item *q) {
     if (bq->current_read == q)
         bq->current_read = q->next;
 
-    pa_memblock_unref(q->chunk.memblock);
+    if (q->chunk.memblock != bq->ring)
+        pa_memblock_unref(q->chunk.memblock);
 
     if (pa_flist_push(PA_STATIC_FLIST_GET(list_items), q) < 0)
         pa_xfree(q);
@@ -282,23 +344,11 @@ static void read_index_changed(pa_memblockq *bq, int64_t old_read_index) {
 #endif
 }
 
-int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *uchunk) {
+static void push_chunk(pa_memblockq *bq, const pa_memchunk *uchunk) {
     struct list_item *q, *n;
     pa_memchunk chunk;
     int64_t old;
 
-    pa_assert(bq);
-    pa_assert(uchunk);
-    pa_assert(uchunk->memblock);
-    pa_assert(uchunk->length > 0);
-    pa_assert(uchunk->index + uchunk->length <= pa_memblock_get_length(uchunk->memblock));
-
-    if (uchunk->length % bq->base)
-        return -1;
-
-    if (!can_push(bq, uchunk->length))
-        return -1;
-
     old = bq->write_index;
     chunk = *uchunk;
 
@@ -354,7 +404,9 @@ int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *uchunk) {
                     p = pa_xnew(struct list_item, 1);
 
                 p->chunk = q->chunk;
-                pa_memblock_ref(p->chunk.memblock);
+
+                if (p->chunk.memblock != bq->ring)
+                    pa_memblock_ref(p->chunk.memblock);
 
                 /* Calculate offset */
                 d = (size_t) (bq->write_index + (int64_t) chunk.length - q->index);
@@ -362,6 +414,7 @@ int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *uchunk) {
 
                 /* Drop it from the new entry */
                 p->index = q->index + (int64_t) d;
+                p->chunk.index += d;
                 p->chunk.length -= d;
 
                 /* Add it to the list */
@@ -424,7 +477,10 @@ int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *uchunk) {
         n = pa_xnew(struct list_item, 1);
 
     n->chunk = chunk;
-    pa_memblock_ref(n->chunk.memblock);
+
+    if (n->chunk.memblock != bq->ring)
+        pa_memblock_ref(n->chunk.memblock);
+
     n->index = bq->write_index;
     bq->write_index += (int64_t) n->chunk.length;
 
@@ -446,9 +502,261 @@ int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *uchunk) {
 finish:
 
     write_index_changed(bq, old, TRUE);
+}
+
+/* Returns TRUE if length bytes may be written to the ring at start
+ * without clobbering anything that is still in use */
+static pa_bool_t ring_range_free(pa_memblockq *bq, size_t start, size_t length) {
+    struct list_item *q;
+
+    if (start + length > bq->ring_size)
+        return FALSE;
+
+    /* Nobody has seen this part yet */
+    if (start >= bq->ring_used)
+        return TRUE;
+
+    /* Somebody else holds on to data from the ring, and we can't tell
+     * which */
+    if (!pa_memblock_ref_is_one(bq->ring))
+        return FALSE;
+
+    for (q = bq->blocks; q; q = q->next)
+        if (q->chunk.memblock == bq->ring &&
+            q->chunk.index < start + length &&
+            start < q->chunk.index + q->chunk.length)
+            return FALSE;
+
+    return TRUE;
+}
+
+static void ring_new(pa_memblockq *bq) {
+    struct list_item *q;
+    unsigned i;
+
+    if (bq->ring) {
+        /* The items that still point into the old ring keep it alive
+         * from now on */
+        for (q = bq->blocks; q; q = q->next)
+            if (q->chunk.memblock == bq->ring)
+                pa_memblock_ref(q->chunk.memblock);
+
+        if (bq->n_ring_spares >= RING_SPARES_MAX) {
+            pa_memblock_unref(bq->ring_spares[0]);
+            memmove(bq->ring_spares, bq->ring_spares + 1, --bq->n_ring_spares * sizeof(pa_memblock*));
+        }
+
+        bq->ring_spares[bq->n_ring_spares++] = bq->ring;
+        bq->ring = NULL;
+    }
+
+    /* A spare nobody else references anymore is as good as new */
+    for (i = 0; i < bq->n_ring_spares; i++)
+        if (pa_memblock_ref_is_one(bq->ring_spares[i])) {
+            bq->ring = bq->ring_spares[i];
+            memmove(bq->ring_spares + i, bq->ring_spares + i + 1, (--bq->n_ring_spares - i) * sizeof(pa_memblock*));
+            break;
+        }
+
+    if (!bq->ring)
+        bq->ring = pa_memblock_new(bq->ring_pool, (size_t) -1);
+
+    bq->ring_size = (pa_memblock_get_length(bq->ring) / bq->base) * bq->base;
+    bq->ring_write = bq->ring_used = 0;
+
+    pa_assert(bq->ring_size > 0);
+}
+
+static void push_ring(pa_memblockq *bq, const pa_memchunk *uchunk) {
+    pa_memchunk chunk = *uchunk;
+
+    while (chunk.length > 0) {
+        pa_memchunk rchunk;
+        size_t n;
+
+        n = PA_MIN(chunk.length, bq->ring_size - bq->ring_write);
+
+        if (n <= 0 || !ring_range_free(bq, bq->ring_write, n)) {
+
+            /* Go back to the start of the ring if we can, start a new
+             * one otherwise */
+            n = PA_MIN(chunk.length, bq->ring_size);
+
+            if (ring_range_free(bq, 0, n))
+                bq->ring_write = 0;
+            else {
+                ring_new(bq);
+                n = PA_MIN(chunk.length, bq->ring_size);
+            }
+        }
+
+        rchunk.memblock = bq->ring;
+        rchunk.index = bq->ring_write;
+        rchunk.length = n;
+
+        chunk.length = n;
+        pa_memchunk_memcpy(&rchunk, &chunk);
+        chunk.index += n;
+        chunk.length = uchunk->length - (chunk.index - uchunk->index);
+
+        bq->ring_write += n;
+        bq->ring_used = PA_MAX(bq->ring_used, bq->ring_write);
+
+        push_chunk(bq, &rchunk);
+    }
+}
+
+/* Copies a small chunk onto the end of the tail item, if that is
+ * where it goes and the tail item ends where the coalesce block has
+ * room left */
+static pa_bool_t append_in_place(pa_memblockq *bq, const pa_memchunk *uchunk) {
+    struct list_item *q;
+    pa_memchunk chunk;
+
+    if (uchunk->length > COALESCE_MAX_LENGTH || !bq->coalesce || !(q = bq->blocks_tail))
+        return FALSE;
+
+    if (q->chunk.memblock != bq->coalesce ||
+        q->chunk.index + q->chunk.length != bq->coalesce_used ||
+        q->index + (int64_t) q->chunk.length != bq->write_index ||
+        bq->coalesce_used + uchunk->length > pa_memblock_get_length(bq->coalesce))
+        return FALSE;
+
+    chunk.memblock = bq->coalesce;
+    chunk.index = bq->coalesce_used;
+    chunk.length = uchunk->length;
+    pa_memchunk_memcpy(&chunk, (pa_memchunk*) uchunk);
+
+    bq->coalesce_used += chunk.length;
+    bq->coalesce_stats.appended++;
+
+    /* This merges with the tail item */
+    push_chunk(bq, &chunk);
+
+    return TRUE;
+}
+
+/* Copies the next run of small adjacent items into one block, so that
+ * the memblocks they referred to can go back to their pools. Returns
+ * FALSE if there is none left. Only one run is copied at a time, so a
+ * push never copies more than a pool slot worth of data, however long
+ * the list has become. */
+static pa_bool_t compact_step(pa_memblockq *bq) {
+    struct list_item *q;
+
+    for (q = bq->blocks; q; q = q->next) {
+        struct list_item *last, *n;
+        pa_mempool *pool;
+        pa_memchunk chunk;
+        size_t length, max;
+        unsigned count = 1;
+
+        if (q->index < bq->compact_index || q->chunk.length > COALESCE_MAX_LENGTH)
+            continue;
+
+        pool = pa_memblock_get_pool(q->chunk.memblock);
+        max = pa_mempool_block_size_max(pool);
+        length = q->chunk.length;
+
+        for (last = q; (n = last->next); last = n) {
+            if (n->index != last->index + (int64_t) last->chunk.length ||
+                n->chunk.length > COALESCE_MAX_LENGTH ||
+                length + n->chunk.length > max)
+                break;
+
+            length += n->chunk.length;
+            count++;
+        }
+
+        if (count < 2)
+            continue;
+
+        chunk.memblock = pa_memblock_new(pool, (size_t) -1);
+        chunk.index = 0;
+
+        for (n = q; n != last->next; n = n->next) {
+            chunk.length = n->chunk.length;
+            pa_memchunk_memcpy(&chunk, &n->chunk);
+            chunk.index += chunk.length;
+        }
+
+        while (q->next != last->next)
+            drop_block(bq, q->next);
+
+        pa_memblock_unref(q->chunk.memblock);
+        q->chunk.memblock = chunk.memblock;
+        q->chunk.index = 0;
+        q->chunk.length = length;
+
+        /* If this is the tail, small chunks may be appended to it from
+         * now on */
+        if (!q->next) {
+            if (bq->coalesce)
+                pa_memblock_unref(bq->coalesce);
+
+            bq->coalesce = pa_memblock_ref(chunk.memblock);
+            bq->coalesce_used = length;
+        }
+
+        bq->coalesce_stats.compacted += count;
+        bq->coalesce_stats.blocks++;
+
+        bq->compact_index = q->index + (int64_t) q->chunk.length;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *uchunk) {
+    pa_assert(bq);
+    pa_assert(uchunk);
+    pa_assert(uchunk->memblock);
+    pa_assert(uchunk->length > 0);
+    pa_assert(uchunk->index + uchunk->length <= pa_memblock_get_length(uchunk->memblock));
+
+    if (uchunk->length % bq->base)
+        return -1;
+
+    if (!can_push(bq, uchunk->length))
+        return -1;
+
+    if (bq->ring)
+        push_ring(bq, uchunk);
+    else if (!append_in_place(bq, uchunk)) {
+        push_chunk(bq, uchunk);
+
+        if (!bq->compacting && bq->n_blocks >= bq->compact_at) {
+            bq->compacting = TRUE;
+            bq->compact_index = bq->blocks->index;
+        }
+
+        if (bq->compacting) {
+            if (!compact_step(bq)) {
+                /* Compacting again only pays off once the list has
+                 * grown by as much again */
+                bq->compacting = FALSE;
+                bq->compact_at = PA_MAX(COMPACT_MIN_BLOCKS, bq->n_blocks * 2);
+            }
+        } else if (bq->n_blocks * 4 < bq->compact_at)
+            /* The list has shrunk again since we last compacted */
+            bq->compact_at = PA_MAX(COMPACT_MIN_BLOCKS, bq->n_blocks * 2);
+    }
+
     return 0;
 }
 
+void pa_memblockq_use_ring(pa_memblockq *bq, pa_mempool *pool) {
+    pa_assert(bq);
+    pa_assert(pool);
+
+    if (bq->ring)
+        return;
+
+    bq->ring_pool = pool;
+    ring_new(bq);
+}
+
 pa_bool_t pa_memblockq_prebuf_active(pa_memblockq *bq) {
     pa_assert(bq);
 
@@ -1032,6 +1340,13 @@ void pa_memblockq_silence(pa_memblockq *bq) {
     pa_assert(bq->n_blocks == 0);
 }
 
+void pa_memblockq_get_coalesce_stats(pa_memblockq *bq, pa_memblockq_coalesce_stats *stats) {
+    pa_assert(bq);
+    pa_assert(stats);
+
+    *stats = bq->coalesce_stats;
+}
+
 unsigned pa_memblockq_get_nblocks(pa_memblockq *bq) {
     pa_assert(bq);
 
@@ -37,6 +37,15 @@
 
 typedef struct pa_memblockq pa_memblockq;
 
+/* What pa_memblockq_push() did to keep small chunks from taking up a
+ * list item and a pool slot each. appended + compacted - blocks is
+ * the number of memblock references the queue got rid of that way. */
+typedef struct pa_memblockq_coalesce_stats {
+    uint64_t appended;   /* Small chunks copied onto the end of the tail item */
+    uint64_t compacted;  /* Small items copied together when the list grew long */
+    uint64_t blocks;     /* Blocks allocated to copy them into */
+} pa_memblockq_coalesce_stats;
+
 
 /* Parameters:
 
@@ -79,9 +88,22 @@ pa_memblockq* pa_memblockq_new(
 
 void pa_memblockq_free(pa_memblockq*bq);
 
-/* Push a new memory chunk into the queue.  */
+/* Push a new memory chunk into the queue. Small chunks may be copied
+ * instead of referenced: onto the end of the tail item if it lives in
+ * a block the queue allocated and there is room left after it, or
+ * together with their neighbours once the list has grown long. */
 int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *chunk);
 
+/* From now on copy what is pushed into a ring of memory taken from
+ * the pool, instead of keeping references to the pushed memblocks. This
+ * is worth it for streams written in many small pieces: they end up in
+ * few list items, and the reader gets contiguous data without
+ * pa_memblockq_peek_fixed_size() having to copy it together. A ring
+ * is only written over once nobody but the queue refers to it anymore.
+ * Until then the queue moves on to another one, and takes up the old
+ * one again once the reader has let go of it. */
+void pa_memblockq_use_ring(pa_memblockq *bq, pa_mempool *pool);
+
 /* Push a new memory chunk into the queue, but filter it through a
  * pa_mcalign object. Don't mix this with pa_memblockq_seek() unless
  * you know what you do. */
@@ -193,4 +215,7 @@ pa_bool_t pa_memblockq_prebuf_active(pa_memblockq *bq);
 /* Return how many items are currently stored in the queue */
 unsigned pa_memblockq_get_nblocks(pa_memblockq *bq);
 
+/* Return how many small chunks were copied together so far */
+void pa_memblockq_get_coalesce_stats(pa_memblockq *bq, pa_memblockq_coalesce_stats *stats);
+
 #endif
@@ -31,13 +31,17 @@
 
 #include <pulse/xmalloc.h>
 #include <pulse/proplist.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
 
 #include <pulsecore/core-subscribe.h>
 #include <pulsecore/log.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/core-error.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/ltdl-helper.h>
 #include <pulsecore/modinfo.h>
+#include <pulsecore/thread.h>
 
 #include "module.h"
 
@@ -47,11 +51,158 @@
 #define PA_SYMBOL_GET_N_USED "pa__get_n_used"
 #define PA_SYMBOL_GET_DEPRECATE "pa__get_deprecated"
 
+struct pa_module_deferred_init {
+    pa_module *module;
+
+    pa_thread *thread;
+    int pipe[2];
+    pa_io_event *io_event;
+
+    pa_module_work_cb_t work_cb;
+    pa_module_done_cb_t done_cb;
+    void *userdata;
+
+    pa_usec_t started;
+
+    /* The module has been unloaded while the worker was busy */
+    pa_bool_t aborted;
+};
+
+static void module_finish_free(pa_module *m);
+
+static void deferred_init_free(pa_module_deferred_init *d) {
+    pa_assert(d);
+
+    /* Waits for the worker if it is still busy */
+    if (d->thread)
+        pa_thread_free(d->thread);
+
+    if (d->io_event)
+        d->module->core->mainloop->io_free(d->io_event);
+
+    pa_close_pipe(d->pipe);
+    pa_xfree(d);
+}
+
+static void deferred_init_thread_func(void *userdata) {
+    pa_module_deferred_init *d = userdata;
+    char x = 'x';
+
+    pa_assert(d);
+
+    d->work_cb(d->module, d->userdata);
+
+    /* Wake up the main loop */
+    if (pa_loop_write(d->pipe[1], &x, sizeof(x), NULL) != sizeof(x))
+        pa_log_error("Failed to notify main loop: %s", pa_cstrerror(errno));
+}
+
+static void deferred_init_io_cb(pa_mainloop_api *a, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    pa_module_deferred_init *d = userdata;
+    pa_module *m;
+    pa_usec_t elapsed;
+    int r;
+
+    pa_assert(d);
+    pa_assert(d->io_event == e);
+
+    m = d->module;
+
+    /* The worker is done, so this doesn't block */
+    pa_thread_free(d->thread);
+    d->thread = NULL;
+
+    m->deferred_init = NULL;
+
+    if (d->aborted) {
+        deferred_init_free(d);
+
+        pa_assert_se(pa_idxset_remove_by_data(m->core->modules_aborted, m, NULL));
+        module_finish_free(m);
+        return;
+    }
+
+    r = d->done_cb(m, d->userdata);
+
+    elapsed = pa_rtclock_now() - d->started;
+    m->load_time += elapsed;
+
+    deferred_init_free(d);
+
+    if (r < 0) {
+        pa_log_error("Deferred initialization of module \"%s\" (index: #%u) failed.", m->name, m->index);
+        pa_module_unload_request(m, TRUE);
+        return;
+    }
+
+    if (m->core->startup_trace)
+        pa_log_notice("Startup trace: \"%s\" (index: #%u) finished deferred initialization in %0.2f ms, %0.2f ms total.",
+                      m->name, m->index, (double) elapsed / PA_USEC_PER_MSEC, (double) m->load_time / PA_USEC_PER_MSEC);
+
+    pa_subscription_post(m->core, PA_SUBSCRIPTION_EVENT_MODULE|PA_SUBSCRIPTION_EVENT_CHANGE, m->index);
+}
+
+int pa_module_defer_init(pa_module *m, pa_module_work_cb_t work_cb, pa_module_done_cb_t done_cb, void *userdata) {
+    pa_module_deferred_init *d;
+    char *t;
+    int r;
+
+    pa_assert(m);
+    pa_assert(!m->deferred_init);
+    pa_assert(work_cb);
+    pa_assert(done_cb);
+
+    d = pa_xnew0(pa_module_deferred_init, 1);
+    d->module = m;
+    d->work_cb = work_cb;
+    d->done_cb = done_cb;
+    d->userdata = userdata;
+    d->started = pa_rtclock_now();
+    d->pipe[0] = d->pipe[1] = -1;
+
+    if (pa_pipe_cloexec(d->pipe) < 0) {
+        pa_log_warn("Failed to create pipe, initializing \"%s\" synchronously: %s", m->name, pa_cstrerror(errno));
+        goto sync;
+    }
+
+    pa_make_fd_nonblock(d->pipe[0]);
+    pa_assert_se(d->io_event = m->core->mainloop->io_new(m->core->mainloop, d->pipe[0], PA_IO_EVENT_INPUT, deferred_init_io_cb, d));
+
+    t = pa_sprintf_malloc("init-%s", m->name);
+    d->thread = pa_thread_new(t, deferred_init_thread_func, d);
+    pa_xfree(t);
+
+    if (!d->thread) {
+        pa_log_warn("Failed to create thread, initializing \"%s\" synchronously.", m->name);
+        goto sync;
+    }
+
+    m->deferred_init = d;
+    return 0;
+
+sync:
+    /* Fall back to doing the work right away. We are still called
+     * from pa__init(), so a failure simply fails the load. */
+    work_cb(m, userdata);
+    r = done_cb(m, userdata);
+
+    deferred_init_free(d);
+
+    return r;
+}
+
+pa_bool_t pa_module_init_pending(pa_module *m) {
+    pa_assert(m);
+
+    return !!m->deferred_init;
+}
+
 pa_module* pa_module_load(pa_core *c, const char *name, const char *argument) {
     pa_module *m = NULL;
     pa_bool_t (*load_once)(void);
     const char* (*get_deprecated)(void);
     pa_modinfo *mi;
+    pa_usec_t started;
 
     pa_assert(c);
     pa_assert(name);
@@ -59,12 +210,16 @@ pa_module* pa_module_load(pa_core *c, const char *name, const char *argument) {
     if (c->disallow_module_loading)
         goto fail;
 
+    started = pa_rtclock_now();
+
     m = pa_xnew(pa_module, 1);
     m->name = pa_xstrdup(name);
     m->argument = pa_xstrdup(argument);
     m->load_once = FALSE;
     m->proplist = pa_proplist_new();
     m->index = PA_IDXSET_INVALID;
+    m->load_time = 0;
+    m->deferred_init = NULL;
 
     if (!(m->dl = lt_dlopenext(name))) {
         pa_log("Failed to open module \"%s\": %s", name, lt_dlerror());
@@ -112,11 +267,22 @@ pa_module* pa_module_load(pa_core *c, const char *name, const char *argument) {
         goto fail;
     }
 
+    m->load_time = pa_rtclock_now() - started;
+
     pa_assert_se(pa_idxset_put(c->modules, m, &m->index) >= 0);
     pa_assert(m->index != PA_IDXSET_INVALID);
 
     pa_log_info("Loaded \"%s\" (index: #%u; argument: \"%s\").", m->name, m->index, m->argument ? m->argument : "");
 
+    if (c->startup_trace) {
+        if (m->deferred_init)
+            pa_log_notice("Startup trace: \"%s\" (index: #%u) initialized in %0.2f ms, deferred initialization pending.",
+                          m->name, m->index, (double) m->load_time / PA_USEC_PER_MSEC);
+        else
+            pa_log_notice("Startup trace: \"%s\" (index: #%u) loaded in %0.2f ms.",
+                          m->name, m->index, (double) m->load_time / PA_USEC_PER_MSEC);
+    }
+
     pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_MODULE|PA_SUBSCRIPTION_EVENT_NEW, m->index);
 
     if ((mi = pa_modinfo_get_by_handle(m->dl, name))) {
@@ -138,6 +304,9 @@ pa_module* pa_module_load(pa_core *c, const char *name, const char *argument) {
 fail:
 
     if (m) {
+        if (m->deferred_init)
+            deferred_init_free(m->deferred_init);
+
         if (m->proplist)
             pa_proplist_free(m->proplist);
 
@@ -157,6 +326,26 @@ static void pa_module_free(pa_module *m) {
     pa_assert(m);
     pa_assert(m->core);
 
+    if (m->deferred_init) {
+        /* The worker runs code and uses data of the module, so it
+         * can't go away before the worker is finished. Instead of
+         * waiting for that here, park the module and let
+         * deferred_init_io_cb() finish the job. */
+        pa_log_info("Aborting deferred initialization of \"%s\" (index: #%u), unloading once the worker has finished.", m->name, m->index);
+
+        m->deferred_init->aborted = TRUE;
+        pa_assert_se(pa_idxset_put(m->core->modules_aborted, m, NULL) >= 0);
+        return;
+    }
+
+    module_finish_free(m);
+}
+
+static void module_finish_free(pa_module *m) {
+    pa_assert(m);
+    pa_assert(m->core);
+    pa_assert(!m->deferred_init);
+
     pa_log_info("Unloading \"%s\" (index: #%u).", m->name, m->index);
 
     if (m->done)
@@ -210,6 +399,14 @@ void pa_module_unload_all(pa_core *c) {
     while ((m = pa_idxset_steal_first(c->modules, NULL)))
         pa_module_free(m);
 
+    /* The main loop isn't going to run again, so there is nobody left
+     * to hand these off to. Wait for their workers. */
+    while ((m = pa_idxset_steal_first(c->modules_aborted, NULL))) {
+        deferred_init_free(m->deferred_init);
+        m->deferred_init = NULL;
+        module_finish_free(m);
+    }
+
     if (c->module_defer_unload_event) {
         c->mainloop->defer_free(c->module_defer_unload_event);
         c->module_defer_unload_event = NULL;
@@ -26,6 +26,7 @@
 #include <ltdl.h>
 
 typedef struct pa_module pa_module;
+typedef struct pa_module_deferred_init pa_module_deferred_init;
 
 #include <pulse/proplist.h>
 
@@ -48,10 +49,29 @@ struct pa_module {
     pa_bool_t unload_requested:1;
 
     pa_proplist *proplist;
+
+    /* Time spent in pa__init() and any deferred initialization */
+    pa_usec_t load_time;
+    pa_module_deferred_init *deferred_init;
 };
 
+typedef void (*pa_module_work_cb_t)(pa_module *m, void *userdata);
+typedef int (*pa_module_done_cb_t)(pa_module *m, void *userdata);
+
 pa_module* pa_module_load(pa_core *c, const char *name, const char*argument);
 
+/* May be called from pa__init() to move blocking initialization work
+ * (e.g. device probing) to a separate thread. work_cb is run in that
+ * thread and must not touch any core objects; done_cb is called from
+ * the main loop afterwards and commits the result. If done_cb returns
+ * a negative value the module is unloaded. If no thread can be started
+ * both are called right away and the return value of done_cb is
+ * passed on, which pa__init() should then fail with. If the module is
+ * unloaded while work_cb is running, pa__done() is only called after
+ * it returned, and done_cb is not called at all. */
+int pa_module_defer_init(pa_module *m, pa_module_work_cb_t work_cb, pa_module_done_cb_t done_cb, void *userdata);
+pa_bool_t pa_module_init_pending(pa_module *m);
+
 void pa_module_unload(pa_core *c, pa_module *m, pa_bool_t force);
 void pa_module_unload_by_index(pa_core *c, uint32_t idx, pa_bool_t force);
 
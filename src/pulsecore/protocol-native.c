@@ -73,6 +73,17 @@
 #define DEFAULT_PROCESS_MSEC 20   /* 20ms */
 #define DEFAULT_FRAGSIZE_MSEC DEFAULT_TLENGTH_MSEC
 
+/* Playback streams that set this property to "ring" get their data
+ * copied into a ring buffer, see pa_memblockq_use_ring() */
+#define MEMBLOCKQ_MODE_PROPERTY "native-protocol.memblockq"
+
+/* How many small writes the memblockq of a playback stream copied
+ * together, and how many memblock references that saved, are published
+ * in these properties. Every update makes for a change event of the
+ * sink input, so they are only updated once the count has doubled. */
+#define MEMBLOCKQ_MERGES_PROPERTY "native-protocol.memblockq.merges"
+#define MEMBLOCKQ_SLOTS_SAVED_PROPERTY "native-protocol.memblockq.slots-saved"
+
 struct pa_native_protocol;
 
 typedef struct record_stream {
@@ -145,6 +156,9 @@ typedef struct playback_stream {
     size_t render_memblockq_length;
     pa_usec_t current_sink_latency;
     uint64_t playing_for, underrun_for;
+
+    /* Only touched from the IO thread */
+    uint64_t coalesce_merges;
 } playback_stream;
 
 #define PLAYBACK_STREAM(o) (playback_stream_cast(o))
@@ -219,7 +233,8 @@ enum {
     PLAYBACK_STREAM_MESSAGE_OVERFLOW,
     PLAYBACK_STREAM_MESSAGE_DRAIN_ACK,
     PLAYBACK_STREAM_MESSAGE_STARTED,
-    PLAYBACK_STREAM_MESSAGE_UPDATE_TLENGTH
+    PLAYBACK_STREAM_MESSAGE_UPDATE_TLENGTH,
+    PLAYBACK_STREAM_MESSAGE_COALESCE_STATS     /* memblockq merge counters for the proplist */
 };
 
 enum {
@@ -889,6 +904,20 @@ static int playback_stream_process_msg(pa_msgobject *o, int code, void*userdata,
             }
 
             break;
+
+        case PLAYBACK_STREAM_MESSAGE_COALESCE_STATS: {
+            pa_memblockq_coalesce_stats *stats = userdata;
+            uint64_t merges = stats->appended + stats->compacted;
+            pa_proplist *p;
+
+            p = pa_proplist_new();
+            pa_proplist_setf(p, MEMBLOCKQ_MERGES_PROPERTY, "%llu", (unsigned long long) merges);
+            pa_proplist_setf(p, MEMBLOCKQ_SLOTS_SAVED_PROPERTY, "%llu", (unsigned long long) (merges > stats->blocks ? merges - stats->blocks : 0));
+            pa_sink_input_update_proplist(s->sink_input, PA_UPDATE_REPLACE, p);
+            pa_proplist_free(p);
+
+            break;
+        }
     }
 
     return 0;
@@ -1087,6 +1116,7 @@ static playback_stream* playback_stream_new(
     int64_t start_index;
     pa_sink_input_new_data data;
     char *memblockq_name;
+    const char *mode;
 
     pa_assert(c);
     pa_assert(ss);
@@ -1165,6 +1195,7 @@ static playback_stream* playback_stream_new(
     s->early_requests = early_requests;
     pa_atomic_store(&s->seek_or_post_in_queue, 0);
     s->seek_windex = -1;
+    s->coalesce_merges = 0;
 
     s->sink_input->parent.process_msg = sink_input_process_msg;
     s->sink_input->pop = sink_input_pop_cb;
@@ -1196,6 +1227,9 @@ static playback_stream* playback_stream_new(
     pa_xfree(memblockq_name);
     pa_memblock_unref(silence.memblock);
 
+    if ((mode = pa_proplist_gets(sink_input->proplist, MEMBLOCKQ_MODE_PROPERTY)) && pa_streq(mode, "ring"))
+        pa_memblockq_use_ring(s->memblockq, c->protocol->core->mempool);
+
     pa_memblockq_get_attr(s->memblockq, &s->buffer_attr);
 
     *missing = (uint32_t) pa_memblockq_pop_missing(s->memblockq);
@@ -1255,6 +1289,22 @@ static void playback_stream_request_bytes(playback_stream *s) {
         pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(s), PLAYBACK_STREAM_MESSAGE_REQUEST_DATA, NULL, 0, NULL, NULL);
 }
 
+/* Called from IO context */
+static void playback_stream_post_coalesce_stats(playback_stream *s) {
+    pa_memblockq_coalesce_stats stats;
+
+    playback_stream_assert_ref(s);
+
+    pa_memblockq_get_coalesce_stats(s->memblockq, &stats);
+
+    if (stats.appended + stats.compacted < PA_MAX(s->coalesce_merges * 2, 1))
+        return;
+
+    s->coalesce_merges = stats.appended + stats.compacted;
+
+    pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(s), PLAYBACK_STREAM_MESSAGE_COALESCE_STATS, pa_xnewdup(pa_memblockq_coalesce_stats, &stats, 1), 0, NULL, pa_xfree);
+}
+
 /* Called from main context */
 static void playback_stream_send_killed(playback_stream *p) {
     pa_tagstruct *t;
@@ -1456,6 +1506,9 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int
                 pa_memblockq_seek(s->memblockq, (int64_t) chunk->length, PA_SEEK_RELATIVE, TRUE);
             }
 
+            if (chunk)
+                playback_stream_post_coalesce_stats(s);
+
             /* If more data is in queue, we rewind later instead. */
             if (s->seek_windex != -1)
                 windex = PA_MIN(windex, s->seek_windex);
@@ -2539,7 +2592,7 @@ static void command_auth(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_ta
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
     const void*cookie;
     pa_tagstruct *reply;
-    pa_bool_t shm_on_remote = FALSE, do_shm;
+    pa_bool_t shm_on_remote = FALSE, memfd_on_remote = FALSE, do_shm, do_memfd;
 
     pa_native_connection_assert_ref(c);
     pa_assert(t);
@@ -2565,6 +2618,13 @@ static void command_auth(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_ta
         c->version &= 0x7FFFFFFFU;
     }
 
+    /* Starting with protocol version 27 the second MSB tells whether
+       memfd segments may be passed over the socket */
+    if (c->version >= 27) {
+        memfd_on_remote = !!(c->version & 0x40000000U);
+        c->version &= 0x3FFFFFFFU;
+    }
+
     pa_log_debug("Protocol version: remote %u, local %u", c->version, PA_PROTOCOL_VERSION);
 
     pa_proplist_setf(c->client->proplist, "native-protocol.version", "%u", c->version);
@@ -2649,8 +2709,19 @@ static void command_auth(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_ta
     pa_log_debug("Negotiated SHM: %s", pa_yes_no(do_shm));
     pa_pstream_enable_shm(c->pstream, do_shm);
 
+    /* Our pool being memfd backed means we can also attach the memfd
+     * segments of the client */
+    do_memfd =
+        do_shm && memfd_on_remote &&
+        pa_mempool_is_memfd_backed(c->protocol->core->mempool);
+
+    pa_log_debug("Negotiated memfd: %s", pa_yes_no(do_memfd));
+
+    if (do_memfd)
+        pa_pstream_enable_memfd(c->pstream);
+
     reply = reply_new(tag);
-    pa_tagstruct_putu32(reply, PA_PROTOCOL_VERSION | (do_shm ? 0x80000000 : 0));
+    pa_tagstruct_putu32(reply, PA_PROTOCOL_VERSION | (do_shm ? 0x80000000 : 0) | (do_memfd ? 0x40000000 : 0));
 
 #ifdef HAVE_CREDS
 {
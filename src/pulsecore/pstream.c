@@ -36,8 +36,10 @@
 
 #include <pulsecore/socket.h>
 #include <pulsecore/queue.h>
+#include <pulsecore/hashmap.h>
 #include <pulsecore/log.h>
 #include <pulsecore/creds.h>
+#include <pulsecore/core-util.h>
 #include <pulsecore/refcnt.h>
 #include <pulsecore/flist.h>
 #include <pulsecore/macro.h>
@@ -49,6 +51,11 @@
 #define PA_FLAG_SHMRELEASE 0x40000000LU
 #define PA_FLAG_SHMREVOKE  0xC0000000LU
 #define PA_FLAG_SHMMASK    0xFF000000LU
+
+/* Set in addition to PA_FLAG_SHMDATA if the block lives in a memfd
+ * segment. The fd of the segment is passed along with the first frame
+ * referencing it, the peer attaches by name otherwise. */
+#define PA_FLAG_SHMDATA_MEMFD_BLOCK 0x20000000LU
 #define PA_FLAG_SEEKMASK   0x000000FFLU
 
 /* The sequence descriptor header consists of 5 32bit integers: */
@@ -159,6 +166,11 @@ struct pa_pstream {
 
     pa_mempool *mempool;
 
+    pa_bool_t use_memfd;
+    pa_hashmap *memfd_sent; /* memfd segments whose fd the peer already got */
+    int write_memfd, read_memfd;
+    pa_bool_t send_memfd_now;
+
 #ifdef HAVE_CREDS
     pa_creds read_creds, write_creds;
     pa_bool_t read_creds_valid, send_creds_now;
@@ -272,6 +284,11 @@ pa_pstream *pa_pstream_new(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *poo
     pa_iochannel_socket_set_rcvbuf(io, pa_mempool_block_size_max(p->mempool));
     pa_iochannel_socket_set_sndbuf(io, pa_mempool_block_size_max(p->mempool));
 
+    p->use_memfd = FALSE;
+    p->memfd_sent = NULL;
+    p->write_memfd = p->read_memfd = -1;
+    p->send_memfd_now = FALSE;
+
 #ifdef HAVE_CREDS
     p->send_creds_now = FALSE;
     p->read_creds_valid = FALSE;
@@ -314,6 +331,9 @@ static void pstream_free(pa_pstream *p) {
     if (p->read.packet)
         pa_packet_unref(p->read.packet);
 
+    if (p->memfd_sent)
+        pa_hashmap_free(p->memfd_sent, NULL, NULL);
+
     pa_xfree(p);
 }
 
@@ -512,6 +532,7 @@ static void prepare_next_write_item(pa_pstream *p) {
         if (p->use_shm) {
             uint32_t block_id, shm_id;
             size_t offset, length;
+            int memfd;
 
             pa_assert(p->export);
 
@@ -520,18 +541,35 @@ static void prepare_next_write_item(pa_pstream *p) {
                                  &block_id,
                                  &shm_id,
                                  &offset,
-                                 &length) >= 0) {
-
-                flags |= PA_FLAG_SHMDATA;
-                send_payload = FALSE;
-
-                p->write.shm_info[PA_PSTREAM_SHM_BLOCKID] = htonl(block_id);
-                p->write.shm_info[PA_PSTREAM_SHM_SHMID] = htonl(shm_id);
-                p->write.shm_info[PA_PSTREAM_SHM_INDEX] = htonl((uint32_t) (offset + p->write.current->chunk.index));
-                p->write.shm_info[PA_PSTREAM_SHM_LENGTH] = htonl((uint32_t) p->write.current->chunk.length);
-
-                p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl(sizeof(p->write.shm_info));
-                p->write.data = p->write.shm_info;
+                                 &length,
+                                 &memfd) >= 0) {
+
+                if (memfd >= 0 && !p->use_memfd)
+                    /* The peer can't attach memfd segments, send it
+                     * a copy of the data instead */
+                    pa_memexport_process_release(p->export, block_id);
+
+                else {
+                    if (memfd >= 0) {
+                        flags |= PA_FLAG_SHMDATA_MEMFD_BLOCK;
+
+                        if (pa_hashmap_put(p->memfd_sent, PA_UINT32_TO_PTR(shm_id), PA_INT_TO_PTR(1)) >= 0) {
+                            p->write_memfd = memfd;
+                            p->send_memfd_now = TRUE;
+                        }
+                    }
+
+                    flags |= PA_FLAG_SHMDATA;
+                    send_payload = FALSE;
+
+                    p->write.shm_info[PA_PSTREAM_SHM_BLOCKID] = htonl(block_id);
+                    p->write.shm_info[PA_PSTREAM_SHM_SHMID] = htonl(shm_id);
+                    p->write.shm_info[PA_PSTREAM_SHM_INDEX] = htonl((uint32_t) (offset + p->write.current->chunk.index));
+                    p->write.shm_info[PA_PSTREAM_SHM_LENGTH] = htonl((uint32_t) p->write.current->chunk.length);
+
+                    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl(sizeof(p->write.shm_info));
+                    p->write.data = p->write.shm_info;
+                }
             }
 /*             else */
 /*                 pa_log_warn("Failed to export memory block."); */
@@ -588,7 +626,14 @@ static int do_write(pa_pstream *p) {
     pa_assert(l > 0);
 
 #ifdef HAVE_CREDS
-    if (p->send_creds_now) {
+    if (p->send_memfd_now) {
+
+        if ((r = pa_iochannel_write_with_fd(p->io, d, l, p->write_memfd)) < 0)
+            goto fail;
+
+        p->send_memfd_now = FALSE;
+        p->write_memfd = -1;
+    } else if (p->send_creds_now) {
 
         if ((r = pa_iochannel_write_with_creds(p->io, d, l, &p->write_creds)) < 0)
             goto fail;
@@ -657,8 +702,21 @@ static int do_read(pa_pstream *p) {
 #ifdef HAVE_CREDS
     {
         pa_bool_t b = 0;
+        int fd = -1;
+
+        r = pa_iochannel_read_with_creds(p->io, d, l, &p->read_creds, &b, &fd);
 
-        if ((r = pa_iochannel_read_with_creds(p->io, d, l, &p->read_creds, &b)) <= 0)
+        if (fd >= 0) {
+            if (!p->use_memfd || p->read_memfd >= 0) {
+                pa_log_warn("Received unexpected file descriptor.");
+                pa_close(fd);
+                goto fail;
+            }
+
+            p->read_memfd = fd;
+        }
+
+        if (r <= 0)
             goto fail;
 
         p->read_creds_valid = p->read_creds_valid || b;
@@ -736,7 +794,8 @@ static int do_read(pa_pstream *p) {
                 return -1;
             }
 
-            if ((flags & PA_FLAG_SHMMASK) == PA_FLAG_SHMDATA) {
+            if ((flags & PA_FLAG_SHMMASK) == PA_FLAG_SHMDATA ||
+                (p->use_memfd && (flags & PA_FLAG_SHMMASK) == (PA_FLAG_SHMDATA|PA_FLAG_SHMDATA_MEMFD_BLOCK))) {
 
                 if (length != sizeof(p->read.shm_info)) {
                     pa_log_warn("Received SHM memblock frame with Invalid frame length.");
@@ -817,16 +876,31 @@ static int do_read(pa_pstream *p) {
                 pa_packet_unref(p->read.packet);
             } else {
                 pa_memblock *b;
+                uint32_t flags = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]);
 
-                pa_assert((ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SHMMASK) == PA_FLAG_SHMDATA);
+                pa_assert((flags & PA_FLAG_SHMDATA) == PA_FLAG_SHMDATA);
 
                 pa_assert(p->import);
 
+                /* This frame brought the fd of a new memfd segment along */
+                if (p->read_memfd >= 0) {
+                    int fd = p->read_memfd;
+
+                    p->read_memfd = -1;
+
+                    if (!(flags & PA_FLAG_SHMDATA_MEMFD_BLOCK) ||
+                        pa_memimport_attach_memfd(p->import, ntohl(p->read.shm_info[PA_PSTREAM_SHM_SHMID]), fd) < 0) {
+                        pa_log_warn("Failed to attach memfd segment.");
+                        return -1;
+                    }
+                }
+
                 if (!(b = pa_memimport_get(p->import,
                                           ntohl(p->read.shm_info[PA_PSTREAM_SHM_BLOCKID]),
                                           ntohl(p->read.shm_info[PA_PSTREAM_SHM_SHMID]),
                                           ntohl(p->read.shm_info[PA_PSTREAM_SHM_INDEX]),
-                                          ntohl(p->read.shm_info[PA_PSTREAM_SHM_LENGTH])))) {
+                                          ntohl(p->read.shm_info[PA_PSTREAM_SHM_LENGTH]),
+                                          !!(flags & PA_FLAG_SHMDATA_MEMFD_BLOCK)))) {
 
                     if (pa_log_ratelimit(PA_LOG_DEBUG))
                         pa_log_debug("Failed to import memory block.");
@@ -873,6 +947,12 @@ frame_done:
     p->read_creds_valid = FALSE;
 #endif
 
+    /* Only frames referencing a memfd segment may bring its fd along */
+    if (p->read_memfd >= 0) {
+        pa_log_warn("Received file descriptor with a frame not referencing a memfd segment.");
+        return -1;
+    }
+
     return 0;
 
 fail:
@@ -973,6 +1053,11 @@ void pa_pstream_unlink(pa_pstream *p) {
         p->import = NULL;
     }
 
+    if (p->read_memfd >= 0) {
+        pa_close(p->read_memfd);
+        p->read_memfd = -1;
+    }
+
     if (p->export) {
         pa_memexport_free(p->export);
         p->export = NULL;
@@ -1011,6 +1096,8 @@ void pa_pstream_enable_shm(pa_pstream *p, pa_bool_t enable) {
             pa_memexport_free(p->export);
             p->export = NULL;
         }
+
+        p->use_memfd = FALSE;
     }
 }
 
@@ -1020,3 +1107,24 @@ pa_bool_t pa_pstream_get_shm(pa_pstream *p) {
 
     return p->use_shm;
 }
+
+/* Call only after pa_pstream_enable_shm(), once both sides agreed on
+ * passing memfd segments over this connection */
+void pa_pstream_enable_memfd(pa_pstream *p) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(p->use_shm);
+
+    if (p->use_memfd)
+        return;
+
+    p->use_memfd = TRUE;
+    p->memfd_sent = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+}
+
+pa_bool_t pa_pstream_get_memfd(pa_pstream *p) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+
+    return p->use_memfd;
+}
@@ -66,4 +66,7 @@ pa_bool_t pa_pstream_is_pending(pa_pstream *p);
 void pa_pstream_enable_shm(pa_pstream *p, pa_bool_t enable);
 pa_bool_t pa_pstream_get_shm(pa_pstream *p);
 
+void pa_pstream_enable_memfd(pa_pstream *p);
+pa_bool_t pa_pstream_get_memfd(pa_pstream *p);
+
 #endif
@@ -452,6 +452,12 @@ pa_resample_method_t pa_resampler_get_method(pa_resampler *r) {
     return r->method;
 }
 
+pa_resample_flags_t pa_resampler_get_flags(pa_resampler *r) {
+    pa_assert(r);
+
+    return r->flags;
+}
+
 const pa_channel_map* pa_resampler_input_channel_map(pa_resampler *r) {
     pa_assert(r);
 
@@ -476,6 +482,19 @@ const pa_sample_spec* pa_resampler_output_sample_spec(pa_resampler *r) {
     return &r->o_ss;
 }
 
+pa_bool_t pa_resampler_same_conversion(pa_resampler *a, pa_resampler *b) {
+    pa_assert(a);
+    pa_assert(b);
+
+    return
+        a->method == b->method &&
+        a->flags == b->flags &&
+        pa_sample_spec_equal(&a->i_ss, &b->i_ss) &&
+        pa_sample_spec_equal(&a->o_ss, &b->o_ss) &&
+        pa_channel_map_equal(&a->i_cm, &b->i_cm) &&
+        pa_channel_map_equal(&a->o_cm, &b->o_cm);
+}
+
 static const char * const resample_methods[] = {
     "src-sinc-best-quality",
     "src-sinc-medium-quality",
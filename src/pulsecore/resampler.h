@@ -90,6 +90,9 @@ void pa_resampler_reset(pa_resampler *r);
 /* Return the resampling method of the resampler object */
 pa_resample_method_t pa_resampler_get_method(pa_resampler *r);
 
+/* Return the flags the resampler object was created with */
+pa_resample_flags_t pa_resampler_get_flags(pa_resampler *r);
+
 /* Try to parse the resampler method */
 pa_resample_method_t pa_parse_resample_method(const char *string);
 
@@ -104,4 +107,7 @@ const pa_sample_spec* pa_resampler_input_sample_spec(pa_resampler *r);
 const pa_channel_map* pa_resampler_output_channel_map(pa_resampler *r);
 const pa_sample_spec* pa_resampler_output_sample_spec(pa_resampler *r);
 
+/* Return TRUE if both resamplers turn the same input into the same output */
+pa_bool_t pa_resampler_same_conversion(pa_resampler *a, pa_resampler *b);
+
 #endif
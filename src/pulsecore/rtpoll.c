@@ -59,6 +59,9 @@ struct pa_rtpoll {
     pa_bool_t quit:1;
     pa_bool_t timer_elapsed:1;
 
+    pa_usec_t woken_up;
+    pa_rtpoll_stat stat;
+
 #ifdef DEBUG_TIMING
     pa_usec_t timestamp;
     pa_usec_t slept, awake;
@@ -284,6 +287,9 @@ int pa_rtpoll_run(pa_rtpoll *p, pa_bool_t wait_op) {
 
     pa_zero(timeout);
 
+    if (p->woken_up > 0)
+        pa_time_histogram_add(&p->stat.processing, (int64_t) (pa_rtclock_now() - p->woken_up));
+
     /* Calculate timeout */
     if (wait_op && !p->quit && p->timer_enabled) {
         struct timeval now;
@@ -319,6 +325,11 @@ int pa_rtpoll_run(pa_rtpoll *p, pa_bool_t wait_op) {
 
     p->timer_elapsed = r == 0;
 
+    p->woken_up = pa_rtclock_now();
+
+    if (p->timer_elapsed && wait_op && !p->quit && p->timer_enabled)
+        pa_time_histogram_add(&p->stat.lateness, (int64_t) p->woken_up - (int64_t) pa_timeval_load(&p->next_elapse));
+
 #ifdef DEBUG_TIMING
     {
         pa_usec_t now = pa_rtclock_now();
@@ -631,6 +642,20 @@ void pa_rtpoll_quit(pa_rtpoll *p) {
     p->quit = TRUE;
 }
 
+pa_rtpoll_stat *pa_rtpoll_get_stat(pa_rtpoll *p) {
+    pa_assert(p);
+
+    return &p->stat;
+}
+
+void pa_rtpoll_reset_stat(pa_rtpoll *p) {
+    pa_assert(p);
+
+    pa_time_histogram_reset(&p->stat.lateness);
+    pa_time_histogram_reset(&p->stat.processing);
+    pa_time_histogram_reset(&p->stat.headroom);
+}
+
 pa_bool_t pa_rtpoll_timer_elapsed(pa_rtpoll *p) {
     pa_assert(p);
 
@@ -29,6 +29,7 @@
 #include <pulsecore/asyncmsgq.h>
 #include <pulsecore/fdsem.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/time-histogram.h>
 
 /* An implementation of a "real-time" poll loop. Basically, this is
  * yet another wrapper around poll(). However it has certain
@@ -46,6 +47,14 @@
 typedef struct pa_rtpoll pa_rtpoll;
 typedef struct pa_rtpoll_item pa_rtpoll_item;
 
+/* Timing statistics of the thread running the loop, for the main
+ * thread to look at */
+typedef struct pa_rtpoll_stat {
+    pa_time_histogram lateness;   /* wakeup by the timer vs. the time it was set to */
+    pa_time_histogram processing; /* time spent awake per iteration */
+    pa_time_histogram headroom;   /* time left to the device deadline when woken up, filled in by the driver */
+} pa_rtpoll_stat;
+
 typedef enum pa_rtpoll_priority {
     PA_RTPOLL_EARLY  = -100,          /* For very important stuff, like handling control messages */
     PA_RTPOLL_NORMAL = 0,             /* For normal stuff */
@@ -71,6 +80,10 @@ void pa_rtpoll_set_timer_disabled(pa_rtpoll *p);
  * the last pa_rtpoll_run() invocation to finish */
 pa_bool_t pa_rtpoll_timer_elapsed(pa_rtpoll *p);
 
+/* May be called from any thread */
+pa_rtpoll_stat *pa_rtpoll_get_stat(pa_rtpoll *p);
+void pa_rtpoll_reset_stat(pa_rtpoll *p);
+
 /* A new fd wakeup item for pa_rtpoll */
 pa_rtpoll_item *pa_rtpoll_item_new(pa_rtpoll *p, pa_rtpoll_priority_t prio, unsigned n_fds);
 void pa_rtpoll_item_free(pa_rtpoll_item *i);
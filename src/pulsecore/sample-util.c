@@ -1210,8 +1210,8 @@ void pa_volume_ramp_memchunk(
 
     if (pa_memblock_is_silence(c->memblock)) {
         for (i = 0; i < ramp->channels; i++) {
-            if (ramp->ramps[i].length > 0)
-                ramp->ramps[i].length -= length_in_frames;
+            if (ramp->ramps[i].left > 0)
+                ramp->ramps[i].left = PA_MAX(ramp->ramps[i].left - length_in_frames, 0);
         }
         return;
     }
@@ -1282,6 +1282,37 @@ pa_bool_t pa_cvolume_ramp_target_active(pa_cvolume_ramp_int *ramp) {
     return FALSE;
 }
 
+/* Sets up a linear ramp from factor from[i] back to unity on each
+ * channel. A ramp that is still running is continued from its current
+ * position, so that back to back fades don't jump. */
+pa_cvolume_ramp_int* pa_cvolume_ramp_fade_init(pa_cvolume_ramp_int *ramp, const float *from, long length, int channels) {
+    int i;
+
+    pa_assert(ramp);
+    pa_assert(from);
+    pa_assert(length > 0);
+    pa_assert(channels > 0 && channels <= PA_CHANNELS_MAX);
+
+    for (i = 0; i < channels; i++) {
+        float start = from[i];
+
+        if (i < ramp->channels && ramp->ramps[i].left > 0)
+            start *= ramp->ramps[i].curr;
+
+        ramp->ramps[i].type = PA_VOLUME_RAMP_TYPE_LINEAR;
+        ramp->ramps[i].length = length;
+        ramp->ramps[i].left = length;
+        ramp->ramps[i].start = start;
+        ramp->ramps[i].end = 1.0;
+        ramp->ramps[i].curr = start;
+        ramp->ramps[i].target = PA_VOLUME_NORM;
+    }
+
+    ramp->channels = (uint8_t) channels;
+
+    return ramp;
+}
+
 pa_cvolume * pa_cvolume_ramp_get_targets(pa_cvolume_ramp_int *ramp, pa_cvolume *volume) {
     int i = 0;
 
@@ -93,6 +93,7 @@ pa_bool_t pa_cvolume_ramp_target_active(pa_cvolume_ramp_int *ramp);
 pa_cvolume_ramp_int* pa_cvolume_ramp_start_from(pa_cvolume_ramp_int *src, pa_cvolume_ramp_int *dst);
 pa_cvolume_ramp_int* pa_cvolume_ramp_int_init(pa_cvolume_ramp_int *src, pa_volume_t vol, int channels);
 pa_cvolume * pa_cvolume_ramp_get_targets(pa_cvolume_ramp_int *ramp, pa_cvolume *volume);
+pa_cvolume_ramp_int* pa_cvolume_ramp_fade_init(pa_cvolume_ramp_int *ramp, const float *from, long length, int channels);
 
 void pa_volume_ramp_memchunk(
         pa_memchunk *c,
@@ -39,6 +39,14 @@
 #include <sys/mman.h>
 #endif
 
+#if defined(HAVE_LINUX_MEMFD_H) && defined(HAVE_SYS_SYSCALL_H)
+#include <sys/syscall.h>
+#include <linux/memfd.h>
+#if defined(SYS_memfd_create) && defined(MFD_ALLOW_SEALING)
+#define HAVE_MEMFD 1
+#endif
+#endif
+
 /* This is deprecated on glibc but is still used by FreeBSD */
 #if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
 # define MAP_ANONYMOUS MAP_ANON
@@ -63,6 +71,15 @@
 /* 1 GiB at max */
 #define MAX_SHM_SIZE (PA_ALIGN(1024*1024*1024))
 
+/* What we assume MAP_HUGETLB mappings are rounded up to if
+ * /proc/meminfo doesn't tell. 2 MiB is the default huge page size on
+ * x86 and most other architectures. */
+#define DEFAULT_HUGE_PAGE_SIZE (2*1024*1024)
+
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+
 #ifdef __linux__
 /* On Linux we know that the shared memory blocks are files in
  * /dev/shm. We can use that information to list all blocks and
@@ -90,6 +107,24 @@ struct shm_marker {
 
 #define SHM_MARKER_SIZE PA_ALIGN(sizeof(struct shm_marker))
 
+#ifdef HAVE_MEMFD
+/* Older C libraries have no wrappers for these */
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS (1024 + 9)
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+
+#ifndef F_GET_SEALS
+#define F_GET_SEALS (1024 + 10)
+#endif
+
+static int pa_memfd_create(const char *name, unsigned flags) {
+    return (int) syscall(SYS_memfd_create, name, flags);
+}
+#endif
+
 #ifdef HAVE_SHM_OPEN
 static char *segment_name(char *fn, size_t l, unsigned id) {
     pa_snprintf(fn, l, "/pulse-shm-%u", id);
@@ -97,7 +132,129 @@ static char *segment_name(char *fn, size_t l, unsigned id) {
 }
 #endif
 
+/* Fault in the pages of the area, so that whoever uses them first
+ * doesn't have to */
+static void prefault(void *ptr, size_t size) {
+    size_t o;
+
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(ptr, size, MADV_POPULATE_WRITE) >= 0)
+        return;
+#endif
+
+    /* Only writing makes the kernel back a page with memory of its own */
+    for (o = 0; o < size; o += PA_PAGE_SIZE)
+        ((volatile uint8_t*) ptr)[o] = 0;
+}
+
+#if defined(MAP_HUGETLB) || defined(MFD_HUGETLB)
+/* The default huge page size of the system, which MAP_HUGETLB and
+ * MFD_HUGETLB mappings have to be a multiple of */
+static size_t huge_page_size(void) {
+    FILE *f;
+    char line[128];
+    unsigned long kb;
+    size_t size = DEFAULT_HUGE_PAGE_SIZE;
+
+    if (!(f = pa_fopen_cloexec("/proc/meminfo", "r")))
+        return size;
+
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) {
+            if (kb > 0)
+                size = (size_t) kb * 1024;
+            break;
+        }
+
+    fclose(f);
+
+    return size;
+}
+#endif
+
+/* Ask for transparent huge pages where explicit ones are not available */
+static void advise_huge_pages(void *ptr, size_t size) {
+#ifdef MADV_HUGEPAGE
+    if (madvise(ptr, size, MADV_HUGEPAGE) < 0)
+        pa_log_debug("madvise(MADV_HUGEPAGE) failed: %s", pa_cstrerror(errno));
+#endif
+}
+
+#ifdef HAVE_MEMFD
+/* Creates, maps and seals a memfd of the given size, returns the fd. A
+ * segment we can't seal is of no use, peers refuse to map it. */
+static int open_memfd(pa_shm *m, size_t size, unsigned flags, int mmap_flags) {
+    int fd, saved_errno;
+
+    if ((fd = pa_memfd_create("pulseaudio", MFD_CLOEXEC|MFD_ALLOW_SEALING|flags)) < 0)
+        return -1;
+
+    if (ftruncate(fd, (off_t) size) < 0)
+        goto fail;
+
+    if ((m->ptr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED|mmap_flags, fd, (off_t) 0)) == MAP_FAILED)
+        goto fail;
+
+    /* The peers we pass the segment to can rely on it staying the
+     * size it is now */
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_SEAL) < 0) {
+        saved_errno = errno;
+        munmap(m->ptr, size);
+        errno = saved_errno;
+        goto fail;
+    }
+
+    m->size = size;
+
+    return fd;
+
+fail:
+    saved_errno = errno;
+    pa_close(fd);
+    errno = saved_errno;
+
+    return -1;
+}
+
+static int create_memfd(pa_shm *m, size_t size, pa_bool_t huge_pages, int populate) {
+    int fd = -1;
+
+#ifdef MFD_HUGETLB
+    if (huge_pages) {
+        size_t huge_size = PA_ROUND_UP(size, huge_page_size());
+
+        if ((fd = open_memfd(m, huge_size, MFD_HUGETLB, populate)) >= 0)
+            m->huge_pages = TRUE;
+        else
+            pa_log_info("No huge pages available (%s), using regular pages.", pa_cstrerror(errno));
+    }
+#endif
+
+    if (fd < 0) {
+        if ((fd = open_memfd(m, size, 0, MAP_NORESERVE|populate)) < 0) {
+            if (errno != ENOSYS)
+                pa_log("Failed to create memfd: %s", pa_cstrerror(errno));
+            return -1;
+        }
+
+        if (huge_pages)
+            advise_huge_pages(m->ptr, m->size);
+    }
+
+    pa_random(&m->id, sizeof(m->id));
+    m->fd = fd;
+    m->memfd = TRUE;
+
+    return 0;
+}
+#endif
+
 int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, mode_t mode) {
+    return pa_shm_create_rw_full(m, size, shared ? PA_SHM_POSIX : PA_SHM_PRIVATE, FALSE, 0, mode);
+}
+
+int pa_shm_create_rw_full(pa_shm *m, size_t size, pa_shm_type_t type, pa_bool_t huge_pages, size_t prefault_size, mode_t mode) {
+    int populate;
 #ifdef HAVE_SHM_OPEN
     char fn[32];
     int fd = -1;
@@ -108,22 +265,70 @@ int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, mode_t mode) {
     pa_assert(size <= MAX_SHM_SIZE);
     pa_assert(mode >= 0600);
 
-    /* Each time we create a new SHM area, let's first drop all stale
-     * ones */
-    pa_shm_cleanup();
-
     /* Round up to make it page aligned */
     size = PA_PAGE_ALIGN(size);
 
-    if (!shared) {
+    /* If everything is to be prefaulted let mmap() do it */
+    prefault_size = PA_MIN(prefault_size, size);
+    populate = prefault_size >= size ? MAP_POPULATE : 0;
+
+    m->fd = -1;
+    m->huge_pages = FALSE;
+    m->memfd = FALSE;
+
+    if (type == PA_SHM_MEMFD) {
+#ifdef HAVE_MEMFD
+        if (create_memfd(m, size, huge_pages, populate) >= 0) {
+
+            if (prefault_size > 0 && !populate)
+                prefault(m->ptr, prefault_size);
+
+            m->do_unlink = FALSE;
+            m->shared = TRUE;
+
+            return 0;
+        }
+#endif
+
+        pa_log_info("memfd not available, using POSIX shared memory.");
+        type = PA_SHM_POSIX;
+    }
+
+    /* Each time we create a new named SHM area, let's first drop all
+     * stale ones */
+    if (type == PA_SHM_POSIX)
+        pa_shm_cleanup();
+
+    if (type == PA_SHM_PRIVATE) {
         m->id = 0;
         m->size = size;
 
 #ifdef MAP_ANONYMOUS
-        if ((m->ptr = mmap(NULL, m->size, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE, -1, (off_t) 0)) == MAP_FAILED) {
-            pa_log("mmap() failed: %s", pa_cstrerror(errno));
-            goto fail;
+#ifdef MAP_HUGETLB
+        if (huge_pages) {
+            m->size = PA_ROUND_UP(size, huge_page_size());
+
+            if ((m->ptr = mmap(NULL, m->size, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE|MAP_HUGETLB|populate, -1, (off_t) 0)) != MAP_FAILED)
+                m->huge_pages = TRUE;
+            else {
+                pa_log_info("No huge pages available (%s), using regular pages.", pa_cstrerror(errno));
+                m->size = size;
+            }
         }
+#endif
+
+        if (!m->huge_pages) {
+            if ((m->ptr = mmap(NULL, m->size, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE|populate, -1, (off_t) 0)) == MAP_FAILED) {
+                pa_log("mmap() failed: %s", pa_cstrerror(errno));
+                goto fail;
+            }
+
+            if (huge_pages)
+                advise_huge_pages(m->ptr, m->size);
+        }
+
+        if (prefault_size > 0 && !populate)
+            prefault(m->ptr, prefault_size);
 #elif defined(HAVE_POSIX_MEMALIGN)
         {
             int r;
@@ -162,11 +367,19 @@ int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, mode_t mode) {
 #define MAP_NORESERVE 0
 #endif
 
-        if ((m->ptr = mmap(NULL, PA_PAGE_ALIGN(m->size), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_NORESERVE, fd, (off_t) 0)) == MAP_FAILED) {
+        if ((m->ptr = mmap(NULL, PA_PAGE_ALIGN(m->size), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_NORESERVE|populate, fd, (off_t) 0)) == MAP_FAILED) {
             pa_log("mmap() failed: %s", pa_cstrerror(errno));
             goto fail;
         }
 
+        /* POSIX shared memory cannot be backed by MAP_HUGETLB, but
+         * tmpfs hands out transparent huge pages when asked to */
+        if (huge_pages)
+            advise_huge_pages(m->ptr, PA_PAGE_ALIGN(m->size));
+
+        if (prefault_size > 0 && !populate)
+            prefault(m->ptr, prefault_size);
+
         /* We store our PID at the end of the shm block, so that we
          * can check for dead shm segments later */
         marker = (struct shm_marker*) ((uint8_t*) m->ptr + m->size - SHM_MARKER_SIZE);
@@ -180,7 +393,7 @@ int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, mode_t mode) {
 #endif
     }
 
-    m->shared = shared;
+    m->shared = type != PA_SHM_PRIVATE;
 
     return 0;
 
@@ -205,7 +418,12 @@ void pa_shm_free(pa_shm *m) {
     pa_assert(m->ptr != MAP_FAILED);
 #endif
 
-    if (!m->shared) {
+    if (m->memfd) {
+        if (munmap(m->ptr, PA_PAGE_ALIGN(m->size)) < 0)
+            pa_log("munmap() failed: %s", pa_cstrerror(errno));
+
+        pa_assert_se(pa_close(m->fd) == 0);
+    } else if (!m->shared) {
 #ifdef MAP_ANONYMOUS
         if (munmap(m->ptr, m->size) < 0)
             pa_log("munmap() failed: %s", pa_cstrerror(errno));
@@ -252,6 +470,11 @@ void pa_shm_punch(pa_shm *m, size_t offset, size_t size) {
     /* You're welcome to implement this as NOOP on systems that don't
      * support it */
 
+    /* Huge pages can only be given back as a whole, which a single
+     * slot never covers */
+    if (m->huge_pages)
+        return;
+
     /* Align the pointer up to multiples of the page size */
     ptr = (uint8_t*) m->ptr + offset;
     o = (size_t) ((uint8_t*) ptr - (uint8_t*) PA_PAGE_ALIGN_PTR(ptr));
@@ -318,8 +541,11 @@ int pa_shm_attach_ro(pa_shm *m, unsigned id) {
         goto fail;
     }
 
+    m->fd = -1;
     m->do_unlink = FALSE;
     m->shared = TRUE;
+    m->huge_pages = FALSE;
+    m->memfd = FALSE;
 
     pa_assert_se(pa_close(fd) == 0);
 
@@ -340,6 +566,60 @@ int pa_shm_attach_ro(pa_shm *m, unsigned id) {
 
 #endif /* HAVE_SHM_OPEN */
 
+int pa_shm_attach_memfd(pa_shm *m, unsigned id, int fd) {
+    struct stat st;
+
+    pa_assert(m);
+    pa_assert(fd >= 0);
+
+    if (fstat(fd, &st) < 0) {
+        pa_log("fstat() failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    if (st.st_size <= 0 ||
+        st.st_size > (off_t) MAX_SHM_SIZE ||
+        PA_ALIGN((size_t) st.st_size) != (size_t) st.st_size) {
+        pa_log("Invalid shared memory segment size");
+        goto fail;
+    }
+
+#ifdef HAVE_MEMFD
+    /* Unless the peer sealed it, it could shrink the segment under our
+     * feet and have us crash with SIGBUS */
+    {
+        int seals;
+
+        if ((seals = fcntl(fd, F_GET_SEALS)) < 0 || !(seals & F_SEAL_SHRINK)) {
+            pa_log("Shared memory segment isn't sealed against shrinking");
+            goto fail;
+        }
+    }
+#endif
+
+    m->size = (size_t) st.st_size;
+
+    if ((m->ptr = mmap(NULL, PA_PAGE_ALIGN(m->size), PROT_READ, MAP_SHARED, fd, (off_t) 0)) == MAP_FAILED) {
+        pa_log("mmap() failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    /* We keep the fd, in case we pass blocks from it on */
+    m->id = id;
+    m->fd = fd;
+    m->do_unlink = FALSE;
+    m->shared = TRUE;
+    m->huge_pages = FALSE;
+    m->memfd = TRUE;
+
+    return 0;
+
+fail:
+    pa_close(fd);
+
+    return -1;
+}
+
 int pa_shm_cleanup(void) {
 
 #ifdef HAVE_SHM_OPEN
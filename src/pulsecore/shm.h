@@ -26,17 +26,35 @@
 
 #include <pulsecore/macro.h>
 
+typedef enum pa_shm_type {
+    PA_SHM_PRIVATE, /* Not shared with anyone */
+    PA_SHM_POSIX,   /* A named segment others attach to by its ID */
+    PA_SHM_MEMFD    /* An anonymous segment passed to others as fd */
+} pa_shm_type_t;
+
 typedef struct pa_shm {
     unsigned id;
     void *ptr;
     size_t size;
+    int fd; /* Only for memfd segments */
     pa_bool_t do_unlink:1;
     pa_bool_t shared:1;
+    pa_bool_t huge_pages:1;
+    pa_bool_t memfd:1;
 } pa_shm;
 
 int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, mode_t mode);
+
+/* Like pa_shm_create_rw(), but backs the area with huge pages if
+ * asked to and possible, and faults in the first prefault_size bytes
+ * right away. If memfd is not available PA_SHM_MEMFD falls back to
+ * PA_SHM_POSIX. */
+int pa_shm_create_rw_full(pa_shm *m, size_t size, pa_shm_type_t type, pa_bool_t huge_pages, size_t prefault_size, mode_t mode);
 int pa_shm_attach_ro(pa_shm *m, unsigned id);
 
+/* Takes ownership of fd, also on failure */
+int pa_shm_attach_memfd(pa_shm *m, unsigned id, int fd);
+
 void pa_shm_punch(pa_shm *m, size_t offset, size_t size);
 
 void pa_shm_free(pa_shm *m);
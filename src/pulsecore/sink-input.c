@@ -498,6 +498,7 @@ int pa_sink_input_new(
     i->thread_info.direct_outputs = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
 
     i->thread_info.ramp = i->ramp;
+    pa_cvolume_ramp_int_init(&i->thread_info.fade, PA_VOLUME_NORM, i->sink->sample_spec.channels);
 
     pa_assert_se(pa_idxset_put(core->sink_inputs, i, &i->index) == 0);
     pa_assert_se(pa_idxset_put(i->sink->inputs, pa_sink_input_ref(i), NULL) == 0);
@@ -916,6 +917,11 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink frames */, p
                     pa_volume_memchunk(&wchunk, &i->sink->sample_spec, &target);
                 }
 
+                if (pa_cvolume_ramp_active(&i->thread_info.fade)) {
+                    pa_memchunk_make_writable(&wchunk, 0);
+                    pa_volume_ramp_memchunk(&wchunk, &i->sink->sample_spec, &i->thread_info.fade);
+                }
+
                 pa_memblockq_push_align(i->thread_info.render_memblockq, &wchunk);
             } else {
                 pa_memchunk rchunk;
@@ -942,6 +948,11 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink frames */, p
                         pa_volume_memchunk(&rchunk, &i->sink->sample_spec, &target);
                     }
 
+                    if (pa_cvolume_ramp_active(&i->thread_info.fade)) {
+                        pa_memchunk_make_writable(&rchunk, 0);
+                        pa_volume_ramp_memchunk(&rchunk, &i->sink->sample_spec, &i->thread_info.fade);
+                    }
+
                     pa_memblockq_push_align(i->thread_info.render_memblockq, &rchunk);
                     pa_memblock_unref(rchunk.memblock);
                 }
@@ -1888,6 +1899,7 @@ int pa_sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int64_t
 
         case PA_SINK_INPUT_MESSAGE_SET_SOFT_VOLUME:
             if (!pa_cvolume_equal(&i->thread_info.soft_volume, &i->soft_volume)) {
+                pa_sink_fade_volume_within_thread(i->sink, &i->thread_info.fade, &i->channel_map, &i->thread_info.soft_volume, &i->soft_volume);
                 i->thread_info.soft_volume = i->soft_volume;
                 pa_sink_input_request_rewind(i, 0, TRUE, FALSE, FALSE);
             }
@@ -1901,6 +1913,13 @@ int pa_sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int64_t
 
         case PA_SINK_INPUT_MESSAGE_SET_SOFT_MUTE:
             if (i->thread_info.muted != i->muted) {
+                if (!i->muted) {
+                    pa_cvolume muted;
+
+                    pa_cvolume_mute(&muted, i->thread_info.soft_volume.channels);
+                    pa_sink_fade_volume_within_thread(i->sink, &i->thread_info.fade, &i->channel_map, &muted, &i->thread_info.soft_volume);
+                }
+
                 i->thread_info.muted = i->muted;
                 pa_sink_input_request_rewind(i, 0, TRUE, FALSE, FALSE);
             }
@@ -2009,6 +2028,14 @@ void pa_sink_input_request_rewind(
     if (i->thread_info.state == PA_SINK_INPUT_CORKED)
         return;
 
+    /* Our sink never rewinds, so nothing that was already mixed can be
+     * rewritten. What we rendered ahead can still be dropped though. */
+    if (i->sink->flags & PA_SINK_NO_REWIND) {
+        if (flush && !dont_rewind_render)
+            pa_memblockq_flush_write(i->thread_info.render_memblockq, TRUE);
+        return;
+    }
+
     nbytes = PA_MAX(i->thread_info.rewrite_nbytes, nbytes);
 
 #ifdef SINK_INPUT_DEBUG
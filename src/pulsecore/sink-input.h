@@ -246,6 +246,9 @@ struct pa_sink_input {
         pa_hashmap *direct_outputs;
 
         pa_cvolume_ramp_int ramp;
+
+        /* Smooths soft volume changes when our sink doesn't rewind */
+        pa_cvolume_ramp_int fade;
     } thread_info;
 
     void *userdata;
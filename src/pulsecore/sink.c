@@ -42,6 +42,7 @@
 #include <pulsecore/namereg.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/sample-util.h>
+#include <pulsecore/sconv.h>
 #include <pulsecore/core-subscribe.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
@@ -71,6 +72,9 @@ struct sink_message_set_port {
 };
 
 static void sink_free(pa_object *s);
+static void filter_unlink(pa_sink_filter *f);
+static void filters_update_history(pa_sink *s);
+static void filters_rewind(pa_sink *s, size_t nbytes);
 
 static void pa_sink_volume_change_push(pa_sink *s);
 static void pa_sink_volume_change_flush(pa_sink *s);
@@ -273,6 +277,7 @@ pa_sink* pa_sink_new(
 
     s->inputs = pa_idxset_new(NULL, NULL);
     s->n_corked = 0;
+    s->filters = pa_idxset_new(NULL, NULL);
     s->input_to_master = NULL;
 
     s->reference_volume = s->real_volume = data->volume;
@@ -342,6 +347,13 @@ pa_sink* pa_sink_new(
     s->thread_info.volume_change_extra_delay = core->deferred_volume_extra_delay_usec;
 
     s->thread_info.ramp = s->ramp;
+    pa_cvolume_ramp_int_init(&s->thread_info.fade, PA_VOLUME_NORM, data->sample_spec.channels);
+
+    PA_LLIST_HEAD_INIT(pa_sink_filter, s->thread_info.filters);
+    s->thread_info.filter_buffer = NULL;
+    s->thread_info.filter_history = NULL;
+    s->thread_info.filter_history_size = s->thread_info.filter_history_index = s->thread_info.filter_history_length = 0;
+    s->thread_info.filter_latency = 0;
 
     /* FIXME: This should probably be moved to pa_sink_put() */
     pa_assert_se(pa_idxset_put(core->sinks, s, &s->index) >= 0);
@@ -659,6 +671,7 @@ void pa_sink_put(pa_sink* s) {
 void pa_sink_unlink(pa_sink* s) {
     pa_bool_t linked;
     pa_sink_input *i, *j = NULL;
+    pa_sink_filter *f;
 
     pa_assert(s);
     pa_assert_ctl_context();
@@ -689,6 +702,11 @@ void pa_sink_unlink(pa_sink* s) {
         j = i;
     }
 
+    while ((f = pa_idxset_first(s->filters, NULL))) {
+        filter_unlink(f);
+        f->kill(f);
+    }
+
     if (linked)
         sink_set_state(s, PA_SINK_UNLINKED);
     else
@@ -731,6 +749,12 @@ static void sink_free(pa_object *o) {
 
     pa_hashmap_free(s->thread_info.inputs, NULL, NULL);
 
+    /* Every stage holds a reference, so they are all gone by now */
+    pa_assert(pa_idxset_isempty(s->filters));
+    pa_idxset_free(s->filters, NULL, NULL);
+    pa_xfree(s->thread_info.filter_buffer);
+    pa_xfree(s->thread_info.filter_history);
+
     if (s->silence.memblock)
         pa_memblock_unref(s->silence.memblock);
 
@@ -939,6 +963,9 @@ void pa_sink_process_rewind(pa_sink *s, size_t nbytes) {
         pa_log_debug("Processing rewind...");
         if (s->flags & PA_SINK_DEFERRED_VOLUME)
             pa_sink_volume_change_rewind(s, nbytes);
+
+        if (s->thread_info.filters)
+            filters_rewind(s, nbytes);
     }
 
     PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
@@ -1089,6 +1116,150 @@ static void inputs_drop(pa_sink *s, pa_mix_info *info, unsigned n, pa_memchunk *
         pa_source_post(s->monitor_source, result);
 }
 
+/* Called from IO thread context */
+static pa_bool_t filters_needed(pa_sink *s, pa_mix_info *info, unsigned n) {
+
+    if (!s->thread_info.filters)
+        return FALSE;
+
+    /* The stages only know how to deal with PCM */
+    if (n == 1 && pa_sink_input_is_passthrough(info[0].userdata))
+        return FALSE;
+
+    return TRUE;
+}
+
+/* Called from IO thread context. Resizes the history of what went into
+ * the first stage to cover max_rewind plus the warm-up. */
+static void filters_update_history(pa_sink *s) {
+    size_t frames = 0;
+
+    if (s->thread_info.filters && s->thread_info.max_rewind > 0)
+        frames =
+            s->thread_info.max_rewind / pa_frame_size(&s->sample_spec) +
+            pa_usec_to_bytes(PA_SINK_FILTER_WARMUP_USEC, &s->sample_spec) / pa_frame_size(&s->sample_spec);
+
+    if (frames == s->thread_info.filter_history_size)
+        return;
+
+    pa_xfree(s->thread_info.filter_history);
+    s->thread_info.filter_history = frames > 0 ? pa_xnew(float, frames * s->sample_spec.channels) : NULL;
+    s->thread_info.filter_history_size = frames;
+    s->thread_info.filter_history_index = s->thread_info.filter_history_length = 0;
+}
+
+/* Called from IO thread context */
+static void filters_remember(pa_sink *s, const float *data, size_t n) {
+    size_t size = s->thread_info.filter_history_size;
+    unsigned channels = s->sample_spec.channels;
+
+    if (size <= 0)
+        return;
+
+    if (n > size) {
+        data += (n - size) * channels;
+        n = size;
+    }
+
+    while (n > 0) {
+        size_t k = PA_MIN(n, size - s->thread_info.filter_history_index);
+
+        memcpy(s->thread_info.filter_history + s->thread_info.filter_history_index * channels, data, k * channels * sizeof(float));
+
+        s->thread_info.filter_history_index = (s->thread_info.filter_history_index + k) % size;
+        s->thread_info.filter_history_length = PA_MIN(s->thread_info.filter_history_length + k, size);
+
+        data += k * channels;
+        n -= k;
+    }
+}
+
+/* Called from IO thread context. The stages have seen data that is now
+ * going to be rendered again, so they have to go back to the state they
+ * had at the rewind point. They forget everything, then the chain is run
+ * once more over the warm-up before the rewind point, with its output
+ * thrown away. */
+static void filters_rewind(pa_sink *s, size_t nbytes) {
+    pa_sink_filter *f;
+    pa_bool_t stateful = FALSE;
+    size_t frames, size, warmup, index, max_n;
+    unsigned channels = s->sample_spec.channels;
+
+    PA_LLIST_FOREACH(f, s->thread_info.filters)
+        if (f->reset) {
+            f->reset(f);
+            stateful = TRUE;
+        }
+
+    frames = nbytes / pa_frame_size(&s->sample_spec);
+
+    if (frames >= s->thread_info.filter_history_length) {
+        s->thread_info.filter_history_length = 0;
+        return;
+    }
+
+    /* What was rewound is going to come in again */
+    size = s->thread_info.filter_history_size;
+    s->thread_info.filter_history_index = (s->thread_info.filter_history_index + size - frames) % size;
+    s->thread_info.filter_history_length -= frames;
+
+    if (!stateful)
+        return;
+
+    warmup = pa_usec_to_bytes(PA_SINK_FILTER_WARMUP_USEC, &s->sample_spec) / pa_frame_size(&s->sample_spec);
+    warmup = PA_MIN(warmup, s->thread_info.filter_history_length);
+    index = (s->thread_info.filter_history_index + size - warmup) % size;
+    max_n = pa_mempool_block_size_max(s->core->mempool) / pa_frame_size(&s->sample_spec);
+
+    while (warmup > 0) {
+        size_t n = PA_MIN(warmup, size - index);
+
+        n = PA_MIN(n, max_n);
+
+        memcpy(s->thread_info.filter_buffer, s->thread_info.filter_history + index * channels, n * channels * sizeof(float));
+
+        PA_LLIST_FOREACH(f, s->thread_info.filters)
+            f->process(f, s->thread_info.filter_buffer, (unsigned) n);
+
+        index = (index + n) % size;
+        warmup -= n;
+    }
+}
+
+/* Called from IO thread context */
+static void filters_process(pa_sink *s, pa_memchunk *chunk) {
+    pa_sink_filter *f;
+    void *d;
+    float *data;
+    unsigned n;
+
+    n = (unsigned) (chunk->length / pa_frame_size(&s->sample_spec));
+
+    if (n <= 0)
+        return;
+
+    d = (uint8_t*) pa_memblock_acquire(chunk->memblock) + chunk->index;
+
+    /* Float sinks are processed right in the mix buffer, everything
+     * else is converted once for the whole chain */
+    if (s->sample_spec.format == PA_SAMPLE_FLOAT32NE)
+        data = d;
+    else {
+        data = s->thread_info.filter_buffer;
+        pa_get_convert_to_float32ne_function(s->sample_spec.format)(n * s->sample_spec.channels, d, data);
+    }
+
+    filters_remember(s, data, n);
+
+    PA_LLIST_FOREACH(f, s->thread_info.filters)
+        f->process(f, data, n);
+
+    if (data != d)
+        pa_get_convert_from_float32ne_function(s->sample_spec.format)(n * s->sample_spec.channels, data, d);
+
+    pa_memblock_release(chunk->memblock);
+}
+
 /* Called from IO thread context */
 void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
     pa_mix_info info[MAX_MIX_CHANNELS];
@@ -1193,6 +1364,16 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
         result->index = 0;
     }
 
+    if (n > 0 && pa_cvolume_ramp_active(&s->thread_info.fade)) {
+        pa_memchunk_make_writable(result, 0);
+        pa_volume_ramp_memchunk(result, &s->sample_spec, &s->thread_info.fade);
+    }
+
+    if (filters_needed(s, info, n)) {
+        pa_memchunk_make_writable(result, 0);
+        filters_process(s, result);
+    }
+
     inputs_drop(s, info, n, result);
 
     pa_sink_unref(s);
@@ -1300,6 +1481,12 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
         pa_memblock_release(target->memblock);
     }
 
+    if (n > 0 && pa_cvolume_ramp_active(&s->thread_info.fade))
+        pa_volume_ramp_memchunk(target, &s->sample_spec, &s->thread_info.fade);
+
+    if (filters_needed(s, info, n))
+        filters_process(s, target);
+
     inputs_drop(s, info, n, target);
 
     pa_sink_unref(s);
@@ -1457,6 +1644,8 @@ pa_bool_t pa_sink_update_rate(pa_sink *s, uint32_t rate, pa_bool_t passthrough)
 /* Called from main thread */
 pa_usec_t pa_sink_get_latency(pa_sink *s) {
     pa_usec_t usec = 0;
+    pa_sink_filter *f;
+    uint32_t idx;
 
     pa_sink_assert_ref(s);
     pa_assert_ctl_context();
@@ -1472,6 +1661,9 @@ pa_usec_t pa_sink_get_latency(pa_sink *s) {
 
     pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SINK_MESSAGE_GET_LATENCY, &usec, 0, NULL) == 0);
 
+    PA_IDXSET_FOREACH(f, s->filters, idx)
+        usec += f->latency;
+
     return usec;
 }
 
@@ -1499,7 +1691,7 @@ pa_usec_t pa_sink_get_latency_within_thread(pa_sink *s) {
     if (o->process_msg(o, PA_SINK_MESSAGE_GET_LATENCY, &usec, 0, NULL) < 0)
         return -1;
 
-    return usec;
+    return usec + s->thread_info.filter_latency;
 }
 
 /* Called from the main thread (and also from the IO thread while the main
@@ -2420,6 +2612,7 @@ static void sync_input_volumes_within_thread(pa_sink *s) {
         if (pa_cvolume_equal(&i->thread_info.soft_volume, &i->soft_volume))
             continue;
 
+        pa_sink_fade_volume_within_thread(s, &i->thread_info.fade, &i->channel_map, &i->thread_info.soft_volume, &i->soft_volume);
         i->thread_info.soft_volume = i->soft_volume;
         pa_sink_input_request_rewind(i, 0, TRUE, FALSE, FALSE);
     }
@@ -2476,6 +2669,11 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
             pa_assert(!i->thread_info.attached);
             i->thread_info.attached = TRUE;
 
+            /* The fade runs on what this sink renders, so it has to
+             * have our channels. A fade begun on another sink doesn't
+             * carry over. */
+            pa_cvolume_ramp_int_init(&i->thread_info.fade, PA_VOLUME_NORM, s->sample_spec.channels);
+
             if (i->attach)
                 i->attach(i);
 
@@ -2654,6 +2852,11 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
             pa_assert(!i->thread_info.attached);
             i->thread_info.attached = TRUE;
 
+            /* The fade runs on what this sink renders, so it has to
+             * have our channels. A fade begun on another sink doesn't
+             * carry over. */
+            pa_cvolume_ramp_int_init(&i->thread_info.fade, PA_VOLUME_NORM, s->sample_spec.channels);
+
             if (i->attach)
                 i->attach(i);
 
@@ -2724,6 +2927,7 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
         case PA_SINK_MESSAGE_SET_VOLUME:
 
             if (!pa_cvolume_equal(&s->thread_info.soft_volume, &s->soft_volume)) {
+                pa_sink_fade_volume_within_thread(s, &s->thread_info.fade, &s->channel_map, &s->thread_info.soft_volume, &s->soft_volume);
                 s->thread_info.soft_volume = s->soft_volume;
                 pa_sink_request_rewind(s, (size_t) -1);
             }
@@ -2733,6 +2937,27 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
             sync_input_volumes_within_thread(s);
             return 0;
 
+        case PA_SINK_MESSAGE_ADD_FILTER: {
+            pa_sink_filter *f = userdata, *last;
+
+            for (last = s->thread_info.filters; last && last->next; last = last->next)
+                ;
+
+            PA_LLIST_INSERT_AFTER(pa_sink_filter, s->thread_info.filters, last, f);
+            s->thread_info.filter_latency += f->latency;
+            filters_update_history(s);
+            return 0;
+        }
+
+        case PA_SINK_MESSAGE_REMOVE_FILTER: {
+            pa_sink_filter *f = userdata;
+
+            PA_LLIST_REMOVE(pa_sink_filter, s->thread_info.filters, f);
+            s->thread_info.filter_latency -= f->latency;
+            filters_update_history(s);
+            return 0;
+        }
+
         case PA_SINK_MESSAGE_SET_VOLUME_RAMP:
             /* if we have ongoing ramp where we take current start values */
             pa_cvolume_ramp_start_from(&s->thread_info.ramp, &s->ramp);
@@ -2749,6 +2974,7 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
 
             /* In case sink implementor reset SW volume. */
             if (!pa_cvolume_equal(&s->thread_info.soft_volume, &s->soft_volume)) {
+                pa_sink_fade_volume_within_thread(s, &s->thread_info.fade, &s->channel_map, &s->thread_info.soft_volume, &s->soft_volume);
                 s->thread_info.soft_volume = s->soft_volume;
                 pa_sink_request_rewind(s, (size_t) -1);
             }
@@ -2758,6 +2984,13 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
         case PA_SINK_MESSAGE_SET_MUTE:
 
             if (s->thread_info.soft_muted != s->muted) {
+                if (!s->muted) {
+                    pa_cvolume muted;
+
+                    pa_cvolume_mute(&muted, s->sample_spec.channels);
+                    pa_sink_fade_volume_within_thread(s, &s->thread_info.fade, &s->channel_map, &muted, &s->thread_info.soft_volume);
+                }
+
                 s->thread_info.soft_muted = s->muted;
                 pa_sink_request_rewind(s, (size_t) -1);
             }
@@ -2982,6 +3215,11 @@ void pa_sink_request_rewind(pa_sink*s, size_t nbytes) {
     if (s->thread_info.state == PA_SINK_SUSPENDED)
         return;
 
+    /* Changes are faded in rather than re-rendered, see
+     * pa_sink_fade_volume_within_thread() */
+    if (s->flags & PA_SINK_NO_REWIND)
+        return;
+
     if (nbytes == (size_t) -1)
         nbytes = s->thread_info.max_rewind;
 
@@ -2998,6 +3236,47 @@ void pa_sink_request_rewind(pa_sink*s, size_t nbytes) {
         s->request_rewind(s);
 }
 
+/* Called from IO thread. Sinks that never rewind cannot re-render what
+ * is already queued with a new soft volume, so instead the first samples
+ * rendered after the change are ramped from the old level to the new one,
+ * channel by channel. The volumes are in the given channel map, the fade
+ * runs on what the sink renders. */
+void pa_sink_fade_volume_within_thread(pa_sink *s, pa_cvolume_ramp_int *fade, const pa_channel_map *map, const pa_cvolume *old_volume, const pa_cvolume *new_volume) {
+    pa_cvolume from_volume, to_volume;
+    float from[PA_CHANNELS_MAX];
+    size_t frames;
+    unsigned c;
+
+    pa_sink_assert_ref(s);
+    pa_assert(fade);
+    pa_assert(map);
+    pa_assert(old_volume);
+    pa_assert(new_volume);
+
+    if (!(s->flags & PA_SINK_NO_REWIND))
+        return;
+
+    frames = pa_usec_to_bytes(PA_SINK_NO_REWIND_FADE_USEC, &s->sample_spec) / pa_frame_size(&s->sample_spec);
+    if (frames <= 0)
+        return;
+
+    from_volume = *old_volume;
+    to_volume = *new_volume;
+    pa_assert_se(pa_cvolume_remap(&from_volume, map, &s->channel_map));
+    pa_assert_se(pa_cvolume_remap(&to_volume, map, &s->channel_map));
+
+    for (c = 0; c < s->sample_spec.channels; c++) {
+        double to = pa_sw_volume_to_linear(to_volume.values[c]);
+
+        /* A fade can only scale what was rendered with the new volume,
+         * which for a muted channel is silence. Those channels change
+         * at once. */
+        from[c] = to > 0 ? (float) (pa_sw_volume_to_linear(from_volume.values[c]) / to) : 1.0f;
+    }
+
+    pa_cvolume_ramp_fade_init(fade, from, (long) frames, s->sample_spec.channels);
+}
+
 /* Called from IO thread */
 pa_usec_t pa_sink_get_requested_latency_within_thread(pa_sink *s) {
     pa_usec_t result = (pa_usec_t) -1;
@@ -3061,6 +3340,10 @@ void pa_sink_set_max_rewind_within_thread(pa_sink *s, size_t max_rewind) {
     pa_sink_assert_ref(s);
     pa_sink_assert_io_context(s);
 
+    /* Not keeping any history also frees the inputs from keeping any */
+    if (s->flags & PA_SINK_NO_REWIND)
+        max_rewind = 0;
+
     if (max_rewind == s->thread_info.max_rewind)
         return;
 
@@ -3070,6 +3353,8 @@ void pa_sink_set_max_rewind_within_thread(pa_sink *s, size_t max_rewind) {
         PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
             pa_sink_input_update_max_rewind(i, s->thread_info.max_rewind);
 
+    filters_update_history(s);
+
     if (s->monitor_source)
         pa_source_set_max_rewind_within_thread(s->monitor_source, s->thread_info.max_rewind);
 }
@@ -3714,6 +3999,83 @@ static void pa_sink_volume_change_rewind(pa_sink *s, size_t nbytes) {
     pa_sink_volume_change_apply(s, NULL);
 }
 
+/* Called from main context */
+pa_sink_filter* pa_sink_filter_new(pa_sink *s, pa_module *m, const char *name) {
+    pa_sink_filter *f;
+
+    pa_sink_assert_ref(s);
+    pa_assert_ctl_context();
+    pa_assert(name);
+
+    f = pa_xnew0(pa_sink_filter, 1);
+    f->sink = pa_sink_ref(s);
+    f->module = m;
+    f->name = pa_xstrdup(name);
+    PA_LLIST_INIT(pa_sink_filter, f);
+
+    return f;
+}
+
+/* Called from main context */
+void pa_sink_filter_put(pa_sink_filter *f) {
+    pa_sink *s;
+
+    pa_assert(f);
+    pa_assert_ctl_context();
+    pa_assert(!f->linked);
+    pa_assert(f->process);
+    pa_assert(f->kill);
+
+    s = f->sink;
+    pa_assert(PA_SINK_IS_LINKED(s->state));
+
+    /* The IO thread only touches the buffer while there are stages in
+     * the chain, and the first one is added below. Float sinks need it
+     * too, for warming the stages up again after a rewind. */
+    if (!s->thread_info.filter_buffer)
+        s->thread_info.filter_buffer = pa_xmalloc(pa_mempool_block_size_max(s->core->mempool) / pa_sample_size(&s->sample_spec) * sizeof(float));
+
+    pa_assert_se(pa_idxset_put(s->filters, f, NULL) >= 0);
+    f->linked = TRUE;
+
+    pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SINK_MESSAGE_ADD_FILTER, f, 0, NULL) == 0);
+
+    pa_log_debug("Added processing stage %s to sink %s, %u stages now", f->name, s->name, pa_idxset_size(s->filters));
+}
+
+/* Called from main context */
+static void filter_unlink(pa_sink_filter *f) {
+    pa_sink *s = f->sink;
+
+    if (!f->linked)
+        return;
+
+    if (PA_SINK_IS_LINKED(s->state))
+        pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SINK_MESSAGE_REMOVE_FILTER, f, 0, NULL) == 0);
+    else {
+        PA_LLIST_REMOVE(pa_sink_filter, s->thread_info.filters, f);
+        s->thread_info.filter_latency -= f->latency;
+        filters_update_history(s);
+    }
+
+    pa_idxset_remove_by_data(s->filters, f, NULL);
+    f->linked = FALSE;
+
+    pa_log_debug("Removed processing stage %s from sink %s", f->name, s->name);
+}
+
+/* Called from main context */
+void pa_sink_filter_free(pa_sink_filter *f) {
+    pa_assert(f);
+    pa_assert_ctl_context();
+
+    filter_unlink(f);
+
+    pa_sink_unref(f->sink);
+    pa_xfree(f->name);
+    pa_xfree(f);
+}
+
 /* Called from the main thread */
 /* Gets the list of formats supported by the sink. The members and idxset must
  * be freed by the caller. */
@@ -25,6 +25,7 @@
 
 typedef struct pa_sink pa_sink;
 typedef struct pa_sink_volume_change pa_sink_volume_change;
+typedef struct pa_sink_filter pa_sink_filter;
 
 #include <inttypes.h>
 
@@ -50,6 +51,14 @@ typedef struct pa_sink_volume_change pa_sink_volume_change;
 
 #define PA_MAX_INPUTS_PER_SINK 32
 
+/* How long sinks flagged PA_SINK_NO_REWIND take to fade in a soft
+ * volume change */
+#define PA_SINK_NO_REWIND_FADE_USEC (10*PA_USEC_PER_MSEC)
+
+/* How much of the audio before a rewind point the processing stages of
+ * a sink are run over again after a rewind */
+#define PA_SINK_FILTER_WARMUP_USEC (100*PA_USEC_PER_MSEC)
+
 /* Returns true if sink is linked: registered and accessible from client side. */
 static inline pa_bool_t PA_SINK_IS_LINKED(pa_sink_state_t x) {
     return x == PA_SINK_RUNNING || x == PA_SINK_IDLE || x == PA_SINK_SUSPENDED;
@@ -58,6 +67,42 @@ static inline pa_bool_t PA_SINK_IS_LINKED(pa_sink_state_t x) {
 /* A generic definition for void callback functions */
 typedef void(*pa_sink_cb_t)(pa_sink *s);
 
+/* A processing stage attached to a sink. All stages of a sink run back
+ * to back on the mixed data inside pa_sink_render() and friends, on one
+ * buffer of interleaved float samples in the sink's rate and channel
+ * map. Unlike a filter sink this needs no sink input, memblockq or
+ * resampler of its own, but it always processes everything the sink
+ * plays. */
+struct pa_sink_filter {
+    pa_sink *sink;
+    pa_module *module;                      /* may be NULL */
+    char *name;
+
+    /* The delay the stage adds to the signal, shall be constant */
+    pa_usec_t latency;
+
+    pa_bool_t linked:1;
+
+    /* Called from IO thread context. Processes n frames in place. */
+    void (*process)(pa_sink_filter *f, float *data, unsigned n);
+
+    /* Called from IO thread context when the sink rewinds, i.e. the
+     * data the stage saw last is going to be rendered again. Stages
+     * that keep state shall forget it here. The sink then runs the
+     * chain again over up to PA_SINK_FILTER_WARMUP_USEC of what came
+     * before the rewind point, which brings the stage back to where it
+     * was there as long as its state doesn't depend on older data. */
+    void (*reset)(pa_sink_filter *f); /* may be NULL for stateless stages */
+
+    /* Called from main context when the sink goes away. The stage has
+     * been taken off the sink already, the owner should free it. */
+    void (*kill)(pa_sink_filter *f);
+
+    void *userdata;
+
+    PA_LLIST_FIELDS(pa_sink_filter);
+};
+
 struct pa_sink {
     pa_msgobject parent;
 
@@ -82,6 +127,7 @@ struct pa_sink {
 
     pa_idxset *inputs;
     unsigned n_corked;
+    pa_idxset *filters;
     pa_source *monitor_source;
     pa_sink_input *input_to_master;         /* non-NULL only for filter sinks */
 
@@ -287,6 +333,19 @@ struct pa_sink {
         int32_t volume_change_extra_delay;
 
         pa_cvolume_ramp_int ramp;
+
+        /* Smooths soft volume changes on PA_SINK_NO_REWIND sinks */
+        pa_cvolume_ramp_int fade;
+
+        /* The processing stages, in the order they are run */
+        PA_LLIST_HEAD(pa_sink_filter, filters);
+        float *filter_buffer;
+        pa_usec_t filter_latency;
+
+        /* A ring of what went into the first stage lately, max_rewind
+         * plus the warm-up, for rewinding the stages; in frames */
+        float *filter_history;
+        size_t filter_history_size, filter_history_index, filter_history_length;
     } thread_info;
 
     void *userdata;
@@ -323,6 +382,8 @@ typedef enum pa_sink_message {
     PA_SINK_MESSAGE_SET_PORT,
     PA_SINK_MESSAGE_UPDATE_VOLUME_AND_MUTE,
     PA_SINK_MESSAGE_SET_VOLUME_RAMP,
+    PA_SINK_MESSAGE_ADD_FILTER,
+    PA_SINK_MESSAGE_REMOVE_FILTER,
     PA_SINK_MESSAGE_MAX
 } pa_sink_message_t;
 
@@ -459,6 +520,11 @@ pa_queue *pa_sink_move_all_start(pa_sink *s, pa_queue *q);
 void pa_sink_move_all_finish(pa_sink *s, pa_queue *q, pa_bool_t save);
 void pa_sink_move_all_fail(pa_queue *q);
 
+/* Stages are appended to the chain on _put() */
+pa_sink_filter* pa_sink_filter_new(pa_sink *s, pa_module *m, const char *name);
+void pa_sink_filter_put(pa_sink_filter *f);
+void pa_sink_filter_free(pa_sink_filter *f);
+
 pa_idxset* pa_sink_get_formats(pa_sink *s);
 pa_bool_t pa_sink_set_formats(pa_sink *s, pa_idxset *formats);
 pa_bool_t pa_sink_check_format(pa_sink *s, pa_format_info *f);
@@ -494,6 +560,8 @@ pa_bool_t pa_sink_volume_change_apply(pa_sink *s, pa_usec_t *usec_to_next);
 
 void pa_sink_request_rewind(pa_sink*s, size_t nbytes);
 
+void pa_sink_fade_volume_within_thread(pa_sink *s, pa_cvolume_ramp_int *fade, const pa_channel_map *map, const pa_cvolume *old_volume, const pa_cvolume *new_volume);
+
 void pa_sink_invalidate_requested_latency(pa_sink *s, pa_bool_t dynamic);
 
 pa_usec_t pa_sink_get_latency_within_thread(pa_sink *s);
@@ -212,6 +212,20 @@ static void reset_callbacks(pa_source_output *o) {
     o->mute_changed = NULL;
 }
 
+/* Called from main context */
+static void set_shared_resampler(pa_source_output *o, pa_source *s) {
+    pa_assert(o);
+
+    if (o->thread_info.shared_resampler) {
+        pa_source_shared_resampler_unref(o->thread_info.shared_resampler);
+        o->thread_info.shared_resampler = NULL;
+    }
+
+    /* Variable rate resamplers are steered one by one */
+    if (s && o->thread_info.resampler && !(o->flags & PA_SOURCE_OUTPUT_VARIABLE_RATE))
+        o->thread_info.shared_resampler = pa_source_get_shared_resampler(s, o->thread_info.resampler);
+}
+
 /* Called from main context */
 int pa_source_output_new(
         pa_source_output**_o,
@@ -446,6 +460,8 @@ int pa_source_output_new(
     o->thread_info.attached = FALSE;
     o->thread_info.sample_spec = o->sample_spec;
     o->thread_info.resampler = resampler;
+    o->thread_info.shared_resampler = NULL;
+    o->thread_info.resampler_stale = FALSE;
     o->thread_info.soft_volume = o->soft_volume;
     o->thread_info.muted = o->muted;
     o->thread_info.requested_source_latency = (pa_usec_t) -1;
@@ -586,6 +602,7 @@ void pa_source_output_unlink(pa_source_output*o) {
         if (PA_SOURCE_IS_LINKED(pa_source_get_state(o->source)))
             pa_source_update_status(o->source);
 
+        set_shared_resampler(o, NULL);
         o->source = NULL;
     }
 
@@ -610,6 +627,8 @@ static void source_output_free(pa_object* mo) {
     if (o->thread_info.delay_memblockq)
         pa_memblockq_free(o->thread_info.delay_memblockq);
 
+    pa_assert(!o->thread_info.shared_resampler);
+
     if (o->thread_info.resampler)
         pa_resampler_free(o->thread_info.resampler);
 
@@ -658,6 +677,7 @@ void pa_source_output_put(pa_source_output *o) {
 
     o->thread_info.soft_volume = o->soft_volume;
     o->thread_info.muted = o->muted;
+    set_shared_resampler(o, o->source);
 
     pa_assert_se(pa_asyncmsgq_send(o->source->asyncmsgq, PA_MSGOBJECT(o->source), PA_SOURCE_MESSAGE_ADD_OUTPUT, o, 0, NULL) == 0);
 
@@ -791,6 +811,11 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
             if (mbs == 0)
                 mbs = pa_resampler_max_block_size(o->thread_info.resampler);
 
+            if (o->thread_info.resampler_stale) {
+                pa_resampler_reset(o->thread_info.resampler);
+                o->thread_info.resampler_stale = FALSE;
+            }
+
             if (qchunk.length > mbs)
                 qchunk.length = mbs;
 
@@ -814,6 +839,70 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
     }
 }
 
+/* Called from thread context */
+pa_bool_t pa_source_output_can_share_conversion(pa_source_output *o, const pa_memchunk *chunk) {
+    pa_source_output_assert_ref(o);
+    pa_source_output_assert_io_context(o);
+    pa_assert(chunk);
+
+    if (!o->push || o->thread_info.state != PA_SOURCE_OUTPUT_RUNNING)
+        return FALSE;
+
+    /* Variable rate resamplers are steered one by one, and don't get
+     * a shared one */
+    if (!o->thread_info.shared_resampler)
+        return FALSE;
+
+    /* The soft volume is applied before resampling, so it has to be a
+     * no-op */
+    if (o->thread_info.muted || !pa_cvolume_is_norm(&o->thread_info.soft_volume))
+        return FALSE;
+
+    /* The chunk has to go through the delay queue at once and in one
+     * piece, as pa_source_output_push() would do it */
+    if (!o->process_rewind && o->source->thread_info.max_rewind > 0)
+        return FALSE;
+
+    if (pa_memblockq_get_length(o->thread_info.delay_memblockq) > 0)
+        return FALSE;
+
+    return chunk->length <= pa_resampler_max_block_size(o->thread_info.resampler);
+}
+
+static void push_converted(pa_source_output *o, const pa_memchunk *chunk, const pa_memchunk *rchunk) {
+
+    /* Keep the delay queue where pa_source_output_push() would leave
+     * it */
+    if (pa_memblockq_push(o->thread_info.delay_memblockq, chunk) < 0)
+        pa_memblockq_seek(o->thread_info.delay_memblockq, (int64_t) chunk->length, PA_SEEK_RELATIVE, TRUE);
+
+    pa_memblockq_drop(o->thread_info.delay_memblockq, chunk->length);
+
+    if (rchunk->length <= 0)
+        return;
+
+    if (!pa_cvolume_is_norm(&o->volume_factor_source)) {
+        pa_memchunk vchunk = *rchunk;
+
+        pa_memblock_ref(vchunk.memblock);
+        pa_memchunk_make_writable(&vchunk, 0);
+        pa_volume_memchunk(&vchunk, &o->thread_info.sample_spec, &o->volume_factor_source);
+        o->push(o, &vchunk);
+        pa_memblock_unref(vchunk.memblock);
+    } else
+        o->push(o, rchunk);
+}
+
+/* Called from thread context */
+void pa_source_output_push_converted(pa_source_output *o, const pa_memchunk *chunk, const pa_memchunk *rchunk) {
+    pa_source_output_assert_ref(o);
+    pa_assert(pa_source_output_can_share_conversion(o, chunk));
+    pa_assert(rchunk);
+
+    o->thread_info.resampler_stale = TRUE;
+    push_converted(o, chunk, rchunk);
+}
+
 /* Called from thread context */
 void pa_source_output_process_rewind(pa_source_output *o, size_t nbytes /* in source sample spec */) {
 
@@ -1236,6 +1325,7 @@ int pa_source_output_start_move(pa_source_output *o) {
     pa_assert_se(pa_asyncmsgq_send(o->source->asyncmsgq, PA_MSGOBJECT(o->source), PA_SOURCE_MESSAGE_REMOVE_OUTPUT, o, 0, NULL) == 0);
 
     pa_source_update_status(o->source);
+    set_shared_resampler(o, NULL);
     o->source = NULL;
 
     pa_source_output_unref(o);
@@ -1445,6 +1535,7 @@ int pa_source_output_finish_move(pa_source_output *o, pa_source *dest, pa_bool_t
         o->source->n_corked++;
 
     pa_source_output_update_rate(o);
+    set_shared_resampler(o, o->source);
 
     pa_source_update_status(dest);
 
@@ -1661,6 +1752,10 @@ int pa_source_output_update_rate(pa_source_output *o) {
         pa_resampler_free(o->thread_info.resampler);
 
     o->thread_info.resampler = new_resampler;
+    o->thread_info.resampler_stale = FALSE;
+
+    if (PA_SOURCE_OUTPUT_IS_LINKED(o->state))
+        set_shared_resampler(o, o->source);
 
     pa_memblockq_free(o->thread_info.delay_memblockq);
 
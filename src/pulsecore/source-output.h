@@ -202,6 +202,12 @@ struct pa_source_output {
 
         pa_resampler* resampler;              /* may be NULL */
 
+        /* The resampler of the source for our conversion, may be NULL.
+         * While that one does it, the history in ours doesn't fit the
+         * data anymore and it is stale. */
+        pa_source_shared_resampler *shared_resampler;
+        pa_bool_t resampler_stale:1;
+
         /* We maintain a delay memblockq here for source outputs that
          * don't implement rewind() */
         pa_memblockq *delay_memblockq;
@@ -344,6 +350,13 @@ pa_usec_t pa_source_output_get_requested_latency(pa_source_output *o);
 /* To be used exclusively by the source driver thread */
 
 void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk);
+
+/* Outputs that would run the same chunk through the same conversion
+ * can share it: the source converts the chunk once with the shared
+ * resampler of the output, and hands the result to all of them with
+ * pa_source_output_push_converted() instead. */
+pa_bool_t pa_source_output_can_share_conversion(pa_source_output *o, const pa_memchunk *chunk);
+void pa_source_output_push_converted(pa_source_output *o, const pa_memchunk *chunk, const pa_memchunk *rchunk);
 void pa_source_output_process_rewind(pa_source_output *o, size_t nbytes);
 void pa_source_output_update_max_rewind(pa_source_output *o, size_t nbytes);
 
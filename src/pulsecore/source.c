@@ -48,6 +48,7 @@
 #define ABSOLUTE_MIN_LATENCY (500)
 #define ABSOLUTE_MAX_LATENCY (10*PA_USEC_PER_SEC)
 #define DEFAULT_FIXED_LATENCY (250*PA_USEC_PER_MSEC)
+#define MAX_SHARED_CONVERSIONS 8
 
 PA_DEFINE_PUBLIC_CLASS(pa_source, pa_msgobject);
 
@@ -58,6 +59,17 @@ struct pa_source_volume_change {
     PA_LLIST_FIELDS(pa_source_volume_change);
 };
 
+struct pa_source_shared_resampler {
+    pa_source *source;
+    unsigned refcnt;
+    pa_resampler *resampler;
+
+    /* The value of thread_info.pushes it last ran for */
+    uint64_t last_push;
+
+    PA_LLIST_FIELDS(pa_source_shared_resampler);
+};
+
 struct source_message_set_port {
     pa_device_port *port;
     int ret;
@@ -260,6 +272,7 @@ pa_source* pa_source_new(
 
     s->outputs = pa_idxset_new(NULL, NULL);
     s->n_corked = 0;
+    PA_LLIST_HEAD_INIT(pa_source_shared_resampler, s->shared_resamplers);
     s->monitor_of = NULL;
     s->output_from_master = NULL;
 
@@ -323,6 +336,9 @@ pa_source* pa_source_new(
     pa_sw_cvolume_multiply(&s->thread_info.current_hw_volume, &s->soft_volume, &s->real_volume);
     s->thread_info.volume_change_safety_margin = core->deferred_volume_safety_margin_usec;
     s->thread_info.volume_change_extra_delay = core->deferred_volume_extra_delay_usec;
+    s->thread_info.conversions = 0;
+    s->thread_info.shared_conversions = 0;
+    s->thread_info.pushes = 0;
 
     /* FIXME: This should probably be moved to pa_source_put() */
     pa_assert_se(pa_idxset_put(core->sources, s, &s->index) >= 0);
@@ -651,6 +667,7 @@ static void source_free(pa_object *o) {
     pa_log_info("Freeing source %u \"%s\"", s->index, s->name);
 
     pa_idxset_free(s->outputs, NULL, NULL);
+    pa_assert(!s->shared_resamplers);
 
     while ((so = pa_hashmap_steal_first(s->thread_info.outputs)))
         pa_source_output_unref(so);
@@ -863,6 +880,9 @@ void pa_source_process_rewind(pa_source *s, size_t nbytes) {
 
     pa_log_debug("Processing rewind...");
 
+    /* The shared resamplers have to start over, too */
+    s->thread_info.pushes++;
+
     PA_HASHMAP_FOREACH(o, s->thread_info.outputs, state) {
         pa_source_output_assert_ref(o);
         pa_source_output_process_rewind(o, nbytes);
@@ -870,10 +890,70 @@ void pa_source_process_rewind(pa_source *s, size_t nbytes) {
 }
 
 /* Called from IO thread context */
-void pa_source_post(pa_source*s, const pa_memchunk *chunk) {
+static void run_shared_resampler(pa_source *s, pa_source_shared_resampler *r, const pa_memchunk *chunk, pa_memchunk *rchunk) {
+
+    /* Nobody shared this conversion last time, what the resampler
+     * remembers doesn't fit the data anymore */
+    if (r->last_push + 1 != s->thread_info.pushes)
+        pa_resampler_reset(r->resampler);
+
+    r->last_push = s->thread_info.pushes;
+    pa_resampler_run(r->resampler, chunk, rchunk);
+}
+
+/* Called from IO thread context */
+static void push_to_outputs(pa_source *s, const pa_memchunk *chunk) {
+    struct {
+        pa_source_shared_resampler *resampler;
+        pa_memchunk rchunk;
+    } conversions[MAX_SHARED_CONVERSIONS];
+    unsigned n_conversions = 0, i;
     pa_source_output *o;
     void *state = NULL;
 
+    s->thread_info.pushes++;
+
+    /* Many outputs often want the same format from us, so every
+     * conversion is only done once, by the resampler they share */
+    while ((o = pa_hashmap_iterate(s->thread_info.outputs, &state, NULL))) {
+        pa_source_output_assert_ref(o);
+
+        if (o->thread_info.direct_on_input)
+            continue;
+
+        if (!pa_source_output_can_share_conversion(o, chunk)) {
+            pa_source_output_push(o, chunk);
+            continue;
+        }
+
+        s->thread_info.conversions++;
+
+        for (i = 0; i < n_conversions; i++)
+            if (conversions[i].resampler == o->thread_info.shared_resampler)
+                break;
+
+        if (i < n_conversions) {
+            pa_source_output_push_converted(o, chunk, &conversions[i].rchunk);
+            s->thread_info.shared_conversions++;
+
+        } else if (n_conversions < MAX_SHARED_CONVERSIONS) {
+            conversions[n_conversions].resampler = o->thread_info.shared_resampler;
+            run_shared_resampler(s, conversions[n_conversions].resampler, chunk, &conversions[n_conversions].rchunk);
+            pa_source_output_push_converted(o, chunk, &conversions[n_conversions].rchunk);
+            n_conversions++;
+
+        } else
+            pa_source_output_push(o, chunk);
+    }
+
+    for (i = 0; i < n_conversions; i++)
+        if (conversions[i].rchunk.memblock)
+            pa_memblock_unref(conversions[i].rchunk.memblock);
+}
+
+/* Called from IO thread context */
+void pa_source_post(pa_source*s, const pa_memchunk *chunk) {
+
     pa_source_assert_ref(s);
     pa_source_assert_io_context(s);
     pa_assert(PA_SOURCE_IS_LINKED(s->thread_info.state));
@@ -893,23 +973,11 @@ void pa_source_post(pa_source*s, const pa_memchunk *chunk) {
         else
             pa_volume_memchunk(&vchunk, &s->sample_spec, &s->thread_info.soft_volume);
 
-        while ((o = pa_hashmap_iterate(s->thread_info.outputs, &state, NULL))) {
-            pa_source_output_assert_ref(o);
-
-            if (!o->thread_info.direct_on_input)
-                pa_source_output_push(o, &vchunk);
-        }
+        push_to_outputs(s, &vchunk);
 
         pa_memblock_unref(vchunk.memblock);
-    } else {
-
-        while ((o = pa_hashmap_iterate(s->thread_info.outputs, &state, NULL))) {
-            pa_source_output_assert_ref(o);
-
-            if (!o->thread_info.direct_on_input)
-                pa_source_output_push(o, chunk);
-        }
-    }
+    } else
+        push_to_outputs(s, chunk);
 }
 
 /* Called from IO thread context */
@@ -2117,6 +2185,15 @@ int pa_source_process_msg(pa_msgobject *object, int code, void *userdata, int64_
             return 0;
         }
 
+        case PA_SOURCE_MESSAGE_GET_CONVERSION_STATS: {
+            uint64_t *r = userdata;
+
+            r[0] = s->thread_info.conversions;
+            r[1] = s->thread_info.shared_conversions;
+
+            return 0;
+        }
+
         case PA_SOURCE_MESSAGE_GET_FIXED_LATENCY:
 
             *((pa_usec_t*) userdata) = s->thread_info.fixed_latency;
@@ -2403,6 +2480,73 @@ void pa_source_get_latency_range(pa_source *s, pa_usec_t *min_latency, pa_usec_t
     }
 }
 
+/* Called from main thread */
+void pa_source_get_conversion_stats(pa_source *s, uint64_t *conversions, uint64_t *shared) {
+    pa_source_assert_ref(s);
+    pa_assert_ctl_context();
+    pa_assert(conversions);
+    pa_assert(shared);
+
+    if (PA_SOURCE_IS_LINKED(s->state)) {
+        uint64_t r[2] = { 0, 0 };
+
+        pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SOURCE_MESSAGE_GET_CONVERSION_STATS, r, 0, NULL) == 0);
+
+        *conversions = r[0];
+        *shared = r[1];
+    } else {
+        *conversions = s->thread_info.conversions;
+        *shared = s->thread_info.shared_conversions;
+    }
+}
+
+/* Called from main context */
+pa_source_shared_resampler* pa_source_get_shared_resampler(pa_source *s, pa_resampler *like) {
+    pa_source_shared_resampler *r;
+
+    pa_source_assert_ref(s);
+    pa_assert_ctl_context();
+    pa_assert(like);
+
+    PA_LLIST_FOREACH(r, s->shared_resamplers)
+        if (pa_resampler_same_conversion(r->resampler, like)) {
+            r->refcnt++;
+            return r;
+        }
+
+    r = pa_xnew0(pa_source_shared_resampler, 1);
+    r->source = s;
+    r->refcnt = 1;
+
+    if (!(r->resampler = pa_resampler_new(
+                  s->core->mempool,
+                  pa_resampler_input_sample_spec(like), pa_resampler_input_channel_map(like),
+                  pa_resampler_output_sample_spec(like), pa_resampler_output_channel_map(like),
+                  pa_resampler_get_method(like),
+                  pa_resampler_get_flags(like)))) {
+        pa_xfree(r);
+        return NULL;
+    }
+
+    PA_LLIST_PREPEND(pa_source_shared_resampler, s->shared_resamplers, r);
+
+    return r;
+}
+
+/* Called from main context */
+void pa_source_shared_resampler_unref(pa_source_shared_resampler *r) {
+    pa_assert(r);
+    pa_assert_ctl_context();
+    pa_assert(r->refcnt >= 1);
+
+    if (--r->refcnt > 0)
+        return;
+
+    PA_LLIST_REMOVE(pa_source_shared_resampler, r->source->shared_resamplers, r);
+    pa_resampler_free(r->resampler);
+    pa_xfree(r);
+}
+
 /* Called from IO thread, and from main thread before pa_source_put() is called */
 void pa_source_set_latency_range_within_thread(pa_source *s, pa_usec_t min_latency, pa_usec_t max_latency) {
     pa_source_assert_ref(s);
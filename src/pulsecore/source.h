@@ -25,6 +25,7 @@
 
 typedef struct pa_source pa_source;
 typedef struct pa_source_volume_change pa_source_volume_change;
+typedef struct pa_source_shared_resampler pa_source_shared_resampler;
 
 #include <inttypes.h>
 
@@ -82,6 +83,10 @@ struct pa_source {
 
     pa_idxset *outputs;
     unsigned n_corked;
+
+    /* Resamplers for the conversions outputs can share, one for each
+     * conversion that an output uses */
+    PA_LLIST_HEAD(pa_source_shared_resampler, shared_resamplers);
     pa_sink *monitor_of;                     /* may be NULL */
     pa_source_output *output_from_master;    /* non-NULL only for filter sources */
 
@@ -223,6 +228,16 @@ struct pa_source {
         uint32_t volume_change_safety_margin;
         /* Usec delay added to all volume change events, may be negative. */
         int32_t volume_change_extra_delay;
+
+        /* How many times pa_source_post() resampled for outputs that
+         * could share their conversion, and how many of those it got
+         * away with handing out a chunk that was converted already */
+        uint64_t conversions;
+        uint64_t shared_conversions;
+
+        /* Counts the chunks pushed to the outputs, and is bumped on
+         * rewinds, so shared resamplers can tell they missed data */
+        uint64_t pushes;
 } thread_info;
 
     void *userdata;
@@ -254,6 +269,7 @@ typedef enum pa_source_message {
     PA_SOURCE_MESSAGE_SET_MAX_REWIND,
     PA_SOURCE_MESSAGE_SET_PORT,
     PA_SOURCE_MESSAGE_UPDATE_VOLUME_AND_MUTE,
+    PA_SOURCE_MESSAGE_GET_CONVERSION_STATS,
     PA_SOURCE_MESSAGE_MAX
 } pa_source_message_t;
 
@@ -340,6 +356,13 @@ pa_usec_t pa_source_get_latency(pa_source *s);
 pa_usec_t pa_source_get_requested_latency(pa_source *s);
 void pa_source_get_latency_range(pa_source *s, pa_usec_t *min_latency, pa_usec_t *max_latency);
 pa_usec_t pa_source_get_fixed_latency(pa_source *s);
+void pa_source_get_conversion_stats(pa_source *s, uint64_t *conversions, uint64_t *shared);
+
+/* Outputs that share their conversion run it through a resampler the
+ * source owns, there is one for each conversion as long as an output
+ * holds a reference to it. like is the output's own resampler. */
+pa_source_shared_resampler* pa_source_get_shared_resampler(pa_source *s, pa_resampler *like);
+void pa_source_shared_resampler_unref(pa_source_shared_resampler *r);
 
 size_t pa_source_get_max_rewind(pa_source *s);
 
@@ -0,0 +1,146 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulsecore/macro.h>
+
+#include "time-histogram.h"
+
+/* Largest value we keep track of in max, about 35 minutes */
+#define MAX_USEC ((int64_t) 0x7FFFFFFF)
+
+static unsigned bucket_of(pa_usec_t usec) {
+    unsigned n = 0;
+
+    while (usec > 0 && n < PA_TIME_HISTOGRAM_BUCKETS - 1) {
+        usec >>= 1;
+        n++;
+    }
+
+    return n;
+}
+
+static pa_usec_t bucket_begin(unsigned n) {
+    return n == 0 ? 0 : (pa_usec_t) 1 << (n - 1);
+}
+
+void pa_time_histogram_reset(pa_time_histogram *h) {
+    unsigned n;
+
+    pa_assert(h);
+
+    for (n = 0; n < PA_TIME_HISTOGRAM_BUCKETS; n++)
+        pa_atomic_store(&h->buckets[n], 0);
+
+    pa_atomic_store(&h->n_negative, 0);
+    pa_atomic_store(&h->max, 0);
+}
+
+void pa_time_histogram_add(pa_time_histogram *h, int64_t usec) {
+    int m;
+
+    pa_assert(h);
+
+    if (usec < 0) {
+        pa_atomic_inc(&h->n_negative);
+        pa_atomic_inc(&h->buckets[0]);
+        return;
+    }
+
+    pa_atomic_inc(&h->buckets[bucket_of((pa_usec_t) usec)]);
+
+    usec = PA_MIN(usec, MAX_USEC);
+
+    do {
+        m = pa_atomic_load(&h->max);
+
+        if (usec <= m)
+            break;
+
+    } while (!pa_atomic_cmpxchg(&h->max, m, (int) usec));
+}
+
+unsigned pa_time_histogram_count(const pa_time_histogram *h) {
+    unsigned n, count = 0;
+
+    pa_assert(h);
+
+    for (n = 0; n < PA_TIME_HISTOGRAM_BUCKETS; n++)
+        count += (unsigned) pa_atomic_load(&h->buckets[n]);
+
+    return count;
+}
+
+unsigned pa_time_histogram_negative(const pa_time_histogram *h) {
+    pa_assert(h);
+
+    return (unsigned) pa_atomic_load(&h->n_negative);
+}
+
+pa_usec_t pa_time_histogram_max(const pa_time_histogram *h) {
+    pa_assert(h);
+
+    return (pa_usec_t) pa_atomic_load(&h->max);
+}
+
+pa_usec_t pa_time_histogram_percentile(const pa_time_histogram *h, double fraction) {
+    unsigned counts[PA_TIME_HISTOGRAM_BUCKETS];
+    unsigned n, total = 0, seen = 0;
+    double rank;
+    pa_usec_t max;
+
+    pa_assert(h);
+    pa_assert(fraction >= 0 && fraction <= 1);
+
+    /* Take a copy first, the counters might change under our feet */
+    for (n = 0; n < PA_TIME_HISTOGRAM_BUCKETS; n++)
+        total += (counts[n] = (unsigned) pa_atomic_load(&h->buckets[n]));
+
+    if (total <= 0)
+        return 0;
+
+    max = pa_time_histogram_max(h);
+    rank = fraction * total;
+
+    for (n = 0; n < PA_TIME_HISTOGRAM_BUCKETS; n++) {
+        pa_usec_t begin, end, r;
+
+        if (counts[n] <= 0)
+            continue;
+
+        if (seen + counts[n] < rank) {
+            seen += counts[n];
+            continue;
+        }
+
+        begin = bucket_begin(n);
+        end = n < PA_TIME_HISTOGRAM_BUCKETS - 1 ? bucket_begin(n + 1) : max;
+        end = PA_MIN(end, max);
+        end = PA_MAX(end, begin);
+
+        r = begin + (pa_usec_t) ((double) (end - begin) * (rank - seen) / counts[n]);
+
+        return PA_MIN(r, max);
+    }
+
+    return max;
+}
@@ -0,0 +1,57 @@
+#ifndef foopulsetimehistogramhfoo
+#define foopulsetimehistogramhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+
+#include <pulse/sample.h>
+#include <pulsecore/atomic.h>
+
+/* A histogram of durations in usec. Bucket 0 counts everything below
+ * 1 us, bucket n everything in [2^(n-1), 2^n) us, the last bucket
+ * everything beyond. Negative durations, i.e. deadlines already
+ * missed, are counted separately.
+ *
+ * All counters are atomic, so that an IO thread may add to a histogram
+ * while the main thread reads or resets it. */
+
+#define PA_TIME_HISTOGRAM_BUCKETS 32
+
+typedef struct pa_time_histogram {
+    pa_atomic_t buckets[PA_TIME_HISTOGRAM_BUCKETS];
+    pa_atomic_t n_negative;
+    pa_atomic_t max;
+} pa_time_histogram;
+
+void pa_time_histogram_reset(pa_time_histogram *h);
+void pa_time_histogram_add(pa_time_histogram *h, int64_t usec);
+
+/* Includes the negative ones */
+unsigned pa_time_histogram_count(const pa_time_histogram *h);
+unsigned pa_time_histogram_negative(const pa_time_histogram *h);
+pa_usec_t pa_time_histogram_max(const pa_time_histogram *h);
+
+/* The duration below which the given fraction (0..1) of the samples
+ * lies, interpolated linearly within the bucket it falls into. Negative
+ * samples count as 0. */
+pa_usec_t pa_time_histogram_percentile(const pa_time_histogram *h, double fraction);
+
+#endif
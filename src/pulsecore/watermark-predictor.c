@@ -0,0 +1,221 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+
+#include <pulse/xmalloc.h>
+#include <pulse/timeval.h>
+
+#include <pulsecore/macro.h>
+
+#include "watermark-predictor.h"
+
+/* Values below 16 us get a bucket each, everything above eight
+ * buckets per power of two, up to 2^32 us */
+#define LINEAR_BUCKETS 16
+#define SUB_BUCKETS 8
+#define N_BUCKETS (LINEAR_BUCKETS + (32 - 4) * SUB_BUCKETS)
+#define MAX_USEC ((pa_usec_t) 0xFFFFFFFFU)
+
+/* Don't lower the watermark before we have this many samples, and
+ * enough that the percentile is more than the largest one */
+#define MIN_SAMPLES 32U
+
+/* Lower the watermark at most this often */
+#define DECREASE_INTERVAL_USEC (1*PA_USEC_PER_SEC)
+
+/* And not at all for this long after a dropout */
+#define DROPOUT_HOLD_USEC (20*PA_USEC_PER_SEC)
+
+struct pa_watermark_predictor {
+    double fraction;
+    pa_usec_t min_margin;
+
+    /* The last window samples, as bucket indexes */
+    uint8_t *samples;
+    unsigned window, n_samples, next;
+    unsigned min_samples;
+
+    unsigned buckets[N_BUCKETS];
+
+    pa_usec_t decrease_not_before;
+};
+
+static unsigned bucket_of(pa_usec_t usec) {
+    unsigned e = 0;
+
+    if (usec < LINEAR_BUCKETS)
+        return (unsigned) usec;
+
+    usec = PA_MIN(usec, MAX_USEC);
+
+    while ((usec >> e) >= 2 * SUB_BUCKETS)
+        e++;
+
+    /* usec >> e is now in [SUB_BUCKETS, 2*SUB_BUCKETS) */
+    return LINEAR_BUCKETS + (e - 1) * SUB_BUCKETS + (unsigned) (usec >> e) - SUB_BUCKETS;
+}
+
+/* The largest value that still falls into bucket n */
+static pa_usec_t bucket_end(unsigned n) {
+    unsigned e;
+
+    if (n < LINEAR_BUCKETS)
+        return n;
+
+    n -= LINEAR_BUCKETS;
+    e = n / SUB_BUCKETS + 1;
+
+    return ((pa_usec_t) (SUB_BUCKETS + n % SUB_BUCKETS + 1) << e) - 1;
+}
+
+pa_watermark_predictor *pa_watermark_predictor_new(unsigned window, double fraction, pa_usec_t min_margin) {
+    pa_watermark_predictor *p;
+
+    pa_assert(window > 0);
+    pa_assert(fraction > 0 && fraction <= 1);
+
+    pa_assert_cc(N_BUCKETS <= 256);
+
+    p = pa_xnew0(pa_watermark_predictor, 1);
+    p->window = window;
+    p->fraction = fraction;
+    p->min_margin = min_margin;
+    p->samples = pa_xnew(uint8_t, window);
+
+    p->min_samples = fraction < 1 ? (unsigned) ceil(1 / (1 - fraction)) : window;
+    p->min_samples = PA_CLAMP(p->min_samples, PA_MIN(MIN_SAMPLES, window), window);
+
+    return p;
+}
+
+void pa_watermark_predictor_free(pa_watermark_predictor *p) {
+    pa_assert(p);
+
+    pa_xfree(p->samples);
+    pa_xfree(p);
+}
+
+void pa_watermark_predictor_add(pa_watermark_predictor *p, int64_t usec) {
+    unsigned b;
+
+    pa_assert(p);
+
+    b = bucket_of(usec > 0 ? (pa_usec_t) usec : 0);
+
+    /* Forget the oldest one if the window is full */
+    if (p->n_samples >= p->window)
+        p->buckets[p->samples[p->next]]--;
+    else
+        p->n_samples++;
+
+    p->samples[p->next] = (uint8_t) b;
+    p->buckets[b]++;
+
+    p->next = (p->next + 1) % p->window;
+}
+
+void pa_watermark_predictor_dropout(pa_watermark_predictor *p, pa_usec_t now) {
+    pa_assert(p);
+
+    p->decrease_not_before = now + DROPOUT_HOLD_USEC;
+}
+
+unsigned pa_watermark_predictor_count(pa_watermark_predictor *p) {
+    pa_assert(p);
+
+    return p->n_samples;
+}
+
+pa_usec_t pa_watermark_predictor_percentile(pa_watermark_predictor *p, double fraction) {
+    unsigned n, needed, sum = 0;
+
+    pa_assert(p);
+    pa_assert(fraction >= 0 && fraction <= 1);
+
+    if (p->n_samples <= 0)
+        return 0;
+
+    needed = (unsigned) ceil(fraction * p->n_samples);
+    needed = PA_CLAMP(needed, 1U, p->n_samples);
+
+    for (n = 0; n < N_BUCKETS; n++) {
+        sum += p->buckets[n];
+
+        if (sum >= needed)
+            return bucket_end(n);
+    }
+
+    pa_assert_not_reached();
+}
+
+pa_usec_t pa_watermark_predictor_update(pa_watermark_predictor *p, pa_usec_t now, pa_usec_t current) {
+    pa_usec_t target;
+
+    pa_assert(p);
+
+    if (p->n_samples <= 0)
+        return current;
+
+    target = pa_watermark_predictor_percentile(p, p->fraction);
+    target += PA_MAX(p->min_margin, target / 4);
+
+    if (target >= current)
+        return target;
+
+    /* Before lowering it make sure we have seen enough to tell what
+     * the percentile is */
+    if (p->n_samples < p->min_samples)
+        return current;
+
+    if (now < p->decrease_not_before)
+        return current;
+
+    p->decrease_not_before = now + DECREASE_INTERVAL_USEC;
+
+    return target;
+}
+
+size_t pa_watermark_increase(size_t watermark, size_t step) {
+    return PA_MIN(watermark * 2, watermark + step);
+}
+
+size_t pa_watermark_decrease(size_t watermark, size_t step, pa_usec_t *not_before, pa_usec_t now) {
+    pa_assert(not_before);
+
+    if (*not_before <= 0)
+        goto restart;
+
+    if (*not_before > now)
+        return watermark;
+
+    if (watermark < step)
+        watermark = watermark / 2;
+    else
+        watermark = PA_MAX(watermark / 2, watermark - step);
+
+restart:
+    *not_before = now + PA_WATERMARK_VERIFY_AFTER_USEC;
+
+    return watermark;
+}
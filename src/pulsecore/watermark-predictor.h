@@ -0,0 +1,99 @@
+#ifndef foopulsewatermarkpredictorhfoo
+#define foopulsewatermarkpredictorhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+#include <sys/types.h>
+
+#include <pulse/sample.h>
+#include <pulse/timeval.h>
+
+/* Sizes the wakeup watermark of a timer scheduled device from what
+ * the last wakeups actually needed, instead of reacting to dropouts
+ * only.
+ *
+ * Each sample is the time that passed between the point the timer was
+ * programmed for and the point the buffer was dealt with, i.e. how
+ * late we were woken up plus how long the refill took. The watermark
+ * suggested is a high percentile of the last samples plus a safety
+ * margin. Increases take effect immediately, decreases at most once a
+ * second and not at all for a while after a dropout.
+ *
+ * Not thread safe, meant to be owned by a single IO thread. Has no
+ * dependency on the device, so that the same policy can be run over
+ * recorded samples offline. */
+
+typedef struct pa_watermark_predictor pa_watermark_predictor;
+
+/* The reactive policy used without a predictor: whenever the buffer
+ * ran lower than PA_WATERMARK_INC_THRESHOLD_USEC raise the watermark
+ * by PA_WATERMARK_INC_STEP_USEC, and once it didn't run lower than
+ * PA_WATERMARK_DEC_THRESHOLD_USEC for PA_WATERMARK_VERIFY_AFTER_USEC
+ * lower it by PA_WATERMARK_DEC_STEP_USEC. An increase threshold of 0
+ * means only real underruns resp. overruns count. */
+#define PA_WATERMARK_INC_STEP_USEC (10*PA_USEC_PER_MSEC)
+#define PA_WATERMARK_DEC_STEP_USEC (5*PA_USEC_PER_MSEC)
+#define PA_WATERMARK_VERIFY_AFTER_USEC (20*PA_USEC_PER_SEC)
+#define PA_WATERMARK_INC_THRESHOLD_USEC (0*PA_USEC_PER_MSEC)
+#define PA_WATERMARK_DEC_THRESHOLD_USEC (100*PA_USEC_PER_MSEC)
+
+/* The predictor the timer scheduled ALSA devices use with
+ * predictive_watermark=: the last 16384 wakeups, 99.99% of them, plus
+ * 25% but at least 1ms */
+#define PA_WATERMARK_PREDICT_WINDOW 16384
+#define PA_WATERMARK_PREDICT_FRACTION 0.9999
+#define PA_WATERMARK_PREDICT_MARGIN_USEC (1*PA_USEC_PER_MSEC)
+
+/* The watermark after a dropout, at most twice the old one. Works in
+ * whatever unit the caller keeps the watermark and step in. */
+size_t pa_watermark_increase(size_t watermark, size_t step);
+
+/* The watermark after the buffer didn't run low at time now, at least
+ * half the old one. *not_before shall be reset to 0 whenever the buffer
+ * does run low, the watermark is only lowered once
+ * PA_WATERMARK_VERIFY_AFTER_USEC have passed since then, and then once
+ * every PA_WATERMARK_VERIFY_AFTER_USEC. */
+size_t pa_watermark_decrease(size_t watermark, size_t step, pa_usec_t *not_before, pa_usec_t now);
+
+/* window is the number of samples to look at, fraction (0..1) the
+ * share of them the watermark shall cover, min_margin what to add on
+ * top at least. */
+pa_watermark_predictor *pa_watermark_predictor_new(unsigned window, double fraction, pa_usec_t min_margin);
+void pa_watermark_predictor_free(pa_watermark_predictor *p);
+
+/* Negative samples count as 0 */
+void pa_watermark_predictor_add(pa_watermark_predictor *p, int64_t usec);
+
+/* We hit an underrun resp. overrun at time now, hold the watermark
+ * for a while */
+void pa_watermark_predictor_dropout(pa_watermark_predictor *p, pa_usec_t now);
+
+unsigned pa_watermark_predictor_count(pa_watermark_predictor *p);
+
+/* The sample below which the given fraction of the window lies,
+ * rounded up to the bucket it falls into, i.e. by less than 1/8 */
+pa_usec_t pa_watermark_predictor_percentile(pa_watermark_predictor *p, double fraction);
+
+/* The watermark to use from now on, given the current one. Returns
+ * current as long as there are too few samples to tell. */
+pa_usec_t pa_watermark_predictor_update(pa_watermark_predictor *p, pa_usec_t now, pa_usec_t current);
+
+#endif
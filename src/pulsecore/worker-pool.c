@@ -0,0 +1,205 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/semaphore.h>
+#include <pulsecore/thread.h>
+
+#include "worker-pool.h"
+
+#define GENERATION_MASK 0x7fffU
+
+struct pa_worker_pool {
+    pa_thread **threads;
+    unsigned n_threads;
+    int rtprio;
+
+    pa_semaphore *work, *done;
+    pa_atomic_t quit;
+
+    /* The generation of the current run in the upper 16 bits, the next
+     * job to hand out in the lower ones. Taking a job is a cmpxchg on
+     * this, so a worker that wakes up late can never take a job of a
+     * run that was set up after it had looked. */
+    pa_atomic_t claim;
+    pa_atomic_t left;
+    unsigned generation;
+
+    unsigned n_jobs;
+    pa_worker_pool_job_cb_t cb;
+    void *userdata;
+
+    pa_usec_t deadline;
+    pa_atomic_t n_late;
+};
+
+/* Called from the calling thread and the workers, after a job */
+static void check_deadline(pa_worker_pool *p) {
+    if (p->deadline > 0 && pa_rtclock_now() > p->deadline)
+        pa_atomic_inc(&p->n_late);
+}
+
+/* Called from the calling thread and the workers. Returns TRUE if this
+ * thread finished the last job of the run. */
+static pa_bool_t run_jobs(pa_worker_pool *p) {
+    pa_bool_t last = FALSE;
+
+    for (;;) {
+        int v;
+        unsigned job;
+
+        v = pa_atomic_load(&p->claim);
+        job = (unsigned) v & PA_WORKER_POOL_JOBS_MAX;
+
+        if (job >= p->n_jobs)
+            break;
+
+        if (!pa_atomic_cmpxchg(&p->claim, v, v + 1))
+            continue;
+
+        p->cb(job, p->userdata);
+        check_deadline(p);
+
+        if (pa_atomic_dec(&p->left) == 1)
+            last = TRUE;
+    }
+
+    return last;
+}
+
+static void thread_func(void *userdata) {
+    pa_worker_pool *p = userdata;
+
+    if (p->rtprio > 0)
+        pa_make_realtime(p->rtprio);
+
+    for (;;) {
+        pa_semaphore_wait(p->work);
+
+        if (pa_atomic_load(&p->quit))
+            break;
+
+        if (run_jobs(p))
+            pa_semaphore_post(p->done);
+    }
+}
+
+pa_worker_pool* pa_worker_pool_new(const char *name, unsigned n_threads, int rtprio) {
+    pa_worker_pool *p;
+    unsigned i;
+
+    pa_assert(name);
+
+    p = pa_xnew0(pa_worker_pool, 1);
+    p->rtprio = rtprio;
+    p->work = pa_semaphore_new(0);
+    p->done = pa_semaphore_new(0);
+    p->threads = pa_xnew0(pa_thread*, n_threads);
+
+    for (i = 0; i < n_threads; i++) {
+        if (!(p->threads[i] = pa_thread_new(name, thread_func, p))) {
+            pa_log("Failed to create worker thread.");
+            pa_worker_pool_free(p);
+            return NULL;
+        }
+
+        p->n_threads++;
+    }
+
+    return p;
+}
+
+void pa_worker_pool_free(pa_worker_pool *p) {
+    unsigned i;
+
+    pa_assert(p);
+
+    pa_atomic_store(&p->quit, 1);
+
+    for (i = 0; i < p->n_threads; i++)
+        pa_semaphore_post(p->work);
+
+    for (i = 0; i < p->n_threads; i++)
+        pa_thread_free(p->threads[i]);
+
+    pa_semaphore_free(p->work);
+    pa_semaphore_free(p->done);
+    pa_xfree(p->threads);
+    pa_xfree(p);
+}
+
+unsigned pa_worker_pool_run(pa_worker_pool *p, unsigned n_jobs, pa_worker_pool_job_cb_t cb, void *userdata, pa_usec_t deadline) {
+    unsigned i;
+
+    pa_assert(p);
+    pa_assert(cb);
+    pa_assert(n_jobs <= PA_WORKER_POOL_JOBS_MAX);
+
+    p->deadline = deadline;
+    pa_atomic_store(&p->n_late, 0);
+
+    if (n_jobs <= 1 || p->n_threads == 0) {
+        for (i = 0; i < n_jobs; i++) {
+            cb(i, userdata);
+            check_deadline(p);
+        }
+
+        return (unsigned) pa_atomic_load(&p->n_late);
+    }
+
+    /* Close the new generation before touching anything a worker looks
+     * at, so that nobody can take a job while we set up the run */
+    p->generation = (p->generation + 1) & GENERATION_MASK;
+    pa_atomic_store(&p->claim, (int) ((p->generation << 16) | PA_WORKER_POOL_JOBS_MAX));
+
+    p->n_jobs = n_jobs;
+    p->cb = cb;
+    p->userdata = userdata;
+    pa_atomic_store(&p->left, (int) n_jobs);
+
+    /* Opening it starts the run */
+    pa_atomic_store(&p->claim, (int) (p->generation << 16));
+
+    /* We take jobs ourselves, so one worker less is enough */
+    for (i = 0; i < PA_MIN(p->n_threads, n_jobs - 1); i++)
+        pa_semaphore_post(p->work);
+
+    /* Whatever nobody has started yet we run here, so we only ever
+     * wait for jobs that are already running */
+    if (!run_jobs(p))
+        pa_semaphore_wait(p->done);
+
+    return (unsigned) pa_atomic_load(&p->n_late);
+}
+
+unsigned pa_worker_pool_get_n_threads(pa_worker_pool *p) {
+    pa_assert(p);
+
+    return p->n_threads;
+}
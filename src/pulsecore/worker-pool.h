@@ -0,0 +1,56 @@
+#ifndef foopulseworkerpoolhfoo
+#define foopulseworkerpoolhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* A small set of threads that help an I/O thread with independent
+ * pieces of work within one render cycle. pa_worker_pool_run() hands out
+ * the jobs and returns when all of them are done. The calling thread
+ * takes jobs itself, so it never waits for a worker that hasn't been
+ * scheduled yet, only for jobs that are already running. */
+
+#include <pulse/sample.h>
+
+#include <pulsecore/macro.h>
+
+#define PA_WORKER_POOL_JOBS_MAX 0xffffU
+
+typedef struct pa_worker_pool pa_worker_pool;
+
+typedef void (*pa_worker_pool_job_cb_t)(unsigned job, void *userdata);
+
+/* If rtprio is > 0 the workers are made realtime with that priority,
+ * like the I/O threads they help */
+pa_worker_pool* pa_worker_pool_new(const char *name, unsigned n_threads, int rtprio);
+void pa_worker_pool_free(pa_worker_pool *p);
+
+/* Calls cb for each job from 0 to n_jobs-1, in parallel. Must not be
+ * called from more than one thread at the same time.
+ *
+ * If deadline is not 0 it is the pa_rtclock_now() time all jobs should
+ * be done by. A job that is running can't be abandoned, as it may be
+ * writing into whatever the caller is about to use, so the run still
+ * waits for all of them. Returns how many of them finished after the
+ * deadline, so that the caller can tell that it is falling behind. */
+unsigned pa_worker_pool_run(pa_worker_pool *p, unsigned n_jobs, pa_worker_pool_job_cb_t cb, void *userdata, pa_usec_t deadline);
+
+unsigned pa_worker_pool_get_n_threads(pa_worker_pool *p);
+
+#endif
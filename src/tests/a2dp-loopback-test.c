@@ -0,0 +1,671 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* Runs the A2DP paths of module-bluetooth-device without a headset.
+ * The module is loaded with fake_transport= pointing at a local
+ * SEQPACKET socket (which keeps packet boundaries just like L2CAP
+ * does), and a fake headset thread on the other end of it
+ * depacketizes and decodes what the sink sends, resp. encodes and
+ * packetizes what the source shall receive. Thus everything from
+ * a2dp_process_render(), a2dp_process_push(), a2dp_reduce_bitpool()
+ * and the timing of thread_func() is the real thing.
+ *
+ * For playback over links of different capacity the RTP interarrival
+ * jitter (RFC 3550) seen by the headset and how the bitpool adapts when
+ * the link can't keep up are reported, for both directions the CPU time
+ * per second of audio spent outside of the fake headset. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <ltdl.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/rtclock.h>
+#include <pulse/sample.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/module.h>
+#include <pulsecore/namereg.h>
+#include <pulsecore/sink-input.h>
+#include <pulsecore/source-output.h>
+#include <pulsecore/sample-util.h>
+#include <pulsecore/atomic.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "sbc.h"
+#include "rtp.h"
+
+/* What the module uses for its fake transport */
+#define LINK_MTU 895
+#define MAX_BITPOOL 53
+
+#define CHECK_USEC (2*PA_USEC_PER_SEC)
+#define BENCHMARK_USEC (5*PA_USEC_PER_SEC)
+#define DRAIN_USEC (200*PA_USEC_PER_MSEC)
+
+#define SINK_NAME "a2dp_loopback_test.sink"
+#define SOURCE_NAME "a2dp_loopback_test.source"
+
+static const pa_sample_spec ss = {
+    .format = PA_SAMPLE_S16LE,
+    .rate = 44100,
+    .channels = 2
+};
+
+struct headset {
+    int listen_fd;
+    pa_bool_t capture;
+    size_t link_rate;                    /* Bytes per second the link can carry, 0 for no limit */
+    pa_usec_t length;                    /* How much audio to send when capturing */
+
+    pa_atomic_t done;
+    pa_usec_t cpu;
+
+    sbc_t sbc;
+
+    /* Playback */
+    unsigned n_packets, n_lost, n_bad;
+    uint16_t next_seq_num;
+    uint32_t next_timestamp;
+    uint64_t n_decoded, n_skipped;
+    uint8_t first_bitpool;
+    unsigned n_bitpool_changes;
+    int16_t peak;
+    pa_usec_t last_arrival, last_rtp_time;
+    double jitter, max_transit_diff;
+
+    /* Capture */
+    uint64_t n_encoded;
+};
+
+/* Only touched from the IO thread of the module while it is loaded */
+struct stream {
+    pa_memchunk sine;
+    size_t peek_index;
+
+    uint64_t n_received;
+    int16_t peak;
+};
+
+static pa_mainloop *mainloop;
+static pa_core *core;
+static char *dir, *socket_path;
+
+static pa_usec_t cpu_time(clockid_t clock) {
+    struct timespec ts;
+
+    pa_assert_se(clock_gettime(clock, &ts) == 0);
+
+    return (pa_usec_t) ts.tv_sec * PA_USEC_PER_SEC + (pa_usec_t) ts.tv_nsec / PA_NSEC_PER_USEC;
+}
+
+static int16_t peak_of(const int16_t *d, size_t n, int16_t peak) {
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        if (d[i] > peak)
+            peak = d[i];
+
+    return peak;
+}
+
+static void headset_receive_packet(struct headset *h, const uint8_t *buffer, ssize_t r, int16_t *decoded, size_t decoded_size) {
+    const struct rtp_header *header;
+    const uint8_t *p;
+    size_t to_decode;
+    uint32_t timestamp;
+    pa_usec_t arrival, rtp_time;
+
+    header = (const struct rtp_header*) buffer;
+
+    pa_assert_se(r > (ssize_t) (sizeof(struct rtp_header) + sizeof(struct rtp_payload)));
+
+    arrival = pa_rtclock_now();
+    timestamp = ntohl(header->timestamp);
+    rtp_time = (pa_usec_t) timestamp * PA_USEC_PER_SEC / ss.rate;
+
+    if (h->n_packets > 0) {
+        double transit_diff;
+
+        if (ntohs(header->sequence_number) != h->next_seq_num)
+            h->n_lost++;
+
+        /* The module skips ahead if it falls behind, but never goes
+         * back */
+        if (timestamp < h->next_timestamp)
+            h->n_bad++;
+        else
+            h->n_skipped += timestamp - h->next_timestamp;
+
+        /* RFC 3550, 6.4.1 */
+        transit_diff = ((double) arrival - (double) h->last_arrival) - ((double) rtp_time - (double) h->last_rtp_time);
+        if (transit_diff < 0)
+            transit_diff = -transit_diff;
+
+        h->jitter += (transit_diff - h->jitter) / 16.0;
+        h->max_transit_diff = PA_MAX(h->max_transit_diff, transit_diff);
+    }
+
+    h->last_arrival = arrival;
+    h->last_rtp_time = rtp_time;
+    h->next_seq_num = (uint16_t) (ntohs(header->sequence_number) + 1);
+    h->next_timestamp = timestamp;
+
+    p = buffer + sizeof(struct rtp_header) + sizeof(struct rtp_payload);
+    to_decode = (size_t) r - sizeof(struct rtp_header) - sizeof(struct rtp_payload);
+
+    while (to_decode > 0) {
+        size_t written;
+        ssize_t consumed;
+
+        consumed = sbc_decode(&h->sbc, p, to_decode, decoded, decoded_size, &written);
+
+        pa_assert_se(consumed > 0);
+        pa_assert_se((size_t) consumed <= to_decode);
+
+        p += consumed;
+        to_decode -= (size_t) consumed;
+
+        h->peak = peak_of(decoded, written / sizeof(int16_t), h->peak);
+        h->n_decoded += written / pa_frame_size(&ss);
+        h->next_timestamp += (uint32_t) (written / pa_frame_size(&ss));
+    }
+
+    h->n_packets++;
+}
+
+/* Takes packets off the link no faster than its capacity, until the
+ * module hangs up */
+static void headset_playback(struct headset *h, int fd) {
+    uint8_t *buffer;
+    int16_t *decoded;
+    size_t decoded_size;
+    uint8_t bitpool = 0;
+    pa_usec_t busy_until = 0;
+    int type = 0;
+
+    buffer = pa_xmalloc(2 * LINK_MTU);
+
+    /* An RTP payload carries at most 15 frames */
+    decoded_size = 15 * 512;
+    decoded = pa_xmalloc(decoded_size);
+
+    for (;;) {
+        ssize_t r;
+        pa_usec_t now;
+
+        if ((r = pa_read(fd, buffer, 2 * LINK_MTU, &type)) < 0 && errno == EINTR)
+            continue;
+
+        if (r <= 0)
+            break;
+
+        headset_receive_packet(h, buffer, r, decoded, decoded_size);
+
+        if (bitpool != h->sbc.bitpool) {
+            if (bitpool == 0)
+                h->first_bitpool = h->sbc.bitpool;
+            else {
+                h->n_bitpool_changes++;
+                pa_log_debug("Bitpool has changed to %u after %llu ms", h->sbc.bitpool,
+                             (unsigned long long) ((uint64_t) h->next_timestamp * PA_MSEC_PER_SEC / ss.rate));
+            }
+
+            bitpool = h->sbc.bitpool;
+        }
+
+        if (h->link_rate <= 0)
+            continue;
+
+        now = pa_rtclock_now();
+        busy_until = PA_MAX(busy_until, now) + (pa_usec_t) r * PA_USEC_PER_SEC / h->link_rate;
+
+        if (busy_until > now + PA_USEC_PER_MSEC)
+            usleep((useconds_t) (busy_until - now));
+    }
+
+    pa_xfree(buffer);
+    pa_xfree(decoded);
+}
+
+/* Sends a sine in real time, in packets of the full MTU like a real
+ * headset does */
+static void headset_capture(struct headset *h, int fd) {
+    struct rtp_header *header;
+    struct rtp_payload *payload;
+    uint8_t *buffer;
+    int16_t *pcm;
+    size_t codesize, frame_length, pcm_size, i;
+    unsigned frames_per_packet;
+    uint64_t pcm_index = 0;
+    uint16_t seq_num = 0;
+    pa_usec_t started_at;
+    int type = 0;
+
+    h->sbc.bitpool = MAX_BITPOOL;
+    codesize = sbc_get_codesize(&h->sbc);
+    frame_length = sbc_get_frame_length(&h->sbc);
+    frames_per_packet = (unsigned) ((LINK_MTU - sizeof(*header) - sizeof(*payload)) / frame_length);
+
+    /* Whole SBC frames only, so that a frame never wraps around */
+    pcm_size = pa_bytes_per_second(&ss) / codesize * codesize;
+    pcm = pa_xmalloc(pcm_size);
+    for (i = 0; i < pcm_size / sizeof(int16_t); i++)
+        pcm[i] = (int16_t) (sin(2 * M_PI * 440 * (double) (i / 2) / ss.rate) * 0x3fff);
+
+    buffer = pa_xmalloc(LINK_MTU);
+    header = (struct rtp_header*) buffer;
+    payload = (struct rtp_payload*) (buffer + sizeof(*header));
+
+    started_at = pa_rtclock_now();
+
+    while (pa_bytes_to_usec(pcm_index, &ss) < h->length) {
+        uint8_t *d;
+        size_t to_write;
+        unsigned frame_count;
+        pa_usec_t audio_sent, time_passed;
+        ssize_t w;
+
+        audio_sent = pa_bytes_to_usec(pcm_index, &ss);
+        time_passed = pa_rtclock_now() - started_at;
+
+        if (audio_sent > time_passed) {
+            usleep((useconds_t) (audio_sent - time_passed));
+            continue;
+        }
+
+        d = buffer + sizeof(*header) + sizeof(*payload);
+        to_write = LINK_MTU - sizeof(*header) - sizeof(*payload);
+
+        memset(buffer, 0, sizeof(*header) + sizeof(*payload));
+        header->v = 2;
+        header->pt = 1;
+        header->sequence_number = htons(seq_num++);
+        header->timestamp = htonl((uint32_t) (pcm_index / pa_frame_size(&ss)));
+        header->ssrc = htonl(1);
+
+        for (frame_count = 0; frame_count < frames_per_packet; frame_count++) {
+            ssize_t written, encoded;
+
+            encoded = sbc_encode(&h->sbc,
+                                 (uint8_t*) pcm + pcm_index % pcm_size, codesize,
+                                 d, to_write,
+                                 &written);
+
+            pa_assert_se(encoded == (ssize_t) codesize);
+            pa_assert_se(written == (ssize_t) frame_length);
+
+            d += written;
+            to_write -= (size_t) written;
+            pcm_index += codesize;
+        }
+
+        payload->frame_count = frame_count;
+
+        if ((w = pa_write(fd, buffer, (size_t) (d - buffer), &type)) < 0 && errno == EINTR)
+            continue;
+
+        pa_assert_se(w == d - buffer);
+    }
+
+    h->n_encoded = pcm_index;
+
+    pa_xfree(buffer);
+    pa_xfree(pcm);
+}
+
+static void headset_thread(void *userdata) {
+    struct headset *h = userdata;
+    int fd, type = 0;
+    pa_usec_t cpu;
+
+    pa_assert_se((fd = accept(h->listen_fd, NULL, NULL)) >= 0);
+
+    cpu = cpu_time(CLOCK_THREAD_CPUTIME_ID);
+
+    if (h->capture) {
+        uint8_t c;
+
+        headset_capture(h, fd);
+        h->cpu = cpu_time(CLOCK_THREAD_CPUTIME_ID) - cpu;
+        pa_atomic_store(&h->done, 1);
+
+        /* The module never sends anything on a capture transport, wait
+         * until it hangs up */
+        while (pa_read(fd, &c, 1, &type) < 0 && errno == EINTR)
+            ;
+    } else {
+        headset_playback(h, fd);
+        h->cpu = cpu_time(CLOCK_THREAD_CPUTIME_ID) - cpu;
+        pa_atomic_store(&h->done, 1);
+    }
+
+    pa_close(fd);
+}
+
+static void headset_init(struct headset *h, pa_bool_t capture, size_t link_rate, pa_usec_t length) {
+    struct sockaddr_un sa;
+
+    memset(h, 0, sizeof(*h));
+    h->capture = capture;
+    h->link_rate = link_rate;
+    h->length = length;
+
+    pa_assert_se(sbc_init(&h->sbc, 0) == 0);
+    h->sbc.frequency = SBC_FREQ_44100;
+    h->sbc.blocks = SBC_BLK_16;
+    h->sbc.subbands = SBC_SB_8;
+    h->sbc.mode = SBC_MODE_JOINT_STEREO;
+    h->sbc.allocation = SBC_AM_LOUDNESS;
+    h->sbc.endian = SBC_LE;
+
+    pa_assert_se((h->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) >= 0);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    pa_strlcpy(sa.sun_path, socket_path, sizeof(sa.sun_path));
+
+    unlink(socket_path);
+    pa_assert_se(bind(h->listen_fd, (struct sockaddr*) &sa, sizeof(sa)) == 0);
+    pa_assert_se(listen(h->listen_fd, 1) == 0);
+}
+
+static void headset_done(struct headset *h) {
+    pa_close(h->listen_fd);
+    unlink(socket_path);
+    sbc_finish(&h->sbc);
+}
+
+static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
+    struct stream *s = i->userdata;
+
+    *chunk = s->sine;
+    pa_memblock_ref(chunk->memblock);
+
+    chunk->index += s->peek_index;
+    chunk->length -= s->peek_index;
+
+    s->peek_index = 0;
+
+    return 0;
+}
+
+static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
+    struct stream *s = i->userdata;
+
+    nbytes %= s->sine.length;
+
+    if (s->peek_index >= nbytes)
+        s->peek_index -= nbytes;
+    else
+        s->peek_index = s->sine.length + s->peek_index - nbytes;
+}
+
+static void sink_input_kill_cb(pa_sink_input *i) {
+    pa_sink_input_unlink(i);
+    pa_sink_input_unref(i);
+}
+
+static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk) {
+    struct stream *s = o->userdata;
+    const int16_t *d;
+
+    d = (const int16_t*) ((const uint8_t*) pa_memblock_acquire(chunk->memblock) + chunk->index);
+    s->peak = peak_of(d, chunk->length / sizeof(int16_t), s->peak);
+    pa_memblock_release(chunk->memblock);
+
+    s->n_received += chunk->length;
+}
+
+static void source_output_kill_cb(pa_source_output *o) {
+    pa_source_output_unlink(o);
+    pa_source_output_unref(o);
+}
+
+static void wakeup_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    pa_core_rttime_restart(core, e, pa_rtclock_now() + 10*PA_USEC_PER_MSEC);
+}
+
+/* Dispatches what the IO thread of the module sends us, for the given
+ * time or until the headset is done */
+static void run_mainloop(pa_usec_t usec, struct headset *h) {
+    pa_time_event *e;
+    pa_usec_t until;
+
+    until = pa_rtclock_now() + usec;
+    e = pa_core_rttime_new(core, pa_rtclock_now() + 10*PA_USEC_PER_MSEC, wakeup_cb, NULL);
+
+    while (pa_rtclock_now() < until && !(h && pa_atomic_load(&h->done)))
+        pa_assert_se(pa_mainloop_iterate(mainloop, 1, NULL) >= 0);
+
+    core->mainloop->time_free(e);
+}
+
+static pa_module *load_module(const char *profile) {
+    pa_module *m;
+    char *args;
+
+    args = pa_sprintf_malloc("fake_transport=%s profile=%s sink_name=" SINK_NAME " source_name=" SOURCE_NAME,
+                             socket_path, profile);
+    pa_assert_se(m = pa_module_load(core, "module-bluetooth-device", args));
+    pa_xfree(args);
+
+    return m;
+}
+
+static void print_cpu(struct headset *h, pa_usec_t cpu, pa_usec_t length) {
+    printf("  %6.1f us cpu per second of audio\n",
+           (double) (cpu - PA_MIN(cpu, h->cpu)) * PA_USEC_PER_SEC / (double) PA_MAX(length, 1U));
+}
+
+/* Let the module render a sine in real time like thread_func() does
+ * when there is no source to synchronize to */
+static void run_playback(size_t link_rate, pa_usec_t length) {
+    struct headset h;
+    struct stream s;
+    pa_module *m;
+    pa_sink *sink;
+    pa_sink_input *i = NULL;
+    pa_sink_input_new_data data;
+    pa_sample_spec sine_ss;
+    pa_thread *thread;
+    pa_usec_t cpu;
+
+    headset_init(&h, FALSE, link_rate, length);
+    memset(&s, 0, sizeof(s));
+
+    m = load_module("a2dp");
+    pa_assert_se(sink = pa_namereg_get(core, SINK_NAME, PA_NAMEREG_SINK));
+
+    pa_memchunk_sine(&s.sine, core->mempool, sink->sample_spec.rate, 440);
+    sine_ss.format = PA_SAMPLE_FLOAT32;
+    sine_ss.rate = sink->sample_spec.rate;
+    sine_ss.channels = 1;
+
+    pa_sink_input_new_data_init(&data);
+    data.driver = __FILE__;
+    pa_sink_input_new_data_set_sink(&data, sink, FALSE);
+    pa_sink_input_new_data_set_sample_spec(&data, &sine_ss);
+    pa_sink_input_new(&i, core, &data);
+    pa_sink_input_new_data_done(&data);
+    pa_assert_se(i);
+
+    i->pop = sink_input_pop_cb;
+    i->process_rewind = sink_input_process_rewind_cb;
+    i->kill = sink_input_kill_cb;
+    i->userdata = &s;
+
+    cpu = cpu_time(CLOCK_PROCESS_CPUTIME_ID);
+
+    pa_assert_se(thread = pa_thread_new("fake-headset", headset_thread, &h));
+    pa_sink_input_put(i);
+
+    run_mainloop(length, NULL);
+
+    /* Hang up so that the headset sees EOF */
+    pa_module_unload(core, m, TRUE);
+    pa_thread_free(thread);
+
+    cpu = cpu_time(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+
+    if (link_rate > 0)
+        printf("playback  link %6lu bytes/s", (unsigned long) link_rate);
+    else
+        printf("playback  link  unlimited     ");
+
+    printf("  bitpool %2u -> %2u (%u changes)  skipped %6.1f ms  %5u packets  %3u lost  jitter %6.1f us (max %8.1f us)",
+           h.first_bitpool, h.sbc.bitpool, h.n_bitpool_changes,
+           (double) h.n_skipped * PA_MSEC_PER_SEC / ss.rate,
+           h.n_packets, h.n_lost, h.jitter, h.max_transit_diff);
+    print_cpu(&h, cpu, (pa_usec_t) h.n_decoded * PA_USEC_PER_SEC / ss.rate);
+
+    /* The module starts out with the best quality and only ever lowers
+     * it, and whatever the link capacity nothing gets lost on the way */
+    pa_assert_se(h.n_packets > 0);
+    pa_assert_se(h.first_bitpool == MAX_BITPOOL);
+    pa_assert_se(h.n_lost == 0);
+    pa_assert_se(h.n_bad == 0);
+
+    /* And it is actually our sine */
+    pa_assert_se(h.peak > 0x1000);
+
+    pa_memblock_unref(s.sine.memblock);
+    headset_done(&h);
+}
+
+/* Let the headset send a sine in real time and the module decode it */
+static void run_capture(pa_usec_t length) {
+    struct headset h;
+    struct stream s;
+    pa_module *m;
+    pa_source *source;
+    pa_source_output *o = NULL;
+    pa_source_output_new_data data;
+    pa_thread *thread;
+    pa_usec_t cpu;
+
+    headset_init(&h, TRUE, 0, length);
+    memset(&s, 0, sizeof(s));
+
+    m = load_module("a2dp_source");
+    pa_assert_se(source = pa_namereg_get(core, SOURCE_NAME, PA_NAMEREG_SOURCE));
+
+    pa_source_output_new_data_init(&data);
+    data.driver = __FILE__;
+    pa_source_output_new_data_set_source(&data, source, FALSE);
+    pa_source_output_new_data_set_sample_spec(&data, &source->sample_spec);
+    pa_source_output_new_data_set_channel_map(&data, &source->channel_map);
+    pa_source_output_new(&o, core, &data);
+    pa_source_output_new_data_done(&data);
+    pa_assert_se(o);
+
+    o->push = source_output_push_cb;
+    o->kill = source_output_kill_cb;
+    o->userdata = &s;
+
+    pa_source_output_put(o);
+
+    cpu = cpu_time(CLOCK_PROCESS_CPUTIME_ID);
+
+    /* The headset only starts sending once we listen */
+    pa_assert_se(thread = pa_thread_new("fake-headset", headset_thread, &h));
+
+    run_mainloop(length + PA_USEC_PER_SEC, &h);
+    pa_assert_se(pa_atomic_load(&h.done));
+
+    /* Let the module catch up with what is still in the socket */
+    run_mainloop(DRAIN_USEC, NULL);
+
+    pa_module_unload(core, m, TRUE);
+    pa_thread_free(thread);
+
+    cpu = cpu_time(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+
+    printf("capture   %8llu bytes sent  %8llu bytes received",
+           (unsigned long long) h.n_encoded, (unsigned long long) s.n_received);
+    print_cpu(&h, cpu, pa_bytes_to_usec(s.n_received, &ss));
+
+    /* Everything the headset sent made it through */
+    pa_assert_se(h.n_encoded > 0);
+    pa_assert_se(s.n_received == h.n_encoded);
+    pa_assert_se(s.peak > 0x1000);
+
+    headset_done(&h);
+}
+
+int main(int argc, char *argv[]) {
+    pa_usec_t length = CHECK_USEC;
+
+    if (!getenv("MAKE_CHECK")) {
+        pa_log_set_level(PA_LOG_DEBUG);
+        length = BENCHMARK_USEC;
+    }
+
+    pa_assert_se(lt_dlinit() == 0);
+    lt_dlsetsearchpath(PA_BUILDDIR "/.libs/");
+
+    pa_assert_se(dir = pa_xstrdup("/tmp/a2dp-loopback-test-XXXXXX"));
+    pa_assert_se(mkdtemp(dir));
+    socket_path = pa_sprintf_malloc("%s/transport", dir);
+
+    pa_assert_se(mainloop = pa_mainloop_new());
+    pa_assert_se(core = pa_core_new(pa_mainloop_get_api(mainloop), PA_SHM_PRIVATE, 0, FALSE, 0));
+
+    if (getenv("MAKE_CHECK"))
+        run_playback(0, length);
+    else {
+        /* Plenty of room, then less than what bitpool 53 needs */
+        run_playback(0, length);
+        run_playback(40000, length);
+        run_playback(30000, length);
+    }
+
+    run_capture(length);
+
+    pa_core_unref(core);
+    pa_mainloop_free(mainloop);
+
+    rmdir(dir);
+    pa_xfree(socket_path);
+    pa_xfree(dir);
+
+    lt_dlexit();
+
+    return 0;
+}
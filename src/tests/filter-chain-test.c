@@ -0,0 +1,519 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* Plays a test pattern through real sinks and records what the master
+ * sink, a module-null-sink, plays from its monitor source.
+ *
+ * First through a stack of module-virtual-sink filter sinks, then
+ * through the same number of module-virtual-sink stage=yes processing
+ * stages (see pa_sink_filter) on the master. Both have to play the
+ * pattern unchanged. Reported are the CPU time per second of audio and
+ * the memory pinned by the mempool and the stage history.
+ *
+ * Then through biquad stages on the master while the sink is made to
+ * rewind over and over. What it plays has to be what the biquads make of
+ * the pattern in one go, i.e. the stages have to end up with the state
+ * they had at every rewind point. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <ltdl.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/rtclock.h>
+#include <pulse/sample.h>
+#include <pulse/timeval.h>
+#include <pulse/volume.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/module.h>
+#include <pulsecore/namereg.h>
+#include <pulsecore/sink.h>
+#include <pulsecore/sink-input.h>
+#include <pulsecore/source-output.h>
+#include <pulsecore/sample-util.h>
+#include <pulsecore/sconv.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#define N_STAGES 3
+#define LATENCY_USEC (20*PA_USEC_PER_MSEC)
+#define REWIND_EVERY_USEC (50*PA_USEC_PER_MSEC)
+#define CHECK_USEC (2*PA_USEC_PER_SEC)
+#define BENCHMARK_USEC (20*PA_USEC_PER_SEC)
+
+#define MASTER_NAME "filter_chain_test.master"
+
+enum mode {
+    MODE_STACKED,
+    MODE_STAGES,
+    MODE_REWIND
+};
+
+static const pa_sample_spec ss = {
+    .format = PA_SAMPLE_S16NE,
+    .rate = 48000,
+    .channels = 2
+};
+
+/* A biquad per channel, about what a parametric EQ band or a simple
+ * LADSPA plugin costs */
+struct stage {
+    float b0, b1, b2, a1, a2;
+    float z1[2], z2[2];
+};
+
+/* Only touched from the IO thread of the master while linked */
+struct capture {
+    int16_t *data;
+    size_t n, allocated;                  /* in samples */
+    unsigned n_rewinds;                   /* that took back some of the pattern */
+};
+
+static pa_mainloop *mainloop;
+static pa_core *core;
+
+static pa_usec_t cpu_time(void) {
+    struct timespec ts;
+
+    pa_assert_se(clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) == 0);
+
+    return (pa_usec_t) ts.tv_sec * PA_USEC_PER_SEC + (pa_usec_t) ts.tv_nsec / PA_NSEC_PER_USEC;
+}
+
+static void stage_init(struct stage *st, unsigned k) {
+    memset(st, 0, sizeof(*st));
+
+    st->b0 = 0.9f + 0.01f * (float) k;
+    st->b1 = -1.6f;
+    st->b2 = 0.7f;
+    st->a1 = -1.5f;
+    st->a2 = 0.6f;
+}
+
+static void stage_process(struct stage *st, float *data, unsigned n) {
+    unsigned i, c;
+
+    for (i = 0; i < n; i++)
+        for (c = 0; c < 2; c++) {
+            float x = *data, y;
+
+            y = st->b0 * x + st->z1[c];
+            st->z1[c] = st->b1 * x - st->a1 * y + st->z2[c];
+            st->z2[c] = st->b2 * x - st->a2 * y;
+
+            *(data++) = y;
+        }
+}
+
+static void filter_process_cb(pa_sink_filter *f, float *data, unsigned n) {
+    stage_process(f->userdata, data, n);
+}
+
+static void filter_reset_cb(pa_sink_filter *f) {
+    struct stage *st = f->userdata;
+
+    memset(st->z1, 0, sizeof(st->z1));
+    memset(st->z2, 0, sizeof(st->z2));
+}
+
+static void filter_kill_cb(pa_sink_filter *f) {
+    /* We take the stages off before the master goes away */
+    pa_assert_not_reached();
+}
+
+/* Never 0, so that the first sample played tells where it starts */
+static int16_t pattern(uint64_t i) {
+    return (int16_t) (((i * 331) & 0x3fff) + 0x1000);
+}
+
+/* What the stages make of the pattern in one go, the same way
+ * filters_process() in sink.c runs them */
+static int16_t *reference(size_t n, unsigned n_stages) {
+    int16_t *r;
+    float *f;
+    struct stage stages[N_STAGES];
+    size_t i;
+    unsigned k;
+
+    r = pa_xnew(int16_t, n);
+    f = pa_xnew(float, n);
+
+    for (i = 0; i < n; i++)
+        r[i] = pattern(i);
+
+    pa_get_convert_to_float32ne_function(ss.format)((unsigned) n, r, f);
+
+    for (k = 0; k < n_stages; k++) {
+        stage_init(&stages[k], k);
+        stage_process(&stages[k], f, (unsigned) (n / ss.channels));
+    }
+
+    pa_get_convert_from_float32ne_function(ss.format)((unsigned) n, f, r);
+
+    pa_xfree(f);
+
+    return r;
+}
+
+static int pattern_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
+    uint64_t *index = i->userdata;
+    int16_t *d;
+    size_t k, n;
+
+    nbytes = PA_MIN(nbytes, pa_mempool_block_size_max(core->mempool));
+    nbytes = pa_frame_align(nbytes, &ss);
+
+    if (nbytes <= 0)
+        nbytes = pa_frame_align(pa_mempool_block_size_max(core->mempool), &ss);
+
+    chunk->memblock = pa_memblock_new(core->mempool, nbytes);
+    chunk->index = 0;
+    chunk->length = nbytes;
+
+    n = nbytes / sizeof(int16_t);
+    d = pa_memblock_acquire(chunk->memblock);
+
+    for (k = 0; k < n; k++)
+        d[k] = pattern(*index + k);
+
+    pa_memblock_release(chunk->memblock);
+
+    *index += n;
+
+    return 0;
+}
+
+static void pattern_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
+    uint64_t *index = i->userdata;
+
+    *index -= PA_MIN(*index, nbytes / sizeof(int16_t));
+}
+
+static int silence_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
+    pa_silence_memchunk_get(&core->silence_cache, core->mempool, chunk, &ss, pa_frame_align(nbytes, &ss));
+
+    return 0;
+}
+
+static void silence_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
+}
+
+static void sink_input_kill_cb(pa_sink_input *i) {
+    pa_assert_not_reached();
+}
+
+static pa_sink_input *input_new(pa_sink *sink,
+                                int (*pop)(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk),
+                                void (*process_rewind)(pa_sink_input *i, size_t nbytes),
+                                void *userdata) {
+    pa_sink_input *i = NULL;
+    pa_sink_input_new_data data;
+
+    pa_sink_input_new_data_init(&data);
+    data.driver = __FILE__;
+    pa_sink_input_new_data_set_sink(&data, sink, FALSE);
+    pa_sink_input_new_data_set_sample_spec(&data, &ss);
+    pa_sink_input_new(&i, core, &data);
+    pa_sink_input_new_data_done(&data);
+    pa_assert_se(i);
+
+    i->pop = pop;
+    i->process_rewind = process_rewind;
+    i->kill = sink_input_kill_cb;
+    i->userdata = userdata;
+
+    pa_sink_input_put(i);
+    pa_sink_input_set_requested_latency(i, LATENCY_USEC);
+
+    return i;
+}
+
+static void input_free(pa_sink_input *i) {
+    pa_sink_input_unlink(i);
+    pa_sink_input_unref(i);
+}
+
+static void capture_push_cb(pa_source_output *o, const pa_memchunk *chunk) {
+    struct capture *c = o->userdata;
+    size_t n;
+
+    n = chunk->length / sizeof(int16_t);
+
+    if (c->n + n > c->allocated) {
+        c->allocated = PA_MAX(c->allocated * 2, c->n + n);
+        c->data = pa_xrenew(int16_t, c->data, c->allocated);
+    }
+
+    memcpy(c->data + c->n, (uint8_t*) pa_memblock_acquire(chunk->memblock) + chunk->index, chunk->length);
+    pa_memblock_release(chunk->memblock);
+
+    c->n += n;
+}
+
+/* The master plays what it rewinds again, so we forget about it */
+static void capture_process_rewind_cb(pa_source_output *o, size_t nbytes) {
+    struct capture *c = o->userdata;
+
+    if (c->n > 0 && c->data[c->n - 1] != 0)
+        c->n_rewinds++;
+
+    c->n -= PA_MIN(c->n, nbytes / sizeof(int16_t));
+}
+
+static void capture_kill_cb(pa_source_output *o) {
+    pa_assert_not_reached();
+}
+
+static pa_source_output *capture_new(pa_sink *master, struct capture *c) {
+    pa_source_output *o = NULL;
+    pa_source_output_new_data data;
+
+    pa_source_output_new_data_init(&data);
+    data.driver = __FILE__;
+    pa_source_output_new_data_set_source(&data, master->monitor_source, FALSE);
+    pa_source_output_new_data_set_sample_spec(&data, &ss);
+    pa_source_output_new(&o, core, &data);
+    pa_source_output_new_data_done(&data);
+    pa_assert_se(o);
+
+    o->push = capture_push_cb;
+    o->process_rewind = capture_process_rewind_cb;
+    o->kill = capture_kill_cb;
+    o->userdata = c;
+
+    pa_source_output_put(o);
+
+    /* The monitor decides how far ahead the master renders, as long as
+     * nothing else asks for less */
+    pa_source_output_set_requested_latency(o, LATENCY_USEC);
+
+    return o;
+}
+
+static void wakeup_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    pa_core_rttime_restart(core, e, pa_rtclock_now() + 10*PA_USEC_PER_MSEC);
+}
+
+/* Dispatches what the IO thread of the master sends us */
+static void run_mainloop(pa_usec_t usec) {
+    pa_time_event *e;
+    pa_usec_t until;
+
+    until = pa_rtclock_now() + usec;
+    e = pa_core_rttime_new(core, pa_rtclock_now() + 10*PA_USEC_PER_MSEC, wakeup_cb, NULL);
+
+    while (pa_rtclock_now() < until)
+        pa_assert_se(pa_mainloop_iterate(mainloop, 1, NULL) >= 0);
+
+    core->mainloop->time_free(e);
+}
+
+static pa_module *load_module(const char *name, const char *args) {
+    pa_module *m;
+
+    pa_assert_se(m = pa_module_load(core, name, args));
+
+    return m;
+}
+
+/* Checks that what the master played, from the first sample of the
+ * pattern on, is what the stages make of the pattern, to within the
+ * given number of LSBs */
+static void check_capture(const struct capture *c, unsigned n_stages, int tolerance, pa_usec_t length) {
+    int16_t *r;
+    size_t start, n, i;
+
+    for (start = 0; start < c->n && c->data[start] == 0; start++)
+        ;
+
+    pa_assert_se(start % ss.channels == 0);
+
+    /* At least half of the time we played has to be the pattern */
+    n = c->n - start;
+    pa_assert_se(n >= pa_usec_to_bytes(length / 2, &ss) / sizeof(int16_t));
+
+    r = reference(n, n_stages);
+
+    for (i = 0; i < n; i++)
+        if (abs((int) c->data[start + i] - (int) r[i]) > tolerance) {
+            pa_log("Sample %lu is %i instead of %i", (unsigned long) i, c->data[start + i], r[i]);
+            pa_assert_not_reached();
+        }
+
+    pa_xfree(r);
+}
+
+static void run(enum mode mode, pa_usec_t length) {
+    static const char * const names[] = { "stacked", "stages", "rewind" };
+    pa_module *master_module, *modules[N_STAGES];
+    pa_sink *master, *top;
+    pa_sink_filter *filters[N_STAGES];
+    struct stage stages[N_STAGES];
+    pa_sink_input *input, *silence = NULL;
+    pa_source_output *o;
+    struct capture c;
+    uint64_t index = 0;
+    pa_usec_t cpu, until;
+    size_t pinned;
+    unsigned k;
+
+    memset(&c, 0, sizeof(c));
+    memset(modules, 0, sizeof(modules));
+    memset(filters, 0, sizeof(filters));
+
+    master_module = load_module("module-null-sink", "sink_name=" MASTER_NAME " format=s16ne rate=48000 channels=2");
+    pa_assert_se(master = pa_namereg_get(core, MASTER_NAME, PA_NAMEREG_SINK));
+
+    o = capture_new(master, &c);
+
+    top = master;
+
+    for (k = 0; k < N_STAGES; k++) {
+        char *name, *args;
+
+        name = pa_sprintf_malloc("filter_chain_test.%u", k);
+
+        switch (mode) {
+            case MODE_STACKED:
+                args = pa_sprintf_malloc("master=%s sink_name=%s", top->name, name);
+                modules[k] = load_module("module-virtual-sink", args);
+                pa_xfree(args);
+
+                pa_assert_se(top = pa_namereg_get(core, name, PA_NAMEREG_SINK));
+                break;
+
+            case MODE_STAGES:
+                args = pa_sprintf_malloc("master=%s sink_name=%s stage=yes", master->name, name);
+                modules[k] = load_module("module-virtual-sink", args);
+                pa_xfree(args);
+                break;
+
+            case MODE_REWIND:
+                stage_init(&stages[k], k);
+
+                filters[k] = pa_sink_filter_new(master, NULL, name);
+                filters[k]->process = filter_process_cb;
+                filters[k]->reset = filter_reset_cb;
+                filters[k]->kill = filter_kill_cb;
+                filters[k]->userdata = &stages[k];
+                pa_sink_filter_put(filters[k]);
+                break;
+        }
+
+        pa_xfree(name);
+    }
+
+    cpu = cpu_time();
+
+    input = input_new(top, pattern_pop_cb, pattern_process_rewind_cb, &index);
+
+    if (mode == MODE_REWIND) {
+        pa_cvolume v;
+        pa_bool_t half = FALSE;
+
+        /* Every volume change of an input rewinds the master, the
+         * silence keeps it from changing what we hear */
+        silence = input_new(master, silence_pop_cb, silence_process_rewind_cb, NULL);
+
+        for (until = pa_rtclock_now() + length; pa_rtclock_now() < until; half = !half) {
+            run_mainloop(REWIND_EVERY_USEC);
+
+            pa_cvolume_set(&v, ss.channels, half ? PA_VOLUME_NORM : PA_VOLUME_NORM / 2);
+            pa_sink_input_set_volume(silence, &v, FALSE, TRUE);
+        }
+    } else
+        run_mainloop(length);
+
+    cpu = cpu_time() - cpu;
+
+    pinned = (size_t) pa_atomic_load(&pa_mempool_get_stat(core->mempool)->allocated_size) +
+        master->thread_info.filter_history_size * ss.channels * sizeof(float);
+
+    /* Stop recording before the pattern stops */
+    pa_source_output_unlink(o);
+    pa_source_output_unref(o);
+
+    if (silence)
+        input_free(silence);
+
+    input_free(input);
+
+    for (k = N_STAGES; k > 0; k--) {
+        if (modules[k-1])
+            pa_module_unload(core, modules[k-1], TRUE);
+        if (filters[k-1])
+            pa_sink_filter_free(filters[k-1]);
+    }
+
+    pa_module_unload(core, master_module, TRUE);
+
+    printf("%-8s %u stages  %8.1f us cpu per second of audio  %8lu bytes pinned",
+           names[mode], N_STAGES, (double) cpu * PA_USEC_PER_SEC / (double) length, (unsigned long) pinned);
+
+    if (mode == MODE_REWIND)
+        printf("  %u rewinds", c.n_rewinds);
+
+    printf("\n");
+
+    if (mode == MODE_REWIND) {
+        /* The rewinds took back some of what we played with the stages
+         * being somewhere inside the pattern */
+        pa_assert_se(c.n_rewinds > 0);
+        check_capture(&c, N_STAGES, 1, length);
+    } else
+        check_capture(&c, 0, 0, length);
+
+    pa_xfree(c.data);
+}
+
+int main(int argc, char *argv[]) {
+    pa_usec_t length = CHECK_USEC;
+
+    if (!getenv("MAKE_CHECK")) {
+        pa_log_set_level(PA_LOG_DEBUG);
+        length = BENCHMARK_USEC;
+    }
+
+    pa_assert_se(lt_dlinit() == 0);
+    lt_dlsetsearchpath(PA_BUILDDIR "/.libs/");
+
+    pa_assert_se(mainloop = pa_mainloop_new());
+    pa_assert_se(core = pa_core_new(pa_mainloop_get_api(mainloop), PA_SHM_PRIVATE, 0, FALSE, 0));
+
+    run(MODE_STACKED, length);
+    run(MODE_STAGES, length);
+    run(MODE_REWIND, CHECK_USEC);
+
+    pa_core_unref(core);
+    pa_mainloop_free(mainloop);
+
+    lt_dlexit();
+
+    return 0;
+}
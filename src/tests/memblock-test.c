@@ -22,8 +22,17 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
+#if defined(HAVE_LINUX_MEMFD_H) && defined(HAVE_SYS_SYSCALL_H)
+#include <sys/syscall.h>
+#include <linux/memfd.h>
+#if defined(SYS_memfd_create) && defined(MFD_ALLOW_SEALING)
+#define HAVE_MEMFD 1
+#endif
+#endif
+
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/log.h>
@@ -66,6 +75,82 @@ static void print_stats(pa_mempool *p, const char *text) {
            (unsigned) pa_atomic_load(&s->n_pool_full));
 }
 
+#ifdef HAVE_MEMFD
+static void memfd_test(const char *txt, size_t length) {
+    pa_mempool *pool_a, *pool_b;
+    pa_memexport *export_a;
+    pa_memimport *import_b;
+    pa_memblock *mb_a, *mb_b;
+    uint32_t id, shm_id;
+    size_t offset, size;
+    int r, memfd, fd;
+    char *x;
+
+    pool_a = pa_mempool_new_full(PA_SHM_MEMFD, 0, FALSE, 0);
+    pool_b = pa_mempool_new(TRUE, 0);
+    pa_assert(pool_a && pool_b);
+
+    if (!pa_mempool_is_memfd_backed(pool_a)) {
+        pa_log("memfd not available, skipping memfd test.");
+        pa_mempool_free(pool_a);
+        pa_mempool_free(pool_b);
+        return;
+    }
+
+    export_a = pa_memexport_new(pool_a, revoke_cb, (void*) "A");
+    import_b = pa_memimport_new(pool_b, release_cb, (void*) "B");
+    pa_assert(export_a && import_b);
+
+    mb_a = pa_memblock_new_pool(pool_a, length);
+    pa_assert(mb_a);
+    x = pa_memblock_acquire(mb_a);
+    memcpy(x, txt, length);
+    pa_memblock_release(mb_a);
+
+    r = pa_memexport_put(export_a, mb_a, &id, &shm_id, &offset, &size, &memfd);
+    pa_assert(r >= 0);
+    pa_assert(memfd >= 0);
+    pa_assert(size == length);
+
+    pa_log("A: Memory block exported as %u of memfd segment %u", id, shm_id);
+
+    /* The block cannot be looked up before the segment is attached */
+    pa_assert(!pa_memimport_get(import_b, id, shm_id, offset, size, TRUE));
+
+    /* Passing the fd over the socket hands B a copy of its own */
+    pa_assert_se((fd = dup(memfd)) >= 0);
+    r = pa_memimport_attach_memfd(import_b, shm_id, fd);
+    pa_assert(r >= 0);
+
+    mb_b = pa_memimport_get(import_b, id, shm_id, offset, size, TRUE);
+    pa_assert(mb_b);
+    pa_assert(pa_memblock_get_length(mb_b) == length);
+    x = pa_memblock_acquire(mb_b);
+    pa_assert(memcmp(x, txt, length) == 0);
+    pa_memblock_release(mb_b);
+
+    /* A segment passed as memfd is not to be used as a named one */
+    pa_assert(!pa_memimport_get(import_b, id + 1, shm_id, offset, size, FALSE));
+
+    pa_memblock_unref(mb_b);
+
+    /* A memfd that isn't sealed against shrinking must be refused */
+    pa_assert_se((fd = (int) syscall(SYS_memfd_create, "memblock-test", MFD_CLOEXEC|MFD_ALLOW_SEALING)) >= 0);
+    pa_assert_se(ftruncate(fd, (off_t) PA_PAGE_SIZE) >= 0);
+
+    r = pa_memimport_attach_memfd(import_b, shm_id + 1, fd);
+    pa_assert(r < 0);
+    pa_assert(!pa_memimport_get(import_b, id, shm_id + 1, 0, length, TRUE));
+
+    pa_memimport_free(import_b);
+    pa_memblock_unref(mb_a);
+    pa_memexport_free(export_a);
+
+    pa_mempool_free(pool_a);
+    pa_mempool_free(pool_b);
+}
+#endif
+
 int main(int argc, char *argv[]) {
     pa_mempool *pool_a, *pool_b, *pool_c;
     unsigned id_a, id_b, id_c;
@@ -124,22 +209,22 @@ int main(int argc, char *argv[]) {
 
         pa_assert(import_b && import_c);
 
-        r = pa_memexport_put(export_a, mb_a, &id, &shm_id, &offset, &size);
+        r = pa_memexport_put(export_a, mb_a, &id, &shm_id, &offset, &size, NULL);
         pa_assert(r >= 0);
         pa_assert(shm_id == id_a);
 
         pa_log("A: Memory block exported as %u", id);
 
-        mb_b = pa_memimport_get(import_b, id, shm_id, offset, size);
+        mb_b = pa_memimport_get(import_b, id, shm_id, offset, size, FALSE);
         pa_assert(mb_b);
-        r = pa_memexport_put(export_b, mb_b, &id, &shm_id, &offset, &size);
+        r = pa_memexport_put(export_b, mb_b, &id, &shm_id, &offset, &size, NULL);
         pa_assert(r >= 0);
         pa_assert(shm_id == id_a || shm_id == id_b);
         pa_memblock_unref(mb_b);
 
         pa_log("B: Memory block exported as %u", id);
 
-        mb_c = pa_memimport_get(import_c, id, shm_id, offset, size);
+        mb_c = pa_memimport_get(import_c, id, shm_id, offset, size, FALSE);
         pa_assert(mb_c);
         x = pa_memblock_acquire(mb_c);
         pa_log_debug("1 data=%s", x);
@@ -163,6 +248,10 @@ int main(int argc, char *argv[]) {
         pa_memexport_free(export_a);
     }
 
+#ifdef HAVE_MEMFD
+    memfd_test(txt, sizeof(txt));
+#endif
+
     pa_log("vacuuming...");
 
     pa_mempool_vacuum(pool_a);
@@ -17,19 +17,54 @@
   USA.
 ***/
 
+/* Runs a fixed sequence of pushes, seeks and rewinds through a
+ * memblockq, once keeping references to the pushed blocks and once in
+ * ring mode, and checks that both read back the same. Then random
+ * operations are run against both modes side by side, and a stream of
+ * tiny pushes is checked to end up in few blocks with its data intact.
+ * Finally a ring mode queue is read by somebody who holds on to what
+ * was read, like a sink input does for rewinding, and must still come
+ * by with a few pool slots.
+ *
+ * Unless run from make check, push/peek/drop throughput is reported for
+ * both modes, with small and with large chunks pushed and read back in
+ * fixed size blocks. */
+
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <signal.h>
 
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
 #include <pulsecore/memblockq.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/strbuf.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
 
-static void dump_chunk(const pa_memchunk *chunk) {
+#define RANDOM_ROUNDS 20000
+#define RANDOM_MAXREWIND 8192
+#define COALESCE_PUSHES 4000
+#define COALESCE_SIZE 64
+#define REUSE_BYTES (16*1024*1024)
+#define REUSE_PUSH_SIZE 1920
+#define REUSE_HOLD 64
+#define BENCHMARK_BYTES (256*1024*1024)
+#define READ_SIZE 4096
+
+static const pa_sample_spec ss = {
+    .format = PA_SAMPLE_S16LE,
+    .rate = 48000,
+    .channels = 1
+};
+
+static void dump_chunk(pa_strbuf *buf, const pa_memchunk *chunk) {
     size_t n;
     void *q;
     char *e;
@@ -38,53 +73,49 @@ static void dump_chunk(const pa_memchunk *chunk) {
 
     q = pa_memblock_acquire(chunk->memblock);
     for (e = (char*) q + chunk->index, n = 0; n < chunk->length; n++, e++)
-        fprintf(stderr, "%c", *e);
+        pa_strbuf_printf(buf, "%c", *e);
     pa_memblock_release(chunk->memblock);
 }
 
-static void dump(pa_memblockq *bq) {
+static char *dump(pa_memblockq *bq) {
+    pa_strbuf *buf;
     pa_memchunk out;
 
     pa_assert(bq);
 
+    buf = pa_strbuf_new();
+
     /* First let's dump this as fixed block */
-    fprintf(stderr, "FIXED >");
+    pa_strbuf_puts(buf, "FIXED >");
     pa_memblockq_peek_fixed_size(bq, 64, &out);
-    dump_chunk(&out);
+    dump_chunk(buf, &out);
     pa_memblock_unref(out.memblock);
-    fprintf(stderr, "<\n");
+    pa_strbuf_puts(buf, "<\n");
 
     /* Then let's dump the queue manually */
-    fprintf(stderr, "MANUAL>");
+    pa_strbuf_puts(buf, "MANUAL>");
 
     for (;;) {
         if (pa_memblockq_peek(bq, &out) < 0)
             break;
 
-        dump_chunk(&out);
+        dump_chunk(buf, &out);
         pa_memblock_unref(out.memblock);
         pa_memblockq_drop(bq, out.length);
     }
 
-    fprintf(stderr, "<\n");
+    pa_strbuf_puts(buf, "<\n");
+
+    return pa_strbuf_tostring_free(buf);
 }
 
-int main(int argc, char *argv[]) {
+static char *run_sequence(pa_mempool *p, pa_bool_t ring) {
     int ret;
 
-    pa_mempool *p;
     pa_memblockq *bq;
     pa_memchunk chunk1, chunk2, chunk3, chunk4;
     pa_memchunk silence;
-    pa_sample_spec ss = {
-        .format = PA_SAMPLE_S16LE,
-        .rate = 48000,
-        .channels = 1
-    };
-
-    pa_log_set_level(PA_LOG_DEBUG);
-
-    p = pa_mempool_new(FALSE, 0);
+    char *a, *b, *result;
 
     pa_assert_se(silence.memblock = pa_memblock_new_fixed(p, (char*) "__", 2, 1));
     silence.index = 0;
@@ -92,6 +123,9 @@ int main(int argc, char *argv[]) {
 
     pa_assert_se(bq = pa_memblockq_new("test memblockq", 0, 200, 10, &ss, 4, 4, 40, &silence));
 
+    if (ring)
+        pa_memblockq_use_ring(bq, p);
+
     pa_assert_se(chunk1.memblock = pa_memblock_new_fixed(p, (char*) "11", 2, 1));
     chunk1.index = 0;
     chunk1.length = 2;
@@ -160,11 +194,15 @@ int main(int argc, char *argv[]) {
 
     pa_memblockq_seek(bq, 30, PA_SEEK_RELATIVE, TRUE);
 
-    dump(bq);
+    a = dump(bq);
 
     pa_memblockq_rewind(bq, 52);
 
-    dump(bq);
+    b = dump(bq);
+
+    result = pa_sprintf_malloc("%s%s", a, b);
+    pa_xfree(a);
+    pa_xfree(b);
 
     pa_memblockq_free(bq);
     pa_memblock_unref(silence.memblock);
@@ -173,6 +211,334 @@ int main(int argc, char *argv[]) {
     pa_memblock_unref(chunk3.memblock);
     pa_memblock_unref(chunk4.memblock);
 
+    return result;
+}
+
+static pa_memblock *make_block(pa_mempool *p, size_t length, unsigned seed) {
+    pa_memblock *b;
+    uint8_t *d;
+    size_t i;
+
+    b = pa_memblock_new(p, length);
+    d = pa_memblock_acquire(b);
+
+    for (i = 0; i < length; i++)
+        d[i] = (uint8_t) (seed + i * 7);
+
+    pa_memblock_release(b);
+
+    return b;
+}
+
+static pa_bool_t chunks_equal(const pa_memchunk *a, const pa_memchunk *b) {
+    pa_bool_t r;
+
+    if (a->length != b->length || !a->memblock != !b->memblock)
+        return FALSE;
+
+    if (!a->memblock)
+        return TRUE;
+
+    r = memcmp((uint8_t*) pa_memblock_acquire(a->memblock) + a->index,
+               (uint8_t*) pa_memblock_acquire(b->memblock) + b->index,
+               a->length) == 0;
+
+    pa_memblock_release(a->memblock);
+    pa_memblock_release(b->memblock);
+
+    return r;
+}
+
+/* Whatever happens to the queues, both have to hand out the same data,
+ * even though the ring one may cut it differently. Only rewinds into
+ * the history that is guaranteed to be kept are done, beyond that the
+ * two may keep different amounts. */
+static void random_test(pa_mempool *p) {
+    pa_memblockq *list, *ring;
+    size_t history = 0;
+    unsigned i;
+
+    pa_assert_se(list = pa_memblockq_new("list memblockq", 0, 64*1024, 16*1024, &ss, 2048, 512, RANDOM_MAXREWIND, NULL));
+    pa_assert_se(ring = pa_memblockq_new("ring memblockq", 0, 64*1024, 16*1024, &ss, 2048, 512, RANDOM_MAXREWIND, NULL));
+    pa_memblockq_use_ring(ring, p);
+
+    for (i = 0; i < RANDOM_ROUNDS; i++) {
+        pa_memchunk a, b;
+        size_t n = (size_t) (rand() % 2048 + 1) * 2;
+        int r;
+
+        switch (rand() % 8) {
+            case 0:
+            case 1:
+            case 2: {
+                pa_memchunk chunk;
+
+                chunk.memblock = make_block(p, n + 64, (unsigned) rand());
+                chunk.index = 32;
+                chunk.length = n;
+
+                r = pa_memblockq_push(list, &chunk);
+                pa_assert_se(pa_memblockq_push(ring, &chunk) == r);
+
+                pa_memblock_unref(chunk.memblock);
+                break;
+            }
+
+            case 3: {
+                int64_t offset = (int64_t) (rand() % 4096 - 2048) * 2;
+
+                pa_memblockq_seek(list, offset, PA_SEEK_RELATIVE, TRUE);
+                pa_memblockq_seek(ring, offset, PA_SEEK_RELATIVE, TRUE);
+                break;
+            }
+
+            case 4:
+                n = PA_MIN(n, history);
+                history -= n;
+
+                pa_memblockq_rewind(list, n);
+                pa_memblockq_rewind(ring, n);
+                break;
+
+            default:
+                r = pa_memblockq_peek(list, &a);
+                pa_assert_se(pa_memblockq_peek(ring, &b) == r);
+
+                if (r < 0)
+                    break;
+
+                /* Compare what both have in common, and drop it */
+                a.length = b.length = PA_MIN(a.length, b.length);
+                pa_assert_se(chunks_equal(&a, &b));
+
+                if (a.memblock) {
+                    pa_memblock_unref(a.memblock);
+                    pa_memblock_unref(b.memblock);
+                }
+
+                n = (size_t) pa_memblockq_get_read_index(list);
+                pa_memblockq_drop(list, a.length);
+                pa_memblockq_drop(ring, b.length);
+
+                n = (size_t) pa_memblockq_get_read_index(list) - n;
+                history = PA_MIN(history + n, RANDOM_MAXREWIND);
+                break;
+        }
+
+        pa_assert_se(pa_memblockq_get_read_index(list) == pa_memblockq_get_read_index(ring));
+        pa_assert_se(pa_memblockq_get_write_index(list) == pa_memblockq_get_write_index(ring));
+        pa_assert_se(pa_memblockq_get_length(list) == pa_memblockq_get_length(ring));
+    }
+
+    pa_memblockq_free(list);
+    pa_memblockq_free(ring);
+}
+
+/* A client writing in tiny pieces must not tie up a list item and a
+ * pool slot for every one of them */
+static void coalesce_test(pa_mempool *p) {
+    pa_memblockq *bq;
+    pa_memblockq_coalesce_stats stats;
+    unsigned i, allocated;
+    int64_t index = 0;
+
+    pa_assert_se(bq = pa_memblockq_new("coalesce memblockq", 0, 1024*1024, 512*1024, &ss, 0, 0, 0, NULL));
+
+    allocated = (unsigned) pa_atomic_load(&pa_mempool_get_stat(p)->n_allocated);
+
+    for (i = 0; i < COALESCE_PUSHES; i++) {
+        pa_memchunk chunk;
+
+        chunk.memblock = make_block(p, COALESCE_SIZE, i);
+        chunk.index = 0;
+        chunk.length = COALESCE_SIZE;
+
+        pa_assert_se(pa_memblockq_push(bq, &chunk) == 0);
+        pa_memblock_unref(chunk.memblock);
+
+        pa_assert_se(pa_memblockq_get_nblocks(bq) <= 64);
+    }
+
+    pa_assert_se((unsigned) pa_atomic_load(&pa_mempool_get_stat(p)->n_allocated) - allocated <= 64);
+
+    pa_memblockq_get_coalesce_stats(bq, &stats);
+    pa_assert_se(stats.appended + stats.compacted > stats.blocks);
+    pa_assert_se(stats.appended + stats.compacted <= COALESCE_PUSHES);
+
+    /* Read it all back in pieces that don't line up with the pushes */
+    while (index < COALESCE_PUSHES * COALESCE_SIZE) {
+        pa_memchunk chunk, expected;
+
+        pa_assert_se(pa_memblockq_peek(bq, &chunk) == 0);
+        chunk.length = PA_MIN(chunk.length, 100);
+
+        i = (unsigned) (index / COALESCE_SIZE);
+        expected.memblock = make_block(p, COALESCE_SIZE, i);
+        expected.index = (size_t) (index % COALESCE_SIZE);
+        expected.length = chunk.length = PA_MIN(chunk.length, COALESCE_SIZE - expected.index);
+
+        pa_assert_se(chunks_equal(&chunk, &expected));
+
+        pa_memblock_unref(expected.memblock);
+        pa_memblock_unref(chunk.memblock);
+
+        pa_memblockq_drop(bq, chunk.length);
+        index += (int64_t) chunk.length;
+    }
+
+    fprintf(stderr, "%u pushes: %llu appended, %llu compacted, into %llu blocks\n",
+            COALESCE_PUSHES,
+            (unsigned long long) stats.appended,
+            (unsigned long long) stats.compacted,
+            (unsigned long long) stats.blocks);
+
+    pa_memblockq_free(bq);
+}
+
+/* The reader keeps references to the last REUSE_HOLD chunks it read,
+ * about two pool slots worth */
+static void ring_reuse_test(pa_mempool *p) {
+    pa_memblockq *bq;
+    pa_memchunk data, held[REUSE_HOLD];
+    unsigned i, n_held = 0, allocated;
+    size_t pushed = 0;
+
+    pa_assert_se(bq = pa_memblockq_new("ring reuse memblockq", 0, 1024*1024, 512*1024, &ss, 0, 0, 0, NULL));
+    pa_memblockq_use_ring(bq, p);
+
+    data.memblock = make_block(p, REUSE_PUSH_SIZE, 0);
+    data.index = 0;
+    data.length = REUSE_PUSH_SIZE;
+
+    allocated = (unsigned) pa_atomic_load(&pa_mempool_get_stat(p)->n_accumulated);
+
+    while (pushed < REUSE_BYTES) {
+        pa_memchunk chunk;
+
+        pa_assert_se(pa_memblockq_push(bq, &data) == 0);
+        pushed += data.length;
+
+        pa_assert_se(pa_memblockq_peek(bq, &chunk) == 0);
+        pa_memblockq_drop(bq, chunk.length);
+
+        if (n_held >= REUSE_HOLD) {
+            pa_memblock_unref(held[0].memblock);
+            memmove(held, held + 1, --n_held * sizeof(pa_memchunk));
+        }
+
+        held[n_held++] = chunk;
+    }
+
+    fprintf(stderr, "%lu bytes through a ring: %u pool slots taken\n",
+            (unsigned long) pushed,
+            (unsigned) pa_atomic_load(&pa_mempool_get_stat(p)->n_accumulated) - allocated);
+
+    pa_assert_se((unsigned) pa_atomic_load(&pa_mempool_get_stat(p)->n_accumulated) - allocated <= 8);
+
+    for (i = 0; i < n_held; i++)
+        pa_memblock_unref(held[i].memblock);
+
+    pa_memblock_unref(data.memblock);
+    pa_memblockq_free(bq);
+}
+
+static void benchmark(pa_mempool *p, pa_bool_t ring, size_t push_size) {
+    pa_memblockq *bq;
+    pa_memchunk silence, chunk;
+    size_t pushed = 0, copied = 0;
+    unsigned max_blocks = 0;
+    pa_usec_t ts;
+
+    silence.memblock = make_block(p, READ_SIZE, 0);
+    silence.index = 0;
+    silence.length = READ_SIZE;
+
+    pa_assert_se(bq = pa_memblockq_new("benchmark memblockq", 0, 4*1024*1024, 256*1024, &ss, 0, 0, 0, &silence));
+    pa_memblock_unref(silence.memblock);
+
+    if (ring)
+        pa_memblockq_use_ring(bq, p);
+
+    chunk.memblock = make_block(p, push_size, 0);
+    chunk.index = 0;
+    chunk.length = push_size;
+
+    ts = pa_rtclock_now();
+
+    while (pushed < BENCHMARK_BYTES) {
+        pa_memchunk out;
+
+        /* Writes come in small pieces, the reader wants larger ones */
+        while (pa_memblockq_get_length(bq) < 64*1024) {
+            pa_assert_se(pa_memblockq_push(bq, &chunk) == 0);
+            pushed += push_size;
+        }
+
+        max_blocks = PA_MAX(max_blocks, pa_memblockq_get_nblocks(bq));
+
+        while (pa_memblockq_get_length(bq) >= READ_SIZE) {
+            pa_memchunk peeked;
+
+            pa_assert_se(pa_memblockq_peek(bq, &peeked) == 0);
+
+            if (peeked.length < READ_SIZE)
+                copied += READ_SIZE;
+
+            pa_memblock_unref(peeked.memblock);
+
+            pa_assert_se(pa_memblockq_peek_fixed_size(bq, READ_SIZE, &out) == 0);
+            pa_memblock_unref(out.memblock);
+            pa_memblockq_drop(bq, READ_SIZE);
+        }
+    }
+
+    ts = pa_rtclock_now() - ts;
+
+    printf("%-4s  %6lu byte pushes  %8.1f MB/s  %6.2f%% of reads copied together  %5u blocks queued at most\n",
+           ring ? "ring" : "list", (unsigned long) push_size,
+           (double) pushed / (double) ts,
+           100.0 * (double) copied / (double) pushed,
+           max_blocks);
+
+    pa_memblock_unref(chunk.memblock);
+    pa_memblockq_free(bq);
+}
+
+int main(int argc, char *argv[]) {
+    pa_mempool *p;
+    char *list, *ring;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    srand(4711);
+
+    p = pa_mempool_new(FALSE, 0);
+
+    list = run_sequence(p, FALSE);
+    ring = run_sequence(p, TRUE);
+
+    fprintf(stderr, "%s", list);
+    pa_assert_se(pa_streq(list, ring));
+
+    pa_xfree(list);
+    pa_xfree(ring);
+
+    random_test(p);
+    coalesce_test(p);
+    ring_reuse_test(p);
+
+    if (!getenv("MAKE_CHECK")) {
+        pa_log_set_level(PA_LOG_WARN);
+
+        benchmark(p, FALSE, 64);
+        benchmark(p, TRUE, 64);
+        benchmark(p, FALSE, 1920);
+        benchmark(p, TRUE, 1920);
+        benchmark(p, FALSE, 16384);
+        benchmark(p, TRUE, 16384);
+    }
+
     pa_mempool_free(p);
 
     return 0;
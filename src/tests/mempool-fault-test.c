@@ -0,0 +1,131 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* Creates private, POSIX shared and memfd shared memory pools with
+ * regular and huge pages,
+ * with and without their first N_SLOTS slots prefaulted, and fills
+ * N_SLOTS blocks allocated from each of them.
+ *
+ * Reported are the page faults this took, as counted by the kernel,
+ * and the slots the pool handed out untouched according to
+ * pa_mempool_stat. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <pulsecore/memblock.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/log.h>
+
+#define N_SLOTS 256
+
+static long minor_faults(void) {
+    struct rusage ru;
+
+    pa_assert_se(getrusage(RUSAGE_SELF, &ru) == 0);
+    return ru.ru_minflt;
+}
+
+static const char *type_to_string(pa_shm_type_t type) {
+    switch (type) {
+        case PA_SHM_PRIVATE:
+            return "private";
+        case PA_SHM_POSIX:
+            return "posix";
+        case PA_SHM_MEMFD:
+            return "memfd";
+    }
+
+    pa_assert_not_reached();
+}
+
+static void run(pa_shm_type_t type, pa_bool_t huge_pages, unsigned prefault_slots) {
+    pa_mempool *pool;
+    pa_memblock *blocks[N_SLOTS];
+    const pa_mempool_stat *stat;
+    long faults;
+    unsigned i;
+
+    if (!(pool = pa_mempool_new_full(type, 0, huge_pages, prefault_slots))) {
+        /* No SHM in this environment */
+        pa_assert_se(type != PA_SHM_PRIVATE);
+        return;
+    }
+
+    stat = pa_mempool_get_stat(pool);
+    pa_assert_se((unsigned) pa_atomic_load(&stat->n_prefaulted) == prefault_slots);
+
+    faults = minor_faults();
+
+    for (i = 0; i < N_SLOTS; i++) {
+        void *d;
+
+        pa_assert_se(blocks[i] = pa_memblock_new_pool(pool, (size_t) -1));
+
+        d = pa_memblock_acquire(blocks[i]);
+        memset(d, 0x55, pa_memblock_get_length(blocks[i]));
+        pa_memblock_release(blocks[i]);
+    }
+
+    faults = minor_faults() - faults;
+
+    printf("%-7s  %-7s  %3u prefaulted  %6ld page faults  %3u cold slots\n",
+           type_to_string(type),
+           huge_pages ? "huge" : "regular",
+           prefault_slots,
+           faults,
+           (unsigned) pa_atomic_load(&stat->n_cold_slots));
+
+    pa_assert_se((unsigned) pa_atomic_load(&stat->n_cold_slots) == N_SLOTS - prefault_slots);
+
+    for (i = 0; i < N_SLOTS; i++)
+        pa_memblock_unref(blocks[i]);
+
+    /* Vacuuming has to leave the prefaulted slots alone, the blocks
+     * we get back are the ones we had before */
+    pa_mempool_vacuum(pool);
+
+    pa_mempool_free(pool);
+}
+
+int main(int argc, char *argv[]) {
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    run(PA_SHM_PRIVATE, FALSE, 0);
+    run(PA_SHM_PRIVATE, FALSE, N_SLOTS);
+    run(PA_SHM_PRIVATE, TRUE, 0);
+    run(PA_SHM_PRIVATE, TRUE, N_SLOTS);
+    run(PA_SHM_POSIX, FALSE, 0);
+    run(PA_SHM_POSIX, FALSE, N_SLOTS);
+    run(PA_SHM_POSIX, TRUE, 0);
+    run(PA_SHM_POSIX, TRUE, N_SLOTS);
+    run(PA_SHM_MEMFD, FALSE, 0);
+    run(PA_SHM_MEMFD, FALSE, N_SLOTS);
+    run(PA_SHM_MEMFD, TRUE, 0);
+    run(PA_SHM_MEMFD, TRUE, N_SLOTS);
+
+    return 0;
+}
@@ -0,0 +1,240 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* Compares what a sink input costs with the usual rewind history against
+ * a PA_SINK_NO_REWIND sink: the memory its render queue pins while
+ * playing, and the CPU time spent on a soft volume change, which means
+ * rewinding and re-rendering the history in one case and fading in the
+ * new volume over a few milliseconds in the other. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/sample.h>
+#include <pulse/timeval.h>
+#include <pulse/volume.h>
+
+#include <pulsecore/memblock.h>
+#include <pulsecore/memblockq.h>
+#include <pulsecore/sample-util.h>
+#include <pulsecore/sink.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#define N_INPUTS 8
+#define N_VOLUME_CHANGES 100
+#define PLAY_USEC (3*PA_USEC_PER_SEC)
+#define CHUNK_USEC (10*PA_USEC_PER_MSEC)
+#define REWIND_BUFFER_USEC (2*PA_USEC_PER_SEC)
+
+static const pa_sample_spec ss = {
+    .format = PA_SAMPLE_S16NE,
+    .rate = 48000,
+    .channels = 2
+};
+
+/* Pushes and consumes audio like a sink input in steady state */
+static void play(pa_mempool *pool, pa_memblockq *bq, size_t chunk_size, pa_usec_t duration) {
+    pa_usec_t t;
+
+    for (t = 0; t < duration; t += CHUNK_USEC) {
+        pa_memchunk chunk;
+
+        chunk.memblock = pa_memblock_new(pool, chunk_size);
+        chunk.index = 0;
+        chunk.length = chunk_size;
+        pa_silence_memchunk(&chunk, &ss);
+
+        pa_assert_se(pa_memblockq_push_align(bq, &chunk) >= 0);
+        pa_memblock_unref(chunk.memblock);
+
+        pa_assert_se(pa_memblockq_peek(bq, &chunk) >= 0);
+        pa_memblock_unref(chunk.memblock);
+        pa_memblockq_drop(bq, chunk_size);
+    }
+}
+
+/* A rewind for a volume change: go back over the whole history and
+ * render it again with the new volume */
+static void change_volume_rewind(pa_memblockq *bq, size_t max_rewind, const pa_cvolume *volume) {
+    size_t left;
+
+    pa_memblockq_rewind(bq, max_rewind);
+
+    for (left = max_rewind; left > 0;) {
+        pa_memchunk chunk;
+
+        pa_assert_se(pa_memblockq_peek(bq, &chunk) >= 0);
+
+        if (chunk.length > left)
+            chunk.length = left;
+
+        pa_memchunk_make_writable(&chunk, 0);
+        pa_volume_memchunk(&chunk, &ss, volume);
+        pa_memblock_unref(chunk.memblock);
+
+        pa_memblockq_drop(bq, chunk.length);
+        left -= chunk.length;
+    }
+}
+
+/* The no-rewind replacement: fade in the new volume over the next chunk */
+static void change_volume_fade(pa_mempool *pool, pa_cvolume_ramp_int *fade, size_t chunk_size, const pa_cvolume *old_volume, const pa_cvolume *new_volume) {
+    pa_memchunk chunk;
+    int16_t *d;
+    float from[PA_CHANNELS_MAX];
+    size_t frames, n;
+    unsigned c;
+
+    for (c = 0; c < ss.channels; c++)
+        from[c] = (float) (pa_sw_volume_to_linear(old_volume->values[c]) / pa_sw_volume_to_linear(new_volume->values[c]));
+
+    frames = pa_usec_to_bytes(PA_SINK_NO_REWIND_FADE_USEC, &ss) / pa_frame_size(&ss);
+    pa_cvolume_ramp_fade_init(fade, from, (long) frames, ss.channels);
+
+    chunk.memblock = pa_memblock_new(pool, chunk_size);
+    chunk.index = 0;
+    chunk.length = chunk_size;
+
+    d = pa_memblock_acquire(chunk.memblock);
+    for (n = 0; n < chunk_size / sizeof(int16_t); n++)
+        d[n] = (int16_t) ((n * 331) & 0x3fff);
+    pa_memblock_release(chunk.memblock);
+
+    while (pa_cvolume_ramp_active(fade)) {
+        pa_volume_memchunk(&chunk, &ss, new_volume);
+        pa_volume_ramp_memchunk(&chunk, &ss, fade);
+    }
+
+    pa_memblock_unref(chunk.memblock);
+}
+
+/* Turning down one channel fades that channel only */
+static void check_fade_per_channel(void) {
+    pa_mempool *pool;
+    pa_cvolume_ramp_int fade;
+    pa_memchunk chunk;
+    const float from[2] = { 1.0f, 2.0f };
+    int16_t *d;
+    size_t frames, n;
+
+    pa_assert_se(pool = pa_mempool_new(FALSE, 0));
+
+    frames = pa_usec_to_bytes(PA_SINK_NO_REWIND_FADE_USEC, &ss) / pa_frame_size(&ss);
+    pa_cvolume_ramp_int_init(&fade, PA_VOLUME_NORM, ss.channels);
+    pa_cvolume_ramp_fade_init(&fade, from, (long) frames, ss.channels);
+
+    chunk.memblock = pa_memblock_new(pool, frames * pa_frame_size(&ss));
+    chunk.index = 0;
+    chunk.length = frames * pa_frame_size(&ss);
+
+    d = pa_memblock_acquire(chunk.memblock);
+    for (n = 0; n < frames * 2; n++)
+        d[n] = 0x1000;
+    pa_memblock_release(chunk.memblock);
+
+    pa_volume_ramp_memchunk(&chunk, &ss, &fade);
+    pa_assert_se(!pa_cvolume_ramp_active(&fade));
+
+    d = pa_memblock_acquire(chunk.memblock);
+
+    for (n = 0; n < frames; n++)
+        pa_assert_se(d[2*n] == 0x1000);
+
+    pa_assert_se(d[1] > 0x1000 * 15 / 8);
+    pa_assert_se(d[2*frames - 1] <= 0x1000 * 17 / 16);
+
+    pa_memblock_release(chunk.memblock);
+    pa_memblock_unref(chunk.memblock);
+    pa_mempool_free(pool);
+}
+
+static void run(pa_bool_t no_rewind) {
+    pa_mempool *pool;
+    pa_memblockq *bq[N_INPUTS];
+    pa_memchunk silence;
+    pa_cvolume volume[2];
+    pa_cvolume_ramp_int fade;
+    size_t max_rewind, chunk_size, allocated;
+    pa_usec_t ts, elapsed;
+    unsigned i, j;
+
+    pa_assert_se(pool = pa_mempool_new(FALSE, 0));
+
+    chunk_size = pa_usec_to_bytes(CHUNK_USEC, &ss);
+    max_rewind = no_rewind ? 0 : pa_usec_to_bytes(REWIND_BUFFER_USEC, &ss);
+
+    silence.memblock = pa_memblock_new(pool, chunk_size);
+    silence.index = 0;
+    silence.length = chunk_size;
+    pa_silence_memchunk(&silence, &ss);
+
+    for (i = 0; i < N_INPUTS; i++) {
+        pa_assert_se(bq[i] = pa_memblockq_new("no-rewind-test memblockq", 0, max_rewind + 4 * chunk_size, 0, &ss, 0, 0, max_rewind, &silence));
+        play(pool, bq[i], chunk_size, PLAY_USEC);
+    }
+
+    allocated = (size_t) pa_atomic_load(&pa_mempool_get_stat(pool)->allocated_size);
+
+    pa_cvolume_set(&volume[0], ss.channels, PA_VOLUME_NORM);
+    pa_cvolume_set(&volume[1], ss.channels, PA_VOLUME_NORM / 2);
+    pa_cvolume_ramp_int_init(&fade, PA_VOLUME_NORM, ss.channels);
+
+    ts = pa_rtclock_now();
+
+    for (j = 0; j < N_VOLUME_CHANGES; j++) {
+        const pa_cvolume *old_volume = &volume[j % 2], *new_volume = &volume[(j + 1) % 2];
+
+        if (no_rewind)
+            change_volume_fade(pool, &fade, chunk_size, old_volume, new_volume);
+        else
+            change_volume_rewind(bq[0], max_rewind, new_volume);
+    }
+
+    elapsed = pa_rtclock_now() - ts;
+
+    printf("%-10s  memory per input: %8lu bytes  cpu per volume change: %8.1f usec\n",
+           no_rewind ? "no-rewind" : "rewind",
+           (unsigned long) (allocated / N_INPUTS),
+           (double) elapsed / N_VOLUME_CHANGES);
+
+    for (i = 0; i < N_INPUTS; i++)
+        pa_memblockq_free(bq[i]);
+
+    pa_memblock_unref(silence.memblock);
+    pa_mempool_free(pool);
+}
+
+int main(int argc, char *argv[]) {
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    check_fade_per_channel();
+
+    run(FALSE);
+    run(TRUE);
+
+    return 0;
+}
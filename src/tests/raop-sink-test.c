@@ -0,0 +1,376 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* Runs the send path of module-raop-sink against a stand-in AirTunes
+ * device on the loopback interface. The device answers the RTSP
+ * ANNOUNCE/SETUP/RECORD handshake of the RAOP client, then takes the
+ * audio connection and checks the framing of every packet and the bytes
+ * that are sent unencrypted at the end of it. The audio key travels
+ * encrypted with the public key of the real devices, so the stand-in
+ * can't look any further.
+ *
+ * Reported are the packets per second pa_raop_client_encode_sample()
+ * manages on its own, and together with writing them out like
+ * thread_func() of the module does. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/rtclock.h>
+#include <pulse/sample.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/memchunk.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "raop_client.h"
+
+#define CHECK_PACKETS 200
+#define BENCHMARK_PACKETS 20000
+
+/* What the header of every packet says its length is, minus the audio */
+#define PACKET_OVERHEAD (16 - 4 + 7)
+
+static const pa_sample_spec ss = {
+    .format = PA_SAMPLE_S16NE,
+    .rate = 44100,
+    .channels = 2
+};
+
+struct device {
+    int rtsp_fd, audio_fd;
+    uint16_t audio_port;
+
+    size_t block_size;
+    uint8_t *expected;
+    size_t tail;
+
+    unsigned n_packets;
+    unsigned n_bad;
+};
+
+static int listen_local(uint16_t *port) {
+    struct sockaddr_in sa;
+    socklen_t sa_len = sizeof(sa);
+    int fd;
+
+    pa_assert_se((fd = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    pa_assert_se(bind(fd, (struct sockaddr*) &sa, sizeof(sa)) == 0);
+    pa_assert_se(listen(fd, 1) == 0);
+    pa_assert_se(getsockname(fd, (struct sockaddr*) &sa, &sa_len) == 0);
+
+    *port = ntohs(sa.sin_port);
+    return fd;
+}
+
+/* Writes the ALAC stream the client has to produce for one block bit by
+ * bit, the way the client used to */
+static void put_bits(uint8_t *d, size_t *pos, uint32_t v, unsigned n) {
+    while (n-- > 0) {
+        if ((v >> n) & 1)
+            d[*pos / 8] |= (uint8_t) (0x80 >> (*pos % 8));
+        (*pos)++;
+    }
+}
+
+static void device_init(struct device *d, const uint8_t *audio, size_t block_size) {
+    size_t pos = 0, i, length;
+    uint32_t n_frames;
+
+    d->block_size = block_size;
+    n_frames = (uint32_t) (block_size / 4);
+    length = 7 + block_size;
+
+    d->expected = pa_xnew0(uint8_t, length);
+    put_bits(d->expected, &pos, 1, 3);
+    put_bits(d->expected, &pos, 0, 4);
+    put_bits(d->expected, &pos, 0, 8);
+    put_bits(d->expected, &pos, 0, 4);
+    put_bits(d->expected, &pos, 1, 1);
+    put_bits(d->expected, &pos, 0, 2);
+    put_bits(d->expected, &pos, 1, 1);
+    put_bits(d->expected, &pos, n_frames, 32);
+
+    for (i = 0; i < block_size; i++)
+        put_bits(d->expected, &pos, audio[i ^ 1], 8);
+
+    /* Only whole AES blocks are encrypted */
+    d->tail = length % 16;
+}
+
+static void read_request(int fd, char *buf, size_t size) {
+    size_t n = 0;
+    char *end, *cl;
+    unsigned content_length = 0;
+
+    for (;;) {
+        ssize_t r;
+
+        pa_assert(n < size - 1);
+        pa_assert_se((r = read(fd, buf + n, size - 1 - n)) > 0);
+        n += (size_t) r;
+        buf[n] = 0;
+
+        if ((end = strstr(buf, "\r\n\r\n")))
+            break;
+    }
+
+    if ((cl = strstr(buf, "Content-Length:")))
+        content_length = (unsigned) atoi(cl + 15);
+
+    /* Skip the SDP of the ANNOUNCE */
+    while (n < (size_t) (end + 4 - buf) + content_length) {
+        ssize_t r;
+
+        pa_assert(n < size - 1);
+        pa_assert_se((r = read(fd, buf + n, size - 1 - n)) > 0);
+        n += (size_t) r;
+    }
+}
+
+static void reply(int fd, const char *request, const char *headers) {
+    char *r, *cseq;
+    int k;
+
+    pa_assert_se(cseq = strstr(request, "CSeq:"));
+    k = atoi(cseq + 5);
+
+    r = pa_sprintf_malloc("RTSP/1.0 200 OK\r\nCSeq: %d\r\n%s\r\n", k, headers);
+    pa_assert_se(pa_loop_write(fd, r, strlen(r), NULL) == (ssize_t) strlen(r));
+    pa_xfree(r);
+}
+
+static void device_thread(void *userdata) {
+    struct device *d = userdata;
+    char buf[4096], *transport;
+    uint8_t *packet;
+    int fd, audio;
+
+    pa_assert_se((fd = accept(d->rtsp_fd, NULL, NULL)) >= 0);
+
+    read_request(fd, buf, sizeof(buf));
+    pa_assert_se(strncmp(buf, "ANNOUNCE ", 9) == 0);
+    reply(fd, buf, "");
+
+    read_request(fd, buf, sizeof(buf));
+    pa_assert_se(strncmp(buf, "SETUP ", 6) == 0);
+    transport = pa_sprintf_malloc("Session: DEADBEEF\r\n"
+                                  "Transport: RTP/AVP/TCP;unicast;mode=record;server_port=%u\r\n"
+                                  "Audio-Jack-Status: connected; type=analog\r\n",
+                                  d->audio_port);
+    reply(fd, buf, transport);
+    pa_xfree(transport);
+
+    read_request(fd, buf, sizeof(buf));
+    pa_assert_se(strncmp(buf, "RECORD ", 7) == 0);
+    reply(fd, buf, "");
+
+    pa_assert_se((audio = accept(d->audio_fd, NULL, NULL)) >= 0);
+
+    packet = pa_xmalloc(PACKET_OVERHEAD + d->block_size + 16);
+
+    for (;;) {
+        uint8_t header[4];
+        size_t len;
+
+        if (pa_loop_read(audio, header, 4, NULL) != 4)
+            break;
+
+        len = ((size_t) header[2] << 8) | header[3];
+
+        if (header[0] != 0x24 || len != PACKET_OVERHEAD + d->block_size) {
+            d->n_bad++;
+            break;
+        }
+
+        pa_assert_se(pa_loop_read(audio, packet, len, NULL) == (ssize_t) len);
+
+        if (memcmp(packet + len - d->tail, d->expected + 7 + d->block_size - d->tail, d->tail) != 0)
+            d->n_bad++;
+
+        d->n_packets++;
+    }
+
+    pa_xfree(packet);
+    pa_close(audio);
+    pa_close(fd);
+}
+
+static void on_connection(int fd, void *userdata) {
+    int *audio_fd = userdata;
+
+    *audio_fd = fd;
+}
+
+static void on_close(void *userdata) {
+}
+
+/* Like the POLLOUT path of thread_func() in module-raop-sink.c */
+static void send_packet(int fd, pa_memchunk *encoded) {
+    const uint8_t *p;
+    size_t done = 0;
+    int write_type = 0;
+
+    p = pa_memblock_acquire(encoded->memblock);
+
+    while (done < encoded->length) {
+        ssize_t l;
+
+        if ((l = pa_write(fd, p + encoded->index + done, encoded->length - done, &write_type)) < 0) {
+            struct pollfd pfd;
+
+            pa_assert(errno == EAGAIN);
+
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+            pa_assert_se(poll(&pfd, 1, -1) == 1);
+            continue;
+        }
+
+        done += (size_t) l;
+    }
+
+    pa_memblock_release(encoded->memblock);
+}
+
+static void run(pa_mainloop *m, pa_core *core, pa_memblock *audio, size_t block_size, unsigned n_packets, pa_bool_t send) {
+    struct device d;
+    pa_raop_client *c;
+    pa_thread *t;
+    uint16_t rtsp_port;
+    char *host;
+    int fd = -1;
+    pa_usec_t ts, elapsed;
+    unsigned i;
+
+    memset(&d, 0, sizeof(d));
+    device_init(&d, pa_memblock_acquire(audio), block_size);
+    pa_memblock_release(audio);
+
+    d.rtsp_fd = listen_local(&rtsp_port);
+    d.audio_fd = listen_local(&d.audio_port);
+    pa_assert_se(t = pa_thread_new("raop-device", device_thread, &d));
+
+    host = pa_sprintf_malloc("127.0.0.1:%u", rtsp_port);
+    pa_assert_se(c = pa_raop_client_new(core, host));
+    pa_xfree(host);
+
+    pa_raop_client_set_callback(c, on_connection, &fd);
+    pa_raop_client_set_closed_callback(c, on_close, NULL);
+
+    while (fd < 0)
+        pa_assert_se(pa_mainloop_iterate(m, 1, NULL) >= 0);
+
+    ts = pa_rtclock_now();
+
+    for (i = 0; i < n_packets; i++) {
+        pa_memchunk raw, encoded;
+
+        /* What pa_sink_render() hands the module */
+        raw.memblock = audio;
+        raw.index = 0;
+        raw.length = block_size;
+
+        pa_raop_client_encode_sample(c, &raw, &encoded);
+        pa_assert_se(raw.length == 0);
+
+        if (send)
+            send_packet(fd, &encoded);
+
+        pa_memblock_unref(encoded.memblock);
+    }
+
+    elapsed = pa_rtclock_now() - ts;
+
+    /* The module closes the audio connection itself */
+    pa_close(fd);
+    pa_thread_free(t);
+
+    pa_assert_se(d.n_bad == 0);
+    pa_assert_se(d.n_packets == (send ? n_packets : 0));
+
+    printf("%-16s %8.0f packets per second  %6.1f us cpu per second of audio\n",
+           send ? "encode and send" : "encode",
+           (double) n_packets * PA_USEC_PER_SEC / (double) elapsed,
+           (double) elapsed * pa_bytes_per_second(&ss) / ((double) n_packets * block_size));
+
+    pa_raop_client_free(c);
+
+    pa_close(d.rtsp_fd);
+    pa_close(d.audio_fd);
+    pa_xfree(d.expected);
+}
+
+int main(int argc, char *argv[]) {
+    pa_mainloop *m;
+    pa_core *core;
+    pa_memblock *audio;
+    size_t block_size, i;
+    int16_t *d;
+    unsigned n_packets = CHECK_PACKETS;
+
+    if (!getenv("MAKE_CHECK")) {
+        pa_log_set_level(PA_LOG_DEBUG);
+        n_packets = BENCHMARK_PACKETS;
+    }
+
+    pa_assert_se(m = pa_mainloop_new());
+    pa_assert_se(core = pa_core_new(pa_mainloop_get_api(m), PA_SHM_PRIVATE, 0, FALSE, 0));
+
+    /* The block size module-raop-sink renders in */
+    block_size = pa_usec_to_bytes(PA_USEC_PER_SEC/20, &ss);
+
+    audio = pa_memblock_new(core->mempool, block_size);
+    d = pa_memblock_acquire(audio);
+    for (i = 0; i < block_size / sizeof(int16_t); i++)
+        d[i] = (int16_t) ((i * 7919) ^ (i << 9));
+    pa_memblock_release(audio);
+
+    run(m, core, audio, block_size, n_packets, FALSE);
+    run(m, core, audio, block_size, n_packets, TRUE);
+
+    pa_memblock_unref(audio);
+    pa_core_unref(core);
+    pa_mainloop_free(m);
+
+    return 0;
+}
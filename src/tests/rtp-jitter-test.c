@@ -0,0 +1,401 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* Replays synthetic packet traces through the jitter buffer of
+ * module-rtp-recv on a simulated clock. The sender sends a packet every
+ * 10ms, the network delays each by a random amount up to the jitter,
+ * holds some back even longer so they arrive out of order, and loses
+ * some. A simulated sink takes what it needs every 10ms.
+ *
+ * Every frame carries its number, so the output is checked to play the
+ * frames that arrived in time in order and exactly once, with silence
+ * in between. The same goes for packets that only carry their number
+ * and are decoded by the jitter buffer, which also has to hand them to
+ * the decoder in order and make up only the ones that are missing.
+ * Reported are the statistics of the jitter buffer and how
+ * much of the playback had to be concealed.
+ *
+ * Usage: rtp-jitter-test [JITTER_MSEC LOSS_PERCENT REORDER_PERCENT] */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pulse/sample.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/memblock.h>
+#include <pulsecore/memblockq.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "jitter.h"
+
+#define PACKET_FRAMES 480
+#define PACKET_USEC (10*PA_USEC_PER_MSEC)
+#define SINK_USEC (10*PA_USEC_PER_MSEC)
+#define BASE_DELAY_USEC (2*PA_USEC_PER_MSEC)
+#define MIN_TARGET_USEC (20*PA_USEC_PER_MSEC)
+#define MAX_TARGET_USEC (500*PA_USEC_PER_MSEC)
+#define CHECK_PACKETS 3000
+#define BENCHMARK_PACKETS 30000
+
+static const pa_sample_spec ss = {
+    .format = PA_SAMPLE_S16LE,
+    .rate = 48000,
+    .channels = 2
+};
+
+struct trace {
+    pa_usec_t jitter;
+    unsigned loss;     /* percent */
+    unsigned reorder;  /* percent */
+};
+
+struct packet {
+    unsigned n;
+    uint16_t sequence;
+    uint32_t timestamp;
+    pa_usec_t arrival;
+};
+
+struct result {
+    pa_rtp_jitter_stats stats;
+    uint64_t played, real, silent;
+    unsigned sent;
+};
+
+/* Decodes packets that only carry their number, makes up silence */
+struct decoder {
+    pa_mempool *pool;
+    pa_bool_t synced;
+    unsigned next;
+};
+
+static int compare_arrival(const void *a, const void *b) {
+    const struct packet *x = a, *y = b;
+
+    if (x->arrival != y->arrival)
+        return x->arrival < y->arrival ? -1 : 1;
+
+    return x->sequence < y->sequence ? -1 : 1;
+}
+
+/* The frames of each packet are numbered from 1 up, which is what the
+ * sink checks. Silence is 0. */
+static pa_memblock* make_payload(pa_mempool *pool, unsigned n) {
+    pa_memblock *b;
+    uint32_t *d;
+    unsigned i;
+
+    b = pa_memblock_new(pool, PACKET_FRAMES * pa_frame_size(&ss));
+    d = pa_memblock_acquire(b);
+
+    for (i = 0; i < PACKET_FRAMES; i++)
+        d[i] = n * PACKET_FRAMES + i + 1;
+
+    pa_memblock_release(b);
+
+    return b;
+}
+
+static unsigned packet_number(const pa_memchunk *chunk) {
+    unsigned n;
+
+    pa_assert_se(chunk->length == sizeof(uint32_t));
+    n = *(const uint32_t*) ((uint8_t*) pa_memblock_acquire(chunk->memblock) + chunk->index);
+    pa_memblock_release(chunk->memblock);
+
+    return n;
+}
+
+static int decode_cb(void *userdata, const pa_memchunk *packet, const pa_memchunk *next, unsigned n_samples, pa_memchunk *pcm) {
+    struct decoder *d = userdata;
+
+    if (packet) {
+        unsigned n = packet_number(packet);
+
+        /* Strictly in order, nothing skipped */
+        pa_assert_se(!d->synced || n == d->next);
+        d->synced = TRUE;
+        d->next = n + 1;
+
+        pcm->memblock = make_payload(d->pool, n);
+    } else {
+        /* Only ever what is missing before a packet we have */
+        pa_assert_se(d->synced);
+        pa_assert_se(!next || packet_number(next) == d->next + 1);
+        pa_assert_se(n_samples == PACKET_FRAMES);
+        d->next++;
+
+        pcm->memblock = pa_memblock_new(d->pool, n_samples * pa_frame_size(&ss));
+        memset(pa_memblock_acquire(pcm->memblock), 0, pa_memblock_get_length(pcm->memblock));
+        pa_memblock_release(pcm->memblock);
+    }
+
+    pcm->index = 0;
+    pcm->length = pa_memblock_get_length(pcm->memblock);
+
+    return 0;
+}
+
+/* Takes SINK_USEC worth of audio the way the sink input does */
+static void sink_read(pa_rtp_jitter *j, pa_memblockq *q, pa_rtp_conceal_mode_t mode, int64_t *debt, uint32_t *last_frame, struct result *r) {
+    *debt += (int64_t) pa_usec_to_bytes(SINK_USEC, &ss);
+
+    while (*debt > 0) {
+        pa_memchunk chunk;
+        const uint32_t *d;
+        size_t i, n;
+
+        if (pa_rtp_jitter_peek(j, (size_t) *debt, &chunk) < 0) {
+            /* Underrun, the sink plays silence on its own */
+            *debt = 0;
+            break;
+        }
+
+        n = chunk.length / sizeof(uint32_t);
+        d = (const uint32_t*) ((uint8_t*) pa_memblock_acquire(chunk.memblock) + chunk.index);
+
+        for (i = 0; i < n; i++) {
+            if (d[i] == 0) {
+                r->silent++;
+                continue;
+            }
+
+            r->real++;
+
+            /* Repeated data goes back in time, everything else has to
+             * move forward without skipping or doubling frames */
+            if (mode == PA_RTP_CONCEAL_SILENCE)
+                pa_assert_se(d[i] > *last_frame);
+
+            *last_frame = d[i];
+        }
+
+        pa_memblock_release(chunk.memblock);
+        pa_memblock_unref(chunk.memblock);
+
+        pa_memblockq_drop(q, chunk.length);
+        r->played += n;
+        *debt -= (int64_t) chunk.length;
+    }
+}
+
+static void run(const struct trace *t, unsigned n_packets, pa_rtp_conceal_mode_t mode, pa_bool_t coded, struct result *r) {
+    struct decoder decoder;
+    pa_mempool *pool;
+    pa_memblockq *q;
+    pa_rtp_jitter *j;
+    pa_memchunk silence;
+    struct packet *packets;
+    unsigned i, n = 0;
+    pa_usec_t now, next_read = 0;
+    int64_t debt = 0;
+    uint32_t last_frame = 0;
+
+    pa_assert_se(pool = pa_mempool_new(FALSE, 0));
+
+    silence.memblock = pa_memblock_new(pool, pa_usec_to_bytes(SINK_USEC, &ss));
+    silence.index = 0;
+    silence.length = pa_memblock_get_length(silence.memblock);
+    memset(pa_memblock_acquire(silence.memblock), 0, silence.length);
+    pa_memblock_release(silence.memblock);
+
+    q = pa_memblockq_new("rtp-jitter-test memblockq", 0, 4*1024*1024, 4*1024*1024, &ss, 0, 0, 0, NULL);
+    j = pa_rtp_jitter_new(q, &ss, &silence, mode, MIN_TARGET_USEC, MAX_TARGET_USEC);
+    pa_memblock_unref(silence.memblock);
+
+    if (coded) {
+        decoder.pool = pool;
+        decoder.synced = FALSE;
+        pa_rtp_jitter_set_decoder(j, decode_cb, &decoder);
+    }
+
+    /* The trace: what arrives when */
+    packets = pa_xnew(struct packet, n_packets);
+
+    for (i = 0; i < n_packets; i++) {
+        pa_usec_t delay = BASE_DELAY_USEC;
+
+        if ((unsigned) (rand() % 100) < t->loss)
+            continue;
+
+        if (t->jitter > 0)
+            delay += (pa_usec_t) rand() % t->jitter;
+
+        if ((unsigned) (rand() % 100) < t->reorder)
+            delay += 3 * PACKET_USEC;
+
+        packets[n].n = i;
+        packets[n].sequence = (uint16_t) (4711 + i);
+        packets[n].timestamp = 0xfffff000U + i * PACKET_FRAMES;
+        packets[n].arrival = i * PACKET_USEC + delay;
+        n++;
+    }
+
+    qsort(packets, n, sizeof(struct packet), compare_arrival);
+
+    memset(r, 0, sizeof(*r));
+    r->sent = n_packets;
+
+    for (i = 0; i < n; i++) {
+        pa_memchunk chunk;
+
+        now = packets[i].arrival;
+
+        while (next_read <= now) {
+            sink_read(j, q, mode, &debt, &last_frame, r);
+            next_read += SINK_USEC;
+        }
+
+        if (coded) {
+            chunk.memblock = pa_memblock_new(pool, sizeof(uint32_t));
+            *(uint32_t*) pa_memblock_acquire(chunk.memblock) = packets[i].n;
+            pa_memblock_release(chunk.memblock);
+        } else
+            chunk.memblock = make_payload(pool, packets[i].n);
+
+        chunk.index = 0;
+        chunk.length = pa_memblock_get_length(chunk.memblock);
+
+        pa_rtp_jitter_push(j, packets[i].sequence, packets[i].timestamp, now, &chunk);
+        pa_memblock_unref(chunk.memblock);
+    }
+
+    /* Play out what is left */
+    pa_memblockq_prebuf_disable(q);
+
+    while (pa_memblockq_get_length(q) > 0)
+        sink_read(j, q, mode, &debt, &last_frame, r);
+
+    pa_rtp_jitter_get_stats(j, &r->stats);
+
+    pa_rtp_jitter_free(j);
+    pa_memblockq_free(q);
+    pa_xfree(packets);
+    pa_mempool_free(pool);
+}
+
+static void print_result(const struct trace *t, const char *mode, const struct result *r) {
+    printf("jitter %3llu ms  loss %2u%%  reorder %2u%%  %-7s  lost %5llu  reordered %5llu  late %5llu  "
+           "underruns %3llu  jitter %6.2f ms  target %6.2f ms  concealed %5.2f%%\n",
+           (unsigned long long) (t->jitter / PA_USEC_PER_MSEC), t->loss, t->reorder, mode,
+           (unsigned long long) r->stats.lost,
+           (unsigned long long) r->stats.reordered,
+           (unsigned long long) r->stats.late,
+           (unsigned long long) r->stats.underruns,
+           (double) r->stats.jitter / PA_USEC_PER_MSEC,
+           (double) r->stats.target / PA_USEC_PER_MSEC,
+           100.0 * (double) r->stats.concealed / (double) PA_MAX(r->played * pa_frame_size(&ss), 1));
+}
+
+static void check(void) {
+    static const struct trace clean = { 0, 0, 0 };
+    static const struct trace rough = { 30*PA_USEC_PER_MSEC, 2, 5 };
+    struct result r;
+
+    /* Nothing lost, nothing late: every frame plays exactly once */
+    run(&clean, CHECK_PACKETS, PA_RTP_CONCEAL_SILENCE, FALSE, &r);
+    pa_assert_se(r.stats.received == CHECK_PACKETS);
+    pa_assert_se(r.stats.lost == 0 && r.stats.reordered == 0 && r.stats.late == 0);
+    pa_assert_se(r.stats.concealed == 0 && r.stats.underruns == 0);
+    pa_assert_se(r.real == (uint64_t) CHECK_PACKETS * PACKET_FRAMES);
+    pa_assert_se(r.silent == 0);
+
+    /* Every packet is accounted for once, and the concealment that was
+     * played is exactly the silence in the output */
+    run(&rough, CHECK_PACKETS, PA_RTP_CONCEAL_SILENCE, FALSE, &r);
+    pa_assert_se(r.stats.received + r.stats.late + r.stats.lost == CHECK_PACKETS);
+    pa_assert_se(r.stats.lost > 0 && r.stats.reordered > 0);
+    pa_assert_se(r.stats.duplicates == 0 && r.stats.resyncs == 0);
+    pa_assert_se(r.stats.concealed == r.silent * pa_frame_size(&ss));
+    pa_assert_se(r.real <= r.stats.received * PACKET_FRAMES);
+    pa_assert_se(r.stats.target > MIN_TARGET_USEC && r.stats.target <= MAX_TARGET_USEC);
+
+    /* Repeating conceals the same holes with data instead */
+    run(&rough, CHECK_PACKETS, PA_RTP_CONCEAL_REPEAT, FALSE, &r);
+    pa_assert_se(r.stats.received + r.stats.late + r.stats.lost == CHECK_PACKETS);
+    pa_assert_se(r.stats.concealed > r.silent * pa_frame_size(&ss));
+
+    /* Encoded packets are decoded in order, the decoder makes up the
+     * ones that are missing when they are due, and originals that show
+     * up after that are dropped */
+    run(&clean, CHECK_PACKETS, PA_RTP_CONCEAL_SILENCE, TRUE, &r);
+    pa_assert_se(r.stats.received == CHECK_PACKETS && r.stats.recovered == 0);
+    pa_assert_se(r.real == (uint64_t) CHECK_PACKETS * PACKET_FRAMES);
+    pa_assert_se(r.silent == 0 && r.stats.underruns == 0);
+
+    run(&rough, CHECK_PACKETS, PA_RTP_CONCEAL_SILENCE, TRUE, &r);
+    pa_assert_se(r.stats.received + r.stats.late + r.stats.lost == CHECK_PACKETS);
+    pa_assert_se(r.stats.recovered > 0 && r.stats.late > 0);
+    pa_assert_se(r.stats.concealed == 0);
+    pa_assert_se(r.real == r.stats.received * PACKET_FRAMES);
+    pa_assert_se(r.silent == r.stats.recovered * PACKET_FRAMES);
+}
+
+int main(int argc, char *argv[]) {
+    static const struct trace traces[] = {
+        { 0, 0, 0 },
+        { 5*PA_USEC_PER_MSEC, 0, 0 },
+        { 20*PA_USEC_PER_MSEC, 1, 1 },
+        { 50*PA_USEC_PER_MSEC, 1, 5 },
+        { 50*PA_USEC_PER_MSEC, 5, 5 },
+        { 100*PA_USEC_PER_MSEC, 10, 10 },
+    };
+    struct result r;
+    unsigned i;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    srand(4711);
+
+    if (argc > 3) {
+        struct trace t;
+
+        t.jitter = (pa_usec_t) atoi(argv[1]) * PA_USEC_PER_MSEC;
+        t.loss = (unsigned) atoi(argv[2]);
+        t.reorder = (unsigned) atoi(argv[3]);
+
+        run(&t, BENCHMARK_PACKETS, PA_RTP_CONCEAL_SILENCE, FALSE, &r);
+        print_result(&t, "silence", &r);
+        run(&t, BENCHMARK_PACKETS, PA_RTP_CONCEAL_REPEAT, FALSE, &r);
+        print_result(&t, "repeat", &r);
+
+        return 0;
+    }
+
+    check();
+
+    if (getenv("MAKE_CHECK"))
+        return 0;
+
+    for (i = 0; i < PA_ELEMENTSOF(traces); i++) {
+        run(&traces[i], BENCHMARK_PACKETS, PA_RTP_CONCEAL_REPEAT, FALSE, &r);
+        print_result(&traces[i], "repeat", &r);
+    }
+
+    return 0;
+}
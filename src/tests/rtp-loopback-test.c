@@ -0,0 +1,320 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* Sends RTP packets with pa_rtp_send() the way module-rtp-send does and
+ * receives them with pa_rtp_recv() the way module-rtp-recv does, over a
+ * multicast group on the loopback interface. If the loopback interface
+ * can't do multicast, plain unicast to 127.0.0.1 is used instead.
+ *
+ * Every packet is checked for its sequence number, timestamp and
+ * payload. Even the loopback may drop a packet when the receive buffer
+ * overflows, so losses are counted rather than treated as failure.
+ * Reported are the packets per second, the CPU time per packet for the
+ * round trip and how many packets got lost. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/sample.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/memblock.h>
+#include <pulsecore/memblockq.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "rtp.h"
+
+#define GROUP "239.255.77.77"
+#define MTU 1280
+#define BURST 32
+#define CHECK_PACKETS 2000
+#define BENCHMARK_PACKETS 1000000
+
+static const pa_sample_spec ss = {
+    .format = PA_SAMPLE_S16BE,
+    .rate = 44100,
+    .channels = 2
+};
+
+/* Binds to a free port and returns it in port */
+static int open_receiver(pa_bool_t multicast, uint16_t *port) {
+    struct sockaddr_in sa;
+    socklen_t sa_len = sizeof(sa);
+    int fd, one = 1, rcvbuf = 4 * BURST * MTU;
+
+    pa_assert_se((fd = socket(AF_INET, SOCK_DGRAM, 0)) >= 0);
+    pa_assert_se(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == 0);
+    pa_assert_se(setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, &one, sizeof(one)) == 0);
+    pa_assert_se(setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) == 0);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = 0;
+    sa.sin_addr.s_addr = multicast ? inet_addr(GROUP) : htonl(INADDR_LOOPBACK);
+    pa_assert_se(bind(fd, (struct sockaddr*) &sa, sizeof(sa)) == 0);
+
+    pa_assert_se(getsockname(fd, (struct sockaddr*) &sa, &sa_len) == 0);
+    *port = ntohs(sa.sin_port);
+
+    if (multicast) {
+        struct ip_mreq mr;
+
+        memset(&mr, 0, sizeof(mr));
+        mr.imr_multiaddr.s_addr = inet_addr(GROUP);
+        mr.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mr, sizeof(mr)) < 0) {
+            pa_close(fd);
+            return -1;
+        }
+    }
+
+    pa_make_fd_nonblock(fd);
+
+    return fd;
+}
+
+static int open_sender(pa_bool_t multicast, uint16_t port) {
+    struct sockaddr_in sa;
+    int fd;
+
+    pa_assert_se((fd = socket(AF_INET, SOCK_DGRAM, 0)) >= 0);
+
+    if (multicast) {
+        struct in_addr lo;
+        int one = 1;
+
+        lo.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &lo, sizeof(lo)) < 0 ||
+            setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &one, sizeof(one)) < 0) {
+            pa_close(fd);
+            return -1;
+        }
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = multicast ? inet_addr(GROUP) : htonl(INADDR_LOOPBACK);
+
+    if (connect(fd, (struct sockaddr*) &sa, sizeof(sa)) < 0) {
+        pa_close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* Returns FALSE if the probe doesn't make it to the receiver */
+static pa_bool_t probe(int send_fd, int recv_fd) {
+    struct pollfd pfd;
+    uint8_t b = 0;
+
+    if (send(send_fd, &b, 1, 0) != 1)
+        return FALSE;
+
+    pfd.fd = recv_fd;
+    pfd.events = POLLIN;
+
+    if (poll(&pfd, 1, 500) != 1)
+        return FALSE;
+
+    pa_assert_se(recv(recv_fd, &b, 1, 0) == 1);
+    return TRUE;
+}
+
+static uint8_t payload_byte(uint64_t offset) {
+    return (uint8_t) ((offset * 131) >> 3);
+}
+
+static pa_usec_t cpu_time(void) {
+    struct rusage ru;
+
+    pa_assert_se(getrusage(RUSAGE_SELF, &ru) == 0);
+    return pa_timeval_load(&ru.ru_utime) + pa_timeval_load(&ru.ru_stime);
+}
+
+static void run(unsigned n_packets) {
+    pa_mempool *pool;
+    pa_memblockq *q;
+    pa_rtp_context send_ctx, recv_ctx;
+    int send_fd = -1, recv_fd = -1;
+    pa_bool_t multicast = TRUE;
+    uint64_t sent_bytes = 0, received_bytes = 0;
+    unsigned sent = 0, received = 0, lost = 0, late = 0;
+    uint16_t sequence, port;
+    uint32_t timestamp;
+    pa_usec_t ts, cpu;
+
+    pa_assert_se(pool = pa_mempool_new(FALSE, 0));
+
+    if ((recv_fd = open_receiver(TRUE, &port)) < 0 ||
+        (send_fd = open_sender(TRUE, port)) < 0 ||
+        !probe(send_fd, recv_fd)) {
+
+        if (recv_fd >= 0)
+            pa_close(recv_fd);
+        if (send_fd >= 0)
+            pa_close(send_fd);
+
+        multicast = FALSE;
+        pa_assert_se((recv_fd = open_receiver(FALSE, &port)) >= 0);
+        pa_assert_se((send_fd = open_sender(FALSE, port)) >= 0);
+        pa_assert_se(probe(send_fd, recv_fd));
+    }
+
+    q = pa_memblockq_new("rtp-loopback-test memblockq", 0, 4 * BURST * MTU, 0, &ss, 1, 0, 0, NULL);
+
+    pa_rtp_context_init_send(&send_ctx, send_fd, 0, pa_rtp_payload_from_sample_spec(&ss), pa_frame_size(&ss));
+    pa_rtp_context_init_recv(&recv_ctx, recv_fd, pa_frame_size(&ss));
+
+    sequence = send_ctx.sequence;
+    timestamp = send_ctx.timestamp;
+
+    ts = pa_rtclock_now();
+    cpu = cpu_time();
+
+    while (sent < n_packets) {
+        pa_memchunk chunk;
+        unsigned burst = PA_MIN(BURST, n_packets - sent), done = 0;
+        uint8_t *d;
+        size_t i;
+
+        /* What the source output of module-rtp-send pushes */
+        chunk.memblock = pa_memblock_new(pool, burst * MTU);
+        chunk.index = 0;
+        chunk.length = burst * MTU;
+
+        d = pa_memblock_acquire(chunk.memblock);
+        for (i = 0; i < chunk.length; i++)
+            d[i] = payload_byte(sent_bytes + i);
+        pa_memblock_release(chunk.memblock);
+
+        pa_assert_se(pa_memblockq_push(q, &chunk) == 0);
+        pa_memblock_unref(chunk.memblock);
+        sent_bytes += burst * MTU;
+
+        pa_assert_se(pa_rtp_send(&send_ctx, MTU, q) == 0);
+        sent += burst;
+
+        /* What the rtpoll item of module-rtp-recv does */
+        while (done < burst) {
+            struct timeval tv;
+            struct pollfd pfd;
+            int16_t gap;
+            int r;
+
+            if ((r = pa_rtp_recv(&recv_ctx, &chunk, pool, &tv)) == 0) {
+                pfd.fd = recv_fd;
+                pfd.events = POLLIN;
+
+                /* Whatever hasn't arrived by now got lost */
+                if (poll(&pfd, 1, 100) == 0) {
+                    unsigned missing = burst - done;
+
+                    lost += missing;
+                    sequence = (uint16_t) (sequence + missing);
+                    timestamp += (uint32_t) (missing * MTU / pa_frame_size(&ss));
+                    received_bytes += missing * MTU;
+                    break;
+                }
+
+                continue;
+            }
+
+            pa_assert_se(r > 0);
+
+            /* A packet we have given up on already */
+            if ((gap = (int16_t) (recv_ctx.sequence - sequence)) < 0) {
+                pa_memblock_unref(chunk.memblock);
+                late++;
+                continue;
+            }
+
+            /* Skip what was lost in between */
+            pa_assert_se(done + (unsigned) gap < burst);
+            lost += (unsigned) gap;
+            done += (unsigned) gap;
+            sequence = (uint16_t) (sequence + gap);
+            timestamp += (uint32_t) ((unsigned) gap * MTU / pa_frame_size(&ss));
+            received_bytes += (unsigned) gap * MTU;
+
+            pa_assert_se(recv_ctx.timestamp == timestamp);
+            pa_assert_se(chunk.length == MTU);
+            pa_assert_se(tv.tv_sec != 0);
+
+            d = (uint8_t*) pa_memblock_acquire(chunk.memblock) + chunk.index;
+            for (i = 0; i < chunk.length; i += 97)
+                pa_assert_se(d[i] == payload_byte(received_bytes + i));
+            pa_memblock_release(chunk.memblock);
+            pa_memblock_unref(chunk.memblock);
+
+            sequence++;
+            timestamp += (uint32_t) (MTU / pa_frame_size(&ss));
+            received_bytes += MTU;
+            received++;
+            done++;
+        }
+    }
+
+    cpu = cpu_time() - cpu;
+    ts = pa_rtclock_now() - ts;
+
+    printf("%-9s %u packets  %9.0f packets per second  %6.2f us cpu per packet  %u lost  %u late\n",
+           multicast ? "multicast" : "unicast", received,
+           (double) received * PA_USEC_PER_SEC / (double) ts,
+           (double) cpu / PA_MAX(received, 1U),
+           lost, late);
+
+    /* Losing a few is fine, losing everything means it's broken */
+    pa_assert_se(received > 0);
+
+    pa_rtp_context_destroy(&send_ctx);
+    pa_rtp_context_destroy(&recv_ctx);
+    pa_memblockq_free(q);
+    pa_mempool_free(pool);
+}
+
+int main(int argc, char *argv[]) {
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    run(getenv("MAKE_CHECK") ? CHECK_PACKETS : BENCHMARK_PACKETS);
+
+    return 0;
+}
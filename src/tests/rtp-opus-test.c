@@ -0,0 +1,279 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* Encodes a synthetic signal to Opus the way module-rtp-send does,
+ * sends it over UDP to 127.0.0.1 with pa_rtp_send_encoded(), receives
+ * it with pa_rtp_recv() and decodes it the way module-rtp-recv does.
+ * Every tenth packet is treated as lost on the receiving side and made
+ * up for from the FEC data in the packet after it.
+ *
+ * Every packet is checked to arrive in order and to decode to a full
+ * frame. Reported are, for a range of bitrates, the bitrate that
+ * actually went over the wire and the CPU time spent encoding and
+ * decoding per second of audio. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <pulse/sample.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/memblock.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "rtp.h"
+#include "opus-codec.h"
+
+#define PORT 46999
+#define MTU 1280
+#define CHANNELS 2
+#define FRAME_MSEC 20
+#define FEC_LOSS 10
+#define LOSS_INTERVAL 10
+#define CHECK_SECONDS 2
+#define BENCHMARK_SECONDS 60
+
+struct result {
+    uint64_t bytes;
+    unsigned packets, recovered;
+    pa_usec_t encode, decode;
+};
+
+static int open_receiver(void) {
+    struct sockaddr_in sa;
+    int fd, one = 1, rcvbuf = 64 * MTU;
+
+    pa_assert_se((fd = socket(AF_INET, SOCK_DGRAM, 0)) >= 0);
+    pa_assert_se(setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, &one, sizeof(one)) == 0);
+    pa_assert_se(setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) == 0);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(PORT);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    pa_assert_se(bind(fd, (struct sockaddr*) &sa, sizeof(sa)) == 0);
+
+    pa_make_fd_nonblock(fd);
+
+    return fd;
+}
+
+static int open_sender(void) {
+    struct sockaddr_in sa;
+    int fd;
+
+    pa_assert_se((fd = socket(AF_INET, SOCK_DGRAM, 0)) >= 0);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(PORT);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    pa_assert_se(connect(fd, (struct sockaddr*) &sa, sizeof(sa)) == 0);
+
+    return fd;
+}
+
+static pa_usec_t cpu_time(void) {
+    struct rusage ru;
+
+    pa_assert_se(getrusage(RUSAGE_SELF, &ru) == 0);
+    return pa_timeval_load(&ru.ru_utime) + pa_timeval_load(&ru.ru_stime);
+}
+
+/* Two tones and a little noise, different on each channel */
+static void make_signal(int16_t *pcm, unsigned n_samples, uint64_t offset) {
+    unsigned i;
+
+    for (i = 0; i < n_samples; i++) {
+        double t = (double) (offset + i) / PA_RTP_OPUS_RATE;
+
+        pcm[i*2] = (int16_t) (8000.0 * sin(2 * M_PI * 440 * t) + (rand() % 256 - 128));
+        pcm[i*2+1] = (int16_t) (6000.0 * sin(2 * M_PI * 1250 * t) + (rand() % 256 - 128));
+    }
+}
+
+static pa_bool_t silent(const int16_t *pcm, unsigned n_samples) {
+    unsigned i;
+
+    for (i = 0; i < n_samples * CHANNELS; i++)
+        if (pcm[i] != 0)
+            return FALSE;
+
+    return TRUE;
+}
+
+static void run(uint32_t bitrate, unsigned seconds, struct result *r) {
+    pa_mempool *pool;
+    pa_rtp_context send_ctx, recv_ctx;
+    pa_rtp_opus_encoder *e;
+    pa_rtp_opus_decoder *d;
+    int send_fd, recv_fd;
+    unsigned frame_samples, n_packets, sent = 0;
+    uint16_t sequence = 0;
+    uint8_t *packet;
+    int16_t *in, *out;
+    pa_bool_t heard = FALSE;
+
+    pa_assert_se(pool = pa_mempool_new(FALSE, 0));
+
+    recv_fd = open_receiver();
+    send_fd = open_sender();
+
+    pa_assert_se(e = pa_rtp_opus_encoder_new(CHANNELS, bitrate, FRAME_MSEC, FEC_LOSS));
+    pa_assert_se(d = pa_rtp_opus_decoder_new(CHANNELS));
+
+    frame_samples = pa_rtp_opus_encoder_get_frame_samples(e);
+    n_packets = seconds * 1000 / FRAME_MSEC;
+
+    packet = pa_xmalloc(MTU);
+    in = pa_xnew(int16_t, frame_samples * CHANNELS);
+    out = pa_xnew(int16_t, PA_RTP_OPUS_MAX_SAMPLES * CHANNELS);
+
+    pa_rtp_context_init_send(&send_ctx, send_fd, 0, 127, 1);
+    pa_rtp_context_init_recv(&recv_ctx, recv_fd, 1);
+
+    memset(r, 0, sizeof(*r));
+
+    while (r->packets < n_packets) {
+        pa_memchunk chunk;
+        struct timeval tv;
+        const uint8_t *p;
+        pa_usec_t cpu;
+        int n;
+
+        /* Keep a few packets in flight, the receive buffer is small */
+        if (sent < n_packets && sent < r->packets + 8) {
+            make_signal(in, frame_samples, (uint64_t) sent * frame_samples);
+
+            cpu = cpu_time();
+            pa_assert_se((n = pa_rtp_opus_encode(e, in, packet, MTU)) > 0);
+            r->encode += cpu_time() - cpu;
+
+            pa_assert_se(pa_rtp_send_encoded(&send_ctx, packet, (size_t) n, frame_samples) == 0);
+            r->bytes += (uint64_t) n;
+            sent++;
+            continue;
+        }
+
+        if ((n = pa_rtp_recv(&recv_ctx, &chunk, pool, &tv)) == 0) {
+            struct pollfd pfd;
+
+            pfd.fd = recv_fd;
+            pfd.events = POLLIN;
+            pa_assert_se(poll(&pfd, 1, 1000) == 1);
+            continue;
+        }
+
+        pa_assert_se(n > 0);
+
+        if (r->packets == 0)
+            sequence = recv_ctx.sequence;
+
+        /* Nothing may be lost or reordered on the loopback */
+        pa_assert_se(recv_ctx.sequence == sequence);
+        pa_assert_se(recv_ctx.payload == 127);
+
+        p = (const uint8_t*) pa_memblock_acquire(chunk.memblock) + chunk.index;
+        pa_assert_se(pa_rtp_opus_get_samples(p, chunk.length) == (int) frame_samples);
+
+        if (r->packets % LOSS_INTERVAL == LOSS_INTERVAL/2) {
+            /* Pretend this one was lost, the next one brings it back from
+             * its FEC data */
+            pa_memblock_release(chunk.memblock);
+            pa_memblock_unref(chunk.memblock);
+            sequence++;
+            r->packets++;
+            continue;
+        }
+
+        cpu = cpu_time();
+
+        if (r->packets % LOSS_INTERVAL == LOSS_INTERVAL/2 + 1) {
+            pa_assert_se(pa_rtp_opus_recover(d, p, chunk.length, out, frame_samples) == (int) frame_samples);
+            r->recovered++;
+        }
+
+        pa_assert_se(pa_rtp_opus_decode(d, p, chunk.length, out, PA_RTP_OPUS_MAX_SAMPLES) == (int) frame_samples);
+        r->decode += cpu_time() - cpu;
+
+        if (!silent(out, frame_samples))
+            heard = TRUE;
+
+        pa_memblock_release(chunk.memblock);
+        pa_memblock_unref(chunk.memblock);
+
+        sequence++;
+        r->packets++;
+    }
+
+    pa_assert_se(heard);
+
+    pa_rtp_context_destroy(&send_ctx);
+    pa_rtp_context_destroy(&recv_ctx);
+    pa_rtp_opus_encoder_free(e);
+    pa_rtp_opus_decoder_free(d);
+    pa_xfree(packet);
+    pa_xfree(in);
+    pa_xfree(out);
+    pa_mempool_free(pool);
+}
+
+int main(int argc, char *argv[]) {
+    static const uint32_t bitrates[] = { 16000, 32000, 64000, 96000, 128000, 192000, 256000 };
+    unsigned i, seconds;
+    struct result r;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    srand(4711);
+
+    seconds = getenv("MAKE_CHECK") ? CHECK_SECONDS : BENCHMARK_SECONDS;
+
+    for (i = 0; i < PA_ELEMENTSOF(bitrates); i++) {
+        run(bitrates[i], seconds, &r);
+
+        pa_assert_se(r.packets == seconds * 1000 / FRAME_MSEC);
+        pa_assert_se(r.recovered == r.packets / LOSS_INTERVAL);
+
+        printf("bitrate %6u  on the wire %9.0f bit/s  encode %7.1f us/s  decode %7.1f us/s  recovered %u of %u packets\n",
+               bitrates[i],
+               (double) r.bytes * 8 / seconds,
+               (double) r.encode / seconds,
+               (double) r.decode / seconds,
+               r.recovered, r.packets);
+    }
+
+    return 0;
+}
@@ -0,0 +1,229 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* Checks that the SBC primitives picked for this CPU give bit-exact
+ * results against the generic C ones, then benchmarks both of them and
+ * a complete offline A2DP style encode. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "sbc.h"
+#include "sbc_math.h"
+#include "sbc_tables.h"
+#include "sbc_primitives.h"
+
+#define N_ROUNDS 2000
+#define BENCHMARK_FRAMES 200000
+#define ENCODE_SECONDS 60
+
+static int16_t random_sample(void) {
+    return (int16_t) (rand() & 0xffff);
+}
+
+static int32_t random_subband_sample(void) {
+    /* The analysis filters produce values in 16.15 fixed point */
+    return ((rand() & 0xffffff) - 0x800000) * 128;
+}
+
+static void check_analyze(struct sbc_encoder_state *ref, struct sbc_encoder_state *opt) {
+    int16_t SBC_ALIGNED x[SBC_X_BUFFER_SIZE];
+    int32_t SBC_ALIGNED out_ref[16][2][8], out_opt[16][2][8];
+    unsigned round, i;
+
+    for (round = 0; round < N_ROUNDS; round++) {
+        unsigned pos;
+
+        for (i = 0; i < SBC_X_BUFFER_SIZE; i++)
+            x[i] = random_sample();
+
+        /* The encoder analyzes at positions that are multiples of the
+         * number of subbands */
+        pos = (unsigned) (rand() % ((SBC_X_BUFFER_SIZE - 104) / 8)) * 8;
+
+        memset(out_ref, 0, sizeof(out_ref));
+        memset(out_opt, 0, sizeof(out_opt));
+        ref->sbc_analyze_4b_4s(x + pos, out_ref[0][0], 16);
+        opt->sbc_analyze_4b_4s(x + pos, out_opt[0][0], 16);
+        pa_assert_se(memcmp(out_ref, out_opt, sizeof(out_ref)) == 0);
+
+        memset(out_ref, 0, sizeof(out_ref));
+        memset(out_opt, 0, sizeof(out_opt));
+        ref->sbc_analyze_4b_8s(x + pos, out_ref[0][0], 16);
+        opt->sbc_analyze_4b_8s(x + pos, out_opt[0][0], 16);
+        pa_assert_se(memcmp(out_ref, out_opt, sizeof(out_ref)) == 0);
+    }
+}
+
+static void check_scalefactors(struct sbc_encoder_state *ref, struct sbc_encoder_state *opt) {
+    int32_t SBC_ALIGNED sb_ref[16][2][8], sb_opt[16][2][8];
+    uint32_t SBC_ALIGNED sf_ref[2][8], sf_opt[2][8];
+    unsigned round;
+
+    for (round = 0; round < N_ROUNDS; round++) {
+        int blocks = 4 * (1 + rand() % 4);
+        int subbands = rand() % 2 ? 8 : 4;
+        int channels = 1 + rand() % 2;
+        int blk, ch, sb;
+
+        for (blk = 0; blk < 16; blk++)
+            for (ch = 0; ch < 2; ch++)
+                for (sb = 0; sb < 8; sb++) {
+                    /* Throw in some silent subbands and extreme values */
+                    switch (rand() % 16) {
+                        case 0: sb_ref[blk][ch][sb] = 0; break;
+                        case 1: sb_ref[blk][ch][sb] = INT32_MIN; break;
+                        case 2: sb_ref[blk][ch][sb] = INT32_MAX; break;
+                        default: sb_ref[blk][ch][sb] = random_subband_sample(); break;
+                    }
+                }
+
+        memcpy(sb_opt, sb_ref, sizeof(sb_ref));
+        memset(sf_ref, 0, sizeof(sf_ref));
+        memset(sf_opt, 0, sizeof(sf_opt));
+
+        ref->sbc_calc_scalefactors(sb_ref, sf_ref, blocks, channels, subbands);
+        opt->sbc_calc_scalefactors(sb_opt, sf_opt, blocks, channels, subbands);
+        pa_assert_se(memcmp(sf_ref, sf_opt, sizeof(sf_ref)) == 0);
+
+        memset(sf_ref, 0, sizeof(sf_ref));
+        memset(sf_opt, 0, sizeof(sf_opt));
+
+        pa_assert_se(ref->sbc_calc_scalefactors_j(sb_ref, sf_ref, blocks, subbands) ==
+                     opt->sbc_calc_scalefactors_j(sb_opt, sf_opt, blocks, subbands));
+        pa_assert_se(memcmp(sf_ref, sf_opt, sizeof(sf_ref)) == 0);
+        pa_assert_se(memcmp(sb_ref, sb_opt, sizeof(sb_ref)) == 0);
+    }
+}
+
+/* Analysis and joint stereo scale factors of a 16 blocks stereo frame,
+ * which is where the encoder spends most of its time */
+static void benchmark_primitives(struct sbc_encoder_state *state, int subbands) {
+    int16_t SBC_ALIGNED x[2][SBC_X_BUFFER_SIZE];
+    int32_t SBC_ALIGNED sb_sample_f[16][2][8];
+    uint32_t SBC_ALIGNED scale_factor[2][8];
+    pa_usec_t ts;
+    unsigned frame, i;
+    int blk, ch;
+
+    for (i = 0; i < SBC_X_BUFFER_SIZE; i++)
+        x[0][i] = x[1][i] = random_sample();
+
+    ts = pa_rtclock_now();
+
+    for (frame = 0; frame < BENCHMARK_FRAMES; frame++) {
+        for (ch = 0; ch < 2; ch++)
+            for (blk = 0; blk < 16; blk += 4) {
+                int16_t *in = x[ch] + (frame % 16) * 8 + blk * subbands;
+
+                if (subbands == 8)
+                    state->sbc_analyze_4b_8s(in, sb_sample_f[blk][ch], 16);
+                else
+                    state->sbc_analyze_4b_4s(in, sb_sample_f[blk][ch], 16);
+            }
+
+        state->sbc_calc_scalefactors_j(sb_sample_f, scale_factor, 16, subbands);
+    }
+
+    printf("%-10s %d subbands %8.1f ns per frame\n", state->implementation_info, subbands,
+           (double) (pa_rtclock_now() - ts) * 1000.0 / BENCHMARK_FRAMES);
+}
+
+/* A complete encode of 44.1kHz stereo with the usual high quality A2DP
+ * settings, with whatever primitives the CPU gets */
+static void benchmark_encode(void) {
+    sbc_t sbc;
+    int16_t *pcm;
+    uint8_t out[512];
+    size_t codesize, n_samples, offset;
+    pa_usec_t ts;
+    unsigned i;
+
+    pa_assert_se(sbc_init(&sbc, 0) == 0);
+    sbc.frequency = SBC_FREQ_44100;
+    sbc.blocks = SBC_BLK_16;
+    sbc.subbands = SBC_SB_8;
+    sbc.mode = SBC_MODE_JOINT_STEREO;
+    sbc.allocation = SBC_AM_LOUDNESS;
+    sbc.bitpool = 53;
+    sbc.endian = SBC_LE;
+
+    codesize = sbc_get_codesize(&sbc);
+
+    n_samples = 44100 * 2;
+    pcm = pa_xnew(int16_t, n_samples);
+    for (i = 0; i < n_samples; i++)
+        pcm[i] = (int16_t) (random_sample() / 4);
+
+    ts = pa_rtclock_now();
+
+    for (i = 0; i < ENCODE_SECONDS; i++)
+        for (offset = 0; offset + codesize <= n_samples * sizeof(int16_t); offset += codesize) {
+            ssize_t written;
+
+            pa_assert_se(sbc_encode(&sbc, (uint8_t *) pcm + offset, codesize, out, sizeof(out), &written) == (ssize_t) codesize);
+        }
+
+    printf("%-10s %8.1f us per second of audio\n", sbc_get_implementation_info(&sbc),
+           (double) (pa_rtclock_now() - ts) / ENCODE_SECONDS);
+
+    pa_xfree(pcm);
+    sbc_finish(&sbc);
+}
+
+int main(int argc, char *argv[]) {
+    struct sbc_encoder_state ref, opt;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    srand(4711);
+
+    sbc_init_primitives_generic(&ref);
+    sbc_init_primitives(&opt);
+
+    pa_log_debug("Checking %s against %s", opt.implementation_info, ref.implementation_info);
+
+    check_analyze(&ref, &opt);
+    check_scalefactors(&ref, &opt);
+
+    if (getenv("MAKE_CHECK"))
+        return 0;
+
+    benchmark_primitives(&ref, 4);
+    benchmark_primitives(&opt, 4);
+    benchmark_primitives(&ref, 8);
+    benchmark_primitives(&opt, 8);
+    benchmark_encode();
+
+    return 0;
+}
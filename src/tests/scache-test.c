@@ -0,0 +1,261 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* Loads WAV files into the sample cache with scache-precompile enabled
+ * and checks that the precompiled versions are used, carry the same
+ * data and properties as decoding the file, are rebuilt when the file
+ * changes, and that the background compiler gets through a directory
+ * even when asked twice in a row. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <math.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core.h>
+#include <pulsecore/core-scache.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/namereg.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#define N_LAZY 8
+
+static char *dir;
+
+static void put_le(uint8_t *d, uint32_t v, unsigned n) {
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+        d[i] = (uint8_t) (v >> (8 * i));
+}
+
+/* A 16 bit stereo WAV file of the given number of frames */
+static char *write_wav(const char *name, unsigned frames) {
+    uint8_t header[44];
+    int16_t *pcm;
+    char *fn;
+    FILE *f;
+    unsigned i;
+
+    memcpy(header, "RIFF", 4);
+    put_le(header + 4, 36 + frames * 4, 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put_le(header + 16, 16, 4);
+    put_le(header + 20, 1, 2);
+    put_le(header + 22, 2, 2);
+    put_le(header + 24, 44100, 4);
+    put_le(header + 28, 44100 * 4, 4);
+    put_le(header + 32, 4, 2);
+    put_le(header + 34, 16, 2);
+    memcpy(header + 36, "data", 4);
+    put_le(header + 40, frames * 4, 4);
+
+    pcm = pa_xnew(int16_t, frames * 2);
+    for (i = 0; i < frames * 2; i++)
+        pcm[i] = (int16_t) (sin(2 * M_PI * 440 * (double) (i / 2) / 44100) * 0x3fff);
+
+    fn = pa_sprintf_malloc("%s/sounds/%s.wav", dir, name);
+
+    pa_assert_se(f = fopen(fn, "w"));
+    pa_assert_se(fwrite(header, sizeof(header), 1, f) == 1);
+    pa_assert_se(fwrite(pcm, frames * 4, 1, f) == 1);
+    pa_assert_se(fclose(f) == 0);
+
+    pa_xfree(pcm);
+
+    return fn;
+}
+
+/* Counts the precompiled files, and asserts that no temporary file
+ * has been left behind */
+static unsigned count_compiled(void) {
+    char *cache;
+    DIR *d;
+    struct dirent *de;
+    unsigned n = 0;
+
+    pa_assert_se(cache = pa_state_path("sample-cache", TRUE));
+
+    if ((d = opendir(cache))) {
+        while ((de = readdir(d))) {
+            pa_assert_se(!strstr(de->d_name, ".tmp-"));
+
+            if (pa_endswith(de->d_name, ".pcm"))
+                n++;
+        }
+
+        closedir(d);
+    }
+
+    pa_xfree(cache);
+
+    return n;
+}
+
+static void remove_dir(const char *path) {
+    DIR *d;
+    struct dirent *de;
+
+    pa_assert_se(d = opendir(path));
+
+    while ((de = readdir(d))) {
+        char *fn;
+
+        if (de->d_name[0] == '.')
+            continue;
+
+        fn = pa_sprintf_malloc("%s/%s", path, de->d_name);
+        unlink(fn);
+        pa_xfree(fn);
+    }
+
+    closedir(d);
+    rmdir(path);
+}
+
+static pa_scache_entry *add_file(pa_core *c, const char *name, const char *fn) {
+    pa_scache_entry *e;
+
+    pa_assert_se(pa_scache_add_file(c, name, fn, NULL) == 0);
+    pa_assert_se(e = pa_namereg_get(c, name, PA_NAMEREG_SAMPLE));
+    pa_assert_se(e->memchunk.memblock);
+
+    return e;
+}
+
+static pa_bool_t chunks_equal(const pa_memchunk *a, const pa_memchunk *b) {
+    pa_bool_t r;
+    const uint8_t *p, *q;
+
+    if (a->length != b->length)
+        return FALSE;
+
+    p = pa_memblock_acquire(a->memblock);
+    q = pa_memblock_acquire(b->memblock);
+    r = memcmp(p + a->index, q + b->index, a->length) == 0;
+    pa_memblock_release(b->memblock);
+    pa_memblock_release(a->memblock);
+
+    return r;
+}
+
+int main(int argc, char *argv[]) {
+    pa_mainloop *m;
+    pa_core *c;
+    pa_scache_entry *e;
+    pa_memchunk decoded;
+    char *fn, *sounds, *format;
+    unsigned i;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    pa_assert_se(dir = pa_xstrdup("/tmp/scache-test-XXXXXX"));
+    pa_assert_se(mkdtemp(dir));
+
+    sounds = pa_sprintf_malloc("%s/sounds", dir);
+    pa_assert_se(mkdir(sounds, 0700) == 0);
+
+    /* That's where the precompiled files go */
+    pa_assert_se(setenv("PULSE_STATE_PATH", dir, 1) == 0);
+
+    pa_assert_se(m = pa_mainloop_new());
+    pa_assert_se(c = pa_core_new(pa_mainloop_get_api(m), PA_SHM_PRIVATE, 0, FALSE, 0));
+    c->scache_precompile = TRUE;
+
+    /* The first load decodes and compiles */
+    fn = write_wav("beep", 44100);
+    e = add_file(c, "beep", fn);
+    pa_assert_se(!pa_memblock_is_read_only(e->memchunk.memblock));
+    pa_assert_se(count_compiled() == 1);
+
+    decoded = e->memchunk;
+    pa_memblock_ref(decoded.memblock);
+    pa_assert_se(format = pa_xstrdup(pa_proplist_gets(e->proplist, "media.format")));
+
+    /* The second one maps the precompiled version, which has the same
+     * data and what libsndfile told us about the file */
+    e = add_file(c, "beep", fn);
+    pa_assert_se(pa_memblock_is_read_only(e->memchunk.memblock));
+    pa_assert_se(chunks_equal(&e->memchunk, &decoded));
+    pa_assert_se(pa_streq(pa_strnull(pa_proplist_gets(e->proplist, "media.format")), format));
+    pa_assert_se(pa_streq(pa_strnull(pa_proplist_gets(e->proplist, PA_PROP_MEDIA_FILENAME)), fn));
+
+    pa_memblock_unref(decoded.memblock);
+
+    /* A changed file is decoded again */
+    pa_xfree(write_wav("beep", 22050));
+    e = add_file(c, "beep", fn);
+    pa_assert_se(!pa_memblock_is_read_only(e->memchunk.memblock));
+    pa_assert_se(e->memchunk.length == 22050 * 4);
+    pa_assert_se(count_compiled() == 1);
+
+    e = add_file(c, "beep", fn);
+    pa_assert_se(pa_memblock_is_read_only(e->memchunk.memblock));
+    pa_assert_se(e->memchunk.length == 22050 * 4);
+
+    pa_assert_se(pa_scache_remove_item(c, "beep") == 0);
+    pa_xfree(fn);
+
+    /* Lazy entries are compiled in the background. Asking again while
+     * the compiler is busy only queues more work. */
+    for (i = 0; i < N_LAZY; i++) {
+        char *name = pa_sprintf_malloc("lazy%u", i);
+        pa_xfree(write_wav(name, 44100 + i));
+        pa_xfree(name);
+    }
+
+    pa_assert_se(pa_scache_add_directory_lazy(c, sounds) == 0);
+    pa_assert_se(pa_scache_add_directory_lazy(c, sounds) == 0);
+
+    for (i = 0; i < 1000 && count_compiled() < N_LAZY + 1; i++)
+        usleep(10000);
+
+    pa_assert_se(count_compiled() == N_LAZY + 1);
+
+    pa_scache_free_all(c);
+    pa_core_unref(c);
+    pa_mainloop_free(m);
+
+    remove_dir(sounds);
+    pa_xfree(sounds);
+
+    pa_assert_se(sounds = pa_state_path("sample-cache", TRUE));
+    remove_dir(sounds);
+    pa_xfree(sounds);
+
+    rmdir(dir);
+    pa_xfree(dir);
+    pa_xfree(format);
+
+    return 0;
+}
@@ -0,0 +1,158 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* Plays a sine wave through the simple API, once written in small
+ * blocks with pa_simple_write() the way pacat-simple does it, and once
+ * pulled by the server through pa_simple_set_fill_callback().
+ *
+ * Reported are the CPU time and the context switches of this process
+ * per second of audio, and the average playback latency. Needs a
+ * running daemon. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <pulse/simple.h>
+#include <pulse/error.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/macro.h>
+
+#define SECONDS 10
+#define BUFSIZE 1024 /* as in pacat-simple */
+#define LATENCY_INTERVAL (100 * PA_USEC_PER_MSEC)
+
+static const pa_sample_spec ss = {
+    .format = PA_SAMPLE_S16NE,
+    .rate = 44100,
+    .channels = 2
+};
+
+struct result {
+    pa_usec_t cpu;
+    long switches;
+    pa_usec_t latency;
+};
+
+/* Where we are in the sine wave, in frames. In pull mode this is
+ * only touched from the thread of the connection, which sets done
+ * when it has filled in everything. */
+static uint64_t position = 0;
+static pa_atomic_t done = PA_ATOMIC_INIT(0);
+
+static void make_sine(int16_t *d, size_t n_frames) {
+    size_t i;
+
+    for (i = 0; i < n_frames; i++, position++)
+        d[i*2] = d[i*2+1] = (int16_t) (8000.0 * sin(2 * M_PI * 440 * (double) position / ss.rate));
+}
+
+static ssize_t fill_cb(pa_simple *s, void *data, size_t nbytes, void *userdata) {
+    size_t n_frames = nbytes / pa_frame_size(&ss);
+
+    if (position >= (uint64_t) SECONDS * ss.rate) {
+        pa_atomic_store(&done, 1);
+        return -1;
+    }
+
+    make_sine(data, n_frames);
+
+    return (ssize_t) (n_frames * pa_frame_size(&ss));
+}
+
+static void usage(pa_usec_t *cpu, long *switches) {
+    struct rusage ru;
+
+    pa_assert_se(getrusage(RUSAGE_SELF, &ru) == 0);
+
+    *cpu = pa_timeval_load(&ru.ru_utime) + pa_timeval_load(&ru.ru_stime);
+    *switches = ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+static void run(pa_bool_t pull, struct result *r) {
+    pa_simple *s;
+    pa_usec_t cpu, latency = 0, next;
+    long switches;
+    unsigned n_latency = 0;
+    int error;
+
+    position = 0;
+    pa_atomic_store(&done, 0);
+
+    if (!(s = pa_simple_new(NULL, "simple-fill-test", PA_STREAM_PLAYBACK, NULL, pull ? "pull" : "push", &ss, NULL, NULL, &error))) {
+        fprintf(stderr, "pa_simple_new() failed: %s\n", pa_strerror(error));
+        exit(1);
+    }
+
+    usage(&cpu, &switches);
+    next = pa_rtclock_now();
+
+    if (pull)
+        pa_assert_se(pa_simple_set_fill_callback(s, fill_cb, NULL, &error) == 0);
+
+    while (pull ? !pa_atomic_load(&done) : position < (uint64_t) SECONDS * ss.rate) {
+
+        if (pull)
+            usleep(LATENCY_INTERVAL);
+        else {
+            int16_t buf[BUFSIZE / sizeof(int16_t)];
+
+            make_sine(buf, BUFSIZE / pa_frame_size(&ss));
+            pa_assert_se(pa_simple_write(s, buf, sizeof(buf), &error) == 0);
+        }
+
+        if (pa_rtclock_now() >= next) {
+            latency += pa_simple_get_latency(s, &error);
+            n_latency++;
+            next += LATENCY_INTERVAL;
+        }
+    }
+
+    pa_assert_se(pa_simple_drain(s, &error) == 0);
+
+    usage(&r->cpu, &r->switches);
+    r->cpu -= cpu;
+    r->switches -= switches;
+    r->latency = n_latency > 0 ? latency / n_latency : 0;
+
+    pa_simple_free(s);
+}
+
+int main(int argc, char *argv[]) {
+    struct result push, pull;
+
+    run(FALSE, &push);
+    run(TRUE, &pull);
+
+    printf("push  %7.1f us CPU/s  %6.1f context switches/s  %6.1f ms latency\n",
+           (double) push.cpu / SECONDS, (double) push.switches / SECONDS, (double) push.latency / PA_USEC_PER_MSEC);
+    printf("pull  %7.1f us CPU/s  %6.1f context switches/s  %6.1f ms latency\n",
+           (double) pull.cpu / SECONDS, (double) pull.switches / SECONDS, (double) pull.latency / PA_USEC_PER_MSEC);
+
+    return 0;
+}
@@ -0,0 +1,208 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* Plays silence through a low latency stream of a threaded main loop
+ * while N_THREADS application threads query its writable size and
+ * latency as fast as they can. This is done once with the threads
+ * taking the lock of the main loop and calling pa_stream_writable_size()
+ * and pa_stream_get_latency(), and once with pa_stream_get_snapshot().
+ *
+ * Reported are the queries per second, the slowest query and how often
+ * the main loop got to refill the stream meanwhile. Needs a running
+ * daemon. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <pulse/pulseaudio.h>
+#include <pulse/thread-mainloop.h>
+#include <pulse/rtclock.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/macro.h>
+
+#define N_THREADS 4
+#define SECONDS 3
+
+static const pa_sample_spec sample_spec = {
+    .format = PA_SAMPLE_S16LE,
+    .rate = 48000,
+    .channels = 2
+};
+
+static pa_threaded_mainloop *mainloop = NULL;
+static pa_stream *stream = NULL;
+
+static pa_bool_t use_snapshot = FALSE;
+static pa_atomic_t stop = PA_ATOMIC_INIT(0);
+static pa_atomic_t refills = PA_ATOMIC_INIT(0);
+
+struct reader {
+    pa_thread *thread;
+    unsigned long queries;
+    pa_usec_t slowest;
+};
+
+static void context_state_cb(pa_context *c, void *userdata) {
+    pa_threaded_mainloop_signal(mainloop, 0);
+}
+
+static void stream_state_cb(pa_stream *s, void *userdata) {
+    pa_threaded_mainloop_signal(mainloop, 0);
+}
+
+static void stream_write_cb(pa_stream *s, size_t nbytes, void *userdata) {
+    void *data;
+
+    pa_assert_se(pa_stream_begin_write(s, &data, &nbytes) == 0);
+    pa_memzero(data, nbytes);
+    pa_assert_se(pa_stream_write(s, data, nbytes, NULL, 0, PA_SEEK_RELATIVE) == 0);
+
+    pa_atomic_inc(&refills);
+}
+
+static void reader_thread(void *userdata) {
+    struct reader *r = userdata;
+
+    while (!pa_atomic_load(&stop)) {
+        pa_usec_t ts, latency;
+        size_t writable;
+        int negative;
+
+        ts = pa_rtclock_now();
+
+        if (use_snapshot) {
+            pa_stream_snapshot snapshot;
+
+            pa_assert_se(pa_stream_get_snapshot(stream, &snapshot) == 0);
+            writable = snapshot.writable_size;
+            latency = snapshot.latency;
+        } else {
+            pa_threaded_mainloop_lock(mainloop);
+            writable = pa_stream_writable_size(stream);
+            if (pa_stream_get_latency(stream, &latency, &negative) < 0)
+                latency = 0;
+            pa_threaded_mainloop_unlock(mainloop);
+        }
+
+        ts = pa_rtclock_now() - ts;
+
+        pa_assert_se(writable != (size_t) -1);
+        pa_assert_se(latency < 10 * PA_USEC_PER_SEC);
+
+        r->queries++;
+        r->slowest = PA_MAX(r->slowest, ts);
+    }
+}
+
+static void run(pa_bool_t snapshot) {
+    struct reader readers[N_THREADS];
+    unsigned long queries = 0;
+    pa_usec_t slowest = 0;
+    unsigned i;
+    int n_refills;
+
+    use_snapshot = snapshot;
+    pa_atomic_store(&stop, 0);
+    n_refills = pa_atomic_load(&refills);
+
+    for (i = 0; i < N_THREADS; i++) {
+        readers[i].queries = 0;
+        readers[i].slowest = 0;
+        pa_assert_se(readers[i].thread = pa_thread_new("reader", reader_thread, &readers[i]));
+    }
+
+    sleep(SECONDS);
+    pa_atomic_store(&stop, 1);
+
+    for (i = 0; i < N_THREADS; i++) {
+        pa_thread_free(readers[i].thread);
+        queries += readers[i].queries;
+        slowest = PA_MAX(slowest, readers[i].slowest);
+    }
+
+    n_refills = pa_atomic_load(&refills) - n_refills;
+
+    printf("%-8s  %10.0f queries/s  %8.1f us slowest  %6.1f refills/s\n",
+           snapshot ? "snapshot" : "locked",
+           (double) queries / SECONDS,
+           (double) slowest,
+           (double) n_refills / SECONDS);
+}
+
+int main(int argc, char *argv[]) {
+    pa_context *c;
+    pa_buffer_attr buffer_attr;
+
+    pa_assert_se(mainloop = pa_threaded_mainloop_new());
+    pa_assert_se(c = pa_context_new(pa_threaded_mainloop_get_api(mainloop), "stream-snapshot-test"));
+
+    pa_context_set_state_callback(c, context_state_cb, NULL);
+    pa_assert_se(pa_context_connect(c, NULL, 0, NULL) >= 0);
+
+    pa_threaded_mainloop_lock(mainloop);
+    pa_assert_se(pa_threaded_mainloop_start(mainloop) >= 0);
+
+    while (pa_context_get_state(c) != PA_CONTEXT_READY) {
+        pa_assert_se(PA_CONTEXT_IS_GOOD(pa_context_get_state(c)));
+        pa_threaded_mainloop_wait(mainloop);
+    }
+
+    /* A short buffer, so that the main loop has plenty to do */
+    buffer_attr.maxlength = (uint32_t) -1;
+    buffer_attr.tlength = (uint32_t) pa_usec_to_bytes(10 * PA_USEC_PER_MSEC, &sample_spec);
+    buffer_attr.prebuf = (uint32_t) -1;
+    buffer_attr.minreq = (uint32_t) -1;
+    buffer_attr.fragsize = (uint32_t) -1;
+
+    pa_assert_se(stream = pa_stream_new(c, "stream-snapshot-test", &sample_spec, NULL));
+    pa_stream_set_state_callback(stream, stream_state_cb, NULL);
+    pa_stream_set_write_callback(stream, stream_write_cb, NULL);
+    pa_assert_se(pa_stream_connect_playback(stream, NULL, &buffer_attr,
+                                            PA_STREAM_INTERPOLATE_TIMING|PA_STREAM_AUTO_TIMING_UPDATE|PA_STREAM_ADJUST_LATENCY,
+                                            NULL, NULL) >= 0);
+
+    while (pa_stream_get_state(stream) != PA_STREAM_READY) {
+        pa_assert_se(PA_STREAM_IS_GOOD(pa_stream_get_state(stream)));
+        pa_threaded_mainloop_wait(mainloop);
+    }
+
+    pa_threaded_mainloop_unlock(mainloop);
+
+    run(FALSE);
+    run(TRUE);
+
+    pa_threaded_mainloop_lock(mainloop);
+    pa_stream_disconnect(stream);
+    pa_stream_unref(stream);
+    pa_context_disconnect(c);
+    pa_context_unref(c);
+    pa_threaded_mainloop_unlock(mainloop);
+
+    pa_threaded_mainloop_stop(mainloop);
+    pa_threaded_mainloop_free(mainloop);
+
+    return 0;
+}
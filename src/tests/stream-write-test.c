@@ -0,0 +1,200 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* Writes one second buffers into a corked playback stream as fast as
+ * the server takes them, flushing the stream whenever it is full. This
+ * is done once with pa_stream_write() copying the data and once with
+ * the data placed in the buffer from pa_stream_alloc_shared_buffer().
+ *
+ * Reported are the throughput and the CPU time this process spent per
+ * MB written. Needs a running daemon. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <pulse/pulseaudio.h>
+#include <pulse/mainloop.h>
+#include <pulse/rtclock.h>
+
+#include <pulsecore/macro.h>
+
+#define BUFFER_BYTES 192000 /* one second */
+#define N_BUFFERS 2
+#define TOTAL_BYTES (512*1024*1024)
+
+static const pa_sample_spec sample_spec = {
+    .format = PA_SAMPLE_S16LE,
+    .rate = 48000,
+    .channels = 2
+};
+
+static const pa_buffer_attr buffer_attr = {
+    .maxlength = 4*1024*1024,
+    .tlength = 4*1024*1024,
+    .prebuf = (uint32_t) -1,
+    .minreq = (uint32_t) -1,
+    .fragsize = (uint32_t) -1
+};
+
+static pa_mainloop *mainloop = NULL;
+static uint8_t *shared = NULL;
+static pa_bool_t busy[N_BUFFERS];
+
+static pa_usec_t cpu_time(void) {
+    struct rusage ru;
+
+    pa_assert_se(getrusage(RUSAGE_SELF, &ru) == 0);
+    return pa_timeval_load(&ru.ru_utime) + pa_timeval_load(&ru.ru_stime);
+}
+
+/* The server is done with one of the shared buffers */
+static void shared_free_cb(void *p) {
+    unsigned i = (unsigned) (((uint8_t*) p - shared) / BUFFER_BYTES);
+
+    pa_assert_se(i < N_BUFFERS);
+    pa_assert_se(busy[i]);
+
+    busy[i] = FALSE;
+}
+
+static void wait_for_operation(pa_operation *o) {
+    pa_assert_se(o);
+
+    while (pa_operation_get_state(o) == PA_OPERATION_RUNNING)
+        pa_assert_se(pa_mainloop_iterate(mainloop, 1, NULL) >= 0);
+
+    pa_operation_unref(o);
+}
+
+static void run(pa_stream *s, pa_bool_t use_shared) {
+    uint8_t *data = NULL;
+    size_t written = 0;
+    pa_usec_t ts, cpu;
+    unsigned i = 0;
+    pa_bool_t flushed = FALSE;
+
+    if (use_shared) {
+        size_t n = N_BUFFERS * BUFFER_BYTES;
+        void *d;
+
+        pa_assert_se(pa_stream_alloc_shared_buffer(s, &d, &n) == 0);
+        pa_assert_se(n >= N_BUFFERS * BUFFER_BYTES);
+
+        shared = d;
+        memset(shared, 0, n);
+    } else
+        data = pa_xmalloc0(BUFFER_BYTES);
+
+    ts = pa_rtclock_now();
+    cpu = cpu_time();
+
+    while (written < TOTAL_BYTES) {
+
+        if (pa_stream_writable_size(s) < BUFFER_BYTES) {
+
+            /* Throw away what we wrote, the server asks for more
+             * afterwards */
+            if (!flushed) {
+                wait_for_operation(pa_stream_flush(s, NULL, NULL));
+                flushed = TRUE;
+            } else
+                pa_assert_se(pa_mainloop_iterate(mainloop, 1, NULL) >= 0);
+
+            continue;
+        }
+
+        if (use_shared) {
+            i = (i + 1) % N_BUFFERS;
+
+            /* Wait for the server to let go of it */
+            while (busy[i])
+                pa_assert_se(pa_mainloop_iterate(mainloop, 1, NULL) >= 0);
+
+            busy[i] = TRUE;
+            pa_assert_se(pa_stream_write(s, shared + i * BUFFER_BYTES, BUFFER_BYTES, shared_free_cb, 0, PA_SEEK_RELATIVE) == 0);
+        } else
+            pa_assert_se(pa_stream_write(s, data, BUFFER_BYTES, NULL, 0, PA_SEEK_RELATIVE) == 0);
+
+        written += BUFFER_BYTES;
+        flushed = FALSE;
+
+        /* Handle what the server sent meanwhile */
+        while (pa_mainloop_iterate(mainloop, 0, NULL) > 0)
+            ;
+    }
+
+    wait_for_operation(pa_stream_flush(s, NULL, NULL));
+
+    ts = pa_rtclock_now() - ts;
+    cpu = cpu_time() - cpu;
+
+    printf("%-6s  %8.1f MB/s  %7.3f ms CPU per MB\n",
+           use_shared ? "shared" : "copy",
+           (double) written / (double) ts,
+           (double) cpu / PA_USEC_PER_MSEC / ((double) written / (1024*1024)));
+
+    if (use_shared) {
+        /* Everything was flushed, the server lets go of all of it */
+        for (i = 0; i < N_BUFFERS; i++)
+            while (busy[i])
+                pa_assert_se(pa_mainloop_iterate(mainloop, 1, NULL) >= 0);
+
+        pa_assert_se(pa_stream_free_shared_buffer(s) == 0);
+    } else
+        pa_xfree(data);
+}
+
+int main(int argc, char *argv[]) {
+    pa_context *c;
+    pa_stream *s;
+
+    pa_assert_se(mainloop = pa_mainloop_new());
+    pa_assert_se(c = pa_context_new(pa_mainloop_get_api(mainloop), "stream-write-test"));
+    pa_assert_se(pa_context_connect(c, NULL, 0, NULL) >= 0);
+
+    while (pa_context_get_state(c) != PA_CONTEXT_READY) {
+        pa_assert_se(PA_CONTEXT_IS_GOOD(pa_context_get_state(c)));
+        pa_assert_se(pa_mainloop_iterate(mainloop, 1, NULL) >= 0);
+    }
+
+    pa_assert_se(s = pa_stream_new(c, "stream-write-test", &sample_spec, NULL));
+    pa_assert_se(pa_stream_connect_playback(s, NULL, &buffer_attr, PA_STREAM_START_CORKED, NULL, NULL) >= 0);
+
+    while (pa_stream_get_state(s) != PA_STREAM_READY) {
+        pa_assert_se(PA_STREAM_IS_GOOD(pa_stream_get_state(s)));
+        pa_assert_se(pa_mainloop_iterate(mainloop, 1, NULL) >= 0);
+    }
+
+    run(s, FALSE);
+    run(s, TRUE);
+
+    pa_stream_disconnect(s);
+    pa_stream_unref(s);
+    pa_context_disconnect(c);
+    pa_context_unref(c);
+    pa_mainloop_free(mainloop);
+
+    return 0;
+}
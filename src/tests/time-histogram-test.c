@@ -0,0 +1,127 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* Checks the percentiles of a time histogram filled with a known
+ * distribution, then runs an rtpoll on a 1 ms timer for a while.
+ *
+ * Reported is how late this machine wakes us up and how long the
+ * loop stays awake, as collected by the rtpoll itself. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <pulse/timeval.h>
+
+#include <pulsecore/time-histogram.h>
+#include <pulsecore/rtpoll.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/log.h>
+
+#define N_WAKEUPS 500
+
+static void check_uniform(void) {
+    pa_time_histogram h;
+    pa_usec_t p;
+    int64_t i;
+
+    pa_time_histogram_reset(&h);
+
+    /* 0 .. 9999 us, each once */
+    for (i = 0; i < 10000; i++)
+        pa_time_histogram_add(&h, i);
+
+    pa_assert_se(pa_time_histogram_count(&h) == 10000);
+    pa_assert_se(pa_time_histogram_negative(&h) == 0);
+    pa_assert_se(pa_time_histogram_max(&h) == 9999);
+
+    /* Interpolating within the power of two buckets must get us close */
+    p = pa_time_histogram_percentile(&h, 0.5);
+    pa_assert_se(p >= 4900 && p <= 5100);
+
+    p = pa_time_histogram_percentile(&h, 0.99);
+    pa_assert_se(p >= 9800 && p <= 9999);
+
+    pa_assert_se(pa_time_histogram_percentile(&h, 1.0) == 9999);
+    pa_assert_se(pa_time_histogram_percentile(&h, 0.0) == 0);
+
+    /* Missed deadlines count, but as 0 */
+    for (i = 0; i < 10000; i++)
+        pa_time_histogram_add(&h, -1000);
+
+    pa_assert_se(pa_time_histogram_count(&h) == 20000);
+    pa_assert_se(pa_time_histogram_negative(&h) == 10000);
+    pa_assert_se(pa_time_histogram_percentile(&h, 0.25) == 0);
+
+    pa_time_histogram_reset(&h);
+
+    pa_assert_se(pa_time_histogram_count(&h) == 0);
+    pa_assert_se(pa_time_histogram_max(&h) == 0);
+    pa_assert_se(pa_time_histogram_percentile(&h, 0.99) == 0);
+}
+
+static void print_histogram(const char *what, const pa_time_histogram *h) {
+    printf("%-10s  %5u samples  50%% < %6.3f ms  99%% < %6.3f ms  max %6.3f ms\n",
+           what,
+           pa_time_histogram_count(h),
+           (double) pa_time_histogram_percentile(h, 0.5) / PA_USEC_PER_MSEC,
+           (double) pa_time_histogram_percentile(h, 0.99) / PA_USEC_PER_MSEC,
+           (double) pa_time_histogram_max(h) / PA_USEC_PER_MSEC);
+}
+
+static void run_rtpoll(void) {
+    pa_rtpoll *p;
+    pa_rtpoll_stat *stat;
+    unsigned i;
+
+    p = pa_rtpoll_new();
+    stat = pa_rtpoll_get_stat(p);
+
+    for (i = 0; i < N_WAKEUPS; i++) {
+        pa_rtpoll_set_timer_relative(p, PA_USEC_PER_MSEC);
+        pa_assert_se(pa_rtpoll_run(p, TRUE) > 0);
+        pa_assert_se(pa_rtpoll_timer_elapsed(p));
+    }
+
+    /* The first iteration has nothing to measure its processing time against */
+    pa_assert_se(pa_time_histogram_count(&stat->lateness) == N_WAKEUPS);
+    pa_assert_se(pa_time_histogram_count(&stat->processing) == N_WAKEUPS - 1);
+    pa_assert_se(pa_time_histogram_count(&stat->headroom) == 0);
+
+    print_histogram("lateness", &stat->lateness);
+    print_histogram("processing", &stat->processing);
+
+    pa_rtpoll_reset_stat(p);
+    pa_assert_se(pa_time_histogram_count(&stat->lateness) == 0);
+
+    pa_rtpoll_free(p);
+}
+
+int main(int argc, char *argv[]) {
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    check_uniform();
+    run_rtpoll();
+
+    return 0;
+}
@@ -0,0 +1,285 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* Checks the percentiles of a watermark predictor, then replays a
+ * trace of wakeups through a simulated timer scheduled ALSA sink,
+ * once with the reactive watermark policy alsa-sink.c uses by default
+ * and once with the predictive one.
+ *
+ * Each line of a trace holds how many usec of the watermark one
+ * wakeup used up, i.e. how late it came plus how long the refill
+ * took. Compiling alsa-sink.c with DEBUG_TIMING and loading it with
+ * predictive_watermark=1 logs them as "Wakeup demand: <usec> us",
+ * such logs may be passed as they are:
+ *
+ *   watermark-predictor-test [TRACE [LATENCY_MSEC]]
+ *
+ * Without a trace a synthetic one is generated: a few hundred usec of
+ * jitter with rare spikes of a few msec, and a minute of heavy load in
+ * the middle.
+ *
+ * Reported are the dropouts, how often we woke up, and the average
+ * and largest watermark for both. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/watermark-predictor.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/log.h>
+
+/* The device, set up like alsa-sink.c sets up a sound card */
+#define DEFAULT_TSCHED_WATERMARK_USEC (20*PA_USEC_PER_MSEC)
+#define TSCHED_MIN_SLEEP_USEC (10*PA_USEC_PER_MSEC)
+#define TSCHED_MIN_WAKEUP_USEC (4*PA_USEC_PER_MSEC)
+
+#define DEFAULT_LATENCY_USEC (50*PA_USEC_PER_MSEC)
+#define N_SYNTHETIC 100000
+
+struct trace {
+    int64_t *samples;
+    unsigned n, allocated;
+};
+
+struct result {
+    unsigned dropouts;
+    pa_usec_t duration;
+    double watermark_sum;
+    pa_usec_t watermark_max;
+};
+
+static void trace_add(struct trace *t, int64_t usec) {
+    if (t->n >= t->allocated) {
+        t->allocated = PA_MAX(t->allocated * 2, 1024U);
+        t->samples = pa_xrenew(int64_t, t->samples, t->allocated);
+    }
+
+    t->samples[t->n++] = usec;
+}
+
+static void trace_load(struct trace *t, const char *fn) {
+    FILE *f;
+    char line[512];
+
+    if (strcmp(fn, "-") == 0)
+        f = stdin;
+    else if (!(f = fopen(fn, "r"))) {
+        fprintf(stderr, "Failed to open %s\n", fn);
+        exit(1);
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        const char *p;
+        long long usec;
+
+        if ((p = strstr(line, "demand: ")))
+            p += 8;
+        else
+            p = line;
+
+        if (sscanf(p, "%lli", &usec) == 1)
+            trace_add(t, (int64_t) usec);
+    }
+
+    if (f != stdin)
+        fclose(f);
+}
+
+/* Good enough to be reproducible everywhere */
+static unsigned rnd(unsigned *seed) {
+    *seed = *seed * 1103515245U + 12345U;
+    return (*seed >> 16) & 0x7FFF;
+}
+
+static void trace_synthesize(struct trace *t) {
+    unsigned seed = 4711, i;
+
+    for (i = 0; i < N_SYNTHETIC; i++) {
+        pa_bool_t busy = i >= N_SYNTHETIC/2 && i < N_SYNTHETIC/2 + 1500;
+        int64_t usec;
+
+        usec = 100 + rnd(&seed) % (busy ? 2000 : 400);
+
+        if (rnd(&seed) % (busy ? 100 : 2000) == 0)
+            usec += 2000 + rnd(&seed) % (busy ? 10000 : 4000);
+
+        trace_add(t, usec);
+    }
+}
+
+static void fix_watermark(pa_usec_t *watermark, pa_usec_t latency) {
+    *watermark = PA_MIN(*watermark, latency - TSCHED_MIN_SLEEP_USEC);
+    *watermark = PA_MAX(*watermark, TSCHED_MIN_WAKEUP_USEC);
+}
+
+static void run(const struct trace *t, pa_usec_t latency, pa_bool_t predictive, struct result *r) {
+    pa_watermark_predictor *p = NULL;
+    pa_usec_t now = 0, watermark = DEFAULT_TSCHED_WATERMARK_USEC, dec_not_before = 0;
+    unsigned i;
+
+    memset(r, 0, sizeof(*r));
+
+    if (predictive)
+        p = pa_watermark_predictor_new(PA_WATERMARK_PREDICT_WINDOW,
+                                       PA_WATERMARK_PREDICT_FRACTION,
+                                       PA_WATERMARK_PREDICT_MARGIN_USEC);
+
+    fix_watermark(&watermark, latency);
+
+    for (i = 0; i < t->n; i++) {
+        int64_t demand = PA_MAX(t->samples[i], 0);
+
+        /* Fill up the buffer, sleep until only the watermark is
+         * left, and get woken up late */
+        now += latency - watermark + (pa_usec_t) demand;
+
+        r->watermark_sum += (double) watermark;
+        r->watermark_max = PA_MAX(r->watermark_max, watermark);
+
+        /* What alsa-sink.c does after each wakeup */
+        if ((pa_usec_t) demand + PA_WATERMARK_INC_THRESHOLD_USEC > watermark) {
+            r->dropouts++;
+
+            watermark = (pa_usec_t) pa_watermark_increase((size_t) watermark, PA_WATERMARK_INC_STEP_USEC);
+            fix_watermark(&watermark, latency);
+
+            if (p)
+                pa_watermark_predictor_dropout(p, now);
+
+            dec_not_before = 0;
+
+        } else if (!p && watermark - (pa_usec_t) demand > PA_WATERMARK_DEC_THRESHOLD_USEC) {
+            watermark = (pa_usec_t) pa_watermark_decrease((size_t) watermark, PA_WATERMARK_DEC_STEP_USEC, &dec_not_before, now);
+            fix_watermark(&watermark, latency);
+        } else
+            dec_not_before = 0;
+
+        if (p) {
+            pa_watermark_predictor_add(p, demand);
+            watermark = pa_watermark_predictor_update(p, now, watermark);
+            fix_watermark(&watermark, latency);
+        }
+    }
+
+    r->duration = now;
+
+    if (p)
+        pa_watermark_predictor_free(p);
+}
+
+static void print_result(const char *what, const struct trace *t, const struct result *r) {
+    printf("%-10s  %5u dropouts  %6.1f wakeups/s  %6.2f ms avg watermark  %6.2f ms max watermark\n",
+           what,
+           r->dropouts,
+           (double) t->n * PA_USEC_PER_SEC / (double) PA_MAX(r->duration, 1U),
+           r->watermark_sum / PA_MAX(t->n, 1U) / PA_USEC_PER_MSEC,
+           (double) r->watermark_max / PA_USEC_PER_MSEC);
+}
+
+static void check_percentiles(void) {
+    pa_watermark_predictor *p;
+    pa_usec_t u;
+    unsigned i;
+
+    pa_assert_se(p = pa_watermark_predictor_new(1000, 0.99, 0));
+
+    /* Nothing to go by yet */
+    pa_assert_se(pa_watermark_predictor_update(p, 0, 4711) == 4711);
+
+    /* 0 .. 9990 us */
+    for (i = 0; i < 1000; i++)
+        pa_watermark_predictor_add(p, i * 10);
+
+    pa_assert_se(pa_watermark_predictor_count(p) == 1000);
+
+    /* Rounded up, but by less than an eighth */
+    u = pa_watermark_predictor_percentile(p, 0.5);
+    pa_assert_se(u >= 4990 && u < 4990 * 9 / 8);
+    u = pa_watermark_predictor_percentile(p, 0.99);
+    pa_assert_se(u >= 9890 && u < 9890 * 9 / 8);
+    pa_assert_se(pa_watermark_predictor_percentile(p, 0.0) == 0);
+
+    /* Small values are exact */
+    pa_assert_se(pa_watermark_predictor_percentile(p, 0.001) == 0);
+    pa_assert_se(pa_watermark_predictor_percentile(p, 0.002) == 10);
+
+    /* The old samples drop out of the window */
+    for (i = 0; i < 1000; i++)
+        pa_watermark_predictor_add(p, 100);
+
+    pa_assert_se(pa_watermark_predictor_count(p) == 1000);
+    u = pa_watermark_predictor_percentile(p, 1.0);
+    pa_assert_se(u >= 100 && u < 100 * 9 / 8);
+
+    /* Increases right away, decreases after a dropout only later on */
+    pa_assert_se(pa_watermark_predictor_update(p, 0, 10) >= 100 + 25);
+    pa_watermark_predictor_dropout(p, 0);
+    pa_assert_se(pa_watermark_predictor_update(p, PA_USEC_PER_SEC, 10000) == 10000);
+    pa_assert_se(pa_watermark_predictor_update(p, 60 * PA_USEC_PER_SEC, 10000) < 200);
+
+    pa_watermark_predictor_free(p);
+}
+
+int main(int argc, char *argv[]) {
+    struct trace t = { NULL, 0, 0 };
+    struct result reactive, predictive;
+    pa_usec_t latency = DEFAULT_LATENCY_USEC;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    check_percentiles();
+
+    if (argc > 1)
+        trace_load(&t, argv[1]);
+    else
+        trace_synthesize(&t);
+
+    if (argc > 2)
+        latency = (pa_usec_t) atoi(argv[2]) * PA_USEC_PER_MSEC;
+
+    pa_assert_se(latency > TSCHED_MIN_SLEEP_USEC + TSCHED_MIN_WAKEUP_USEC);
+
+    run(&t, latency, FALSE, &reactive);
+    run(&t, latency, TRUE, &predictive);
+
+    printf("%u wakeups at %0.2f ms latency\n", t.n, (double) latency / PA_USEC_PER_MSEC);
+    print_result("reactive", &t, &reactive);
+    print_result("predictive", &t, &predictive);
+
+    /* On the synthetic trace we know what to expect: the onset of the
+     * heavy load may cost us one dropout, but otherwise we get away
+     * with a lot less */
+    if (argc <= 1) {
+        pa_assert_se(predictive.dropouts <= reactive.dropouts + 1);
+        pa_assert_se(predictive.watermark_sum < reactive.watermark_sum * 3 / 4);
+    }
+
+    pa_xfree(t.samples);
+
+    return 0;
+}
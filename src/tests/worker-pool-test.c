@@ -0,0 +1,195 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* Checks that pa_worker_pool_run() runs every job exactly once and
+ * counts the jobs that miss the deadline, then
+ * compares running eight heavy plugin instances, one per channel like
+ * module-ladspa-sink does, on the calling thread alone and with
+ * additional worker threads. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/util.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/worker-pool.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#define N_JOBS_MAX 32
+#define N_CHECK_RUNS 20000
+
+#define N_CHANNELS 8
+#define RATE 48000
+#define BLOCK_FRAMES (RATE / 100)
+#define N_TAPS 256
+#define BENCHMARK_BLOCKS 1000
+
+static pa_atomic_t counts[N_JOBS_MAX];
+
+static void count_job(unsigned job, void *userdata) {
+    pa_atomic_inc(&counts[job]);
+}
+
+static void check(void) {
+    pa_worker_pool *p;
+    unsigned run, i;
+
+    pa_assert_se(p = pa_worker_pool_new("worker-pool-test", 3, 0));
+
+    for (run = 0; run < N_CHECK_RUNS; run++) {
+        unsigned n_jobs = 1 + (unsigned) (rand() % N_JOBS_MAX);
+
+        for (i = 0; i < N_JOBS_MAX; i++)
+            pa_atomic_store(&counts[i], 0);
+
+        pa_assert_se(pa_worker_pool_run(p, n_jobs, count_job, NULL, 0) == 0);
+
+        for (i = 0; i < N_JOBS_MAX; i++)
+            pa_assert_se(pa_atomic_load(&counts[i]) == (i < n_jobs ? 1 : 0));
+    }
+
+    pa_worker_pool_free(p);
+}
+
+static void sleep_job(unsigned job, void *userdata) {
+    pa_msleep(2);
+}
+
+/* Jobs that end after the deadline are counted, whichever thread ran
+ * them */
+static void check_deadline(void) {
+    pa_worker_pool *p;
+
+    pa_assert_se(p = pa_worker_pool_new("worker-pool-test", 3, 0));
+
+    pa_assert_se(pa_worker_pool_run(p, 8, sleep_job, NULL, pa_rtclock_now() + PA_USEC_PER_SEC) == 0);
+    pa_assert_se(pa_worker_pool_run(p, 8, sleep_job, NULL, pa_rtclock_now() + PA_USEC_PER_MSEC) == 8);
+    pa_assert_se(pa_worker_pool_run(p, 1, sleep_job, NULL, pa_rtclock_now() + PA_USEC_PER_MSEC) == 1);
+
+    pa_worker_pool_free(p);
+}
+
+/* A FIR filter per channel, which is about what a short convolver
+ * plugin costs */
+struct instance {
+    float taps[N_TAPS];
+    float history[N_TAPS + BLOCK_FRAMES];
+};
+
+struct block {
+    struct instance *instances;
+    float *data;
+};
+
+static void run_instance(unsigned h, void *userdata) {
+    struct block *b = userdata;
+    struct instance *in = &b->instances[h];
+    unsigned i, k;
+
+    memmove(in->history, in->history + BLOCK_FRAMES, N_TAPS * sizeof(float));
+
+    for (i = 0; i < BLOCK_FRAMES; i++)
+        in->history[N_TAPS + i] = b->data[i * N_CHANNELS + h];
+
+    for (i = 0; i < BLOCK_FRAMES; i++) {
+        float y = 0;
+
+        for (k = 0; k < N_TAPS; k++)
+            y += in->taps[k] * in->history[N_TAPS + i - k];
+
+        b->data[i * N_CHANNELS + h] = y;
+    }
+}
+
+static void benchmark(unsigned n_threads) {
+    pa_worker_pool *p = NULL;
+    struct block b;
+    pa_usec_t ts, t, worst = 0;
+    unsigned i, h;
+
+    if (n_threads > 0)
+        pa_assert_se(p = pa_worker_pool_new("worker-pool-test", n_threads, 0));
+
+    b.instances = pa_xnew0(struct instance, N_CHANNELS);
+    b.data = pa_xnew(float, BLOCK_FRAMES * N_CHANNELS);
+
+    for (h = 0; h < N_CHANNELS; h++)
+        for (i = 0; i < N_TAPS; i++)
+            b.instances[h].taps[i] = 1.0f / (float) (i + 1 + h);
+
+    ts = pa_rtclock_now();
+
+    for (i = 0; i < BENCHMARK_BLOCKS; i++) {
+        unsigned j;
+
+        for (j = 0; j < BLOCK_FRAMES * N_CHANNELS; j++)
+            b.data[j] = (float) ((j * 331 + i) & 0xff) / 256.0f;
+
+        t = pa_rtclock_now();
+
+        if (p)
+            pa_worker_pool_run(p, N_CHANNELS, run_instance, &b, 0);
+        else
+            for (h = 0; h < N_CHANNELS; h++)
+                run_instance(h, &b);
+
+        t = pa_rtclock_now() - t;
+        if (t > worst)
+            worst = t;
+    }
+
+    printf("%u threads  %8.1f us per 10ms block on average  %8.1f us at most\n",
+           n_threads, (double) (pa_rtclock_now() - ts) / BENCHMARK_BLOCKS, (double) worst);
+
+    pa_xfree(b.data);
+    pa_xfree(b.instances);
+
+    if (p)
+        pa_worker_pool_free(p);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned n;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    srand(4711);
+
+    check();
+    check_deadline();
+
+    if (getenv("MAKE_CHECK"))
+        return 0;
+
+    for (n = 0; n < 4; n++)
+        benchmark(n);
+
+    return 0;
+}